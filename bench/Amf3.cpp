@@ -0,0 +1,115 @@
+//
+//  rtmp_relay
+//
+
+#include <vector>
+#include "Amf.hpp"
+#include "Bench.hpp"
+
+namespace relay
+{
+    namespace bench
+    {
+        // onMetaData of an MP4 source, the track objects repeat the same keys and strings
+        static amf::Node createMetaData()
+        {
+            amf::Node metaData(amf::Node::Type::Dictionary);
+            metaData["duration"] = 0.0;
+            metaData["width"] = 1280.0;
+            metaData["height"] = 720.0;
+            metaData["videodatarate"] = 2500.0;
+            metaData["framerate"] = 30.0;
+            metaData["videocodecid"] = std::string("avc1");
+            metaData["audiodatarate"] = 128.0;
+            metaData["audiosamplerate"] = 44100.0;
+            metaData["audiosamplesize"] = 16.0;
+            metaData["stereo"] = true;
+            metaData["audiocodecid"] = std::string("mp4a");
+            metaData["encoder"] = std::string("Lavf57.1.0");
+
+            std::vector<amf::Node> tracks;
+
+            for (const char* type : {"avc1", "mp4a"})
+            {
+                std::vector<amf::Node> sampleDescription;
+                amf::Node sample(amf::Node::Type::Object);
+                sample["sampletype"] = std::string(type);
+                sampleDescription.push_back(sample);
+
+                amf::Node track(amf::Node::Type::Object);
+                track["length"] = 0.0;
+                track["timescale"] = 1000.0;
+                track["language"] = std::string("eng");
+                track["sampledescription"] = sampleDescription;
+                tracks.push_back(track);
+            }
+
+            metaData["trackinfo"] = tracks;
+
+            return metaData;
+        }
+
+        bool amf3()
+        {
+            amf::Node metaData = createMetaData();
+
+            std::vector<uint8_t> amf0Buffer;
+            std::vector<uint8_t> amf3Buffer;
+
+            if (metaData.encode(amf::Version::AMF0, amf0Buffer) == 0 ||
+                metaData.encode(amf::Version::AMF3, amf3Buffer) == 0)
+            {
+                std::cout << "  failed to encode" << std::endl;
+                return false;
+            }
+
+            // decoding and encoding again must give the same bytes in both versions
+            for (const auto& version : {std::make_pair(amf::Version::AMF0, &amf0Buffer),
+                                        std::make_pair(amf::Version::AMF3, &amf3Buffer)})
+            {
+                amf::Node decoded;
+                std::vector<uint8_t> encoded;
+                std::vector<uint8_t> encodedAMF0;
+
+                if (decoded.decode(version.first, *version.second, 0) != version.second->size() ||
+                    decoded.encode(version.first, encoded) == 0 ||
+                    encoded != *version.second ||
+                    decoded.encode(amf::Version::AMF0, encodedAMF0) == 0 ||
+                    encodedAMF0 != amf0Buffer)
+                {
+                    std::cout << "  AMF" << (version.first == amf::Version::AMF0 ? 0 : 3) << " round trip failed" << std::endl;
+                    return false;
+                }
+            }
+
+            std::cout << "  meta data size, AMF0: " << amf0Buffer.size() << " bytes, AMF3: " << amf3Buffer.size() << " bytes" << std::endl;
+
+            const uint64_t iterations = 100000;
+            std::vector<uint8_t> buffer;
+
+            measure("encode, AMF0", iterations, [&]() {
+                buffer.clear();
+                metaData.encode(amf::Version::AMF0, buffer);
+                sink = sink + buffer.size();
+            });
+
+            measure("encode, AMF3", iterations, [&]() {
+                buffer.clear();
+                metaData.encode(amf::Version::AMF3, buffer);
+                sink = sink + buffer.size();
+            });
+
+            measure("decode, AMF0", iterations, [&]() {
+                amf::Node node;
+                sink = sink + node.decode(amf::Version::AMF0, amf0Buffer, 0);
+            });
+
+            measure("decode, AMF3", iterations, [&]() {
+                amf::Node node;
+                sink = sink + node.decode(amf::Version::AMF3, amf3Buffer, 0);
+            });
+
+            return true;
+        }
+    }
+}
@@ -0,0 +1,122 @@
+//
+//  rtmp_relay
+//
+
+#include <vector>
+#include "Amf.hpp"
+#include "Arena.hpp"
+#include "Bench.hpp"
+
+namespace relay
+{
+    namespace bench
+    {
+        // decodes the command, transaction ID and command object like Connection::handlePacket
+        static bool decodeInvoke(const std::vector<uint8_t>& buffer, const amf::Node::Allocator& allocator)
+        {
+            ByteReader reader(buffer);
+
+            amf::Node command(allocator);
+            amf::Node transactionId(allocator);
+            amf::Node argument1(allocator);
+
+            if (command.decode(amf::Version::AMF0, reader) == 0 ||
+                transactionId.decode(amf::Version::AMF0, reader) == 0 ||
+                argument1.decode(amf::Version::AMF0, reader) == 0)
+            {
+                return false;
+            }
+
+            sink = sink + argument1["objectEncoding"].asUInt32();
+
+            return true;
+        }
+
+        bool arena()
+        {
+            // connect invoke of a Flash Player client
+            std::vector<uint8_t> buffer;
+
+            amf::Node command = std::string("connect");
+            command.encode(amf::Version::AMF0, buffer);
+
+            amf::Node transactionId = 1.0;
+            transactionId.encode(amf::Version::AMF0, buffer);
+
+            amf::Node argument1(amf::Node::Type::Object);
+            argument1["app"] = std::string("live");
+            argument1["flashVer"] = std::string("WIN 32,0,0,465");
+            argument1["swfUrl"] = std::string("http://example.com/player.swf");
+            argument1["tcUrl"] = std::string("rtmp://example.com/live");
+            argument1["fpad"] = false;
+            argument1["capabilities"] = 239.0;
+            argument1["audioCodecs"] = 3575.0;
+            argument1["videoCodecs"] = 252.0;
+            argument1["videoFunction"] = 1.0;
+            argument1["pageUrl"] = std::string("http://example.com/player.html");
+            argument1["objectEncoding"] = 0.0;
+            argument1.encode(amf::Version::AMF0, buffer);
+
+            Arena invokeArena;
+            amf::Node::Allocator heapAllocator;
+            amf::Node::Allocator arenaAllocator(&invokeArena);
+
+            uint64_t heapAllocations = getHeapAllocationCount();
+
+            if (!decodeInvoke(buffer, heapAllocator))
+            {
+                std::cout << "  failed to decode" << std::endl;
+                return false;
+            }
+
+            heapAllocations = getHeapAllocationCount() - heapAllocations;
+
+            // the first decode adds the arena block
+            {
+                Arena::Scope arenaScope(invokeArena);
+                decodeInvoke(buffer, arenaAllocator);
+            }
+
+            uint64_t arenaHeapAllocations = getHeapAllocationCount();
+            uint64_t arenaAllocations = invokeArena.getAllocationCount();
+
+            {
+                Arena::Scope arenaScope(invokeArena);
+                decodeInvoke(buffer, arenaAllocator);
+            }
+
+            arenaHeapAllocations = getHeapAllocationCount() - arenaHeapAllocations;
+            arenaAllocations = invokeArena.getAllocationCount() - arenaAllocations;
+
+            std::cout << "  " << buffer.size() << " byte connect invoke" << std::endl;
+            std::cout << "  heap allocator: " << heapAllocations << " heap allocations" << std::endl;
+            std::cout << "  arena: " << arenaHeapAllocations << " heap allocations (strings longer than the inline buffer), " <<
+                arenaAllocations << " arena allocations, " << invokeArena.getBlockCount() << " block" << std::endl;
+
+            const uint64_t iterations = 200000;
+
+            measure("decode, heap allocator", iterations, [&]() {
+                decodeInvoke(buffer, heapAllocator);
+            });
+
+            measure("decode, arena", iterations, [&]() {
+                Arena::Scope arenaScope(invokeArena);
+                decodeInvoke(buffer, arenaAllocator);
+            });
+
+            // an oversized message must not keep its block after the reset
+            invokeArena.allocate(1024 * 1024, alignof(double));
+            invokeArena.reset();
+
+            std::cout << "  arena size after a 1 MiB allocation and reset: " << invokeArena.getSize() << " bytes" << std::endl;
+
+            if (invokeArena.getSize() >= 1024 * 1024)
+            {
+                std::cout << "  oversized block was kept" << std::endl;
+                return false;
+            }
+
+            return true;
+        }
+    }
+}
@@ -0,0 +1,42 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+namespace relay
+{
+    namespace bench
+    {
+        // results are added here so that the compiler can not remove the measured code
+        extern volatile uint64_t sink;
+
+        // number of times operator new was called since the start
+        uint64_t getHeapAllocationCount();
+
+        // runs function the given number of times and prints the time per iteration and iterations per second
+        template<class F> double measure(const std::string& name, uint64_t iterations, F function)
+        {
+            // warm up caches and pools
+            for (uint64_t i = 0; i < iterations / 10 + 1; ++i) function();
+
+            auto startTime = std::chrono::steady_clock::now();
+
+            for (uint64_t i = 0; i < iterations; ++i) function();
+
+            auto diff = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime);
+            double nanoseconds = static_cast<double>(diff.count()) / static_cast<double>(iterations);
+
+            std::cout << "  " << name;
+            for (size_t i = name.size(); i < 48; ++i) std::cout << ' ';
+            std::cout << nanoseconds << " ns/op, " << static_cast<uint64_t>(1000000000.0 / nanoseconds) << " op/s" << std::endl;
+
+            return nanoseconds;
+        }
+    }
+}
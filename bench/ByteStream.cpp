@@ -0,0 +1,330 @@
+//
+//  rtmp_relay
+//
+
+#include <vector>
+#include "Bench.hpp"
+#include "ByteStream.hpp"
+
+namespace relay
+{
+    namespace bench
+    {
+        // vector+offset helpers that ByteReader and ByteWriter replaced, kept here for comparison
+        namespace legacy
+        {
+            union IntFloat64
+            {
+                uint64_t i;
+                double   f;
+            };
+
+            template <class T>
+            inline uint32_t decodeIntBE(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t size, T& result)
+            {
+                if (buffer.size() - offset < size)
+                {
+                    return 0;
+                }
+
+                result = 0;
+
+                for (uint32_t i = 0; i < size; ++i)
+                {
+                    result += static_cast<T>(*(buffer.data() + offset)) << 8 * (size - i - 1);
+                    offset += 1;
+                }
+
+                return size;
+            }
+
+            template <class T>
+            inline uint32_t decodeIntLE(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t size, T& result)
+            {
+                if (buffer.size() - offset < size)
+                {
+                    return 0;
+                }
+
+                result = 0;
+
+                for (uint32_t i = 0; i < size; ++i)
+                {
+                    result += static_cast<T>(*(buffer.data() + offset)) << 8 * i;
+                    offset += 1;
+                }
+
+                return size;
+            }
+
+            inline uint32_t decodeDouble(const std::vector<uint8_t>& buffer, uint32_t offset, double& result)
+            {
+                if (buffer.size() - offset < 8)
+                {
+                    return 0;
+                }
+
+                uint64_t value = 0;
+
+                for (uint32_t i = 0; i < sizeof(double); ++i)
+                {
+                    value <<= 8;
+                    value += *(buffer.data() + offset);
+                    offset += 1;
+                }
+
+                IntFloat64 intFloat64;
+                intFloat64.i = value;
+
+                result = intFloat64.f;
+
+                return sizeof(double);
+            }
+
+            inline uint32_t decodeU29(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t& result)
+            {
+                uint32_t originalOffset = offset;
+
+                result = 0;
+
+                for (uint32_t i = 0; i < 4; ++i)
+                {
+                    uint8_t b = *(buffer.data() + offset);
+
+                    if (i == 3)
+                    {
+                        result <<= 8;
+                        result += b;
+                    }
+                    else
+                    {
+                        result <<= 7;
+                        result += b & 0x7F; // zero the first bit
+                    }
+
+                    offset += 1;
+
+                    if (!(b & (1 << 7))) break;
+                }
+
+                return offset - originalOffset;
+            }
+
+            template <class T>
+            inline uint32_t encodeIntBE(std::vector<uint8_t>& buffer, uint32_t size, T value)
+            {
+                for (uint32_t i = 0; i < size; ++i)
+                {
+                    buffer.push_back(static_cast<uint8_t>(value >> 8 * (size - i - 1)));
+                }
+
+                return size;
+            }
+
+            template <class T>
+            inline uint32_t encodeIntLE(std::vector<uint8_t>& buffer, uint32_t size, T value)
+            {
+                for (uint32_t i = 0; i < size; ++i)
+                {
+                    buffer.push_back(static_cast<uint8_t>(value >> 8 * i));
+                }
+
+                return size;
+            }
+
+            inline uint32_t encodeDouble(std::vector<uint8_t>& buffer, double value)
+            {
+                IntFloat64 intFloat64;
+                intFloat64.f = value;
+
+                uint64_t data = intFloat64.i;
+
+                for (uint32_t i = 0; i < sizeof(double); ++i)
+                {
+                    buffer.push_back(static_cast<uint8_t>(data >> 8 * (sizeof(value) - i - 1)));
+                }
+
+                return sizeof(double);
+            }
+
+            inline uint32_t encodeU29(std::vector<uint8_t>& buffer, uint32_t value)
+            {
+                if (value <= 0x7F) // one byte
+                {
+                    buffer.push_back(static_cast<uint8_t>(value));
+                    return 1;
+                }
+                else if (value <= 0x3FFF) // two bytes
+                {
+                    buffer.push_back(static_cast<uint8_t>((value >> 7) | 0x80));
+                    buffer.push_back(static_cast<uint8_t>(value & 0x7F));
+                    return 2;
+                }
+                else if (value <= 0x1FFFFF) // three bytes
+                {
+                    buffer.push_back(static_cast<uint8_t>((value >> 14) | 0x80));
+                    buffer.push_back(static_cast<uint8_t>((value >> 7) | 0x80));
+                    buffer.push_back(static_cast<uint8_t>(value & 0x7F));
+                    return 3;
+                }
+                else if (value <= 0x1FFFFFFF) // four bytes
+                {
+                    buffer.push_back(static_cast<uint8_t>((value >> 22) | 0x80));
+                    buffer.push_back(static_cast<uint8_t>((value >> 15) | 0x80));
+                    buffer.push_back(static_cast<uint8_t>((value >> 8) | 0x80));
+                    buffer.push_back(static_cast<uint8_t>(value));
+                    return 4;
+                }
+                else
+                {
+                    return 0;
+                }
+            }
+        }
+
+        // fields of a twelve byte chunk header followed by an AMF number and an AMF3 integer
+        static const uint32_t RECORD_COUNT = 1000;
+
+        static uint64_t decodeLegacy(const std::vector<uint8_t>& buffer)
+        {
+            uint64_t sum = 0;
+            uint32_t offset = 0;
+
+            for (uint32_t i = 0; i < RECORD_COUNT; ++i)
+            {
+                uint8_t type;
+                uint32_t timestamp;
+                uint32_t length;
+                uint8_t messageType;
+                uint32_t messageStreamId;
+                double number;
+                uint32_t integer;
+                uint32_t ret;
+
+                if ((ret = legacy::decodeIntBE(buffer, offset, 1, type)) == 0) return 0;
+                offset += ret;
+                if ((ret = legacy::decodeIntBE(buffer, offset, 3, timestamp)) == 0) return 0;
+                offset += ret;
+                if ((ret = legacy::decodeIntBE(buffer, offset, 3, length)) == 0) return 0;
+                offset += ret;
+                if ((ret = legacy::decodeIntBE(buffer, offset, 1, messageType)) == 0) return 0;
+                offset += ret;
+                if ((ret = legacy::decodeIntLE(buffer, offset, 4, messageStreamId)) == 0) return 0;
+                offset += ret;
+                if ((ret = legacy::decodeDouble(buffer, offset, number)) == 0) return 0;
+                offset += ret;
+                if ((ret = legacy::decodeU29(buffer, offset, integer)) == 0) return 0;
+                offset += ret;
+
+                sum += type + timestamp + length + messageType + messageStreamId + static_cast<uint64_t>(number) + integer;
+            }
+
+            return sum;
+        }
+
+        static uint64_t decodeReader(const std::vector<uint8_t>& buffer)
+        {
+            uint64_t sum = 0;
+            ByteReader reader(buffer);
+
+            for (uint32_t i = 0; i < RECORD_COUNT; ++i)
+            {
+                uint8_t type;
+                uint32_t timestamp;
+                uint32_t length;
+                uint8_t messageType;
+                uint32_t messageStreamId;
+                double number;
+                uint32_t integer;
+
+                if (!reader.readUInt8(type) ||
+                    !reader.readUInt24BE(timestamp) ||
+                    !reader.readUInt24BE(length) ||
+                    !reader.readUInt8(messageType) ||
+                    !reader.readUInt32LE(messageStreamId) ||
+                    !reader.readDouble(number) ||
+                    !reader.readU29(integer))
+                {
+                    return 0;
+                }
+
+                sum += type + timestamp + length + messageType + messageStreamId + static_cast<uint64_t>(number) + integer;
+            }
+
+            return sum;
+        }
+
+        static void encodeLegacy(std::vector<uint8_t>& buffer)
+        {
+            for (uint32_t i = 0; i < RECORD_COUNT; ++i)
+            {
+                legacy::encodeIntBE(buffer, 1, static_cast<uint8_t>(0x03));
+                legacy::encodeIntBE(buffer, 3, i * 40);
+                legacy::encodeIntBE(buffer, 3, 4096 + i);
+                legacy::encodeIntBE(buffer, 1, static_cast<uint8_t>(9));
+                legacy::encodeIntLE(buffer, 4, 1U);
+                legacy::encodeDouble(buffer, i * 0.5);
+                legacy::encodeU29(buffer, i * 300);
+            }
+        }
+
+        static void encodeWriter(std::vector<uint8_t>& buffer)
+        {
+            ByteWriter writer(buffer);
+
+            for (uint32_t i = 0; i < RECORD_COUNT; ++i)
+            {
+                writer.writeUInt8(0x03);
+                writer.writeUInt24BE(i * 40);
+                writer.writeUInt24BE(4096 + i);
+                writer.writeUInt8(9);
+                writer.writeUInt32LE(1);
+                writer.writeDouble(i * 0.5);
+                writer.writeU29(i * 300);
+            }
+        }
+
+        bool byteStream()
+        {
+            std::vector<uint8_t> legacyBuffer;
+            encodeLegacy(legacyBuffer);
+
+            std::vector<uint8_t> buffer;
+            encodeWriter(buffer);
+
+            if (buffer != legacyBuffer ||
+                decodeReader(buffer) != decodeLegacy(buffer) ||
+                decodeReader(buffer) == 0)
+            {
+                std::cout << "  encoders or decoders differ" << std::endl;
+                return false;
+            }
+
+            const uint64_t iterations = 20000;
+
+            std::cout << "  " << RECORD_COUNT << " records of " << buffer.size() / RECORD_COUNT << " bytes" << std::endl;
+
+            measure("decode, vector+offset helpers", iterations, [&]() {
+                sink = sink + decodeLegacy(buffer);
+            });
+
+            measure("decode, ByteReader", iterations, [&]() {
+                sink = sink + decodeReader(buffer);
+            });
+
+            measure("encode, vector+offset helpers", iterations, [&]() {
+                legacyBuffer.clear();
+                encodeLegacy(legacyBuffer);
+                sink = sink + legacyBuffer.size();
+            });
+
+            measure("encode, ByteWriter", iterations, [&]() {
+                buffer.clear();
+                encodeWriter(buffer);
+                sink = sink + buffer.size();
+            });
+
+            return true;
+        }
+    }
+}
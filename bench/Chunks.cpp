@@ -0,0 +1,72 @@
+//
+//  rtmp_relay
+//
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Bench.hpp"
+#include "BufferPool.hpp"
+#include "RTMP.hpp"
+
+namespace relay
+{
+    namespace bench
+    {
+        bool chunks()
+        {
+            BufferPool bufferPool;
+
+            for (uint32_t messageSize : {1024, 128 * 1024})
+            {
+                rtmp::Packet packet;
+                packet.channel = rtmp::Channel::VIDEO;
+                packet.messageType = rtmp::MessageType::VIDEO_PACKET;
+                packet.messageStreamId = 1;
+                packet.timestamp = 40;
+                packet.data.resize(messageSize);
+
+                for (uint32_t i = 0; i < messageSize; ++i) packet.data[i] = static_cast<uint8_t>(i);
+
+                for (uint32_t chunkSize : {128, 4096, 65536})
+                {
+                    std::vector<uint8_t> buffer;
+                    std::map<uint32_t, rtmp::Header> sentPackets;
+
+                    if (packet.encode(buffer, chunkSize, sentPackets) == 0)
+                    {
+                        std::cout << "  failed to encode" << std::endl;
+                        return false;
+                    }
+
+                    {
+                        rtmp::Packet decoded;
+                        std::map<uint32_t, rtmp::Header> receivedPackets;
+
+                        if (decoded.decode(buffer, 0, chunkSize, receivedPackets) != buffer.size() ||
+                            decoded.data != packet.data)
+                        {
+                            std::cout << "  reassembled message differs at chunk size " << chunkSize << std::endl;
+                            return false;
+                        }
+                    }
+
+                    const uint64_t iterations = 2000000 / (messageSize / 1024 + 1);
+
+                    // the first chunk always has a twelve byte header, like the first message on a chunk stream
+                    double nanoseconds = measure(std::to_string(messageSize) + " byte message, chunk size " + std::to_string(chunkSize), iterations, [&]() {
+                        rtmp::Packet decoded;
+                        std::map<uint32_t, rtmp::Header> receivedPackets;
+
+                        sink = sink + decoded.decode(buffer, 0, chunkSize, receivedPackets, &bufferPool);
+                        bufferPool.release(decoded.data);
+                    });
+
+                    std::cout << "    " << static_cast<uint64_t>(messageSize / nanoseconds * 1000.0) << " MB/s" << std::endl;
+                }
+            }
+
+            return true;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+//
+//  rtmp_relay
+//
+
+#include <random>
+#include <vector>
+#include "Bench.hpp"
+#include "RTMP.hpp"
+#include "Sha256.hpp"
+#include "Utils.hpp"
+
+namespace relay
+{
+    namespace bench
+    {
+        // first 30 bytes of the Flash Player key, used by clients to sign C1
+        static const uint8_t GENUINE_FP_KEY[] = {
+            'G', 'e', 'n', 'u', 'i', 'n', 'e', ' ', 'A', 'd', 'o', 'b', 'e', ' ',
+            'F', 'l', 'a', 's', 'h', ' ', 'P', 'l', 'a', 'y', 'e', 'r', ' ', '0', '0', '1'
+        };
+
+        static void fillRandom(std::mt19937& generator, uint8_t* data, size_t size)
+        {
+            for (size_t i = 0; i < size; ++i) data[i] = static_cast<uint8_t>(generator());
+        }
+
+        // C1 of a Flash Player 9+ client, digest in the block at byte 8
+        static void signClientChallenge(uint8_t* challenge)
+        {
+            const uint32_t base = 8;
+            uint32_t digestOffset = (static_cast<uint32_t>(challenge[base]) + challenge[base + 1] +
+                                     challenge[base + 2] + challenge[base + 3]) % 728 + base + 4;
+
+            HmacSha256 hmac(GENUINE_FP_KEY, sizeof(GENUINE_FP_KEY));
+            hmac.update(challenge, digestOffset);
+            hmac.update(challenge + digestOffset + Sha256::DIGEST_SIZE, sizeof(rtmp::Challenge) - digestOffset - Sha256::DIGEST_SIZE);
+            hmac.finish(challenge + digestOffset);
+        }
+
+        bool handshake()
+        {
+            std::mt19937 generator(1);
+            auto generateRandomBytes = [&generator](uint8_t* data, size_t size) {
+                ::generateRandomBytes(generator, data, size);
+            };
+
+            // C0 followed by C1
+            std::vector<uint8_t> simple(sizeof(uint8_t) + sizeof(rtmp::Challenge));
+            simple[0] = 3;
+            fillRandom(generator, simple.data() + 5 + 4, sizeof(rtmp::Challenge) - 8); // zero time and version
+
+            std::vector<uint8_t> digest(simple.size());
+            digest[0] = 3;
+            fillRandom(generator, digest.data() + 1, sizeof(rtmp::Challenge));
+            digest[5] = 9; // client version 9.0.124.2
+            digest[6] = 0;
+            digest[7] = 124;
+            digest[8] = 2;
+            signClientChallenge(digest.data() + 1);
+
+            // a version is set but C1 is not signed, both digest positions are checked before falling back
+            std::vector<uint8_t> unsignedC1(digest);
+            unsignedC1[100] ^= 0xff;
+            unsignedC1[800] ^= 0xff;
+
+            std::vector<uint8_t> reply(sizeof(uint8_t) + sizeof(rtmp::Challenge) + sizeof(rtmp::Ack));
+
+            if (!rtmp::writeHandshakeReply(digest.data() + 1, reply.data(), generateRandomBytes) ||
+                rtmp::writeHandshakeReply(simple.data() + 1, reply.data(), generateRandomBytes) ||
+                rtmp::writeHandshakeReply(unsignedC1.data() + 1, reply.data(), generateRandomBytes))
+            {
+                std::cout << "  unexpected handshake type" << std::endl;
+                return false;
+            }
+
+            const uint64_t iterations = 20000;
+
+            for (const auto& input : {std::make_pair("simple (C1 echoed)", &simple),
+                                      std::make_pair("digest (C1 signed)", &digest),
+                                      std::make_pair("digest lookup failed", &unsignedC1)})
+            {
+                const std::vector<uint8_t>& c0c1 = *input.second;
+
+                measure(input.first, iterations, [&]() {
+                    if (c0c1[0] != 3) return;
+
+                    sink = sink + rtmp::writeHandshakeReply(c0c1.data() + 1, reply.data(), generateRandomBytes) + reply[1000];
+                });
+            }
+
+            return true;
+        }
+    }
+}
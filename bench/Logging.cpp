@@ -0,0 +1,82 @@
+//
+//  rtmp_relay
+//
+
+#include <map>
+#include <string>
+#include <vector>
+#include "Bench.hpp"
+#include "Log.hpp"
+#include "RTMP.hpp"
+
+namespace relay
+{
+    namespace bench
+    {
+        bool logging()
+        {
+            const uint32_t chunkSize = 128;
+            const std::string idString = "[CON:1 app/stream] ";
+
+            rtmp::Packet packet;
+            packet.channel = rtmp::Channel::VIDEO;
+            packet.messageType = rtmp::MessageType::VIDEO_PACKET;
+            packet.messageStreamId = 1;
+            packet.timestamp = 40;
+            packet.data.resize(64 * 1024);
+
+            std::vector<uint8_t> buffer;
+            uint32_t chunkCount = (static_cast<uint32_t>(packet.data.size()) + chunkSize - 1) / chunkSize;
+
+            // lines are formatted and queued, but not written anywhere
+            bool syslogEnabled = Log::syslogEnabled.load();
+            Log::Level threshold = Log::threshold.load();
+            Log::syslogEnabled = false;
+            Log::setFile("/dev/null");
+            Log::startThread();
+
+            std::cout << "  " << packet.data.size() << " byte message, " << chunkCount << " chunks of " << chunkSize << " bytes" << std::endl;
+
+            const uint64_t iterations = 2000;
+
+            for (Log::Level level : {Log::Level::INFO, Log::Level::ALL})
+            {
+                Log::threshold = level;
+                std::string suffix = (level == Log::Level::ALL) ? ", verbose log enabled" : ", verbose log disabled";
+
+                double nanoseconds = measure("encode" + suffix, iterations, [&]() {
+                    std::map<uint32_t, rtmp::Header> previousPackets;
+                    buffer.clear();
+                    packet.encode(buffer, chunkSize, previousPackets);
+                    sink = sink + buffer.size();
+                });
+
+                std::cout << "    " << nanoseconds / chunkCount << " ns per chunk" << std::endl;
+            }
+
+            // the per read statement of Connection::handleRead, before and after arguments were evaluated lazily
+            Log::threshold = Log::Level::INFO;
+            size_t size = 4096;
+
+            measure("disabled statement, arguments evaluated", iterations * 1000, [&]() {
+                Log(Log::Level::ALL) << idString << "Got " << std::to_string(size) << " bytes";
+            });
+
+            measure("disabled statement, RELAY_LOG", iterations * 1000, [&]() {
+                RELAY_LOG(Log::Level::ALL) << idString << "Got " << std::to_string(size) << " bytes";
+            });
+
+            Log::stopThread();
+            Log::setFile("");
+            Log::threshold = threshold;
+            Log::syslogEnabled = syslogEnabled;
+
+            if (uint64_t dropped = Log::getDroppedCount())
+            {
+                std::cout << "  " << dropped << " log lines were dropped because the queue was full" << std::endl;
+            }
+
+            return true;
+        }
+    }
+}
@@ -0,0 +1,85 @@
+//
+//  rtmp_relay
+//
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include "Bench.hpp"
+
+namespace relay
+{
+    namespace bench
+    {
+        volatile uint64_t sink = 0;
+
+        static std::atomic<uint64_t> heapAllocationCount(0);
+
+        uint64_t getHeapAllocationCount()
+        {
+            return heapAllocationCount.load(std::memory_order_relaxed);
+        }
+
+        bool handshake();
+        bool byteStream();
+        bool logging();
+        bool amf3();
+        bool arena();
+        bool chunks();
+    }
+}
+
+// counts the heap allocations of the whole process
+void* operator new(size_t size)
+{
+    relay::bench::heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* pointer = malloc(size ? size : 1)) return pointer;
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    free(pointer);
+}
+
+struct Benchmark
+{
+    const char* name;
+    bool (*run)(); // false if a check failed
+};
+
+static const Benchmark BENCHMARKS[] = {
+    {"handshake", relay::bench::handshake},
+    {"bytestream", relay::bench::byteStream},
+    {"logging", relay::bench::logging},
+    {"amf3", relay::bench::amf3},
+    {"arena", relay::bench::arena},
+    {"chunks", relay::bench::chunks}
+};
+
+int main(int argc, const char* argv[])
+{
+    int result = 0;
+
+    // runs all benchmarks or only the ones named on the command line
+    for (const Benchmark& benchmark : BENCHMARKS)
+    {
+        bool selected = (argc < 2);
+
+        for (int i = 1; i < argc; ++i)
+        {
+            if (strcmp(argv[i], benchmark.name) == 0) selected = true;
+        }
+
+        if (!selected) continue;
+
+        std::cout << benchmark.name << std::endl;
+        if (!benchmark.run()) result = 1;
+    }
+
+    return result;
+}
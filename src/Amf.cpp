@@ -2,9 +2,11 @@
 //  rtmp_relay
 //
 
+#include <cstring>
 #include <iostream>
+#include <tuple>
+#include <utility>
 #include "Amf.hpp"
-#include "Utils.hpp"
 
 namespace relay
 {
@@ -38,229 +40,244 @@ namespace relay
 
         // decoding
         // AMF0 and AMF3
-        static uint32_t readNumber(const std::vector<uint8_t>& buffer, uint32_t offset, double& result)
+        static bool readNumber(ByteReader& reader, double& result)
         {
-            uint32_t originalOffset = offset;
-
-            uint32_t ret = decodeDouble(buffer, offset, result);
-
-            if (ret == 0)
-            {
-                return 0;
-            }
-
-            offset += ret;
-
-            return offset - originalOffset;
+            return reader.readDouble(result);
         }
 
         // AMF3
-        static uint32_t readInteger(const std::vector<uint8_t>& buffer, uint32_t offset, int32_t& result)
+        static bool readInteger(ByteReader& reader, int32_t& result)
         {
-            uint32_t originalOffset = offset;
-
             uint32_t unsignedValue;
-            uint32_t ret = decodeU29(buffer, offset, unsignedValue);
 
-            if (ret == 0)
+            if (!reader.readU29(unsignedValue))
             {
-                return 0;
+                return false;
             }
 
-            offset += ret;
-
             result = static_cast<int32_t>(unsignedValue << 3);
             result >>= 3;
 
-            return offset - originalOffset;
+            return true;
         }
 
         // AMF0
-        static uint32_t readBoolean(const std::vector<uint8_t>& buffer, uint32_t offset, bool& result)
+        static bool readBoolean(ByteReader& reader, bool& result)
         {
-            uint32_t originalOffset = offset;
+            uint8_t value;
 
-            if (buffer.size() - offset < 1)
+            if (!reader.readUInt8(value))
             {
-                return 0;
+                return false;
             }
 
-            result = (*(buffer.data() + offset)) > 0;
-            offset += 1;
+            result = value > 0;
 
-            return offset - originalOffset;
+            return true;
         }
 
         // AMF0
-        static uint32_t readString(const std::vector<uint8_t>& buffer, uint32_t offset, std::string& result)
+        static bool readString(ByteReader& reader, std::string& result)
         {
-            uint32_t originalOffset = offset;
-
             uint16_t length;
 
-            uint32_t ret = decodeIntBE(buffer, offset, 2, length);
-
-            if (ret == 0)
+            if (!reader.readUInt16BE(length))
             {
-                return 0;
+                return false;
             }
 
-            offset += ret;
+            return reader.readString(length, result);
+        }
+
+        // AMF3
+        static bool readStringAMF3(ByteReader& reader, DecodeTables& tables, std::string& result)
+        {
+            uint32_t header;
 
-            if (buffer.size() - offset < length)
+            if (!reader.readU29(header))
             {
-                return 0;
+                return false;
             }
 
-            result.assign(reinterpret_cast<const char*>(buffer.data() + offset), length);
-            offset += length;
+            if ((header & 0x01) == 0) // string reference
+            {
+                uint32_t index = header >> 1;
 
-            return offset - originalOffset;
-        }
+                if (index >= tables.strings.size())
+                {
+                    return false;
+                }
 
-        // AMF3
-        static uint32_t readStringAMF3(const std::vector<uint8_t>& buffer, uint32_t offset, std::string& result)
-        {
-            uint32_t originalOffset = offset;
+                result = tables.strings[index];
 
-            uint32_t length;
+                return true;
+            }
 
-            uint32_t ret = decodeU29(buffer, offset, length);
+            if (!reader.readString(header >> 1, result))
+            {
+                return false;
+            }
 
-            if (ret == 0)
+            // empty strings are never sent by reference
+            if (!result.empty())
             {
-                return 0;
+                tables.strings.push_back(result);
             }
 
-            offset += ret;
+            return true;
+        }
+
+        // the node is constructed in place, so that it uses the container's allocator
+        static Node& emplaceNode(Node::Map& map, const std::string& key)
+        {
+            map.erase(key);
 
-            length >>= 1; // shift out the low bit (reference/literal marker)
+            return map.emplace(std::piecewise_construct,
+                               std::forward_as_tuple(key),
+                               std::forward_as_tuple(map.get_allocator())).first->second;
+        }
 
-            if (buffer.size() - offset < length)
-            {
-                return 0;
-            }
+        static Node& emplaceNode(Node::Vector& vector)
+        {
+            vector.emplace_back(vector.get_allocator());
 
-            result.assign(reinterpret_cast<const char*>(buffer.data() + offset), length);
-            offset += length;
-            
-            return offset - originalOffset;
+            return vector.back();
         }
 
         // AMF0
-        static uint32_t readObject(const std::vector<uint8_t>& buffer, uint32_t offset, std::map<std::string, Node>& result)
+        static bool readObject(ByteReader& reader, Node::Map& result)
         {
-            uint32_t originalOffset = offset;
-
             while (true)
             {
                 std::string key;
 
-                uint32_t ret = readString(buffer, offset, key);
-
-                if (ret == 0)
+                if (!readString(reader, key))
                 {
-                    return 0;
+                    return false;
                 }
 
-                offset += ret;
+                uint8_t marker;
 
-                if (buffer.size() - offset < 1)
+                if (!reader.peekUInt8(marker))
                 {
-                    return 0;
+                    return false;
                 }
 
-                AMF0Marker marker = *reinterpret_cast<const AMF0Marker*>(buffer.data() + offset);
-
-                if (marker == AMF0Marker::ObjectEnd)
+                if (static_cast<AMF0Marker>(marker) == AMF0Marker::ObjectEnd)
                 {
-                    offset += 1;
+                    reader.skip(1);
                     break;
                 }
                 else
                 {
-                    Node node;
-
-                    ret = node.decode(amf::Version::AMF0, buffer, offset);
+                    Node& node = emplaceNode(result, key);
 
-                    if (ret == 0)
+                    if (node.decode(amf::Version::AMF0, reader) == 0)
                     {
-                        return 0;
+                        return false;
                     }
-                    offset += ret;
-
-                    result[key] = node;
                 }
             }
 
-            return offset - originalOffset;
+            return true;
         }
 
         // AMF3
-        static uint32_t readObjectAMF3(const std::vector<uint8_t>& buffer, uint32_t offset, std::map<std::string, Node>& result)
+        static bool readObjectAMF3(ByteReader& reader, DecodeTables& tables, uint32_t header, Node::Map& result)
         {
-            uint32_t originalOffset = offset;
+            Traits traits;
 
-            while (true)
+            if ((header & 0x02) == 0) // traits reference
             {
-                std::string key;
+                uint32_t index = header >> 2;
 
-                uint32_t ret = readString(buffer, offset, key);
+                if (index >= tables.traits.size())
+                {
+                    return false;
+                }
 
-                if (ret == 0)
+                traits = tables.traits[index];
+            }
+            else
+            {
+                if (header & 0x04)
                 {
-                    return 0;
+                    RELAY_LOG(Log::Level::ERR) << "Externalizable objects are not supported";
+                    return false;
                 }
 
-                offset += ret;
+                traits.dynamic = (header & 0x08) != 0;
+                uint32_t memberCount = header >> 4;
 
-                if (buffer.size() - offset < 1)
+                if (!readStringAMF3(reader, tables, traits.className))
                 {
-                    return 0;
+                    return false;
+                }
+
+                for (uint32_t i = 0; i < memberCount; ++i)
+                {
+                    std::string memberName;
+
+                    if (!readStringAMF3(reader, tables, memberName))
+                    {
+                        return false;
+                    }
+
+                    traits.memberNames.push_back(memberName);
                 }
 
-                AMF0Marker marker = *reinterpret_cast<const AMF0Marker*>(buffer.data() + offset);
+                tables.traits.push_back(traits);
+            }
+
+            for (const std::string& memberName : traits.memberNames)
+            {
+                Node& node = emplaceNode(result, memberName);
 
-                if (marker == AMF0Marker::ObjectEnd)
+                if (node.decode(amf::Version::AMF3, reader, tables) == 0)
                 {
-                    offset += 1;
-                    break;
+                    return false;
                 }
-                else
+            }
+
+            if (traits.dynamic)
+            {
+                // dynamic members are terminated by an empty key
+                while (true)
                 {
-                    Node node;
+                    std::string key;
 
-                    ret = node.decode(amf::Version::AMF0, buffer, offset);
+                    if (!readStringAMF3(reader, tables, key))
+                    {
+                        return false;
+                    }
 
-                    if (ret == 0)
+                    if (key.empty())
                     {
-                        return 0;
+                        break;
+                    }
+
+                    Node& node = emplaceNode(result, key);
+
+                    if (node.decode(amf::Version::AMF3, reader, tables) == 0)
+                    {
+                        return false;
                     }
-                    offset += ret;
-                    
-                    result[key] = node;
                 }
             }
-            
-            return offset - originalOffset;
+
+            return true;
         }
 
         // AMF0
-        static uint32_t readECMAArray(const std::vector<uint8_t>& buffer, uint32_t offset, std::map<std::string, Node>& result)
+        static bool readECMAArray(ByteReader& reader, Node::Map& result)
         {
-            uint32_t originalOffset = offset;
-
             uint32_t count;
 
-            uint32_t ret = decodeIntBE(buffer, offset, 4, count);
-
-            if (ret == 0)
+            if (!reader.readUInt32BE(count))
             {
-                return 0;
+                return false;
             }
 
-            offset += ret;
-
             std::string key;
 
             uint32_t currentCount = 0;
@@ -268,335 +285,300 @@ namespace relay
             while (true)
             {
                 key.clear();
-                ret = readString(buffer, offset, key);
 
-                if (ret == 0)
+                if (!readString(reader, key))
                 {
-                    return 0;
+                    return false;
                 }
 
-                offset += ret;
+                uint8_t marker;
 
-                if (buffer.size() - offset < 1)
+                if (!reader.peekUInt8(marker))
                 {
-                    return 0;
+                    return false;
                 }
 
-                AMF0Marker marker = *reinterpret_cast<const AMF0Marker*>(buffer.data() + offset);
-
-                if (marker == AMF0Marker::ObjectEnd)
+                if (static_cast<AMF0Marker>(marker) == AMF0Marker::ObjectEnd)
                 {
-                    offset += 1;
+                    reader.skip(1);
                     break;
                 }
                 else
                 {
-                    Node node;
-                    ret = node.decode(amf::Version::AMF0, buffer, offset);
+                    Node& node = emplaceNode(result, key);
 
-                    if (ret == 0)
+                    if (node.decode(amf::Version::AMF0, reader) == 0)
                     {
-                        return 0;
+                        return false;
                     }
 
-                    offset += ret;
-
-                    result[key] = node;
-
                     ++currentCount;
                 }
             }
 
             if (count != 0 && count != currentCount) // Wowza sends count 0 for ECMA arrays
             {
-                return 0;
+                return false;
             }
 
-            return offset - originalOffset;
+            return true;
         }
 
         // AMF3
-        static uint32_t readDictionary(const std::vector<uint8_t>& buffer, uint32_t offset, std::map<std::string, Node>& result)
+        static bool readDictionary(ByteReader& reader, DecodeTables& tables, uint32_t header, Node::Map& result)
         {
-            uint32_t originalOffset = offset;
-
-            uint32_t count;
-
-            uint32_t ret = decodeU29(buffer, offset, count);
-
-            if (ret == 0)
+            // skip the weakly-referenced flag
+            if (!reader.skip(1))
             {
-                return 0;
+                return false;
             }
 
-            offset += ret;
-
-            // skip the weakly-referenced flag
-            offset += 1;
-
-            std::string key;
+            uint32_t count = header >> 1;
 
-            while (true)
+            for (uint32_t i = 0; i < count; ++i)
             {
-                key.clear();
-                ret = readStringAMF3(buffer, offset, key);
+                Node key;
 
-                if (ret == 0)
+                if (key.decode(amf::Version::AMF3, reader, tables) == 0)
                 {
-                    return 0;
+                    return false;
                 }
 
-                offset += ret;
-
-                if (buffer.size() - offset < 1)
+                // keys can be of any type, only strings and numbers can be stored
+                if (!key.isString() && !key.isNumber())
                 {
-                    return 0;
+                    return false;
                 }
 
-                Node node;
-                ret = node.decode(amf::Version::AMF3, buffer, offset);
+                Node& node = emplaceNode(result, key.toString());
 
-                if (ret == 0)
+                if (node.decode(amf::Version::AMF3, reader, tables) == 0)
                 {
-                    return 0;
+                    return false;
                 }
-
-                offset += ret;
-
-                result[key] = node;
             }
 
-            return offset - originalOffset;
+            return true;
         }
 
         // AMF0
-        static uint32_t readStrictArray(const std::vector<uint8_t>& buffer, uint32_t offset, std::vector<Node>& result)
+        static bool readStrictArray(ByteReader& reader, Node::Vector& result)
         {
-            uint32_t originalOffset = offset;
-
             uint32_t count;
 
-            uint32_t ret = decodeIntBE(buffer, offset, 4, count);
-
-            if (ret == 0)
+            if (!reader.readUInt32BE(count))
             {
-                return 0;
+                return false;
             }
 
-            offset += ret;
-
             for (uint32_t i = 0; i < count; ++i)
             {
-                Node node;
-                ret = node.decode(amf::Version::AMF0, buffer, offset);
+                Node& node = emplaceNode(result);
 
-                if (ret == 0)
+                if (node.decode(amf::Version::AMF0, reader) == 0)
                 {
-                    return 0;
+                    return false;
                 }
-
-                offset += ret;
-
-                result.push_back(node);
             }
 
-            return offset - originalOffset;
+            return true;
         }
 
         // AMF3
-        static uint32_t readStrictArrayAMF3(const std::vector<uint8_t>& buffer, uint32_t offset, std::vector<Node>& result)
+        static bool readArrayAMF3(ByteReader& reader, DecodeTables& tables, uint32_t header, Node::Type& type,
+                                  Node::Vector& vectorValue, Node::Map& mapValue)
         {
-            uint32_t originalOffset = offset;
+            // associative part, terminated by an empty key
+            while (true)
+            {
+                std::string key;
 
-            uint32_t count;
+                if (!readStringAMF3(reader, tables, key))
+                {
+                    return false;
+                }
+
+                if (key.empty())
+                {
+                    break;
+                }
 
-            uint32_t ret = decodeIntBE(buffer, offset, 4, count);
+                Node& node = emplaceNode(mapValue, key);
 
-            if (ret == 0)
-            {
-                return 0;
+                if (node.decode(amf::Version::AMF3, reader, tables) == 0)
+                {
+                    return false;
+                }
             }
 
-            offset += ret;
+            uint32_t count = header >> 1;
 
             for (uint32_t i = 0; i < count; ++i)
             {
-                Node node;
-                ret = node.decode(amf::Version::AMF0, buffer, offset);
+                Node& node = emplaceNode(vectorValue);
 
-                if (ret == 0)
+                if (node.decode(amf::Version::AMF3, reader, tables) == 0)
                 {
-                    return 0;
+                    return false;
                 }
-
-                offset += ret;
-
-                result.push_back(node);
             }
-            
-            return offset - originalOffset;
-        }
-
-        // AMF0
-        static uint32_t readDate(const std::vector<uint8_t>& buffer, uint32_t offset, double& ms, uint32_t& timezone)
-        {
-            uint32_t originalOffset = offset;
 
-            uint32_t ret = decodeDouble(buffer, offset, ms);
-
-            if (ret == 0) // date in milliseconds from 01/01/1970
+            if (mapValue.empty())
             {
-                return 0;
+                type = Node::Type::Array;
             }
+            else
+            {
+                // mixed arrays are stored like AMF0 ECMA arrays, with the dense part keyed by index
+                type = Node::Type::Dictionary;
 
-            offset += ret;
-
-            ret = decodeIntBE(buffer, offset, 4, timezone);
+                for (size_t i = 0; i < vectorValue.size(); ++i)
+                {
+                    mapValue[std::to_string(i)] = vectorValue[i];
+                }
 
-            if (ret == 0) // unsupported timezone
-            {
-                return 0;
+                vectorValue.clear();
             }
 
-            offset += ret;
-
-            return offset - originalOffset;
+            return true;
         }
 
-        // AMF3
-        static uint32_t readDateAMF3(const std::vector<uint8_t>& buffer, uint32_t offset, double& ms)
+        // AMF0
+        static bool readDate(ByteReader& reader, double& ms, uint32_t& timezone)
         {
-            uint32_t originalOffset = offset;
-
-            uint32_t value;
-            uint32_t ret = decodeU29(buffer, offset, value);
-
-            if (ret == 0)
+            if (!reader.readDouble(ms)) // date in milliseconds from 01/01/1970
             {
-                return 0;
+                return false;
             }
 
-            offset += ret;
-
-            ret = decodeDouble(buffer, offset, ms);
-
-            if (ret == 0) // date in milliseconds from 01/01/1970
+            if (!reader.readUInt32BE(timezone)) // unsupported timezone
             {
-                return 0;
+                return false;
             }
 
-            offset += ret;
-            
-            return offset - originalOffset;
+            return true;
         }
 
-        // AMF0
-        static uint32_t readLongString(const std::vector<uint8_t>& buffer, uint32_t offset, std::string& result)
+        // AMF3
+        static bool readDateAMF3(ByteReader& reader, double& ms)
         {
-            uint32_t originalOffset = offset;
+            return reader.readDouble(ms); // date in milliseconds from 01/01/1970
+        }
 
+        // AMF0
+        static bool readLongString(ByteReader& reader, std::string& result)
+        {
             uint32_t length;
 
-            uint32_t ret = decodeIntBE(buffer, offset, 4, length);
-
-            if (ret == 0)
-            {
-                return 0;
-            }
-
-            offset += ret;
-
-            if (buffer.size() - offset < length)
+            if (!reader.readUInt32BE(length))
             {
-                return 0;
+                return false;
             }
 
-            result.assign(reinterpret_cast<const char*>(buffer.data() + offset), length);
-            offset += length;
-
-            return offset - originalOffset;
+            return reader.readString(length, result);
         }
 
         // AMF0
-        static uint32_t readTypedObject(const std::vector<uint8_t>& /* buffer */, uint32_t& /* offset */)
+        static bool readTypedObject(ByteReader& /* reader */)
         {
-            Log(Log::Level::ERR) << "Typed objects are not supported";
+            RELAY_LOG(Log::Level::ERR) << "Typed objects are not supported";
 
-            return 0;
+            return false;
         }
 
         // encoding
         // AMF0 and AMF3
-        static uint32_t writeNumber(std::vector<uint8_t>& buffer, double value)
+        static uint32_t writeNumber(ByteWriter& writer, double value)
         {
-            uint32_t ret = encodeDouble(buffer, value);
+            writer.writeDouble(value);
 
-            return ret;
+            return 8;
         }
 
         // AMF3
-        static uint32_t writeInteger(std::vector<uint8_t>& buffer, int32_t value)
+        static uint32_t writeInteger(ByteWriter& writer, int32_t value)
         {
             uint32_t unsignedValue = static_cast<uint32_t>(value & 0xFFFFFFF);
             unsignedValue |= (static_cast<uint32_t>(value) & 0x80000000) >> 3;
 
-            uint32_t ret = encodeU29(buffer, unsignedValue);
+            size_t originalSize = writer.getSize();
+
+            if (!writer.writeU29(unsignedValue))
+            {
+                return 0;
+            }
 
-            return ret;
+            return static_cast<uint32_t>(writer.getSize() - originalSize);
         }
 
         // AMF0
-        static uint32_t writeBoolean(std::vector<uint8_t>& buffer, bool value)
+        static uint32_t writeBoolean(ByteWriter& writer, bool value)
         {
-            buffer.push_back(static_cast<uint8_t>(value));
+            writer.writeUInt8(static_cast<uint8_t>(value));
 
             return 1;
         }
 
         // AMF0
-        static uint32_t writeString(std::vector<uint8_t>& buffer, const std::string& value)
+        static uint32_t writeString(ByteWriter& writer, const std::string& value)
         {
-            uint32_t ret = encodeIntBE(buffer, 2, value.size());
-
-            if (ret == 0)
+            if (value.size() > std::numeric_limits<uint16_t>::max())
             {
                 return 0;
             }
 
-            uint32_t size = ret;
+            writer.writeUInt16BE(static_cast<uint16_t>(value.size()));
+            writer.writeBytes(value.data(), value.size());
 
-            buffer.insert(buffer.end(),
-                          reinterpret_cast<const uint8_t*>(value.data()),
-                          reinterpret_cast<const uint8_t*>(value.data()) + value.length());
-            size += static_cast<uint32_t>(value.length());
-
-            return size;
+            return 2 + static_cast<uint32_t>(value.size());
         }
 
         // AMF3
-        static uint32_t writeStringAMF3(std::vector<uint8_t>& buffer, const std::string& value)
+        static uint32_t writeStringAMF3(ByteWriter& writer, EncodeTables& tables, const std::string& value)
         {
-            uint32_t ret = encodeU29(buffer, static_cast<uint32_t>(value.size()) << 1 | 1); // add the low bit (string literal marker)
+            size_t originalSize = writer.getSize();
 
-            uint32_t size = ret;
+            if (!value.empty())
+            {
+                auto i = tables.strings.find(value);
 
-            buffer.insert(buffer.end(),
-                          reinterpret_cast<const uint8_t*>(value.data()),
-                          reinterpret_cast<const uint8_t*>(value.data()) + value.length());
-            size += static_cast<uint32_t>(value.length());
-            
-            return size;
+                if (i != tables.strings.end())
+                {
+                    if (!writer.writeU29(i->second << 1)) // string reference
+                    {
+                        return 0;
+                    }
+
+                    return static_cast<uint32_t>(writer.getSize() - originalSize);
+                }
+            }
+
+            if (!writer.writeU29(static_cast<uint32_t>(value.size()) << 1 | 1)) // add the low bit (string literal marker)
+            {
+                return 0;
+            }
+
+            writer.writeBytes(value.data(), value.size());
+
+            // empty strings are never sent by reference
+            if (!value.empty())
+            {
+                uint32_t index = static_cast<uint32_t>(tables.strings.size());
+                tables.strings[value] = index;
+            }
+
+            return static_cast<uint32_t>(writer.getSize() - originalSize);
         }
 
         // AMF0
-        static uint32_t writeObject(std::vector<uint8_t>& buffer, const std::map<std::string, Node>& value)
+        static uint32_t writeObject(ByteWriter& writer, const Node::Map& value)
         {
             uint32_t size = 0;
             uint32_t ret;
 
             for (const auto& i : value)
             {
-                ret = writeString(buffer, i.first);
+                ret = writeString(writer, i.first);
 
                 if (ret == 0)
                 {
@@ -605,7 +587,7 @@ namespace relay
 
                 size += ret;
 
-                ret = i.second.encode(amf::Version::AMF0, buffer);
+                ret = i.second.encode(amf::Version::AMF0, writer);
 
                 if (ret == 0)
                 {
@@ -615,7 +597,7 @@ namespace relay
                 size += ret;
             }
 
-            if ((ret = writeString(buffer, "")) == 0)
+            if ((ret = writeString(writer, "")) == 0)
             {
                 return 0;
             }
@@ -623,7 +605,7 @@ namespace relay
             size += ret;
 
             AMF0Marker marker = AMF0Marker::ObjectEnd;
-            buffer.push_back(static_cast<uint8_t>(marker));
+            writer.writeUInt8(static_cast<uint8_t>(marker));
 
             size += 1;
 
@@ -631,64 +613,58 @@ namespace relay
         }
 
         // AMF3
-        static uint32_t writeObjectAMF3(std::vector<uint8_t>& buffer, const std::map<std::string, Node>& value)
+        static uint32_t writeObjectAMF3(ByteWriter& writer, EncodeTables& tables, const Node::Map& value)
         {
-            uint32_t size = 0;
-            uint32_t ret;
+            size_t originalSize = writer.getSize();
 
-            for (const auto& i : value)
+            if (tables.traitsWritten)
+            {
+                writer.writeU29(0x01); // inline object, reference to traits 0
+            }
+            else
             {
-                ret = writeString(buffer, i.first);
+                writer.writeU29(0x0B); // inline object, inline traits, dynamic, no sealed members
+                writeStringAMF3(writer, tables, ""); // anonymous class
+                tables.traitsWritten = true;
+            }
 
-                if (ret == 0)
+            for (const auto& i : value)
+            {
+                // an empty key would terminate the dynamic members
+                if (i.first.empty())
                 {
                     return 0;
                 }
 
-                size += ret;
-
-                ret = i.second.encode(amf::Version::AMF0, buffer);
-
-                if (ret == 0)
+                if (writeStringAMF3(writer, tables, i.first) == 0)
                 {
                     return 0;
                 }
 
-                size += ret;
-            }
-
-            if ((ret = writeString(buffer, "")) == 0)
-            {
-                return 0;
+                if (i.second.encode(amf::Version::AMF3, writer, tables) == 0)
+                {
+                    return 0;
+                }
             }
 
-            size += ret;
+            writeStringAMF3(writer, tables, "");
 
-            AMF0Marker marker = AMF0Marker::ObjectEnd;
-            buffer.push_back(static_cast<uint8_t>(marker));
-            
-            size += 1;
-            
-            return size;
+            return static_cast<uint32_t>(writer.getSize() - originalSize);
         }
 
         // AMF0
-        static uint32_t writeECMAArray(std::vector<uint8_t>& buffer, const std::map<std::string, Node>& value)
+        static uint32_t writeECMAArray(ByteWriter& writer, const Node::Map& value)
         {
             uint32_t size = 0;
 
-            uint32_t ret = encodeIntBE(buffer, 4, value.size());
-
-            if (ret == 0)
-            {
-                return 0;
-            }
+            writer.writeUInt32BE(static_cast<uint32_t>(value.size()));
+            size += 4;
 
-            size += ret;
+            uint32_t ret;
 
             for (const auto& i : value)
             {
-                ret = writeString(buffer, i.first);
+                ret = writeString(writer, i.first);
 
                 if (ret == 0)
                 {
@@ -697,7 +673,7 @@ namespace relay
 
                 size += ret;
 
-                ret = i.second.encode(amf::Version::AMF0, buffer);
+                ret = i.second.encode(amf::Version::AMF0, writer);
 
                 if (ret == 0)
                 {
@@ -707,7 +683,7 @@ namespace relay
                 size += ret;
             }
 
-            if ((ret = writeString(buffer, "")) == 0)
+            if ((ret = writeString(writer, "")) == 0)
             {
                 return 0;
             }
@@ -715,71 +691,55 @@ namespace relay
             size += ret;
 
             AMF0Marker marker = AMF0Marker::ObjectEnd;
-            buffer.push_back(static_cast<uint8_t>(marker));
-            
+            writer.writeUInt8(static_cast<uint8_t>(marker));
+
             size += 1;
 
             return size;
         }
 
         // AMF3
-        static uint32_t writeDictionary(std::vector<uint8_t>& buffer, const std::map<std::string, Node>& value)
+        static uint32_t writeECMAArrayAMF3(ByteWriter& writer, EncodeTables& tables, const Node::Map& value)
         {
-            uint32_t size = 0;
-
-            uint32_t ret = encodeU29(buffer, static_cast<uint32_t>(value.size()) << 1 | 1); // add the low bit (dictionary literal marker)
+            size_t originalSize = writer.getSize();
 
-            if (ret == 0)
-            {
-                return 0;
-            }
-
-            size += ret;
-
-            buffer.push_back(0x00); // not using weakly-referenced keys
-            size += 1;
+            writer.writeU29(0x01); // array literal without a dense part
 
             for (const auto& i : value)
             {
-                ret = writeStringAMF3(buffer, i.first);
-
-                if (ret == 0)
+                // an empty key would terminate the associative part
+                if (i.first.empty())
                 {
                     return 0;
                 }
 
-                size += ret;
-
-                ret = i.second.encode(amf::Version::AMF3, buffer);
-
-                if (ret == 0)
+                if (writeStringAMF3(writer, tables, i.first) == 0)
                 {
                     return 0;
                 }
 
-                size += ret;
+                if (i.second.encode(amf::Version::AMF3, writer, tables) == 0)
+                {
+                    return 0;
+                }
             }
-            
-            return size;
+
+            writeStringAMF3(writer, tables, "");
+
+            return static_cast<uint32_t>(writer.getSize() - originalSize);
         }
 
         // AMF0
-        static uint32_t writeStrictArray(std::vector<uint8_t>& buffer, const std::vector<Node>& value)
+        static uint32_t writeStrictArray(ByteWriter& writer, const Node::Vector& value)
         {
             uint32_t size = 0;
 
-            uint32_t ret = encodeIntBE(buffer, 4, value.size());
-
-            if (ret == 0)
-            {
-                return 0;
-            }
-
-            size += ret;
+            writer.writeUInt32BE(static_cast<uint32_t>(value.size()));
+            size += 4;
 
             for (const auto& i : value)
             {
-                ret = i.encode(amf::Version::AMF0, buffer);
+                uint32_t ret = i.encode(amf::Version::AMF0, writer);
 
                 if (ret == 0)
                 {
@@ -793,185 +753,140 @@ namespace relay
         }
 
         // AMF3
-        static uint32_t writeStrictArrayAMF3(std::vector<uint8_t>& buffer, const std::vector<Node>& value)
+        static uint32_t writeArrayAMF3(ByteWriter& writer, EncodeTables& tables, const Node::Vector& value)
         {
-            uint32_t size = 0;
+            size_t originalSize = writer.getSize();
 
-            uint32_t ret = encodeIntBE(buffer, 4, value.size());
-
-            if (ret == 0)
+            if (!writer.writeU29(static_cast<uint32_t>(value.size()) << 1 | 1)) // add the low bit (array literal marker)
             {
                 return 0;
             }
 
-            size += ret;
+            writeStringAMF3(writer, tables, ""); // no associative part
 
             for (const auto& i : value)
             {
-                ret = i.encode(amf::Version::AMF0, buffer);
-
-                if (ret == 0)
+                if (i.encode(amf::Version::AMF3, writer, tables) == 0)
                 {
                     return 0;
                 }
-
-                size += ret;
             }
-            
-            return size;
+
+            return static_cast<uint32_t>(writer.getSize() - originalSize);
         }
 
         // AMF0
-        static uint32_t writeDate(std::vector<uint8_t>& buffer, double ms, uint32_t timezone)
+        static uint32_t writeDate(ByteWriter& writer, double ms, uint32_t timezone)
         {
-            uint32_t size = 0;
-
-            uint32_t ret = encodeDouble(buffer, ms);
-
-            if (ret == 0) // date in milliseconds from 01/01/1970
-            {
-                return 0;
-            }
-
-            size += ret;
+            writer.writeDouble(ms); // date in milliseconds from 01/01/1970
+            writer.writeUInt32BE(timezone);
 
-            ret = encodeIntBE(buffer, 4, timezone);
-
-            if (ret == 0) // unsupported timezone
-            {
-                return 0;
-            }
+            return 8 + 4;
+        }
 
-            size += ret;
+        // AMF3
+        static uint32_t writeDateAMF3(ByteWriter& writer, double ms)
+        {
+            writer.writeU29(1); // date literal
+            writer.writeDouble(ms); // date in milliseconds from 01/01/1970
 
-            return size;
+            return 1 + 8;
         }
 
         // AMF3
-        static uint32_t writeDateAMF3(std::vector<uint8_t>& buffer, double ms)
+        static uint32_t writeXMLDocumentAMF3(ByteWriter& writer, const std::string& value)
         {
-            uint32_t size = 0;
+            size_t originalSize = writer.getSize();
 
-            uint32_t ret = encodeU29(buffer, 1);
-
-            if (ret == 0) // date in milliseconds from 01/01/1970
+            // XML goes to the object table, not the string table, so it is always written as a literal
+            if (!writer.writeU29(static_cast<uint32_t>(value.size()) << 1 | 1))
             {
                 return 0;
             }
 
-            ret = encodeDouble(buffer, ms);
-
-            if (ret == 0) // date in milliseconds from 01/01/1970
-            {
-                return 0;
-            }
+            writer.writeBytes(value.data(), value.size());
 
-            size += ret;
-            
-            return size;
+            return static_cast<uint32_t>(writer.getSize() - originalSize);
         }
 
         // AMF0
-        static uint32_t writeLongString(std::vector<uint8_t>& buffer, const std::string& value)
+        static uint32_t writeLongString(ByteWriter& writer, const std::string& value)
         {
-            uint32_t ret = encodeIntBE(buffer, 4, value.size());
-
-            if (ret == 0)
-            {
-                return 0;
-            }
-
-            uint32_t size = ret;
+            writer.writeUInt32BE(static_cast<uint32_t>(value.size()));
+            writer.writeBytes(value.data(), value.size());
 
-            buffer.insert(buffer.end(),
-                          reinterpret_cast<const uint8_t*>(value.data()),
-                          reinterpret_cast<const uint8_t*>(value.data()) + value.length());
-            size += static_cast<uint32_t>(value.length());
-
-            return size;
+            return 4 + static_cast<uint32_t>(value.size());
         }
 
         // AMF0
-        static uint32_t writeXMLDocument(std::vector<uint8_t>& buffer, const std::string& value)
+        static uint32_t writeXMLDocument(ByteWriter& writer, const std::string& value)
         {
-            uint32_t ret = encodeIntBE(buffer, 4, value.size());
+            return writeLongString(writer, value);
+        }
 
-            if (ret == 0)
-            {
-                return 0;
-            }
+        // AMF0
+        static uint32_t writeTypedObject(ByteWriter& /* writer */)
+        {
+            RELAY_LOG(Log::Level::ERR) << "Typed objects are not supported";
 
-            uint32_t size = ret;
+            return 0;
+        }
 
-            for (char i : value)
-            {
-                buffer.push_back(static_cast<uint8_t>(i));
-                size += 1;
-            }
+        uint32_t Node::decode(Version version, const std::vector<uint8_t>& buffer, uint32_t offset)
+        {
+            ByteReader reader(buffer, offset);
 
-            return size;
+            return decode(version, reader);
         }
 
-        // AMF0
-        static uint32_t writeTypedObject(std::vector<uint8_t>& /* buffer */)
+        uint32_t Node::decode(Version version, ByteReader& reader)
         {
-            Log(Log::Level::ERR) << "Typed objects are not supported";
+            DecodeTables tables;
 
-            return 0;
+            return decode(version, reader, tables);
         }
 
-        uint32_t Node::decode(Version version, const std::vector<uint8_t>& buffer, uint32_t offset)
+        uint32_t Node::decode(Version version, ByteReader& reader, DecodeTables& tables)
         {
-            uint32_t originalOffset = offset;
+            size_t originalOffset = reader.getOffset();
 
-            if (version == Version::AMF0)
+            uint8_t markerData;
+
+            if (!reader.readUInt8(markerData))
             {
-                if (buffer.size() - offset < 1)
-                {
-                    return 0;
-                }
+                return 0;
+            }
 
-                AMF0Marker marker = *reinterpret_cast<const AMF0Marker*>(buffer.data() + offset);
-                offset += 1;
+            bool result = true;
 
-                uint32_t ret = 0;
+            if (version == Version::AMF0)
+            {
+                AMF0Marker marker = static_cast<AMF0Marker>(markerData);
 
                 switch (marker)
                 {
                     case AMF0Marker::Number:
                     {
                         type = Type::Double;
-                        if ((ret = readNumber(buffer, offset, doubleValue)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readNumber(reader, doubleValue);
                         break;
                     }
                     case AMF0Marker::Boolean:
                     {
                         type = Type::Boolean;
-                        if ((ret = readBoolean(buffer, offset, boolValue)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readBoolean(reader, boolValue);
                         break;
                     }
                     case AMF0Marker::String:
                     {
                         type = Type::String;
-                        if ((ret = readString(buffer, offset, stringValue)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readString(reader, stringValue);
                         break;
                     }
                     case AMF0Marker::Object:
                     {
                         type = Type::Object;
-                        if ((ret = readObject(buffer, offset, mapValue)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readObject(reader, mapValue);
                         break;
                     }
                     case AMF0Marker::Null: type = Type::Null; break;
@@ -979,74 +894,51 @@ namespace relay
                     case AMF0Marker::ECMAArray:
                     {
                         type = Type::Dictionary;
-                        if ((ret = readECMAArray(buffer, offset, mapValue)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readECMAArray(reader, mapValue);
                         break;
                     }
                     case AMF0Marker::ObjectEnd: break; // should not happen
                     case AMF0Marker::StrictArray:
                     {
                         type = Type::Array;
-                        if ((ret = readStrictArray(buffer, offset, vectorValue)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readStrictArray(reader, vectorValue);
                         break;
                     }
                     case AMF0Marker::Date:
                     {
                         type = Type::Date;
-                        if ((ret = readDate(buffer, offset, doubleValue, timezone)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readDate(reader, doubleValue, timezone);
                         break;
                     }
                     case AMF0Marker::LongString:
                     {
                         type = Type::String;
-                        if ((ret = readLongString(buffer, offset, stringValue)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readLongString(reader, stringValue);
                         break;
                     }
                     case AMF0Marker::XMLDocument:
                     {
                         type = Type::XMLDocument;
-                        if ((ret = readLongString(buffer, offset, stringValue)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readLongString(reader, stringValue);
                         break;
                     }
                     case AMF0Marker::TypedObject:
                     {
                         type = Type::TypedObject;
-                        if ((ret = readTypedObject(buffer, offset)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readTypedObject(reader);
                         break;
                     }
                     case AMF0Marker::SwitchToAMF3:
                     {
-                        ret += decode(Version::AMF3, buffer, offset);
+                        result = decode(Version::AMF3, reader) != 0;
                         break;
                     }
-                    default: return 0;
+                    default: result = false; break;
                 }
-
-                offset += ret;
             }
             else if (version == Version::AMF3)
             {
-                AMF3Marker marker = *reinterpret_cast<const AMF3Marker*>(buffer.data() + offset);
-                offset += 1;
-
-                uint32_t ret = 0;
+                AMF3Marker marker = static_cast<AMF3Marker>(markerData);
 
                 switch (marker)
                 {
@@ -1066,85 +958,129 @@ namespace relay
                         break;
                     case AMF3Marker::Integer:
                         type = Type::Integer;
-                        if ((ret = readInteger(buffer, offset, intValue)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readInteger(reader, intValue);
                         break;
                     case AMF3Marker::Double:
                         type = Type::Double;
-                        if ((ret = readNumber(buffer, offset, doubleValue)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readNumber(reader, doubleValue);
                         break;
                     case AMF3Marker::String:
                         type = Type::String;
-                        if ((ret = readStringAMF3(buffer, offset, stringValue)) == 0)
-                        {
-                            return 0;
-                        }
+                        result = readStringAMF3(reader, tables, stringValue);
                         break;
                     case AMF3Marker::XMLDocument:
-                        type = Type::XMLDocument;
-                        if ((ret = readStringAMF3(buffer, offset, stringValue)) == 0)
-                        {
-                            return 0;
-                        }
-                        break;
                     case AMF3Marker::Date:
-                        type = Type::Date;
-                        if ((ret = readDateAMF3(buffer, offset, doubleValue)) == 0)
+                    case AMF3Marker::Array:
+                    case AMF3Marker::Object:
+                    case AMF3Marker::XML:
+                    case AMF3Marker::Dictionary:
+                    {
+                        uint32_t header;
+
+                        if (!reader.readU29(header))
                         {
-                            return 0;
+                            result = false;
+                            break;
                         }
-                        timezone = 0;
-                        break;
-                    case AMF3Marker::Array:
-                        type = Type::Array;
-                        if ((ret = readStrictArrayAMF3(buffer, offset, vectorValue)) == 0)
+
+                        if ((header & 0x01) == 0) // object reference
                         {
-                            return 0;
+                            uint32_t index = header >> 1;
+
+                            // objects that are still being decoded (cyclic references) can not be represented
+                            if (index >= tables.objects.size() ||
+                                !tables.objects[index].complete)
+                            {
+                                result = false;
+                                break;
+                            }
+
+                            // decode the object again with the tables as they were when it was first read
+                            const DecodeTables::ObjectEntry& entry = tables.objects[index];
+                            DecodeTables referenceTables;
+                            referenceTables.strings.assign(tables.strings.begin(), tables.strings.begin() + entry.stringCount);
+                            referenceTables.traits.assign(tables.traits.begin(), tables.traits.begin() + entry.traitsCount);
+                            referenceTables.objects.assign(tables.objects.begin(), tables.objects.begin() + entry.objectCount);
+
+                            size_t offset = reader.getOffset();
+                            reader.setOffset(entry.offset);
+                            result = decode(Version::AMF3, reader, referenceTables) != 0;
+                            reader.setOffset(offset);
+                            break;
                         }
-                        break;
-                    case AMF3Marker::Object:
-                        type = Type::Object;
-                        if ((ret = readObjectAMF3(buffer, offset, mapValue)) == 0)
+
+                        // the index is taken before the members are decoded
+                        size_t index = tables.objects.size();
+                        DecodeTables::ObjectEntry entry = {originalOffset, tables.strings.size(), tables.traits.size(), index, false};
+                        tables.objects.push_back(entry);
+
+                        switch (marker)
                         {
-                            return 0;
+                            case AMF3Marker::XMLDocument:
+                            case AMF3Marker::XML:
+                                type = Type::XMLDocument;
+                                result = reader.readString(header >> 1, stringValue);
+                                break;
+                            case AMF3Marker::Date:
+                                type = Type::Date;
+                                result = readDateAMF3(reader, doubleValue);
+                                timezone = 0;
+                                break;
+                            case AMF3Marker::Array:
+                                result = readArrayAMF3(reader, tables, header, type, vectorValue, mapValue);
+                                break;
+                            case AMF3Marker::Object:
+                                type = Type::Object;
+                                result = readObjectAMF3(reader, tables, header, mapValue);
+                                break;
+                            case AMF3Marker::Dictionary:
+                                type = Type::Dictionary;
+                                result = readDictionary(reader, tables, header, mapValue);
+                                break;
+                            default: break;
                         }
-                        break;
-                    case AMF3Marker::XML:
-                        type = Type::XMLDocument;
-                        if ((ret = readStringAMF3(buffer, offset, stringValue)) == 0)
+
+                        if (result)
                         {
-                            return 0;
+                            tables.objects[index].complete = true;
                         }
                         break;
+                    }
                     case AMF3Marker::ByteArray:
-                        break;
                     case AMF3Marker::VectorInt:
-                        break;
                     case AMF3Marker::VectorDouble:
-                        break;
                     case AMF3Marker::VectorObject:
+                        RELAY_LOG(Log::Level::ERR) << "AMF3 byte arrays and vectors are not supported";
+                        result = false;
                         break;
-                    case AMF3Marker::Dictionary:
-                        type = Type::Dictionary;
-                        if ((ret = readDictionary(buffer, offset, mapValue)) == 0)
-                        {
-                            return 0;
-                        }
-                        break;
+                    default: result = false; break;
                 }
+            }
 
-                offset += ret;
+            if (!result)
+            {
+                reader.setOffset(originalOffset);
+                return 0;
             }
 
-            return offset - originalOffset;
+            return static_cast<uint32_t>(reader.getOffset() - originalOffset);
         }
 
         uint32_t Node::encode(Version version, std::vector<uint8_t>& buffer) const
+        {
+            ByteWriter writer(buffer);
+
+            return encode(version, writer);
+        }
+
+        uint32_t Node::encode(Version version, ByteWriter& writer) const
+        {
+            EncodeTables tables;
+
+            return encode(version, writer, tables);
+        }
+
+        uint32_t Node::encode(Version version, ByteWriter& writer, EncodeTables& tables) const
         {
             uint32_t size = 0;
 
@@ -1175,7 +1111,7 @@ namespace relay
                     default: return 0;
                 }
 
-                buffer.push_back(static_cast<uint8_t>(marker));
+                writer.writeUInt8(static_cast<uint8_t>(marker));
                 size += 1;
 
                 uint32_t ret = 0;
@@ -1186,60 +1122,60 @@ namespace relay
                     case Type::Null: break;
                     case Type::Integer:
                     {
-                        ret = writeNumber(buffer, static_cast<double>(intValue));
+                        ret = writeNumber(writer, static_cast<double>(intValue));
                         break;
                     }
                     case Type::Double:
                     {
-                        ret = writeNumber(buffer, doubleValue);
+                        ret = writeNumber(writer, doubleValue);
                         break;
                     }
                     case Type::Boolean:
                     {
-                        ret = writeBoolean(buffer, boolValue);
+                        ret = writeBoolean(writer, boolValue);
                         break;
                     }
                     case Type::String:
                     {
                         if (stringValue.length() <= std::numeric_limits<uint16_t>::max())
                         {
-                            ret = writeString(buffer, stringValue); break;
+                            ret = writeString(writer, stringValue); break;
                         }
                         else
                         {
-                            ret = writeLongString(buffer, stringValue); break;
+                            ret = writeLongString(writer, stringValue); break;
                         }
                         break;
                     }
                     case Type::Object:
                     {
-                        ret = writeObject(buffer, mapValue);
+                        ret = writeObject(writer, mapValue);
                         break;
                     }
                     case Type::Undefined: break;
                     case Type::Dictionary:
                     {
-                        ret = writeECMAArray(buffer, mapValue);
+                        ret = writeECMAArray(writer, mapValue);
                         break;
                     }
                     case Type::Array:
                     {
-                        ret = writeStrictArray(buffer, vectorValue);
+                        ret = writeStrictArray(writer, vectorValue);
                         break;
                     }
                     case Type::Date:
                     {
-                        ret = writeDate(buffer, doubleValue, timezone);
+                        ret = writeDate(writer, doubleValue, timezone);
                         break;
                     }
                     case Type::XMLDocument:
                     {
-                        ret = writeXMLDocument(buffer, stringValue);
+                        ret = writeXMLDocument(writer, stringValue);
                         break;
                     }
                     case Type::TypedObject:
                     {
-                        ret = writeTypedObject(buffer);
+                        ret = writeTypedObject(writer);
                         break;
                     }
                     case Type::SwitchToAMF3: break;
@@ -1255,13 +1191,18 @@ namespace relay
                 {
                     case Type::Unknown: return 0; // should not happen
                     case Type::Null: marker = AMF3Marker::Null; break;
-                    case Type::Integer: marker = AMF3Marker::Integer; break;
+                    case Type::Integer:
+                    {
+                        // integers are 29-bit signed, larger values are sent as doubles
+                        marker = (intValue >= -0x10000000 && intValue <= 0x0FFFFFFF) ? AMF3Marker::Integer : AMF3Marker::Double;
+                        break;
+                    }
                     case Type::Double: marker = AMF3Marker::Double; break;
                     case Type::Boolean: marker = (boolValue) ? AMF3Marker::True : AMF3Marker::False; break;
                     case Type::String: marker = AMF3Marker::String; break;
                     case Type::Object: marker = AMF3Marker::Object; break;
                     case Type::Undefined: marker = AMF3Marker::Undefined; break;
-                    case Type::Dictionary: marker = AMF3Marker::Dictionary; break;
+                    case Type::Dictionary: marker = AMF3Marker::Array; break; // associative array, like AMF0 ECMA arrays
                     case Type::Array: marker = AMF3Marker::Array; break;
                     case Type::Date: marker = AMF3Marker::Date; break;
                     case Type::XMLDocument: marker = AMF3Marker::XMLDocument; break;
@@ -1270,7 +1211,7 @@ namespace relay
                     default: return 0;
                 }
 
-                buffer.push_back(static_cast<uint8_t>(marker));
+                writer.writeUInt8(static_cast<uint8_t>(marker));
                 size += 1;
 
                 uint32_t ret = 0;
@@ -1281,44 +1222,51 @@ namespace relay
                     case Type::Null: break;
                     case Type::Integer:
                     {
-                        ret = writeInteger(buffer, intValue);
+                        if (marker == AMF3Marker::Integer)
+                        {
+                            ret = writeInteger(writer, intValue);
+                        }
+                        else
+                        {
+                            ret = writeNumber(writer, static_cast<double>(intValue));
+                        }
                         break;
                     }
                     case Type::Double:
                     {
-                        ret = writeNumber(buffer, doubleValue);
+                        ret = writeNumber(writer, doubleValue);
                         break;
                     }
                     case Type::Boolean: break;
                     case Type::String:
                     {
-                        ret = writeStringAMF3(buffer, stringValue);
+                        ret = writeStringAMF3(writer, tables, stringValue);
                         break;
                     }
                     case Type::Object:
                     {
-                        ret = writeObjectAMF3(buffer, mapValue);
+                        ret = writeObjectAMF3(writer, tables, mapValue);
                         break;
                     }
                     case Type::Undefined: break;
                     case Type::Dictionary:
                     {
-                        ret = writeDictionary(buffer, mapValue);
+                        ret = writeECMAArrayAMF3(writer, tables, mapValue);
                         break;
                     }
                     case Type::Array:
                     {
-                        ret = writeStrictArrayAMF3(buffer, vectorValue);
+                        ret = writeArrayAMF3(writer, tables, vectorValue);
                         break;
                     }
                     case Type::Date:
                     {
-                        ret = writeDateAMF3(buffer, doubleValue);
+                        ret = writeDateAMF3(writer, doubleValue);
                         break;
                     }
                     case Type::XMLDocument:
                     {
-                        ret = writeStringAMF3(buffer, stringValue);
+                        ret = writeXMLDocumentAMF3(writer, stringValue);
                         break;
                     }
                     case Type::TypedObject:
@@ -1329,9 +1277,6 @@ namespace relay
                 }
 
                 size += ret;
-
-                Log(Log::Level::ERR) << "AMF3 not supported";
-                return 0;
             }
 
             return size;
@@ -1385,5 +1330,185 @@ namespace relay
                 }
             }
         }
+
+        // AMF0
+        static bool skipValue(ByteReader& reader);
+
+        static bool skipProperties(ByteReader& reader)
+        {
+            while (true)
+            {
+                uint16_t length;
+
+                if (!reader.readUInt16BE(length) || !reader.skip(length))
+                {
+                    return false;
+                }
+
+                uint8_t marker;
+
+                if (!reader.peekUInt8(marker))
+                {
+                    return false;
+                }
+
+                if (static_cast<AMF0Marker>(marker) == AMF0Marker::ObjectEnd)
+                {
+                    return reader.skip(1);
+                }
+
+                if (!skipValue(reader))
+                {
+                    return false;
+                }
+            }
+        }
+
+        static bool skipValue(ByteReader& reader)
+        {
+            uint8_t marker;
+
+            if (!reader.readUInt8(marker))
+            {
+                return false;
+            }
+
+            switch (static_cast<AMF0Marker>(marker))
+            {
+                case AMF0Marker::Number: return reader.skip(8);
+                case AMF0Marker::Boolean: return reader.skip(1);
+                case AMF0Marker::String:
+                {
+                    uint16_t length;
+                    return reader.readUInt16BE(length) && reader.skip(length);
+                }
+                case AMF0Marker::Object: return skipProperties(reader);
+                case AMF0Marker::Null: return true;
+                case AMF0Marker::Undefined: return true;
+                case AMF0Marker::ECMAArray: return reader.skip(4) && skipProperties(reader);
+                case AMF0Marker::StrictArray:
+                {
+                    uint32_t count;
+
+                    if (!reader.readUInt32BE(count))
+                    {
+                        return false;
+                    }
+
+                    for (uint32_t i = 0; i < count; ++i)
+                    {
+                        if (!skipValue(reader))
+                        {
+                            return false;
+                        }
+                    }
+
+                    return true;
+                }
+                case AMF0Marker::Date: return reader.skip(8 + 4);
+                case AMF0Marker::LongString:
+                case AMF0Marker::XMLDocument:
+                {
+                    uint32_t length;
+                    return reader.readUInt32BE(length) && reader.skip(length);
+                }
+                case AMF0Marker::TypedObject:
+                {
+                    uint16_t length;
+                    return reader.readUInt16BE(length) && reader.skip(length) && skipProperties(reader);
+                }
+                case AMF0Marker::SwitchToAMF3:
+                {
+                    // AMF3 values can refer back to earlier strings and traits, so their length is only known after decoding
+                    Node node;
+                    return node.decode(Version::AMF3, reader) != 0;
+                }
+                default: return false;
+            }
+        }
+
+        bool View::read(ByteReader& reader, View& view)
+        {
+            size_t originalOffset = reader.getOffset();
+
+            if (!skipValue(reader))
+            {
+                reader.setOffset(originalOffset);
+                return false;
+            }
+
+            view = View(reader.getData() + originalOffset, reader.getOffset() - originalOffset);
+
+            return true;
+        }
+
+        bool View::equals(const char* str) const
+        {
+            if (!isString()) return false;
+
+            ByteReader reader(data, size, 1);
+            uint32_t length;
+
+            if (getMarker() == AMF0Marker::String)
+            {
+                uint16_t shortLength;
+                if (!reader.readUInt16BE(shortLength)) return false;
+                length = shortLength;
+            }
+            else
+            {
+                if (!reader.readUInt32BE(length)) return false;
+            }
+
+            return strlen(str) == length &&
+                memcmp(reader.getCurrent(), str, length) == 0;
+        }
+
+        bool View::getElement(const char* key, View& result) const
+        {
+            if (!isMap() || isAMF3Map()) return false;
+
+            ByteReader reader(data, size, (getMarker() == AMF0Marker::ECMAArray) ? 1 + 4 : 1);
+            size_t keyLength = strlen(key);
+
+            while (true)
+            {
+                uint16_t length;
+                const uint8_t* name;
+
+                if (!reader.readUInt16BE(length) || !reader.readBytes(length, name))
+                {
+                    return false;
+                }
+
+                uint8_t marker;
+
+                if (!reader.peekUInt8(marker) ||
+                    static_cast<AMF0Marker>(marker) == AMF0Marker::ObjectEnd)
+                {
+                    return false;
+                }
+
+                View value;
+
+                if (!read(reader, value))
+                {
+                    return false;
+                }
+
+                if (length == keyLength && memcmp(name, key, length) == 0)
+                {
+                    result = value;
+                    return true;
+                }
+            }
+        }
+
+        bool View::toNode(Node& node) const
+        {
+            ByteReader reader(data, size);
+
+            return node.decode(Version::AMF0, reader) == size;
+        }
     }
 }
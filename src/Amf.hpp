@@ -9,6 +9,9 @@
 #include <limits>
 #include <vector>
 #include <map>
+#include <string>
+#include "Arena.hpp"
+#include "ByteStream.hpp"
 #include "Log.hpp"
 
 namespace relay
@@ -60,6 +63,9 @@ namespace relay
             Dictionary = 0x11
         };
 
+        struct DecodeTables;
+        struct EncodeTables;
+
         class Node
         {
         public:
@@ -81,13 +87,20 @@ namespace relay
                 SwitchToAMF3
             };
 
+            typedef ArenaAllocator<Node> Allocator;
+            typedef std::vector<Node, Allocator> Vector;
+            typedef std::map<std::string, Node, std::less<std::string>, ArenaAllocator<std::pair<const std::string, Node>>> Map;
+
             Node() {}
+            // child nodes decoded into this node are allocated with the given allocator,
+            // copies of the node always use the heap
+            explicit Node(const Allocator& allocator): vectorValue(allocator), mapValue(allocator) {}
             Node(Type aType): type(aType) {}
             Node(int32_t value): type(Type::Integer), intValue(value) {}
             Node(double value): type(Type::Double), doubleValue(value) {}
             Node(bool value): type(Type::Boolean), boolValue(value) {}
-            Node(const std::vector<Node>& value): type(Type::Array), vectorValue(value) {}
-            Node(const std::map<std::string, Node>& value): type(Type::Object), mapValue(value) {}
+            Node(const std::vector<Node>& value): type(Type::Array), vectorValue(value.begin(), value.end()) {}
+            Node(const std::map<std::string, Node>& value): type(Type::Object), mapValue(value.begin(), value.end()) {}
             Node(const std::string& value): type(Type::String), stringValue(value) {}
 
             Node(double ms, uint32_t aTimezone): type(Type::Date), doubleValue(ms), timezone(aTimezone) {}
@@ -162,21 +175,27 @@ namespace relay
             Node& operator=(const std::vector<Node>& value)
             {
                 type = Type::Array;
-                vectorValue = value;
+                vectorValue.assign(value.begin(), value.end());
                 return *this;
             }
 
             Node& operator=(const std::map<std::string, Node>& value)
             {
                 type = Type::Object;
-                mapValue = value;
+                mapValue.clear();
+                mapValue.insert(value.begin(), value.end());
                 return *this;
             }
 
             Type getType() const { return type; }
 
+            // each call without tables starts with empty AMF3 reference tables
             uint32_t decode(Version version, const std::vector<uint8_t>& buffer, uint32_t offset = 0);
+            uint32_t decode(Version version, ByteReader& reader);
+            uint32_t decode(Version version, ByteReader& reader, DecodeTables& tables);
             uint32_t encode(Version version, std::vector<uint8_t>& buffer) const;
+            uint32_t encode(Version version, ByteWriter& writer) const;
+            uint32_t encode(Version version, ByteWriter& writer, EncodeTables& tables) const;
 
             double asDouble() const
             {
@@ -258,14 +277,14 @@ namespace relay
                 return type == Type::String;
             }
 
-            const std::vector<Node>& asVector() const
+            const Vector& asVector() const
             {
                 assert(type == Type::Array);
 
                 return vectorValue;
             }
             
-            const std::map<std::string, Node>& asMap() const
+            const Map& asMap() const
             {
                 assert(type == Type::Object || type == Type::Dictionary);
 
@@ -389,8 +408,98 @@ namespace relay
             };
             uint32_t timezone;
             std::string stringValue;
-            std::vector<Node> vectorValue;
-            std::map<std::string, Node> mapValue;
+            Vector vectorValue;
+            Map mapValue;
+        };
+
+        struct Traits
+        {
+            std::string className;
+            std::vector<std::string> memberNames; // sealed members
+            bool dynamic = false;
+        };
+
+        // AMF3 reference tables, shared by all the values nested in one top-level value
+        struct DecodeTables
+        {
+            // where an object was encoded, references to it decode it again instead of keeping a copy of every object
+            struct ObjectEntry
+            {
+                size_t offset; // of the marker
+                size_t stringCount; // sizes of the tables before the object was decoded
+                size_t traitsCount;
+                size_t objectCount;
+                bool complete; // false while the object's members are decoded (cyclic references)
+            };
+
+            std::vector<std::string> strings;
+            std::vector<ObjectEntry> objects; // objects, arrays, dictionaries, dates and XML
+            std::vector<Traits> traits;
+        };
+
+        struct EncodeTables
+        {
+            std::map<std::string, uint32_t> strings;
+            // all objects are written as anonymous dynamic objects, so they share the first traits entry
+            bool traitsWritten = false;
+        };
+
+        // non-owning view of an encoded AMF0 value, nothing is allocated until toNode is called
+        // (values switched to AMF3 are decoded once to find their end)
+        class View
+        {
+        public:
+            View() {}
+            View(const uint8_t* aData, size_t aSize): data(aData), size(aSize) {}
+
+            // reads the next value and advances the reader past it
+            static bool read(ByteReader& reader, View& view);
+
+            bool isValid() const { return size > 0; }
+            const uint8_t* getData() const { return data; }
+            size_t getSize() const { return size; }
+
+            AMF0Marker getMarker() const
+            {
+                assert(size > 0);
+
+                return static_cast<AMF0Marker>(data[0]);
+            }
+
+            bool isString() const
+            {
+                return size > 0 &&
+                    (getMarker() == AMF0Marker::String ||
+                     getMarker() == AMF0Marker::LongString);
+            }
+
+            bool isMap() const
+            {
+                return size > 0 &&
+                    (getMarker() == AMF0Marker::Object ||
+                     getMarker() == AMF0Marker::ECMAArray ||
+                     isAMF3Map());
+            }
+
+            // AMF3 object or associative array, can only be read with toNode
+            bool isAMF3Map() const
+            {
+                return size > 1 &&
+                    getMarker() == AMF0Marker::SwitchToAMF3 &&
+                    (static_cast<AMF3Marker>(data[1]) == AMF3Marker::Object ||
+                     static_cast<AMF3Marker>(data[1]) == AMF3Marker::Array ||
+                     static_cast<AMF3Marker>(data[1]) == AMF3Marker::Dictionary);
+            }
+
+            // compares a string value without copying it
+            bool equals(const char* str) const;
+            // looks up a property of an AMF0 object or ECMA array
+            bool getElement(const char* key, View& result) const;
+            bool toNode(Node& node) const;
+
+        private:
+            const uint8_t* data = nullptr;
+            size_t size = 0;
         };
     }
 }
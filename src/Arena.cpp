@@ -0,0 +1,101 @@
+//
+//  rtmp_relay
+//
+
+#include <algorithm>
+#include "Arena.hpp"
+
+namespace relay
+{
+    Arena::Arena(size_t aBlockSize, size_t aMaxRetainedSize):
+        initialBlockSize(aBlockSize), maxRetainedSize(std::max(aBlockSize, aMaxRetainedSize)), blockSize(aBlockSize)
+    {
+    }
+
+    Arena::~Arena()
+    {
+        freeBlocks();
+    }
+
+    void* Arena::allocate(size_t size, size_t alignment)
+    {
+        for (;;)
+        {
+            if (current)
+            {
+                uintptr_t address = (reinterpret_cast<uintptr_t>(current) + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+
+                if (address + size <= reinterpret_cast<uintptr_t>(end))
+                {
+                    uint8_t* result = reinterpret_cast<uint8_t*>(address);
+                    usedSize += static_cast<size_t>(result + size - current);
+                    current = result + size;
+                    ++allocationCount;
+
+                    return result;
+                }
+            }
+
+            addBlock(size + alignment);
+        }
+    }
+
+    void Arena::reset()
+    {
+        if (!blocks) return;
+
+        if (blocks->next || blocks->size > maxRetainedSize)
+        {
+            // more than one block was needed, replace them with a single block that fits everything,
+            // unless that would keep a single oversized message's memory around for good
+            size_t totalSize = std::max(blockSize, usedSize + sizeof(Block));
+
+            freeBlocks();
+
+            if (totalSize <= maxRetainedSize)
+            {
+                blockSize = totalSize;
+                addBlock(0);
+            }
+            else
+            {
+                blockSize = initialBlockSize;
+            }
+        }
+        else
+        {
+            current = reinterpret_cast<uint8_t*>(blocks + 1);
+        }
+
+        usedSize = 0;
+    }
+
+    void Arena::addBlock(size_t minimumSize)
+    {
+        size_t newSize = std::max(blockSize, minimumSize + sizeof(Block));
+
+        Block* block = static_cast<Block*>(::operator new(newSize));
+        block->next = blocks;
+        block->size = newSize;
+        blocks = block;
+        size += newSize;
+        ++blockCount;
+
+        current = reinterpret_cast<uint8_t*>(block + 1);
+        end = reinterpret_cast<uint8_t*>(block) + newSize;
+    }
+
+    void Arena::freeBlocks()
+    {
+        while (blocks)
+        {
+            Block* next = blocks->next;
+            ::operator delete(blocks);
+            blocks = next;
+        }
+
+        current = nullptr;
+        end = nullptr;
+        size = 0;
+    }
+}
@@ -0,0 +1,127 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+namespace relay
+{
+    // monotonic allocator, memory is only released all at once by reset
+    class Arena
+    {
+    public:
+        // blocks merged to a size above maxRetainedSize are freed by reset instead of being kept
+        explicit Arena(size_t aBlockSize = 4096, size_t aMaxRetainedSize = 65536);
+        ~Arena();
+
+        Arena(const Arena&) = delete;
+        Arena(Arena&&) = delete;
+        Arena& operator=(const Arena&) = delete;
+        Arena& operator=(Arena&&) = delete;
+
+        void* allocate(size_t size, size_t alignment);
+        // everything allocated since the last reset must be destroyed before calling this
+        void reset();
+
+        uint64_t getAllocationCount() const { return allocationCount; }
+        uint64_t getBlockCount() const { return blockCount; }
+        // bytes of all the blocks currently held
+        size_t getSize() const { return size; }
+
+        // resets the arena when going out of scope, declare it before the objects using the arena
+        class Scope
+        {
+        public:
+            explicit Scope(Arena& aArena): arena(aArena) {}
+            ~Scope() { arena.reset(); }
+
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            Arena& arena;
+        };
+
+    private:
+        struct Block
+        {
+            Block* next;
+            size_t size;
+        };
+
+        void addBlock(size_t minimumSize);
+        void freeBlocks();
+
+        size_t initialBlockSize;
+        size_t maxRetainedSize;
+        size_t blockSize;
+        size_t size = 0;
+        Block* blocks = nullptr;
+        uint8_t* current = nullptr;
+        uint8_t* end = nullptr;
+        size_t usedSize = 0; // bytes taken from the blocks since the last reset
+
+        uint64_t allocationCount = 0;
+        uint64_t blockCount = 0;
+    };
+
+    // allocates from an arena if one is set and from the heap otherwise
+    template<class T>
+    class ArenaAllocator
+    {
+    public:
+        typedef T value_type;
+        typedef std::false_type propagate_on_container_copy_assignment;
+        typedef std::false_type propagate_on_container_move_assignment;
+        typedef std::false_type propagate_on_container_swap;
+
+        ArenaAllocator() {}
+        explicit ArenaAllocator(Arena* aArena): arena(aArena) {}
+
+        template<class U>
+        ArenaAllocator(const ArenaAllocator<U>& other): arena(other.getArena()) {}
+
+        T* allocate(size_t count)
+        {
+            if (arena)
+            {
+                return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+            }
+
+            return static_cast<T*>(::operator new(count * sizeof(T)));
+        }
+
+        void deallocate(T* pointer, size_t)
+        {
+            if (!arena) ::operator delete(pointer);
+        }
+
+        // copies of arena containers use the heap, so that they can outlive the arena
+        ArenaAllocator select_on_container_copy_construction() const
+        {
+            return ArenaAllocator();
+        }
+
+        Arena* getArena() const { return arena; }
+
+    private:
+        Arena* arena = nullptr;
+    };
+
+    template<class T, class U>
+    inline bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+    {
+        return a.getArena() == b.getArena();
+    }
+
+    template<class T, class U>
+    inline bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+    {
+        return a.getArena() != b.getArena();
+    }
+}
@@ -0,0 +1,84 @@
+//
+//  rtmp_relay
+//
+
+#include "BufferPool.hpp"
+
+namespace relay
+{
+    // smallest class that fits size
+    static uint32_t getAcquireClass(size_t size)
+    {
+        uint32_t shift = BufferPool::MIN_CLASS_SHIFT;
+
+        while (shift < BufferPool::MAX_CLASS_SHIFT && (static_cast<size_t>(1) << shift) < size) ++shift;
+
+        return shift - BufferPool::MIN_CLASS_SHIFT;
+    }
+
+    // largest class that the capacity fully covers
+    static uint32_t getReleaseClass(size_t capacity)
+    {
+        uint32_t shift = BufferPool::MIN_CLASS_SHIFT;
+
+        while (shift < BufferPool::MAX_CLASS_SHIFT && (static_cast<size_t>(1) << (shift + 1)) <= capacity) ++shift;
+
+        return shift - BufferPool::MIN_CLASS_SHIFT;
+    }
+
+    BufferPool::BufferPool(size_t aMaxCachedSize):
+        maxCachedSize(aMaxCachedSize)
+    {
+    }
+
+    std::vector<uint8_t> BufferPool::acquire(size_t size)
+    {
+        std::vector<uint8_t> result;
+
+        if (size <= (static_cast<size_t>(1) << MAX_CLASS_SHIFT))
+        {
+            uint32_t index = getAcquireClass(size);
+            std::vector<std::vector<uint8_t>>& buffers = classes[index];
+
+            if (!buffers.empty())
+            {
+                result.swap(buffers.back());
+                buffers.pop_back();
+                cachedSize -= result.capacity();
+                ++hitCount;
+
+                return result;
+            }
+
+            // allocate the whole class, so that the buffer can be returned to the same class
+            size = static_cast<size_t>(1) << (index + MIN_CLASS_SHIFT);
+        }
+
+        ++missCount;
+        result.reserve(size);
+
+        return result;
+    }
+
+    void BufferPool::release(std::vector<uint8_t>& buffer)
+    {
+        size_t capacity = buffer.capacity();
+
+        if (capacity < (static_cast<size_t>(1) << MIN_CLASS_SHIFT) ||
+            capacity > (static_cast<size_t>(1) << (MAX_CLASS_SHIFT + 1)) ||
+            cachedSize + capacity > maxCachedSize)
+        {
+            if (capacity > 0) ++discardCount;
+            std::vector<uint8_t>().swap(buffer);
+            return;
+        }
+
+        buffer.clear();
+
+        std::vector<std::vector<uint8_t>>& buffers = classes[getReleaseClass(capacity)];
+        buffers.push_back(std::vector<uint8_t>());
+        buffers.back().swap(buffer);
+        cachedSize += capacity;
+        ++releaseCount;
+    }
+}
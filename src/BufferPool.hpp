@@ -0,0 +1,50 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace relay
+{
+    // keeps released byte buffers in power of two size classes so that their storage can be reused
+    class BufferPool
+    {
+    public:
+        static const uint32_t MIN_CLASS_SHIFT = 8; // 256 bytes
+        static const uint32_t MAX_CLASS_SHIFT = 22; // 4 MiB
+        static const uint32_t CLASS_COUNT = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+
+        explicit BufferPool(size_t aMaxCachedSize = 16 * 1024 * 1024);
+
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator=(const BufferPool&) = delete;
+        BufferPool(BufferPool&&) = delete;
+        BufferPool& operator=(BufferPool&&) = delete;
+
+        // returns an empty buffer with a capacity of at least size bytes
+        std::vector<uint8_t> acquire(size_t size);
+        // takes the storage of the buffer, leaves it empty
+        void release(std::vector<uint8_t>& buffer);
+
+        uint64_t getHitCount() const { return hitCount; }
+        uint64_t getMissCount() const { return missCount; }
+        uint64_t getReleaseCount() const { return releaseCount; }
+        uint64_t getDiscardCount() const { return discardCount; }
+        size_t getCachedSize() const { return cachedSize; }
+
+    private:
+        size_t maxCachedSize;
+        size_t cachedSize = 0;
+
+        std::vector<std::vector<uint8_t>> classes[CLASS_COUNT];
+
+        uint64_t hitCount = 0;
+        uint64_t missCount = 0;
+        uint64_t releaseCount = 0;
+        uint64_t discardCount = 0;
+    };
+}
@@ -0,0 +1,378 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#  include <stdlib.h>
+#endif
+
+namespace relay
+{
+    inline uint16_t byteSwap16(uint16_t value)
+    {
+#if defined(_MSC_VER)
+        return _byteswap_ushort(value);
+#elif defined(__GNUC__)
+        return __builtin_bswap16(value);
+#else
+        return static_cast<uint16_t>((value >> 8) | (value << 8));
+#endif
+    }
+
+    inline uint32_t byteSwap32(uint32_t value)
+    {
+#if defined(_MSC_VER)
+        return _byteswap_ulong(value);
+#elif defined(__GNUC__)
+        return __builtin_bswap32(value);
+#else
+        return ((value >> 24) & 0x000000FF) |
+            ((value >> 8) & 0x0000FF00) |
+            ((value << 8) & 0x00FF0000) |
+            ((value << 24) & 0xFF000000);
+#endif
+    }
+
+    inline uint64_t byteSwap64(uint64_t value)
+    {
+#if defined(_MSC_VER)
+        return _byteswap_uint64(value);
+#elif defined(__GNUC__)
+        return __builtin_bswap64(value);
+#else
+        return (static_cast<uint64_t>(byteSwap32(static_cast<uint32_t>(value))) << 32) |
+            byteSwap32(static_cast<uint32_t>(value >> 32));
+#endif
+    }
+
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    inline uint16_t toBigEndian(uint16_t value) { return value; }
+    inline uint32_t toBigEndian(uint32_t value) { return value; }
+    inline uint64_t toBigEndian(uint64_t value) { return value; }
+    inline uint32_t toLittleEndian(uint32_t value) { return byteSwap32(value); }
+#else
+    inline uint16_t toBigEndian(uint16_t value) { return byteSwap16(value); }
+    inline uint32_t toBigEndian(uint32_t value) { return byteSwap32(value); }
+    inline uint64_t toBigEndian(uint64_t value) { return byteSwap64(value); }
+    inline uint32_t toLittleEndian(uint32_t value) { return value; }
+#endif
+
+    // unaligned fixed-width loads and stores
+    inline uint16_t loadBE16(const uint8_t* data)
+    {
+        uint16_t value;
+        memcpy(&value, data, sizeof(value));
+        return toBigEndian(value);
+    }
+
+    inline uint32_t loadBE24(const uint8_t* data)
+    {
+        return (static_cast<uint32_t>(data[0]) << 16) |
+            (static_cast<uint32_t>(data[1]) << 8) |
+            static_cast<uint32_t>(data[2]);
+    }
+
+    inline uint32_t loadBE32(const uint8_t* data)
+    {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        return toBigEndian(value);
+    }
+
+    inline uint32_t loadLE32(const uint8_t* data)
+    {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        return toLittleEndian(value);
+    }
+
+    inline uint64_t loadBE64(const uint8_t* data)
+    {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        return toBigEndian(value);
+    }
+
+    inline void storeBE16(uint8_t* data, uint16_t value)
+    {
+        value = toBigEndian(value);
+        memcpy(data, &value, sizeof(value));
+    }
+
+    inline void storeBE24(uint8_t* data, uint32_t value)
+    {
+        data[0] = static_cast<uint8_t>(value >> 16);
+        data[1] = static_cast<uint8_t>(value >> 8);
+        data[2] = static_cast<uint8_t>(value);
+    }
+
+    inline void storeBE32(uint8_t* data, uint32_t value)
+    {
+        value = toBigEndian(value);
+        memcpy(data, &value, sizeof(value));
+    }
+
+    inline void storeLE32(uint8_t* data, uint32_t value)
+    {
+        value = toLittleEndian(value);
+        memcpy(data, &value, sizeof(value));
+    }
+
+    inline void storeBE64(uint8_t* data, uint64_t value)
+    {
+        value = toBigEndian(value);
+        memcpy(data, &value, sizeof(value));
+    }
+
+    // bounds-checked reader over memory it does not own
+    class ByteReader
+    {
+    public:
+        ByteReader(const uint8_t* aData, size_t aSize, size_t aOffset = 0):
+            data(aData), size(aSize), offset(aOffset)
+        {
+        }
+
+        explicit ByteReader(const std::vector<uint8_t>& buffer, size_t aOffset = 0):
+            data(buffer.data()), size(buffer.size()), offset(aOffset)
+        {
+        }
+
+        const uint8_t* getData() const { return data; }
+        size_t getSize() const { return size; }
+        size_t getOffset() const { return offset; }
+        void setOffset(size_t newOffset) { offset = newOffset; }
+        size_t getRemaining() const { return (offset < size) ? size - offset : 0; }
+        const uint8_t* getCurrent() const { return data + offset; }
+
+        bool skip(size_t count)
+        {
+            if (getRemaining() < count) return false;
+            offset += count;
+            return true;
+        }
+
+        bool peekUInt8(uint8_t& result) const
+        {
+            if (getRemaining() < 1) return false;
+            result = data[offset];
+            return true;
+        }
+
+        bool readUInt8(uint8_t& result)
+        {
+            if (getRemaining() < 1) return false;
+            result = data[offset];
+            offset += 1;
+            return true;
+        }
+
+        bool readUInt16BE(uint16_t& result)
+        {
+            if (getRemaining() < 2) return false;
+            result = loadBE16(data + offset);
+            offset += 2;
+            return true;
+        }
+
+        bool readUInt24BE(uint32_t& result)
+        {
+            if (getRemaining() < 3) return false;
+            result = loadBE24(data + offset);
+            offset += 3;
+            return true;
+        }
+
+        bool readUInt32BE(uint32_t& result)
+        {
+            if (getRemaining() < 4) return false;
+            result = loadBE32(data + offset);
+            offset += 4;
+            return true;
+        }
+
+        bool readUInt32LE(uint32_t& result)
+        {
+            if (getRemaining() < 4) return false;
+            result = loadLE32(data + offset);
+            offset += 4;
+            return true;
+        }
+
+        bool readUInt64BE(uint64_t& result)
+        {
+            if (getRemaining() < 8) return false;
+            result = loadBE64(data + offset);
+            offset += 8;
+            return true;
+        }
+
+        bool readDouble(double& result)
+        {
+            if (getRemaining() < 8) return false;
+            uint64_t value = loadBE64(data + offset);
+            memcpy(&result, &value, sizeof(result));
+            offset += 8;
+            return true;
+        }
+
+        // AMF3 variable length 29-bit integer
+        bool readU29(uint32_t& result)
+        {
+            result = 0;
+
+            for (uint32_t i = 0; i < 4; ++i)
+            {
+                if (getRemaining() < 1) return false;
+
+                uint8_t b = data[offset];
+                offset += 1;
+
+                if (i == 3)
+                {
+                    result = (result << 8) | b;
+                }
+                else
+                {
+                    result = (result << 7) | (b & 0x7F);
+                    if (!(b & 0x80)) break;
+                }
+            }
+
+            return true;
+        }
+
+        // returns a pointer into the underlying memory, no copy is made
+        bool readBytes(size_t count, const uint8_t*& result)
+        {
+            if (getRemaining() < count) return false;
+            result = data + offset;
+            offset += count;
+            return true;
+        }
+
+        bool readString(size_t length, std::string& result)
+        {
+            if (getRemaining() < length) return false;
+            result.assign(reinterpret_cast<const char*>(data + offset), length);
+            offset += length;
+            return true;
+        }
+
+    private:
+        const uint8_t* data;
+        size_t size;
+        size_t offset;
+    };
+
+    // appends to a vector, each write grows the vector at most once
+    class ByteWriter
+    {
+    public:
+        explicit ByteWriter(std::vector<uint8_t>& aBuffer):
+            buffer(aBuffer)
+        {
+        }
+
+        // reserve space for the whole message up front
+        void reserve(size_t count) { buffer.reserve(buffer.size() + count); }
+        size_t getSize() const { return buffer.size(); }
+        std::vector<uint8_t>& getBuffer() { return buffer; }
+
+        void writeUInt8(uint8_t value)
+        {
+            buffer.push_back(value);
+        }
+
+        void writeUInt16BE(uint16_t value)
+        {
+            storeBE16(extend(2), value);
+        }
+
+        void writeUInt24BE(uint32_t value)
+        {
+            storeBE24(extend(3), value);
+        }
+
+        void writeUInt32BE(uint32_t value)
+        {
+            storeBE32(extend(4), value);
+        }
+
+        void writeUInt32LE(uint32_t value)
+        {
+            storeLE32(extend(4), value);
+        }
+
+        void writeUInt64BE(uint64_t value)
+        {
+            storeBE64(extend(8), value);
+        }
+
+        void writeDouble(double value)
+        {
+            uint64_t data;
+            memcpy(&data, &value, sizeof(data));
+            storeBE64(extend(8), data);
+        }
+
+        // AMF3 variable length 29-bit integer
+        bool writeU29(uint32_t value)
+        {
+            if (value <= 0x7F) // one byte
+            {
+                buffer.push_back(static_cast<uint8_t>(value));
+            }
+            else if (value <= 0x3FFF) // two bytes
+            {
+                uint8_t* data = extend(2);
+                data[0] = static_cast<uint8_t>((value >> 7) | 0x80);
+                data[1] = static_cast<uint8_t>(value & 0x7F);
+            }
+            else if (value <= 0x1FFFFF) // three bytes
+            {
+                uint8_t* data = extend(3);
+                data[0] = static_cast<uint8_t>((value >> 14) | 0x80);
+                data[1] = static_cast<uint8_t>((value >> 7) | 0x80);
+                data[2] = static_cast<uint8_t>(value & 0x7F);
+            }
+            else if (value <= 0x1FFFFFFF) // four bytes
+            {
+                uint8_t* data = extend(4);
+                data[0] = static_cast<uint8_t>((value >> 22) | 0x80);
+                data[1] = static_cast<uint8_t>((value >> 15) | 0x80);
+                data[2] = static_cast<uint8_t>((value >> 8) | 0x80);
+                data[3] = static_cast<uint8_t>(value);
+            }
+            else
+            {
+                return false;
+            }
+
+            return true;
+        }
+
+        void writeBytes(const void* data, size_t count)
+        {
+            if (count == 0) return;
+            memcpy(extend(count), data, count);
+        }
+
+    private:
+        uint8_t* extend(size_t count)
+        {
+            size_t oldSize = buffer.size();
+            buffer.resize(oldSize + count);
+            return buffer.data() + oldSize;
+        }
+
+        std::vector<uint8_t>& buffer;
+    };
+}
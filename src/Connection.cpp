@@ -2,31 +2,249 @@
 //  rtmp_relay
 //
 
-#include <sstream>
+#include <cstring>
 #include <iostream>
-#include <iomanip>
 
 #include "Connection.hpp"
 #include "Relay.hpp"
 #include "Server.hpp"
+#include "StatusSnapshot.hpp"
 #include "Endpoint.hpp"
 #include "Constants.hpp"
+#include "Handoff.hpp"
 #include "Log.hpp"
 
 namespace relay
 {
+    enum class InvokeCommand
+    {
+        UNKNOWN,
+        CONNECT,
+        ON_BW_DONE,
+        CHECK_BW,
+        CREATE_STREAM,
+        RELEASE_STREAM,
+        DELETE_STREAM,
+        FC_PUBLISH,
+        ON_FC_PUBLISH,
+        FC_UNPUBLISH,
+        ON_FC_UNPUBLISH,
+        FC_SUBSCRIBE,
+        ON_FC_SUBSCRIBE,
+        PUBLISH,
+        UNPUBLISH,
+        PLAY,
+        GET_STREAM_LENGTH,
+        STOP,
+        ON_STATUS,
+        ERROR_RESULT,
+        RESULT
+    };
+
+    // indexed by InvokeCommand
+    static const char* INVOKE_COMMAND_NAMES[] = {
+        "",
+        "connect",
+        "onBWDone",
+        "_checkbw",
+        "createStream",
+        "releaseStream",
+        "deleteStream",
+        "FCPublish",
+        "onFCPublish",
+        "FCUnpublish",
+        "onFCUnpublish",
+        "FCSubscribe",
+        "onFCSubscribe",
+        "publish",
+        "unpublish",
+        "play",
+        "getStreamLength",
+        "stop",
+        "onStatus",
+        "_error",
+        "_result"
+    };
+
+    static InvokeCommand getInvokeCommand(const std::string& name)
+    {
+        InvokeCommand command;
+
+        // duplicate case labels do not compile, so the hash is collision free for all known commands
+        switch (hashString(name))
+        {
+            case hashString("connect"): command = InvokeCommand::CONNECT; break;
+            case hashString("onBWDone"): command = InvokeCommand::ON_BW_DONE; break;
+            case hashString("_checkbw"): command = InvokeCommand::CHECK_BW; break;
+            case hashString("createStream"): command = InvokeCommand::CREATE_STREAM; break;
+            case hashString("releaseStream"): command = InvokeCommand::RELEASE_STREAM; break;
+            case hashString("deleteStream"): command = InvokeCommand::DELETE_STREAM; break;
+            case hashString("FCPublish"): command = InvokeCommand::FC_PUBLISH; break;
+            case hashString("onFCPublish"): command = InvokeCommand::ON_FC_PUBLISH; break;
+            case hashString("FCUnpublish"): command = InvokeCommand::FC_UNPUBLISH; break;
+            case hashString("onFCUnpublish"): command = InvokeCommand::ON_FC_UNPUBLISH; break;
+            case hashString("FCSubscribe"): command = InvokeCommand::FC_SUBSCRIBE; break;
+            case hashString("onFCSubscribe"): command = InvokeCommand::ON_FC_SUBSCRIBE; break;
+            case hashString("publish"): command = InvokeCommand::PUBLISH; break;
+            case hashString("unpublish"): command = InvokeCommand::UNPUBLISH; break;
+            case hashString("play"): command = InvokeCommand::PLAY; break;
+            case hashString("getStreamLength"): command = InvokeCommand::GET_STREAM_LENGTH; break;
+            case hashString("stop"): command = InvokeCommand::STOP; break;
+            case hashString("onStatus"): command = InvokeCommand::ON_STATUS; break;
+            case hashString("_error"): command = InvokeCommand::ERROR_RESULT; break;
+            case hashString("_result"): command = InvokeCommand::RESULT; break;
+            default: return InvokeCommand::UNKNOWN;
+        }
+
+        // an unknown command can still share the hash of a known one
+        return (name == INVOKE_COMMAND_NAMES[static_cast<size_t>(command)]) ? command : InvokeCommand::UNKNOWN;
+    }
+
+    // pre-encoded AMF0 invoke body, only the transaction ID and the variable fields are written per message
+    class InvokeTemplate
+    {
+    public:
+        // if openObject is set, the end marker of the last argument is left out, so that more properties can be appended to it
+        InvokeTemplate(const std::string& commandName, const std::vector<amf::Node>& arguments, bool openObject = false)
+        {
+            amf::Node commandNameNode = commandName;
+            commandNameNode.encode(amf::Version::AMF0, data);
+
+            transactionIdOffset = data.size() + 1; // skip the number marker
+
+            amf::Node transactionIdNode = 0.0;
+            transactionIdNode.encode(amf::Version::AMF0, data);
+
+            for (const amf::Node& argument : arguments)
+            {
+                argument.encode(amf::Version::AMF0, data);
+            }
+
+            if (openObject)
+            {
+                data.resize(data.size() - 3); // empty key and the object end marker
+            }
+        }
+
+        void write(std::vector<uint8_t>& buffer, double transactionId) const
+        {
+            size_t offset = buffer.size();
+            buffer.insert(buffer.end(), data.begin(), data.end());
+
+            uint64_t value;
+            memcpy(&value, &transactionId, sizeof(value));
+            storeBE64(buffer.data() + offset + transactionIdOffset, value);
+        }
+
+    private:
+        std::vector<uint8_t> data;
+        size_t transactionIdOffset;
+    };
+
+    // appends a property to an object left open by an InvokeTemplate
+    static void writeProperty(std::vector<uint8_t>& buffer, const std::string& key, const amf::Node& value)
+    {
+        ByteWriter writer(buffer);
+        writer.writeUInt16BE(static_cast<uint16_t>(key.length()));
+        writer.writeBytes(key.data(), key.length());
+
+        value.encode(amf::Version::AMF0, writer);
+    }
+
+    static void writeStringProperty(std::vector<uint8_t>& buffer, const std::string& key, const std::string& value)
+    {
+        writeProperty(buffer, key, amf::Node(value));
+    }
+
+    static void writeObjectEnd(std::vector<uint8_t>& buffer)
+    {
+        ByteWriter writer(buffer);
+        writer.writeUInt16BE(0);
+        writer.writeUInt8(static_cast<uint8_t>(amf::AMF0Marker::ObjectEnd));
+    }
+
+    static amf::Node getStatusInfo(const std::string& code)
+    {
+        amf::Node info;
+        info["clientid"] = std::string("Lavf57.1.0");
+        info["code"] = code;
+        info["level"] = std::string("status");
+
+        return info;
+    }
+
+    static amf::Node getRejectedInfo()
+    {
+        amf::Node info;
+        info["code"] = std::string("NetConnection.Connect.Rejected");
+        info["level"] = std::string("error");
+
+        return info;
+    }
+
+    static amf::Node getFailedInfo(const std::string& code)
+    {
+        amf::Node info;
+        info["code"] = code;
+        info["level"] = std::string("error");
+
+        return info;
+    }
+
+    static amf::Node getConnectProperties()
+    {
+        amf::Node properties;
+        properties["fmsVer"] = std::string("FMS/3,5,7,7009");
+        properties["capabilities"] = 31.0;
+
+        return properties;
+    }
+
+    static amf::Node getConnectInfo(double objectEncoding)
+    {
+        amf::Node info;
+        info["level"] = std::string("status");
+        info["code"] = std::string("NetConnection.Connect.Success");
+        info["description"] = std::string("Connection succeeded.");
+        info["objectEncoding"] = objectEncoding;
+
+        return info;
+    }
+
+    static const amf::Node NULL_NODE(amf::Node::Type::Null);
+
+    // how long a refused connection waits for its reply to be sent before closing anyway
+    static const float CLOSING_TIMEOUT = 5.0f;
+
+    static const InvokeTemplate CONNECT_RESULT_AMF0("_result", {getConnectProperties(), getConnectInfo(0.0)});
+    static const InvokeTemplate CONNECT_RESULT_AMF3("_result", {getConnectProperties(), getConnectInfo(3.0)});
+    static const InvokeTemplate CHECK_BW_RESULT("_result", {NULL_NODE});
+    static const InvokeTemplate RELEASE_STREAM_RESULT("_result", {NULL_NODE});
+    static const InvokeTemplate CREATE_STREAM_RESULT("_result", {NULL_NODE});
+    static const InvokeTemplate GET_STREAM_LENGTH_RESULT("_result", {NULL_NODE, amf::Node(0.0)});
+    // the description and details properties depend on the stream name
+    static const InvokeTemplate PUBLISH_STATUS("onStatus", {NULL_NODE, getStatusInfo("NetStream.Publish.Start")}, true);
+    static const InvokeTemplate UNPUBLISH_STATUS("onStatus", {NULL_NODE, getStatusInfo("NetStream.Unpublish.Success")}, true);
+    static const InvokeTemplate PLAY_STATUS("onStatus", {NULL_NODE, getStatusInfo("NetStream.Play.Start")}, true);
+    static const InvokeTemplate STOP_STATUS("onStatus", {NULL_NODE, getStatusInfo("NetStream.Play.Stop")}, true);
+    static const InvokeTemplate REJECTED_STATUS("onStatus", {NULL_NODE, getRejectedInfo()}, true);
+    static const InvokeTemplate PUBLISH_FAILED_STATUS("onStatus", {NULL_NODE, getFailedInfo("NetStream.Publish.Failed")}, true);
+    static const InvokeTemplate PLAY_FAILED_STATUS("onStatus", {NULL_NODE, getFailedInfo("NetStream.Play.Failed")}, true);
+
     Connection::Connection(Relay& aRelay,
                            Socket& client):
         relay(aRelay),
+        bufferPool(relay.getNetwork().getBufferPool()),
         id(Relay::nextId()),
         type(Type::HOST),
         socket(std::move(client))
     {
         updateIdString();
-        Log(Log::Level::INFO) << idString << "Create connection";
+        RELAY_LOG(Log::Level::INFO) << idString << "Create connection";
 
         socket.setReadCallback(std::bind(&Connection::handleRead, this, std::placeholders::_1, std::placeholders::_2));
         socket.setCloseCallback(std::bind(&Connection::handleClose, this, std::placeholders::_1));
+        socket.setFlushCallback(std::bind(&Connection::handleFlush, this, std::placeholders::_1, std::placeholders::_2));
         socket.startRead();
     }
 
@@ -34,6 +252,7 @@ namespace relay
                            Stream& aStream,
                            const Endpoint& aEndpoint):
         relay(aRelay),
+        bufferPool(relay.getNetwork().getBufferPool()),
         id(Relay::nextId()),
         type(Type::CLIENT),
         socket(relay.getNetwork()),
@@ -43,7 +262,7 @@ namespace relay
         stream = &aStream;
 
         resolveStreamName();
-        Log(Log::Level::INFO) << idString << "Create connection";
+        RELAY_LOG(Log::Level::INFO) << idString << "Create connection";
 
         reconnectCount = endpoint->reconnectCount;
         bufferSize = endpoint->bufferSize;
@@ -52,6 +271,7 @@ namespace relay
 
         socket.setReadCallback(std::bind(&Connection::handleRead, this, std::placeholders::_1, std::placeholders::_2));
         socket.setCloseCallback(std::bind(&Connection::handleClose, this, std::placeholders::_1));
+        socket.setFlushCallback(std::bind(&Connection::handleFlush, this, std::placeholders::_1, std::placeholders::_2));
         socket.setConnectTimeout(endpoint->connectionTimeout);
         socket.setConnectCallback(std::bind(&Connection::handleConnect, this, std::placeholders::_1));
         socket.setConnectErrorCallback(std::bind(&Connection::handleConnectError, this, std::placeholders::_1));
@@ -60,7 +280,12 @@ namespace relay
     Connection::~Connection()
     {
         close();
-        Log(Log::Level::INFO) << idString << "Delete connection";
+
+        MemoryUsage& memoryTotals = relay.getMemoryTotals();
+        memoryTotals.inputBuffers -= data.size();
+        memoryTotals.arenas -= arenaSize;
+
+        RELAY_LOG(Log::Level::INFO) << idString << "Delete connection";
     }
 
     void Connection::updateIdString()
@@ -68,12 +293,25 @@ namespace relay
         idString = "[CON:" + std::to_string(id) + " " + applicationName + "/" + streamName + "] ";
     }
 
+    void Connection::setState(State newState)
+    {
+        if (state == newState) return;
+
+        state = newState;
+
+        if (Status* status = relay.getStatus()) status->publishConnectionEvent(*this, false);
+    }
+
     void Connection::close(bool forceClose)
     {
         if (closed) return;
 
-        Log(Log::Level::INFO) << idString << "Close called";
+        RELAY_LOG(Log::Level::INFO) << idString << "Close called";
         closed = closed || forceClose;
+        if (socket.isReady())
+        {
+            if (Status* status = relay.getStatus()) status->publishConnectionEvent(*this, true);
+        }
         socket.close(forceClose);
 
         reset();
@@ -84,13 +322,24 @@ namespace relay
         if (stream && streaming) stream->stop(*this);
         streaming = false;
 
-        state = State::UNINITIALIZED;
+        setState(State::UNINITIALIZED);
+        relay.getMemoryTotals().inputBuffers -= data.size();
         data.clear();
         receivedPackets.clear();
         sentPackets.clear();
         inChunkSize = 128;
         outChunkSize = 128;
         serverBandwidth = 2500000;
+        peerBandwidth = 0;
+        inBytes = 0;
+        inBytesAcknowledged = 0;
+        outBytes = 0;
+        outBytesAcknowledged = 0;
+        acknowledgementReceived = false;
+        congested = false;
+        sendQueueOverflow = false;
+        closing = false;
+        timeSinceClosing = 0.0f;
         receivedPackets.clear();
         sentPackets.clear();
         invokeId = 0;
@@ -125,12 +374,29 @@ namespace relay
     {
         if (closed) return;
 
+        if (sendQueueOverflow)
+        {
+            close(true);
+            return;
+        }
+
+        if (closing)
+        {
+            timeSinceClosing += delta;
+
+            if (!socket.hasOutData() || timeSinceClosing >= CLOSING_TIMEOUT)
+            {
+                close();
+            }
+            return;
+        }
+
         if (socket.isReady())
         {
             timeSinceLastData += delta;
             if (timeSinceLastData > 5.0f)
             {
-                Log(Log::Level::INFO) << idString << "Disconnecting as no data for 5s";
+                RELAY_LOG(Log::Level::INFO) << idString << "Disconnecting as no data for 5s";
                 timeSinceLastData = 0;
                 close(type == Connection::Type::HOST);
             }
@@ -151,7 +417,7 @@ namespace relay
 
                 if (timeSincePong >= 2 * pingInterval)
                 {
-                    Log(Log::Level::INFO) << idString << "Disconnecting as no pong";
+                    RELAY_LOG(Log::Level::INFO) << idString << "Disconnecting as no pong";
                     close(true);
                 }
             }
@@ -171,7 +437,7 @@ namespace relay
                 if (timeSinceConnect >= endpoint->reconnectInterval)
                 {
                     timeSinceConnect = 0.0f;
-                    state = State::UNINITIALIZED;
+                    setState(State::UNINITIALIZED);
 
                     if (connectCount >= reconnectCount)
                     {
@@ -198,185 +464,316 @@ namespace relay
         if (timeSinceMeasure >= 1.0f)
         {
             timeSinceMeasure = 0.0f;
+
+            if (currentAudioBytes != audioRate || currentVideoBytes != videoRate)
+            {
+                if (Status* status = relay.getStatus()) status->publishRateEvent(*this, currentAudioBytes, currentVideoBytes);
+            }
+
             audioRate = currentAudioBytes;
             videoRate = currentVideoBytes;
 
             currentAudioBytes = 0;
             currentVideoBytes = 0;
         }
-    }
 
-    void Connection::getStats(std::string& str, ReportType reportType) const
-    {
-        switch (reportType)
+        if (direction == Direction::INPUT && stream && streaming &&
+            endpoint && endpoint->latencyProbeInterval > 0.0f)
         {
-            case ReportType::TEXT:
-            {
-                std::stringstream ss;
-
-                ss
-                << std::setw(8) << " "
-                << std::setw(5) << id << " "
-                << std::setw(20) << applicationName << " "
-                << std::setw(20) << streamName << " "
-                << std::setw(15) << (socket.isReady() ? "connected" : "not connected") << " "
-                << std::setw(22) << ipToString(socket.getRemoteIPAddress()) + ":" + std::to_string(socket.getRemotePort()) << " "
-                << std::setw(7) << (type == Type::HOST ? "HOST" : "CLIENT") << " "
-                << std::setw(20);
-                switch (state)
-                {
-                    case State::UNINITIALIZED: ss << "UNINITIALIZED"; break;
-                    case State::VERSION_RECEIVED: ss << "VERSION_RECEIVED"; break;
-                    case State::VERSION_SENT: ss << "VERSION_SENT"; break;
-                    case State::ACK_SENT: ss << "ACK_SENT"; break;
-                    case State::HANDSHAKE_DONE: ss << "HANDSHAKE_DONE"; break;
-                }
+            timeSinceProbe += delta;
 
-                ss << " " << std::setw(10);
-                switch (direction)
-                {
-                    case Direction::NONE: ss << "NONE"; break;
-                    case Direction::INPUT: ss << "INPUT"; break;
-                    case Direction::OUTPUT: ss << "OUTPUT"; break;
-                }
+            if (timeSinceProbe >= endpoint->latencyProbeInterval)
+            {
+                timeSinceProbe = 0.0f;
+                stream->sendLatencyProbe();
+            }
+        }
+    }
 
-                ss << " " << std::setw(6) << (stream ? std::to_string(stream->getServer().getId()) : "") << " ";
+    void Connection::getStatus(ConnectionStatus& status) const
+    {
+        status.id = id;
+        status.applicationName = applicationName;
+        status.streamName = streamName;
+        status.connected = socket.isReady();
+        status.address = ipToString(socket.getRemoteIPAddress()) + ":" + std::to_string(socket.getRemotePort());
+        status.type = type;
+        status.state = state;
+        status.direction = direction;
+        status.hasServer = (stream != nullptr);
+        if (stream) status.serverId = stream->getServer().getId();
+        status.metaData = metaData;
+
+        status.counters.inBytes = inBytes;
+        status.counters.outBytes = outBytes;
+        status.counters.inMessages = inMessages;
+        status.counters.outMessages = outMessages;
+        status.counters.droppedMessages = droppedMessages;
+        status.sendQueueSize = socket.getOutDataSize();
+        status.inputBufferSize = data.size();
+        status.arenaSize = invokeArena.getSize();
+        status.socketStats = socket.getStats();
+        latencyHistogram.getSummary(status.latency);
+    }
 
-                if (metaData.getType() == amf::Node::Type::Dictionary ||
-                    metaData.getType() == amf::Node::Type::Object)
-                {
-                    bool first = true;
+    static void writeHeaders(ByteWriter& writer, const std::map<uint32_t, rtmp::Header>& headers)
+    {
+        writer.writeUInt32BE(static_cast<uint32_t>(headers.size()));
 
-                    for (const std::pair<std::string, amf::Node>& value : metaData.asMap())
-                    {
-                        if (!first) ss << ", ";
-                        first = false;
-                        ss << value.first + " = " + value.second.toString();
-                    }
-                }
+        for (const auto& i : headers)
+        {
+            const rtmp::Header& header = i.second;
+            writer.writeUInt32BE(i.first);
+            writer.writeUInt8(static_cast<uint8_t>(header.type));
+            writer.writeUInt32BE(header.channel);
+            writer.writeUInt32BE(header.ts);
+            writer.writeUInt32BE(header.length);
+            writer.writeUInt8(static_cast<uint8_t>(header.messageType));
+            writer.writeUInt32BE(header.messageStreamId);
+            writer.writeUInt64BE(header.timestamp);
+        }
+    }
 
-                str += ss.str();
-                str += "\n";
-                break;
-            }
-            case ReportType::HTML:
+    static bool readHeaders(ByteReader& reader, std::map<uint32_t, rtmp::Header>& headers)
+    {
+        uint32_t count;
+        if (!reader.readUInt32BE(count)) return false;
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            uint32_t channel;
+            uint8_t type;
+            uint8_t messageType;
+            rtmp::Header header;
+
+            if (!reader.readUInt32BE(channel) ||
+                !reader.readUInt8(type) ||
+                !reader.readUInt32BE(header.channel) ||
+                !reader.readUInt32BE(header.ts) ||
+                !reader.readUInt32BE(header.length) ||
+                !reader.readUInt8(messageType) ||
+                !reader.readUInt32BE(header.messageStreamId) ||
+                !reader.readUInt64BE(header.timestamp))
             {
-                str += "<tr><td>" + std::to_string(id) +"</td><td>" + streamName + "</td>" +
-                    "<td>" + applicationName + "</td>" +
-                    "<td>" + (socket.isReady() ? "Connected" : "Not connected") + "</td><td>" + ipToString(socket.getRemoteIPAddress()) + ":" + std::to_string(socket.getRemotePort()) + "</td><td>";
-
-                switch (type)
-                {
-                    case Type::HOST: str += "HOST"; break;
-                    case Type::CLIENT: str += "CLIENT"; break;
-                }
+                return false;
+            }
 
-                str += "</td><td>";
+            header.type = static_cast<rtmp::Header::Type>(type);
+            header.messageType = static_cast<rtmp::MessageType>(messageType);
+            headers[channel] = header;
+        }
 
-                switch (state)
-                {
-                    case State::UNINITIALIZED: str += "UNINITIALIZED"; break;
-                    case State::VERSION_RECEIVED: str += "VERSION_RECEIVED"; break;
-                    case State::VERSION_SENT: str += "VERSION_SENT"; break;
-                    case State::ACK_SENT: str += "ACK_SENT"; break;
-                    case State::HANDSHAKE_DONE: str += "HANDSHAKE_DONE"; break;
-                }
+        return true;
+    }
 
-                str += "</td><td>";
+    static void writeMetaData(ByteWriter& writer, const amf::Node& metaData)
+    {
+        std::vector<uint8_t> buffer;
+        if (metaData.getType() != amf::Node::Type::Unknown) metaData.encode(amf::Version::AMF0, buffer);
+        handoff::writeBuffer(writer, buffer);
+    }
 
-                switch (direction)
-                {
-                    case Direction::NONE: str += "NONE"; break;
-                    case Direction::INPUT: str += "INPUT"; break;
-                    case Direction::OUTPUT: str += "OUTPUT"; break;
-                }
+    static bool readMetaData(ByteReader& reader, amf::Node& metaData)
+    {
+        std::vector<uint8_t> buffer;
+        if (!handoff::readBuffer(reader, buffer)) return false;
 
-                str += "</td><td>" + (stream ? std::to_string(stream->getServer().getId()) : "") + "</td><td>";
+        metaData = amf::Node();
+        return buffer.empty() || metaData.decode(amf::Version::AMF0, buffer) > 0;
+    }
 
-                if (metaData.getType() == amf::Node::Type::Dictionary ||
-                    metaData.getType() == amf::Node::Type::Object)
-                {
-                    bool first = true;
+    bool Connection::canHandOff() const
+    {
+        // client connections are reconnected by the new process
+        return type == Type::HOST && state == State::HANDSHAKE_DONE && socket.isReady() && !closed;
+    }
 
-                    for (const std::pair<std::string, amf::Node>& value : metaData.asMap())
-                    {
-                        if (!first) str += "<br/>";
-                        first = false;
-                        str += value.first + " = " + value.second.toString();
-                    }
-                }
+    void Connection::saveSession(std::vector<uint8_t>& buffer) const
+    {
+        ByteWriter writer(buffer);
+
+        writer.writeUInt32BE(inChunkSize);
+        writer.writeUInt32BE(outChunkSize);
+        writer.writeUInt32BE(serverBandwidth);
+        writer.writeUInt32BE(peerBandwidth);
+        writer.writeUInt64BE(inBytes);
+        writer.writeUInt64BE(inBytesAcknowledged);
+        writer.writeUInt64BE(outBytes);
+        writer.writeUInt32BE(outBytesAcknowledged);
+        writer.writeUInt64BE(inMessages);
+        writer.writeUInt64BE(outMessages);
+        writer.writeUInt64BE(droppedMessages);
+        writer.writeUInt8(acknowledgementReceived ? 1 : 0);
+
+        writeHeaders(writer, receivedPackets);
+        writeHeaders(writer, sentPackets);
+
+        writer.writeUInt32BE(invokeId);
+        writer.writeUInt32BE(static_cast<uint32_t>(invokes.size()));
+        for (const auto& invoke : invokes)
+        {
+            writer.writeUInt32BE(invoke.first);
+            handoff::writeString(writer, invoke.second);
+        }
+
+        writer.writeUInt32BE(streamId);
+        writer.writeUInt8(static_cast<uint8_t>(direction));
+        handoff::writeString(writer, applicationName);
+        handoff::writeString(writer, streamName);
+        writer.writeUInt8(connected ? 1 : 0);
+        writer.writeUInt8(streaming ? 1 : 0);
+        writer.writeUInt8(videoFrameSent ? 1 : 0);
+        writer.writeDouble(pingInterval);
+        writer.writeUInt32BE(bufferSize);
+        writer.writeUInt8(static_cast<uint8_t>(amfVersion));
+        writeMetaData(writer, metaData);
+
+        handoff::writeBuffer(writer, data);
+        handoff::writeBuffer(writer, socket.getOutData());
+
+        // the input carries the headers that new outputs of the stream need
+        if (direction == Direction::INPUT && stream && streaming)
+        {
+            writer.writeUInt8(1);
+            handoff::writeBuffer(writer, stream->getAudioHeader());
+            handoff::writeBuffer(writer, stream->getVideoHeader());
+            writeMetaData(writer, stream->getMetaData());
+        }
+        else
+        {
+            writer.writeUInt8(0);
+        }
+    }
 
-                str += "</td></tr>";
-                break;
-            }
-            case ReportType::JSON:
+    bool Connection::restoreSession(const std::vector<uint8_t>& buffer)
+    {
+        ByteReader reader(buffer);
+
+        uint8_t acknowledged;
+        uint32_t invokeCount;
+        uint8_t newDirection;
+        uint8_t newConnected;
+        uint8_t newStreaming;
+        uint8_t newVideoFrameSent;
+        double newPingInterval;
+        uint8_t newAMFVersion;
+        std::vector<uint8_t> outData;
+        uint8_t hasHeaders;
+
+        if (!reader.readUInt32BE(inChunkSize) ||
+            !reader.readUInt32BE(outChunkSize) ||
+            !reader.readUInt32BE(serverBandwidth) ||
+            !reader.readUInt32BE(peerBandwidth) ||
+            !reader.readUInt64BE(inBytes) ||
+            !reader.readUInt64BE(inBytesAcknowledged) ||
+            !reader.readUInt64BE(outBytes) ||
+            !reader.readUInt32BE(outBytesAcknowledged) ||
+            !reader.readUInt64BE(inMessages) ||
+            !reader.readUInt64BE(outMessages) ||
+            !reader.readUInt64BE(droppedMessages) ||
+            !reader.readUInt8(acknowledged) ||
+            !readHeaders(reader, receivedPackets) ||
+            !readHeaders(reader, sentPackets) ||
+            !reader.readUInt32BE(invokeId) ||
+            !reader.readUInt32BE(invokeCount))
+        {
+            RELAY_LOG(Log::Level::ERR) << idString << "Invalid handoff session";
+            return false;
+        }
+
+        for (uint32_t i = 0; i < invokeCount; ++i)
+        {
+            uint32_t invoke;
+            std::string commandName;
+
+            if (!reader.readUInt32BE(invoke) || !handoff::readString(reader, commandName))
             {
-                str += "{\"id\":" + std::to_string(id) + "," +
-                    "\"name\":\"" + streamName + "\","
-                    "\"application\":\"" + applicationName + "\"," +
-                    "\"status\":" + (socket.isReady() ? "\"connected\"" : "\"not connected\"") + "," +
-                    "\"address\":\"" + ipToString(socket.getRemoteIPAddress()) + ":" + std::to_string(socket.getRemotePort()) + "\"," +
-                    "\"connection\":";
-
-                switch (type)
-                {
-                    case Type::HOST: str += "\"HOST\""; break;
-                    case Type::CLIENT: str += "\"CLIENT\""; break;
-                }
+                RELAY_LOG(Log::Level::ERR) << idString << "Invalid handoff session";
+                return false;
+            }
 
-                str += ",\"state\":";
+            invokes[invoke] = commandName;
+        }
+
+        if (!reader.readUInt32BE(streamId) ||
+            !reader.readUInt8(newDirection) ||
+            !handoff::readString(reader, applicationName) ||
+            !handoff::readString(reader, streamName) ||
+            !reader.readUInt8(newConnected) ||
+            !reader.readUInt8(newStreaming) ||
+            !reader.readUInt8(newVideoFrameSent) ||
+            !reader.readDouble(newPingInterval) ||
+            !reader.readUInt32BE(bufferSize) ||
+            !reader.readUInt8(newAMFVersion) ||
+            !readMetaData(reader, metaData) ||
+            !handoff::readBuffer(reader, data) ||
+            !handoff::readBuffer(reader, outData) ||
+            !reader.readUInt8(hasHeaders))
+        {
+            RELAY_LOG(Log::Level::ERR) << idString << "Invalid handoff session";
+            return false;
+        }
+
+        acknowledgementReceived = (acknowledged != 0);
+        direction = static_cast<Direction>(newDirection);
+        connected = (newConnected != 0);
+        videoFrameSent = (newVideoFrameSent != 0);
+        pingInterval = static_cast<float>(newPingInterval);
+        amfVersion = static_cast<amf::Version>(newAMFVersion);
+        updateIdString();
+        setState(State::HANDSHAKE_DONE);
 
-                switch (state)
-                {
-                    case State::UNINITIALIZED: str += "\"UNINITIALIZED\""; break;
-                    case State::VERSION_RECEIVED: str += "\"VERSION_RECEIVED\""; break;
-                    case State::VERSION_SENT: str += "\"VERSION_SENT\""; break;
-                    case State::ACK_SENT: str += "\"ACK_SENT\","; break;
-                    case State::HANDSHAKE_DONE: str += "\"HANDSHAKE_DONE\""; break;
-                }
+        // queued before anything else is sent
+        if (!outData.empty()) socket.send(outData);
 
-                str += ",\"direction\":";
+        RELAY_LOG(Log::Level::INFO) << idString << "Session restored, chunk size " << inChunkSize << "/" << outChunkSize << ", " << data.size() << " bytes pending";
 
-                switch (direction)
-                {
-                    case Direction::NONE: str += "\"NONE\""; break;
-                    case Direction::INPUT: str += "\"INPUT\""; break;
-                    case Direction::OUTPUT: str += "\"OUTPUT\""; break;
-                }
+        if (!newStreaming || direction == Direction::NONE) return true;
 
-                if (stream) str += ",\"serverId\":" + std::to_string(stream->getServer().getId());
+        std::vector<std::pair<Server*, const Endpoint*>> endpoints = relay.getEndpoints(std::make_pair(socket.getLocalIPAddress(), socket.getLocalPort()), direction, applicationName, streamName);
 
-                if (metaData.getType() == amf::Node::Type::Dictionary ||
-                    metaData.getType() == amf::Node::Type::Object)
-                {
-                    str += ",\"metaData\":{";
-                    bool first = true;
+        if (endpoints.empty())
+        {
+            RELAY_LOG(Log::Level::WARN) << idString << "Invalid stream \"" << applicationName << "/" << streamName << "\" after handoff, disconnecting";
+            return false;
+        }
 
-                    for (const std::pair<std::string, amf::Node>& value : metaData.asMap())
-                    {
-                        if (!first) str += ", ";
-                        first = false;
-                        if (value.second.getType() == amf::Node::Type::Boolean)
-                        {
-                            str += "\"" + escapeString(value.first) + "\":" + (value.second.asBool() ? "true" : "false");
-                        }
-                        else if (value.second.isNumber())
-                        {
-                            str += "\"" + escapeString(value.first) + "\":" + value.second.toString();
-                        }
-                        else
-                        {
-                            str += "\"" + escapeString(value.first) + "\":\"" + escapeString(value.second.toString()) + "\"";
-                        }
-                    }
+        Server* server = endpoints.front().first;
+        endpoint = endpoints.front().second;
 
-                    str += "}";
-                }
+        Stream* newStream = server->findStream(applicationName, streamName);
+        if (!newStream)
+        {
+            newStream = server->createStream(applicationName, streamName);
+        }
+        else if (direction == Direction::INPUT && newStream->getInputConnection())
+        {
+            RELAY_LOG(Log::Level::WARN) << idString << "Stream \"" << applicationName << "/" << streamName << "\" already has input after handoff, disconnecting";
+            return false;
+        }
 
-                str += "}";
-                break;
+        stream = newStream;
+        streaming = true;
+        stream->start(*this);
+
+        if (hasHeaders)
+        {
+            std::vector<uint8_t> audioHeader;
+            std::vector<uint8_t> videoHeader;
+            amf::Node streamMetaData;
+
+            if (!handoff::readBuffer(reader, audioHeader) ||
+                !handoff::readBuffer(reader, videoHeader) ||
+                !readMetaData(reader, streamMetaData))
+            {
+                RELAY_LOG(Log::Level::ERR) << idString << "Invalid handoff session";
+                return false;
             }
+
+            stream->restoreHeaders(audioHeader, videoHeader, streamMetaData);
         }
+
+        return true;
     }
 
     void Connection::connect()
@@ -385,6 +782,7 @@ namespace relay
 
         if (addressIndex < endpoint->addresses.size())
         {
+            ++relay.getCounters().clientConnections;
             socket.connect(endpoint->addresses[addressIndex].ipAddresses.first,
                            endpoint->addresses[addressIndex].ipAddresses.second);
         }
@@ -401,36 +799,26 @@ namespace relay
         // handshake
         if (type == Type::CLIENT)
         {
-            Log(Log::Level::INFO) << idString << "Connected to " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort();
+            RELAY_LOG(Log::Level::INFO) << idString << "Connected to " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort();
+
+            std::vector<uint8_t> handshake(sizeof(uint8_t) + sizeof(rtmp::Challenge));
 
             // C0
-            std::vector<uint8_t> version;
-            version.push_back(RTMP_VERSION);
-            socket.send(version);
+            handshake[0] = RTMP_VERSION;
 
-            Log(Log::Level::ALL) << idString << "Sending version message " << RTMP_VERSION;
+            RELAY_LOG(Log::Level::ALL) << idString << "Sending version message " << RTMP_VERSION;
 
             // C1
-            rtmp::Challenge challenge;
-            challenge.time = 0;
-            std::copy(RTMP_SERVER_VERSION, RTMP_SERVER_VERSION + sizeof(RTMP_SERVER_VERSION), challenge.version);
-
-            for (size_t i = 0; i < sizeof(challenge.randomBytes); ++i)
-            {
-                uint32_t randomValue = std::uniform_int_distribution<uint32_t>{0, 255}(relay.getGenerator());
-
-                challenge.randomBytes[i] = static_cast<uint8_t>(randomValue);
-            }
+            rtmp::Challenge* challenge = reinterpret_cast<rtmp::Challenge*>(handshake.data() + sizeof(uint8_t));
+            // time is left zero
+            std::copy(RTMP_SERVER_VERSION, RTMP_SERVER_VERSION + sizeof(RTMP_SERVER_VERSION), challenge->version);
+            relay.generateRandomBytes(challenge->randomBytes, sizeof(challenge->randomBytes));
 
-            std::vector<uint8_t> challengeMessage;
-            challengeMessage.insert(challengeMessage.begin(),
-                                    reinterpret_cast<uint8_t*>(&challenge),
-                                    reinterpret_cast<uint8_t*>(&challenge) + sizeof(challenge));
-            socket.send(challengeMessage);
+            sendData(handshake);
 
-            Log(Log::Level::ALL) << idString << "Sending challenge message";
+            RELAY_LOG(Log::Level::ALL) << idString << "Sending challenge message";
 
-            state = State::VERSION_SENT;
+            setState(State::VERSION_SENT);
         }
     }
 
@@ -440,9 +828,16 @@ namespace relay
 
     void Connection::handleRead(Socket&, const std::vector<uint8_t>& newData)
     {
+        // a refused connection only waits for its reply to be sent
+        if (closing) return;
+
+        auto startTime = std::chrono::steady_clock::now();
+
         data.insert(data.end(), newData.begin(), newData.end());
+        relay.getMemoryTotals().inputBuffers += newData.size();
+        inBytes += newData.size();
 
-        Log(Log::Level::ALL) << idString << "Got " << std::to_string(newData.size()) << " bytes";
+        RELAY_LOG(Log::Level::ALL) << idString << "Got " << std::to_string(newData.size()) << " bytes";
 
         uint32_t offset = 0;
 
@@ -452,18 +847,34 @@ namespace relay
             {
                 rtmp::Packet packet;
 
-                uint32_t ret = packet.decode(data, offset, inChunkSize, receivedPackets);
+                uint32_t ret = packet.decode(data, offset, inChunkSize, receivedPackets, &bufferPool);
+
+                // the length is known once the header is parsed, don't accept or wait for the rest of a larger message
+                if (packet.length > relay.getMemoryLimits().maxMessageSize)
+                {
+                    bufferPool.release(packet.data);
+
+                    RELAY_LOG(Log::Level::ERR) << idString << "Message of " << packet.length << " bytes exceeds the maximum message size, disconnecting";
+                    ++relay.getCounters().oversizedMessages;
+                    close(true);
+                    return;
+                }
 
                 if (ret > 0)
                 {
-                    Log(Log::Level::ALL) << idString << "Total packet size: " << ret;
+                    RELAY_LOG(Log::Level::ALL) << idString << "Total packet size: " << ret;
 
                     offset += ret;
+                    ++inMessages;
 
                     handlePacket(packet);
+                    bufferPool.release(packet.data);
+
+                    if (closing) break;
                 }
                 else
                 {
+                    bufferPool.release(packet.data);
                     break;
                 }
             }
@@ -475,76 +886,45 @@ namespace relay
                     {
                         // C0
                         uint8_t version = *(data.data() + offset);
-                        offset += sizeof(version);
-
-                        Log(Log::Level::ALL) << idString << "Got version " << static_cast<uint32_t>(version);
 
                         if (version != 0x03)
                         {
-                            Log(Log::Level::ERR) << idString << "Unsupported version(" << version << "), disconnecting";
+                            RELAY_LOG(Log::Level::ERR) << idString << "Unsupported version(" << static_cast<uint32_t>(version) << "), disconnecting";
                             close();
                             break;
                         }
-
-                        // S0
-                        std::vector<uint8_t> reply;
-                        reply.push_back(RTMP_VERSION);
-                        socket.send(reply);
-                        Log(Log::Level::ALL) << idString << "Sending reply version " << RTMP_VERSION;
-
-                        state = State::VERSION_SENT;
-                    }
-                    else
-                    {
-                        break;
                     }
-                }
-                else if (state == State::VERSION_SENT)
-                {
-                    if (data.size() - offset >= sizeof(rtmp::Challenge))
+
+                    // wait for both C0 and C1, so that S0, S1 and S2 can be sent with one write
+                    if (data.size() - offset >= sizeof(uint8_t) + sizeof(rtmp::Challenge))
                     {
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got version " << static_cast<uint32_t>(*(data.data() + offset));
+                        offset += sizeof(uint8_t);
+
                         // C1
-                        rtmp::Challenge* challenge = reinterpret_cast<rtmp::Challenge*>(data.data() + offset);
+                        const uint8_t* challengeData = data.data() + offset;
+                        const rtmp::Challenge* challenge = reinterpret_cast<const rtmp::Challenge*>(challengeData);
                         offset += sizeof(*challenge);
 
-                        Log(Log::Level::ALL) << idString << "Got challenge message, time: " << challenge->time <<
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got challenge message, time: " << challenge->time <<
                         ", version: " << static_cast<uint32_t>(challenge->version[0]) << "." <<
                         static_cast<uint32_t>(challenge->version[1]) << "." <<
                         static_cast<uint32_t>(challenge->version[2]) << "." <<
                         static_cast<uint32_t>(challenge->version[3]);
 
-                        // S1
-                        rtmp::Challenge replyChallenge;
-                        replyChallenge.time = 0;
-                        std::copy(RTMP_SERVER_VERSION, RTMP_SERVER_VERSION + sizeof(RTMP_SERVER_VERSION), replyChallenge.version);
+                        std::vector<uint8_t> reply(sizeof(uint8_t) + sizeof(rtmp::Challenge) + sizeof(rtmp::Ack));
 
-                        for (size_t i = 0; i < sizeof(replyChallenge.randomBytes); ++i)
+                        if (rtmp::writeHandshakeReply(challengeData, reply.data(),
+                                                      [this](uint8_t* randomData, size_t size) { relay.generateRandomBytes(randomData, size); }))
                         {
-                            uint32_t randomValue = std::uniform_int_distribution<uint32_t>{0, 255}(relay.getGenerator());
-                            replyChallenge.randomBytes[i] = static_cast<uint8_t>(randomValue);
+                            RELAY_LOG(Log::Level::ALL) << idString << "Using digest handshake";
                         }
 
-                        std::vector<uint8_t> reply;
-                        reply.insert(reply.begin(),
-                                     reinterpret_cast<uint8_t*>(&replyChallenge),
-                                     reinterpret_cast<uint8_t*>(&replyChallenge) + sizeof(replyChallenge));
-                        socket.send(reply);
-
-                        Log(Log::Level::ALL) << idString << "Sending challange reply message";
-
-                        // S2
-                        rtmp::Ack ack;
-                        ack.time = challenge->time;
-                        std::copy(challenge->version, challenge->version + sizeof(ack.version), ack.version);
-                        std::copy(challenge->randomBytes, challenge->randomBytes + sizeof(ack.randomBytes), ack.randomBytes);
-
-                        std::vector<uint8_t> ackData(reinterpret_cast<uint8_t*>(&ack),
-                                                     reinterpret_cast<uint8_t*>(&ack) + sizeof(ack));
-                        socket.send(ackData);
+                        sendData(reply);
 
-                        Log(Log::Level::ALL) << idString << "Sending Ack message";
+                        RELAY_LOG(Log::Level::ALL) << idString << "Sending reply version " << RTMP_VERSION << ", challenge reply and Ack message";
 
-                        state = State::ACK_SENT;
+                        setState(State::ACK_SENT);
                     }
                     else
                     {
@@ -559,14 +939,15 @@ namespace relay
                         rtmp::Ack* ack = reinterpret_cast<rtmp::Ack*>(data.data() + offset);
                         offset += sizeof(*ack);
 
-                        Log(Log::Level::ALL) << idString << "Got Ack reply message, time: " << ack->time <<
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got Ack reply message, time: " << ack->time <<
                             ", version: " << static_cast<uint32_t>(ack->version[0]) << "." <<
                         static_cast<uint32_t>(ack->version[1]) << "." <<
                         static_cast<uint32_t>(ack->version[2]) << "." <<
                         static_cast<uint32_t>(ack->version[3]);
-                        Log(Log::Level::ALL) << idString << "Handshake done";
+                        RELAY_LOG(Log::Level::ALL) << idString << "Handshake done";
 
-                        state = State::HANDSHAKE_DONE;
+                        setState(State::HANDSHAKE_DONE);
+                        ++relay.getCounters().completedHandshakes;
                     }
                     else
                     {
@@ -584,16 +965,16 @@ namespace relay
                         uint8_t version = *(data.data() + offset);
                         offset += sizeof(version);
 
-                        Log(Log::Level::ALL) << idString << "Got reply version " << static_cast<uint32_t>(version);
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got reply version " << static_cast<uint32_t>(version);
 
                         if (version != 0x03)
                         {
-                            Log(Log::Level::ERR) << idString << "Unsupported version (" << version << "), disconnecting";
+                            RELAY_LOG(Log::Level::ERR) << idString << "Unsupported version (" << version << "), disconnecting";
                             close();
                             break;
                         }
 
-                        state = State::VERSION_RECEIVED;
+                        setState(State::VERSION_RECEIVED);
                     }
                     else
                     {
@@ -608,7 +989,7 @@ namespace relay
                         rtmp::Challenge* challenge = reinterpret_cast<rtmp::Challenge*>(data.data() + offset);
                         offset += sizeof(*challenge);
 
-                        Log(Log::Level::ALL) << idString << "Got challenge reply message, time: " << challenge->time <<
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got challenge reply message, time: " << challenge->time <<
                             ", version: " << static_cast<uint32_t>(challenge->version[0]) << "." <<
                         static_cast<uint32_t>(challenge->version[1]) << "." <<
                         static_cast<uint32_t>(challenge->version[2]) << "." <<
@@ -622,11 +1003,11 @@ namespace relay
 
                         std::vector<uint8_t> ackData(reinterpret_cast<uint8_t*>(&ack),
                                                      reinterpret_cast<uint8_t*>(&ack) + sizeof(ack));
-                        socket.send(ackData);
+                        sendData(ackData);
 
-                        Log(Log::Level::ALL) << "[" << id << ", " << name << " " << applicationName << "/" << streamName << "] " << "Sending Ack message";
+                        RELAY_LOG(Log::Level::ALL) << "[" << id << ", " << name << " " << applicationName << "/" << streamName << "] " << "Sending Ack message";
 
-                        state = State::ACK_SENT;
+                        setState(State::ACK_SENT);
                     }
                     else
                     {
@@ -641,18 +1022,20 @@ namespace relay
                         rtmp::Ack* ack = reinterpret_cast<rtmp::Ack*>(data.data() + offset);
                         offset += sizeof(*ack);
 
-                        Log(Log::Level::ALL) << idString << "Got Ack reply message, time: " << ack->time <<
+                        RELAY_LOG(Log::Level::ALL) << idString << "Got Ack reply message, time: " << ack->time <<
                             ", version: " << static_cast<uint32_t>(ack->version[0]) << "." <<
                             static_cast<uint32_t>(ack->version[1]) << "." <<
                             static_cast<uint32_t>(ack->version[2]) << "." <<
                             static_cast<uint32_t>(ack->version[3]);
-                        Log(Log::Level::ALL) << idString << "Handshake done";
+                        RELAY_LOG(Log::Level::ALL) << idString << "Handshake done";
                         
-                        state = State::HANDSHAKE_DONE;
+                        setState(State::HANDSHAKE_DONE);
+                        ++relay.getCounters().completedHandshakes;
 
-                        Log(Log::Level::ALL) << idString << "Connecting to application " << applicationName;
+                        RELAY_LOG(Log::Level::ALL) << idString << "Connecting to application " << applicationName;
 
                         sendConnect();
+                        sendServerBandwidth();
                     }
                     else
                     {
@@ -666,22 +1049,45 @@ namespace relay
         {
             if (socket.isReady())
             {
-                Log(Log::Level::ERR) << idString << "Reading outside of the buffer, buffer size: " << static_cast<uint32_t>(data.size()) << ", data size: " << offset;
+                RELAY_LOG(Log::Level::ERR) << idString << "Reading outside of the buffer, buffer size: " << static_cast<uint32_t>(data.size()) << ", data size: " << offset;
             }
 
+            relay.getMemoryTotals().inputBuffers -= data.size();
             data.clear();
         }
         else
         {
             data.erase(data.begin(), data.begin() + offset);
-            
-            Log(Log::Level::ALL) << idString << "Remaining data " << data.size();
+            relay.getMemoryTotals().inputBuffers -= offset;
+
+            RELAY_LOG(Log::Level::ALL) << idString << "Remaining data " << data.size();
+        }
+
+        // the invoke arena only grows or shrinks while packets are handled
+        if (invokeArena.getSize() != arenaSize)
+        {
+            MemoryUsage& memoryTotals = relay.getMemoryTotals();
+            memoryTotals.arenas += invokeArena.getSize();
+            memoryTotals.arenas -= arenaSize;
+            arenaSize = invokeArena.getSize();
+        }
+
+        // acknowledge received bytes once the window announced by the peer is full
+        if (state == State::HANDSHAKE_DONE &&
+            peerBandwidth > 0 &&
+            inBytes - inBytesAcknowledged >= peerBandwidth)
+        {
+            sendBytesRead();
         }
+
+        relay.checkCallbackTime(startTime, idString, "read");
     }
 
     void Connection::handleClose(Socket&)
     {
-        Log(Log::Level::INFO) << idString << "Handle close connection at " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " disconnected";
+        RELAY_LOG(Log::Level::INFO) << idString << "Handle close connection at " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " disconnected";
+
+        if (Status* status = relay.getStatus()) status->publishConnectionEvent(*this, true);
 
         reset();
 
@@ -689,22 +1095,26 @@ namespace relay
         timeSinceConnect = 0.0f;
     }
 
+    void Connection::handleFlush(Socket&, uint64_t latency)
+    {
+        latencyHistogram.record(latency);
+        if (stream) stream->recordLatency(latency);
+    }
+
     bool Connection::handlePacket(const rtmp::Packet& packet)
     {
         switch (packet.messageType)
         {
             case rtmp::MessageType::SET_CHUNK_SIZE:
             {
-                uint32_t offset = 0;
-
-                uint32_t ret = decodeIntBE(packet.data, offset, 4, inChunkSize);
+                ByteReader reader(packet.data);
 
-                if (ret == 0)
+                if (!reader.readUInt32BE(inChunkSize))
                 {
                     return false;
                 }
 
-                Log(Log::Level::ALL) << idString << "Received SET_CHUNK_SIZE, parameter: " << inChunkSize;
+                RELAY_LOG(Log::Level::ALL) << idString << "Received SET_CHUNK_SIZE, parameter: " << inChunkSize;
 
                 if (type == Type::CLIENT)
                 {
@@ -716,53 +1126,49 @@ namespace relay
 
             case rtmp::MessageType::ABORT:
             {
-                Log(Log::Level::ALL) << idString << "Received ABORT";
+                RELAY_LOG(Log::Level::ALL) << idString << "Received ABORT";
                 break;
             }
 
             case rtmp::MessageType::BYTES_READ:
             {
-                uint32_t offset = 0;
+                ByteReader reader(packet.data);
                 uint32_t bytesRead;
 
-                uint32_t ret = decodeIntBE(packet.data, offset, 4, bytesRead);
-
-                if (ret == 0)
+                if (!reader.readUInt32BE(bytesRead))
                 {
                     return false;
                 }
 
-                Log(Log::Level::ALL) << idString << "Received BYTES_READ, parameter: " << bytesRead;
+                RELAY_LOG(Log::Level::ALL) << idString << "Received BYTES_READ, parameter: " << bytesRead;
+
+                outBytesAcknowledged = bytesRead;
+                acknowledgementReceived = true;
 
                 break;
             }
 
             case rtmp::MessageType::USER_CONTROL:
             {
-                uint32_t offset = 0;
+                ByteReader reader(packet.data);
 
                 uint16_t argument;
-                uint32_t ret = decodeIntBE(packet.data, offset, 2, argument);
-
-                rtmp::UserControlType userControlType = static_cast<rtmp::UserControlType>(argument);
 
-                if (ret == 0)
+                if (!reader.readUInt16BE(argument))
                 {
                     return false;
                 }
 
-                offset += ret;
+                rtmp::UserControlType userControlType = static_cast<rtmp::UserControlType>(argument);
 
                 uint32_t param;
-                ret = decodeIntBE(packet.data, offset, 4, param);
 
-                if (ret == 0)
+                if (!reader.readUInt32BE(param))
                 {
                     return false;
                 }
 
-                offset += ret;
-
+                if (Log::isEnabled(Log::Level::ALL))
                 {
                     Log log(Log::Level::ALL);
                     log << idString << "Received PING, type: ";
@@ -774,14 +1180,17 @@ namespace relay
                         case rtmp::UserControlType::CLIENT_BUFFER_TIME: log << "CLIENT_BUFFER_TIME"; break;
                         case rtmp::UserControlType::RESET_STREAM: log << "RESET_STREAM"; break;
                         case rtmp::UserControlType::PING: log << "PING"; break;
-                        case rtmp::UserControlType::PONG: log << "PONG";
-                            timeSincePong = 0;
-                            break;
+                        case rtmp::UserControlType::PONG: log << "PONG"; break;
                     }
 
                     log << ", param: " << param;
                 }
 
+                if (userControlType == rtmp::UserControlType::PONG)
+                {
+                    timeSincePong = 0;
+                }
+
                 if (userControlType == rtmp::UserControlType::PING)
                 {
                     sendUserControl(rtmp::UserControlType::PONG, packet.timestamp);
@@ -792,48 +1201,48 @@ namespace relay
 
             case rtmp::MessageType::SERVER_BANDWIDTH:
             {
-                uint32_t offset = 0;
+                ByteReader reader(packet.data);
 
                 uint32_t bandwidth;
-                uint32_t ret = decodeIntBE(packet.data, offset, 4, bandwidth);
 
-                if (ret == 0)
+                if (!reader.readUInt32BE(bandwidth))
                 {
                     return false;
                 }
 
-                offset += ret;
+                RELAY_LOG(Log::Level::ALL) << idString << "Received SERVER_BANDWIDTH, parameter: " << bandwidth;
 
-                Log(Log::Level::ALL) << idString << "Received SERVER_BANDWIDTH, parameter: " << bandwidth;
+                peerBandwidth = bandwidth;
 
                 break;
             }
 
             case rtmp::MessageType::CLIENT_BANDWIDTH:
             {
-                uint32_t offset = 0;
+                ByteReader reader(packet.data);
 
                 uint32_t bandwidth;
-                uint32_t ret = decodeIntBE(packet.data, offset, 4, bandwidth);
 
-                if (ret == 0)
+                if (!reader.readUInt32BE(bandwidth))
                 {
                     return false;
                 }
 
-                offset += ret;
-
                 uint8_t bandwidthType;
-                ret = decodeIntBE(packet.data, offset, 1, bandwidthType);
 
-                if (ret == 0)
+                if (!reader.readUInt8(bandwidthType))
                 {
                     return false;
                 }
 
-                offset += ret;
+                RELAY_LOG(Log::Level::ALL) << idString << "Received CLIENT_BANDWIDTH, parameter: " << bandwidth << ", type: " << static_cast<uint32_t>(bandwidthType);
 
-                Log(Log::Level::ALL) << idString << "Received CLIENT_BANDWIDTH, parameter: " << bandwidth << ", type: " << bandwidthType;
+                // the peer limits our output, announce the matching acknowledgement window
+                if (bandwidth != serverBandwidth)
+                {
+                    serverBandwidth = bandwidth;
+                    sendServerBandwidth();
+                }
 
                 break;
             }
@@ -841,21 +1250,17 @@ namespace relay
             case rtmp::MessageType::AMF0_DATA:
             case rtmp::MessageType::AMF3_DATA:
             {
-                uint32_t offset = 0;
-                uint32_t ret;
+                ByteReader reader(packet.data);
 
                 if (packet.messageType == rtmp::MessageType::AMF3_DATA)
                 {
                     uint8_t header;
-                    ret = decodeIntBE(packet.data, offset, sizeof(uint8_t), header);
 
-                    if (ret == 0)
+                    if (!reader.readUInt8(header))
                     {
                         return false;
                     }
 
-                    offset += ret;
-
                     // no documentation states what this byte means, but it usually is 0
                     if (header != 0)
                     {
@@ -866,101 +1271,94 @@ namespace relay
                 // only input can receive notify packets
                 if (direction == Direction::INPUT)
                 {
-                    amf::Node command;
-
-                    ret = command.decode(amf::Version::AMF0, packet.data, offset);
+                    // data messages are inspected in place, only meta data gets decoded
+                    amf::View command;
 
-                    if (ret == 0)
+                    if (!amf::View::read(reader, command))
                     {
                         return false;
                     }
 
-                    offset += ret;
+                    amf::View argument1;
+                    amf::View argument2;
 
+                    if (amf::View::read(reader, argument1))
                     {
-                        Log log(Log::Level::ALL);
-                        log << idString << "Received NOTIFY, command: ";
-                        command.dump(log);
+                        amf::View::read(reader, argument2);
                     }
 
-                    amf::Node argument1;
-
-                    if ((ret = argument1.decode(amf::Version::AMF0, packet.data, offset))  > 0)
+                    if (Log::isEnabled(Log::Level::ALL))
                     {
-                        offset += ret;
-
-                        Log log(Log::Level::ALL);
-                        log << idString << "Argument 1: ";
-                        argument1.dump(log);
-                    }
+                        amf::Node node;
 
-                    amf::Node argument2;
+                        if (command.toNode(node))
+                        {
+                            Log log(Log::Level::ALL);
+                            log << idString << "Received NOTIFY, command: ";
+                            node.dump(log);
+                        }
 
-                    if ((ret = argument2.decode(amf::Version::AMF0, packet.data, offset)) > 0)
-                    {
-                        offset += ret;
+                        node = amf::Node();
 
-                        Log log(Log::Level::ALL);
-                        log << idString << "Argument 2: ";
-                        argument2.dump(log);
-                    }
-
-                    if (command.asString() == "@setDataFrame" &&
-                        argument1.asString() == "onMetaData" &&
-                        (argument2.getType() == amf::Node::Type::Dictionary ||
-                         argument2.getType() == amf::Node::Type::Object))
-                    {
-                        metaData = argument2;
-
-                        if (metaData.hasElement("audiocodecid"))
+                        if (argument1.isValid() && argument1.toNode(node))
                         {
-                            if (metaData["audiocodecid"].isNumber())
-                                Log(Log::Level::ALL) << "Audio codec: " << getAudioCodec(static_cast<AudioCodec>(metaData["audiocodecid"].asUInt32()));
-                            else if (metaData["audiocodecid"].isString())
-                                Log(Log::Level::ALL) << "Audio codec: " << metaData["audiocodecid"].asString();
+                            Log log(Log::Level::ALL);
+                            log << idString << "Argument 1: ";
+                            node.dump(log);
                         }
 
-                        if (metaData.hasElement("videocodecid"))
-                        {
-                            if (metaData["videocodecid"].isNumber())
-                                Log(Log::Level::ALL) << "Video codec: " << getVideoCodec(static_cast<VideoCodec>(metaData["videocodecid"].asUInt32()));
-                            else if (metaData["videocodecid"].isString())
-                                Log(Log::Level::ALL) << "Video codec: " << metaData["videocodecid"].asString();
-                        }
+                        node = amf::Node();
 
-                        // forward notify packet
-                        if (stream)
+                        if (argument2.isValid() && argument2.toNode(node))
                         {
-                            stream->sendMetaData(metaData);
-                            timeSinceLastData = 0;
+                            Log log(Log::Level::ALL);
+                            log << idString << "Argument 2: ";
+                            node.dump(log);
                         }
-                        else
+                    }
+
+                    amf::View metaDataView;
+
+                    if (command.equals("@setDataFrame") &&
+                        argument1.equals("onMetaData") &&
+                        argument2.isMap())
+                    {
+                        metaDataView = argument2;
+                    }
+                    else if (command.equals("onMetaData") &&
+                             argument1.isMap())
+                    {
+                        metaDataView = argument1;
+                    }
+
+                    if (metaDataView.isValid())
+                    {
+                        amf::Node newMetaData;
+
+                        // AMF3 arrays without associative members decode to plain arrays
+                        if (!metaDataView.toNode(newMetaData) ||
+                            (newMetaData.getType() != amf::Node::Type::Object &&
+                             newMetaData.getType() != amf::Node::Type::Dictionary))
                         {
-                            Log(Log::Level::ERR) << idString << "Not server, disconnecting - setDataFrame > onMetaData";
-                            close();
                             return false;
                         }
-                    }
-                    else if (command.asString() == "onMetaData" &&
-                             (argument1.getType() == amf::Node::Type::Dictionary ||
-                              argument1.getType() == amf::Node::Type::Object))
-                    {
-                        metaData = argument1;
+
+                        metaData = newMetaData;
 
                         if (metaData.hasElement("audiocodecid"))
                         {
                             if (metaData["audiocodecid"].isNumber())
-                                Log(Log::Level::ALL) << "Audio codec: " << getAudioCodec(static_cast<AudioCodec>(metaData["audiocodecid"].asUInt32()));
+                                RELAY_LOG(Log::Level::ALL) << "Audio codec: " << getAudioCodec(static_cast<AudioCodec>(metaData["audiocodecid"].asUInt32()));
                             else if (metaData["audiocodecid"].isString())
-                                Log(Log::Level::ALL) << "Audio codec: " << metaData["audiocodecid"].asString();
+                                RELAY_LOG(Log::Level::ALL) << "Audio codec: " << metaData["audiocodecid"].asString();
                         }
 
                         if (metaData.hasElement("videocodecid"))
                         {
                             if (metaData["videocodecid"].isNumber())
-                                Log(Log::Level::ALL) << "Video codec: " << getVideoCodec(static_cast<VideoCodec>(metaData["videocodecid"].asUInt32()));
+                                RELAY_LOG(Log::Level::ALL) << "Video codec: " << getVideoCodec(static_cast<VideoCodec>(metaData["videocodecid"].asUInt32()));
                             else if (metaData["videocodecid"].isString())
-                                Log(Log::Level::ALL) << "Video codec: " << metaData["videocodecid"].asString();
+                                RELAY_LOG(Log::Level::ALL) << "Video codec: " << metaData["videocodecid"].asString();
                         }
 
                         // forward notify packet
@@ -971,29 +1369,53 @@ namespace relay
                         }
                         else
                         {
-                            Log(Log::Level::ERR) << idString << "Not server, disconnecting - onMetaData";
+                            RELAY_LOG(Log::Level::ERR) << idString << "Not server, disconnecting - onMetaData";
                             close();
                             return false;
                         }
                     }
-                    else if (command.asString() == "onTextData")
+                    else if (command.equals("onTextData"))
                     {
                         if (stream)
                         {
-                            stream->sendTextData(packet.timestamp, argument1);
+                            // forwarded as received, without decoding the payload
+                            if (packet.messageType == rtmp::MessageType::AMF0_DATA)
+                            {
+                                stream->sendTextData(packet.timestamp, packet.data);
+                            }
+                            else
+                            {
+                                std::vector<uint8_t> textData(packet.data.begin() + 1, packet.data.end());
+                                stream->sendTextData(packet.timestamp, textData);
+                            }
+
                             timeSinceLastData = 0;
                         }
                         else
                         {
-                            Log(Log::Level::ERR) << idString << "Not server, disconnecting - onTextData";
+                            RELAY_LOG(Log::Level::ERR) << idString << "Not server, disconnecting - onTextData";
                             close();
                             return false;
                         }
                     }
+                    else if (command.equals(LATENCY_PROBE_COMMAND) &&
+                             argument1.isMap())
+                    {
+                        amf::Node probe;
+
+                        if (!argument1.toNode(probe))
+                        {
+                            return false;
+                        }
+
+                        // never forwarded as received, the stream re-stamps it for the next hop
+                        if (stream) stream->receiveLatencyProbe(probe);
+                        timeSinceLastData = 0;
+                    }
                 }
                 else
                 {
-                    Log(Log::Level::ERR) << idString << "Client sent notify packet to sender, disconnecting";
+                    RELAY_LOG(Log::Level::ERR) << idString << "Client sent notify packet to sender, disconnecting";
                     close();
                     return false;
                 }
@@ -1005,6 +1427,7 @@ namespace relay
                 // only input can receive audio packets
                 if (direction == Direction::INPUT)
                 {
+                    if (Log::isEnabled(Log::Level::ALL))
                     {
                         Log log(Log::Level::ALL);
                         log << idString << "Received AUDIO_PACKET";
@@ -1020,7 +1443,7 @@ namespace relay
                         AudioCodec codec = static_cast<AudioCodec>((format & 0xf0) >> 4);
                         uint32_t channels = (format & 0x01) + 1;
                         uint32_t sampleSize = (format & 0x02) ? 2 : 1;
-                        Log(Log::Level::ALL) << "Codec: " << getAudioCodec(codec) << ", channels: " << channels << ", sampleSize: " << sampleSize * 8;
+                        RELAY_LOG(Log::Level::ALL) << "Codec: " << getAudioCodec(codec) << ", channels: " << channels << ", sampleSize: " << sampleSize * 8;
 
                         if (stream)
                         {
@@ -1028,7 +1451,7 @@ namespace relay
                         }
                         else
                         {
-                            Log(Log::Level::ERR) << idString << "Not server, disconnecting - audio codec header";
+                            RELAY_LOG(Log::Level::ERR) << idString << "Not server, disconnecting - audio codec header";
                             close();
                             return false;
                         }
@@ -1038,11 +1461,11 @@ namespace relay
                         // forward audio packet
                         if (stream)
                         {
-                            stream->sendAudioFrame(packet.timestamp, packet.data);
+                            stream->sendAudioFrame(packet.timestamp, packet.data, socket.getReadTime());
                         }
                         else
                         {
-                            Log(Log::Level::ERR) << idString << "Not server, disconnecting - audio packet";
+                            RELAY_LOG(Log::Level::ERR) << idString << "Not server, disconnecting - audio packet";
                             close();
                             return false;
                         }
@@ -1050,7 +1473,7 @@ namespace relay
                 }
                 else
                 {
-                    Log(Log::Level::ERR) << idString << "Client sent audio packet to sender, disconnecting";
+                    RELAY_LOG(Log::Level::ERR) << idString << "Client sent audio packet to sender, disconnecting";
                     close();
                     return false;
                 }
@@ -1064,6 +1487,7 @@ namespace relay
                 {
                     VideoFrameType frameType = getVideoFrameType(packet.data);
 
+                    if (Log::isEnabled(Log::Level::ALL))
                     {
                         Log log(Log::Level::ALL);
                         log << idString << "Received VIDEO_PACKET";
@@ -1091,7 +1515,7 @@ namespace relay
                     {
                         uint8_t format = packet.data[0];
                         VideoCodec codec = static_cast<VideoCodec>(format & 0x0f);
-                        Log(Log::Level::ALL) << "Codec: " << getVideoCodec(codec);
+                        RELAY_LOG(Log::Level::ALL) << "Codec: " << getVideoCodec(codec);
 
                         if (stream)
                         {
@@ -1100,7 +1524,7 @@ namespace relay
                         }
                         else
                         {
-                            Log(Log::Level::ERR) << idString << "Not server, disconnecting - video header";
+                            RELAY_LOG(Log::Level::ERR) << idString << "Not server, disconnecting - video header";
                             close();
                             return false;
                         }
@@ -1110,11 +1534,11 @@ namespace relay
                         // forward video packet
                         if (stream)
                         {
-                            stream->sendVideoFrame(packet.timestamp, packet.data, frameType);
+                            stream->sendVideoFrame(packet.timestamp, packet.data, frameType, socket.getReadTime());
                         }
                         else
                         {
-                            Log(Log::Level::ERR) << idString << "Not server, disconnecting - video packet";
+                            RELAY_LOG(Log::Level::ERR) << idString << "Not server, disconnecting - video packet";
                             close();
                             return false;
                         }
@@ -1122,7 +1546,7 @@ namespace relay
                 }
                 else
                 {
-                    Log(Log::Level::ERR) << idString << "Client sent video packet to sender, disconnecting";
+                    RELAY_LOG(Log::Level::ERR) << idString << "Client sent video packet to sender, disconnecting";
                     close();
                     return false;
                 }
@@ -1132,21 +1556,22 @@ namespace relay
             case rtmp::MessageType::AMF0_INVOKE:
             case rtmp::MessageType::AMF3_INVOKE:
             {
-                uint32_t offset = 0;
+                ByteReader reader(packet.data);
                 uint32_t ret;
 
+                // all nodes of this message are released at once when leaving the case
+                Arena::Scope arenaScope(invokeArena);
+                amf::Node::Allocator allocator(&invokeArena);
+
                 if (packet.messageType == rtmp::MessageType::AMF3_INVOKE)
                 {
                     uint8_t header;
-                    ret = decodeIntBE(packet.data, offset, sizeof(uint8_t), header);
 
-                    if (ret == 0)
+                    if (!reader.readUInt8(header))
                     {
                         return false;
                     }
 
-                    offset += ret;
-
                     // no documentation states what this byte means, but it usually is 0
                     if (header != 0)
                     {
@@ -1154,527 +1579,629 @@ namespace relay
                     }
                 }
 
-                amf::Node command;
+                amf::Node command(allocator);
 
-                ret = command.decode(amf::Version::AMF0, packet.data, offset);
+                ret = command.decode(amf::Version::AMF0, reader);
 
                 if (ret == 0)
                 {
                     return false;
                 }
 
-                offset += ret;
-
+                if (Log::isEnabled(Log::Level::ALL))
                 {
                     Log log(Log::Level::ALL);
                     log << idString << "Received INVOKE, command: ";
                     command.dump(log);
                 }
 
-                amf::Node transactionId;
+                amf::Node transactionId(allocator);
 
-                ret = transactionId.decode(amf::Version::AMF0, packet.data, offset);
+                ret = transactionId.decode(amf::Version::AMF0, reader);
 
                 if (ret == 0)
                 {
                     return false;
                 }
 
-                offset += ret;
-
+                if (Log::isEnabled(Log::Level::ALL))
                 {
                     Log log(Log::Level::ALL);
                     log << idString << "Transaction ID: ";
                     transactionId.dump(log);
                 }
 
-                amf::Node argument1;
+                amf::Node argument1(allocator);
 
-                if ((ret = argument1.decode(amf::Version::AMF0, packet.data, offset)) > 0)
+                if ((ret = argument1.decode(amf::Version::AMF0, reader)) > 0 && Log::isEnabled(Log::Level::ALL))
                 {
-                    offset += ret;
-
                     Log log(Log::Level::ALL);
                     log << idString << "Argument 1: ";
                     argument1.dump(log);
                 }
 
-                if (command.asString() == "connect")
+                switch (getInvokeCommand(command.asString()))
                 {
-                    if (type == Type::HOST)
+                    case InvokeCommand::CONNECT:
                     {
-                        applicationName = argument1["app"].asString();
-
-                        if (argument1.hasElement("objectEncoding"))
+                        if (type == Type::HOST)
                         {
-                            amfVersion = (argument1["objectEncoding"].asDouble() == 3.0) ? amf::Version::AMF3 : amf::Version::AMF0;
-                        }
+                            applicationName = argument1["app"].asString();
 
-                        sendServerBandwidth();
-                        sendClientBandwidth();
-                        sendUserControl(rtmp::UserControlType::CLEAR_STREAM);
-                        sendSetChunkSize();
-                        sendConnectResult(transactionId.asDouble());
-                        sendOnBWDone();
+                            if (argument1.hasElement("objectEncoding"))
+                            {
+                                amfVersion = (argument1["objectEncoding"].asDouble() == 3.0) ? amf::Version::AMF3 : amf::Version::AMF0;
+                            }
+
+                            sendServerBandwidth();
+                            sendClientBandwidth();
+                            sendUserControl(rtmp::UserControlType::CLEAR_STREAM);
+                            sendSetChunkSize();
+                            sendConnectResult(transactionId.asDouble());
+                            sendOnBWDone();
 
-                        connected = true;
+                            connected = true;
 
-                        updateIdString();
-                        Log(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " sent connect, application: \"" << argument1["app"].asString() << "\"";
+                            updateIdString();
+                            RELAY_LOG(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " sent connect, application: \"" << argument1["app"].asString() << "\"";
 
 #ifdef DEBUG
-                        Log log(Log::Level::ALL);
-                        log << "Connect argument: ";
-                        argument1.dump(log);
+                            Log log(Log::Level::ALL);
+                            log << "Connect argument: ";
+                            argument1.dump(log);
 #endif
-                    }
-                    else
-                    {
-                        Log(Log::Level::INFO) << idString << "Invalid message (\"connect\") received, disconnecting";
-                        close();
-                        return false;
-                    }
-                }
-                else if (command.asString() == "onBWDone")
-                {
-                    if (type == Type::CLIENT)
-                    {
-                        sendCheckBW();
-                    }
-                    else
-                    {
-                        Log(Log::Level::INFO) << idString << "Invalid message (\"onBWDone\"), disconnecting";
-                        close();
-                        return false;
-                    }
-                }
-                else if (command.asString() == "_checkbw")
-                {
-                    if (type == Type::HOST)
-                    {
-                        sendCheckBWResult(transactionId.asDouble());
-                    }
-                    else
-                    {
-                        Log(Log::Level::INFO) << idString << "Invalid message (\"_checkbw\"), disconnecting";
-                        close();
-                        return false;
-                    }
-                }
-                else if (command.asString() == "createStream")
-                {
-                    if (type == Type::HOST)
-                    {
-                        sendCreateStreamResult(transactionId.asDouble());
-                    }
-                    else
-                    {
-                        Log(Log::Level::INFO) << idString << "Invalid message (\"createStream\"), disconnecting";
-                        close();
-                        return false;
-                    }
-                }
-                else if (command.asString() == "releaseStream")
-                {
-                    if (type == Type::HOST)
-                    {
-                        sendReleaseStreamResult(transactionId.asDouble());
-                    }
-                    else
-                    {
-                        Log(Log::Level::INFO) << idString << "Invalid message (\"releaseStream\"), disconnecting";
-                        close();
-                        return false;
-                    }
-                }
-                else if (command.asString() == "deleteStream")
-                {
-                    if (type == Type::HOST)
-                    {
-                        if (stream)
+                        }
+                        else
                         {
+                            RELAY_LOG(Log::Level::INFO) << idString << "Invalid message (\"connect\") received, disconnecting";
                             close();
+                            return false;
                         }
+
+                        break;
                     }
-                    else
-                    {
-                        Log(Log::Level::INFO) << idString << "Invalid message (\"deleteStream\"), disconnecting";
-                        close();
-                        return false;
-                    }
-                }
-                else if (command.asString() == "FCPublish")
-                {
-                    if (direction == Direction::NONE ||
-                        direction == Direction::INPUT)
-                    {
-                        sendOnFCPublish();
-                    }
-                    else if (direction == Direction::OUTPUT)
+
+                    case InvokeCommand::ON_BW_DONE:
                     {
-                        Log(Log::Level::ERR) << idString << "Invalid message (\"FCPublish\") received, disconnecting";
-                        close();
-                        return false;
+                        if (type == Type::CLIENT)
+                        {
+                            sendCheckBW();
+                        }
+                        else
+                        {
+                            RELAY_LOG(Log::Level::INFO) << idString << "Invalid message (\"onBWDone\"), disconnecting";
+                            close();
+                            return false;
+                        }
+
+                        break;
                     }
-                }
-                else if (command.asString() == "onFCPublish")
-                {
-                }
-                else if (command.asString() == "FCUnpublish")
-                {
-                    if (direction == Direction::INPUT)
-                    {
-                        Log(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " unpublished stream \"" << streamName << "\"";
 
-                        sendOnFCUnpublish();
+                    case InvokeCommand::CHECK_BW:
+                    {
+                        if (type == Type::HOST)
+                        {
+                            sendCheckBWResult(transactionId.asDouble());
+                        }
+                        else
+                        {
+                            RELAY_LOG(Log::Level::INFO) << idString << "Invalid message (\"_checkbw\"), disconnecting";
+                            close();
+                            return false;
+                        }
 
-                        close();
+                        break;
                     }
-                    else
+
+                    case InvokeCommand::CREATE_STREAM:
                     {
-                        // this is not a receiver
-                        Log(Log::Level::ERR) << idString << "Invalid message (\"FCUnpublish\") received, disconnecting";
-                        close();
-                        return false;
+                        if (type == Type::HOST)
+                        {
+                            sendCreateStreamResult(transactionId.asDouble());
+                        }
+                        else
+                        {
+                            RELAY_LOG(Log::Level::INFO) << idString << "Invalid message (\"createStream\"), disconnecting";
+                            close();
+                            return false;
+                        }
+
+                        break;
                     }
-                }
-                else if (command.asString() == "onFCUnpublish")
-                {
-                    if (direction == Direction::INPUT)
+
+                    case InvokeCommand::RELEASE_STREAM:
                     {
-                        // Do nothing
+                        if (type == Type::HOST)
+                        {
+                            sendReleaseStreamResult(transactionId.asDouble());
+                        }
+                        else
+                        {
+                            RELAY_LOG(Log::Level::INFO) << idString << "Invalid message (\"releaseStream\"), disconnecting";
+                            close();
+                            return false;
+                        }
+
+                        break;
                     }
-                    else
+
+                    case InvokeCommand::DELETE_STREAM:
                     {
-                        // this is not a receiver
-                        Log(Log::Level::ERR) << idString << "Invalid message (\"onFCUnpublish\") received, disconnecting";
-                        close();
-                        return false;
+                        if (type == Type::HOST)
+                        {
+                            if (stream)
+                            {
+                                close();
+                            }
+                        }
+                        else
+                        {
+                            RELAY_LOG(Log::Level::INFO) << idString << "Invalid message (\"deleteStream\"), disconnecting";
+                            close();
+                            return false;
+                        }
+
+                        break;
                     }
-                }
-                else if (command.asString() == "FCSubscribe")
-                {
-                    if (direction == Direction::NONE ||
-                        direction == Direction::OUTPUT)
+
+                    case InvokeCommand::FC_PUBLISH:
                     {
-                        sendOnFCSubscribe();
+                        if (direction == Direction::NONE ||
+                            direction == Direction::INPUT)
+                        {
+                            sendOnFCPublish();
+                        }
+                        else if (direction == Direction::OUTPUT)
+                        {
+                            RELAY_LOG(Log::Level::ERR) << idString << "Invalid message (\"FCPublish\") received, disconnecting";
+                            close();
+                            return false;
+                        }
+
+                        break;
                     }
-                    else if (direction == Direction::INPUT)
+
+                    case InvokeCommand::ON_FC_PUBLISH:
                     {
-                        Log(Log::Level::ERR) << idString << "Invalid message (\"FCSubscribe\") received, disconnecting";
-                        close();
-                        return false;
+                        break;
                     }
-                }
-                else if (command.asString() == "onFCSubscribe")
-                {
-                }
-                else if (command.asString() == "publish")
-                {
-                    if (direction == Direction::NONE ||
-                        direction == Direction::INPUT)
+
+                    case InvokeCommand::FC_UNPUBLISH:
                     {
-                        direction = Direction::INPUT;
+                        if (direction == Direction::INPUT)
+                        {
+                            RELAY_LOG(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " unpublished stream \"" << streamName << "\"";
 
-                        amf::Node argument2;
+                            sendOnFCUnpublish();
 
-                        if ((ret = argument2.decode(amf::Version::AMF0, packet.data, offset)) > 0)
+                            close();
+                        }
+                        else
                         {
-                            offset += ret;
-
-                            Log log(Log::Level::ALL);
-                            log << idString << "Argument 2: ";
-                            argument2.dump(log);
+                            // this is not a receiver
+                            RELAY_LOG(Log::Level::ERR) << idString << "Invalid message (\"FCUnpublish\") received, disconnecting";
+                            close();
+                            return false;
                         }
 
-                        streamName = argument2.asString();
-                        updateIdString();
-
-                        std::vector<std::pair<Server*, const Endpoint*>> endpoints = relay.getEndpoints(std::make_pair(socket.getLocalIPAddress(), socket.getLocalPort()), direction, applicationName, streamName);
+                        break;
+                    }
 
-                        if (!endpoints.empty())
+                    case InvokeCommand::ON_FC_UNPUBLISH:
+                    {
+                        if (direction == Direction::INPUT)
                         {
-                            Server* server = endpoints.front().first;
-                            endpoint = endpoints.front().second;
-
-                            sendUserControl(rtmp::UserControlType::CLEAR_STREAM);
-                            sendPublishStatus(transactionId.asDouble());
-
-                            pingInterval = endpoint->pingInterval;
-
-                            Stream* newStream = server->findStream(applicationName, streamName);
-                            if (!newStream)
-                            {
-                                newStream = server->createStream(applicationName, streamName);
-                            }
-                            else if (newStream->getInputConnection() && newStream->getInputConnection() != this)
-                            {
-                                Log(Log::Level::WARN) << idString << "Stream \"" << applicationName << "/" << streamName << "\" already has input, disconnecting " << newStream->getInputConnection()->getId();
-                                close(true);
-                                return false;
-                            }
-
-                            Log(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " published stream \"" << streamName << "\"";
-
-                            stream = newStream;
-                            streaming = true;
-                            stream->start(*this);
+                            // Do nothing
                         }
                         else
                         {
-                            Log(Log::Level::WARN) << idString << "Invalid stream \"" << applicationName << "/" << streamName << "\", disconnecting";
+                            // this is not a receiver
+                            RELAY_LOG(Log::Level::ERR) << idString << "Invalid message (\"onFCUnpublish\") received, disconnecting";
                             close();
                             return false;
                         }
+
+                        break;
                     }
-                    else if (direction == Direction::OUTPUT)
-                    {
-                        // this is not a receiver
-                        Log(Log::Level::ERR) << idString << "Invalid message (\"publish\") received, disconnecting";
-                        close();
-                        return false;
-                    }
-                }
-                else if (command.asString() == "unpublish")
-                {
-                    if (direction != Direction::INPUT)
+
+                    case InvokeCommand::FC_SUBSCRIBE:
                     {
-                        // this is not a receiver
-                        Log(Log::Level::ERR) << idString << "Invalid message (\"FCUnpublish\") received, disconnecting";
-                        close();
-                        return false;
-                    }
+                        if (direction == Direction::NONE ||
+                            direction == Direction::OUTPUT)
+                        {
+                            sendOnFCSubscribe();
+                        }
+                        else if (direction == Direction::INPUT)
+                        {
+                            RELAY_LOG(Log::Level::ERR) << idString << "Invalid message (\"FCSubscribe\") received, disconnecting";
+                            close();
+                            return false;
+                        }
 
-                    Log(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " unpublished stream \"" << streamName << "\"";
+                        break;
+                    }
 
-                    sendUnublishStatus(transactionId.asDouble());
-                    close();
-                }
-                else if (command.asString() == "play")
-                {
-                    if (direction == Direction::INPUT)
+                    case InvokeCommand::ON_FC_SUBSCRIBE:
                     {
-                        // this is not a sender
-                        Log(Log::Level::ERR) << idString << "Invalid message (\"play\") received, disconnecting";
-                        close();
-                        return false;
+                        break;
                     }
 
-                    direction = Direction::OUTPUT;
+                    case InvokeCommand::PUBLISH:
+                    {
+                        if (direction == Direction::NONE ||
+                            direction == Direction::INPUT)
+                        {
+                            direction = Direction::INPUT;
 
-                    amf::Node argument2;
+                            amf::Node argument2(allocator);
 
-                    if ((ret = argument2.decode(amf::Version::AMF0, packet.data, offset)) > 0)
-                    {
-                        offset += ret;
+                            if ((ret = argument2.decode(amf::Version::AMF0, reader)) > 0 && Log::isEnabled(Log::Level::ALL))
+                            {
+                                Log log(Log::Level::ALL);
+                                log << idString << "Argument 2: ";
+                                argument2.dump(log);
+                            }
 
-                        Log log(Log::Level::ALL);
-                        log << idString << "Argument 2: ";
-                        argument2.dump(log);
-                    }
+                            streamName = argument2.asString();
+                            updateIdString();
 
-                    Log(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " sent play, stream: \"" << argument2.asString() << "\"";
+                            std::vector<std::pair<Server*, const Endpoint*>> endpoints = relay.getEndpoints(std::make_pair(socket.getLocalIPAddress(), socket.getLocalPort()), direction, applicationName, streamName);
 
-                    streamName = argument2.asString();
-                    updateIdString();
+                            if (!endpoints.empty())
+                            {
+                                if (relay.isOverMemoryBudget())
+                                {
+                                    RELAY_LOG(Log::Level::WARN) << idString << "Memory budget exceeded, refusing to publish stream \"" << applicationName << "/" << streamName << "\"";
+                                    ++relay.getCounters().memoryRejections;
+                                    sendFailedStatus(transactionId.asDouble(), "Memory budget exceeded");
+                                    closing = true;
+                                    return false;
+                                }
 
-                    std::vector<std::pair<Server*, const Endpoint*>> endpoints = relay.getEndpoints(std::make_pair(socket.getLocalIPAddress(), socket.getLocalPort()), direction, applicationName, streamName);
+                                Server* server = endpoints.front().first;
+                                endpoint = endpoints.front().second;
 
-                    if (endpoints.empty())
-                    {
-                        Log(Log::Level::WARN) << idString << "Invalid stream \"" << applicationName << "/" << streamName << "\", disconnecting";
-                        close();
-                        return false;
-                    }
+                                sendUserControl(rtmp::UserControlType::CLEAR_STREAM);
+                                sendPublishStatus(transactionId.asDouble());
 
+                                pingInterval = endpoint->pingInterval;
 
-                    Server* server = endpoints.front().first;
-                    endpoint = endpoints.front().second;
+                                Stream* newStream = server->findStream(applicationName, streamName);
+                                if (!newStream)
+                                {
+                                    newStream = server->createStream(applicationName, streamName);
+                                }
+                                else if (newStream->getInputConnection() && newStream->getInputConnection() != this)
+                                {
+                                    RELAY_LOG(Log::Level::WARN) << idString << "Stream \"" << applicationName << "/" << streamName << "\" already has input, disconnecting " << newStream->getInputConnection()->getId();
+                                    close(true);
+                                    return false;
+                                }
 
-                    sendUserControl(rtmp::UserControlType::CLEAR_STREAM);
-                    sendPlayStatus(transactionId.asDouble());
+                                RELAY_LOG(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " published stream \"" << streamName << "\"";
 
-                    Stream* newStream = server->findStream(applicationName, streamName);
-                    if (!newStream) newStream = server->createStream(applicationName, streamName);
+                                stream = newStream;
+                                streaming = true;
+                                stream->start(*this);
+                            }
+                            else
+                            {
+                                RELAY_LOG(Log::Level::WARN) << idString << "Invalid stream \"" << applicationName << "/" << streamName << "\", disconnecting";
+                                close();
+                                return false;
+                            }
+                        }
+                        else if (direction == Direction::OUTPUT)
+                        {
+                            // this is not a receiver
+                            RELAY_LOG(Log::Level::ERR) << idString << "Invalid message (\"publish\") received, disconnecting";
+                            close();
+                            return false;
+                        }
 
-                    stream = newStream;
-                    streaming = true;
-                    stream->start(*this);
-                }
-                else if (command.asString() == "getStreamLength")
-                {
-                    if (direction == Direction::INPUT)
-                    {
-                        // this is not a sender
-                        Log(Log::Level::ERR) << idString << "Invalid message (\"getStreamLength\") received, disconnecting";
-                        close();
-                        return false;
+                        break;
                     }
 
-                    sendGetStreamLengthResult(transactionId.asDouble());
-                }
-                else if (command.asString() == "stop")
-                {
-                    if (direction != Direction::OUTPUT)
+                    case InvokeCommand::UNPUBLISH:
                     {
-                        Log(Log::Level::ERR) << idString << "Invalid message (\"stop\") received, disconnecting";
-                        close();
-                        return false;
-                    }
+                        if (direction != Direction::INPUT)
+                        {
+                            // this is not a receiver
+                            RELAY_LOG(Log::Level::ERR) << idString << "Invalid message (\"FCUnpublish\") received, disconnecting";
+                            close();
+                            return false;
+                        }
 
-                    close();
-                }
-                else if (command.asString() == "onStatus")
-                {
-                    amf::Node argument2;
+                        RELAY_LOG(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " unpublished stream \"" << streamName << "\"";
 
-                    if ((ret = argument2.decode((packet.messageType == rtmp::MessageType::AMF3_INVOKE) ? amf::Version::AMF3 : amf::Version::AMF0, packet.data, offset)) > 0)
-                    {
-                        offset += ret;
+                        sendUnublishStatus(transactionId.asDouble());
+                        close();
 
-                        Log log(Log::Level::ALL);
-                        log << idString << "Argument 2: ";
-                        argument2.dump(log);
+                        break;
                     }
 
-                    // TODO: paarbaudiit - izskataas nepareizi
-                    if (argument2["code"].asString() == "NetStream.Publish.Start")
+                    case InvokeCommand::PLAY:
                     {
-                        if (direction != Direction::OUTPUT)
+                        if (direction == Direction::INPUT)
                         {
-                            Log(Log::Level::ERR) << idString << "Wrong status (\"NetStream.Publish.Start\") received, disconnecting";
+                            // this is not a sender
+                            RELAY_LOG(Log::Level::ERR) << idString << "Invalid message (\"play\") received, disconnecting";
                             close();
                             return false;
                         }
 
-                        if (!stream)
+                        direction = Direction::OUTPUT;
+
+                        amf::Node argument2(allocator);
+
+                        if ((ret = argument2.decode(amf::Version::AMF0, reader)) > 0 && Log::isEnabled(Log::Level::ALL))
                         {
-                            Log(Log::Level::ERR) << idString << "Not streaming, disconnecting";
-                            close();
-                            return false;
+                            Log log(Log::Level::ALL);
+                            log << idString << "Argument 2: ";
+                            argument2.dump(log);
                         }
 
-                        streaming = true;
-                        stream->start(*this);
-                    }
-                    else if (argument2["code"].asString() == "NetStream.Play.Start")
-                    {
-                        if (direction != Direction::INPUT)
+                        RELAY_LOG(Log::Level::INFO) << idString << "Input from " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort() << " sent play, stream: \"" << argument2.asString() << "\"";
+
+                        streamName = argument2.asString();
+                        updateIdString();
+
+                        std::vector<std::pair<Server*, const Endpoint*>> endpoints = relay.getEndpoints(std::make_pair(socket.getLocalIPAddress(), socket.getLocalPort()), direction, applicationName, streamName);
+
+                        if (endpoints.empty())
                         {
-                            Log(Log::Level::ERR) << idString << "Wrong status (\"NetStream.Play.Start\") received, disconnecting";
+                            RELAY_LOG(Log::Level::WARN) << idString << "Invalid stream \"" << applicationName << "/" << streamName << "\", disconnecting";
                             close();
                             return false;
                         }
 
-                        if (!stream)
+
+                        if (relay.isOverMemoryBudget())
                         {
-                            Log(Log::Level::ERR) << idString << "Not streaming, disconnecting";
-                            close();
+                            RELAY_LOG(Log::Level::WARN) << idString << "Memory budget exceeded, refusing to play stream \"" << applicationName << "/" << streamName << "\"";
+                            ++relay.getCounters().memoryRejections;
+                            sendFailedStatus(transactionId.asDouble(), "Memory budget exceeded");
+                            closing = true;
                             return false;
                         }
 
+                        Server* server = endpoints.front().first;
+                        Stream* newStream = server->findStream(applicationName, streamName);
 
-                        if (stream->getInputConnection() && stream->getInputConnection() != this)
+                        // refuse before the new output slows down the existing ones
+                        Admission admission = relay.admitPlayer(newStream);
+
+                        if (admission != Admission::ACCEPTED)
                         {
-                            Log(Log::Level::WARN) << idString << "Stream \"" << applicationName << "/" << streamName << "\" already has input, disconnecting";
-                            close(true);
+                            RELAY_LOG(Log::Level::WARN) << idString << "Capacity exceeded (" << getAdmissionString(admission) << "), refusing to play stream \"" << applicationName << "/" << streamName << "\"";
+                            sendRejectedStatus(transactionId.asDouble(), admission);
+                            closing = true;
                             return false;
                         }
 
+                        endpoint = endpoints.front().second;
+
+                        sendUserControl(rtmp::UserControlType::CLEAR_STREAM);
+                        sendPlayStatus(transactionId.asDouble());
+
+                        if (!newStream) newStream = server->createStream(applicationName, streamName);
+
+                        stream = newStream;
                         streaming = true;
                         stream->start(*this);
-                    }
 
-                }
-                else if (command.asString() == "_error")
-                {
-                    auto i = invokes.find(static_cast<uint32_t>(transactionId.asDouble()));
+                        break;
+                    }
 
-                    if (i != invokes.end())
+                    case InvokeCommand::GET_STREAM_LENGTH:
                     {
-                        Log(Log::Level::ALL) << idString << i->second << " error";
+                        if (direction == Direction::INPUT)
+                        {
+                            // this is not a sender
+                            RELAY_LOG(Log::Level::ERR) << idString << "Invalid message (\"getStreamLength\") received, disconnecting";
+                            close();
+                            return false;
+                        }
 
-                        invokes.erase(i);
+                        sendGetStreamLengthResult(transactionId.asDouble());
+
+                        break;
                     }
-                    else
+
+                    case InvokeCommand::STOP:
                     {
-                        Log(Log::Level::ALL) << idString << i->second << "Invalid _error received";
+                        if (direction != Direction::OUTPUT)
+                        {
+                            RELAY_LOG(Log::Level::ERR) << idString << "Invalid message (\"stop\") received, disconnecting";
+                            close();
+                            return false;
+                        }
+
+                        close();
+
+                        break;
                     }
-                }
-                else if (command.asString() == "_result")
-                {
-                    auto i = invokes.find(static_cast<uint32_t>(transactionId.asDouble()));
 
-                    if (i != invokes.end())
+                    case InvokeCommand::ON_STATUS:
                     {
-                        Log(Log::Level::ALL) << idString << i->second << " result";
+                        amf::Node argument2(allocator);
 
-                        if (i->second == "connect")
+                        if ((ret = argument2.decode(amf::Version::AMF0, reader)) > 0 && Log::isEnabled(Log::Level::ALL))
                         {
-                            connected = true;
+                            Log log(Log::Level::ALL);
+                            log << idString << "Argument 2: ";
+                            argument2.dump(log);
+                        }
 
-                            if (!streamName.empty())
+                        // TODO: paarbaudiit - izskataas nepareizi
+                        if (argument2["code"].asString() == "NetStream.Publish.Start")
+                        {
+                            if (direction != Direction::OUTPUT)
                             {
-                                if (direction == Direction::OUTPUT)
-                                {
-                                    Log(Log::Level::ALL) << idString << "Publishing stream " << streamName;
+                                RELAY_LOG(Log::Level::ERR) << idString << "Wrong status (\"NetStream.Publish.Start\") received, disconnecting";
+                                close();
+                                return false;
+                            }
 
-                                    sendReleaseStream();
-                                    sendFCPublish();
-                                }
-                                else if (direction == Direction::INPUT)
-                                {
-                                    Log(Log::Level::ALL) << idString << "Subscribing to stream " << streamName;
+                            if (!stream)
+                            {
+                                RELAY_LOG(Log::Level::ERR) << idString << "Not streaming, disconnecting";
+                                close();
+                                return false;
+                            }
 
-                                    sendFCSubscribe();
-                                }
+                            streaming = true;
+                            stream->start(*this);
+                        }
+                        else if (argument2["code"].asString() == "NetStream.Play.Start")
+                        {
+                            if (direction != Direction::INPUT)
+                            {
+                                RELAY_LOG(Log::Level::ERR) << idString << "Wrong status (\"NetStream.Play.Start\") received, disconnecting";
+                                close();
+                                return false;
+                            }
+
+                            if (!stream)
+                            {
+                                RELAY_LOG(Log::Level::ERR) << idString << "Not streaming, disconnecting";
+                                close();
+                                return false;
+                            }
 
-                                sendCreateStream();
+                            if (stream->getInputConnection() && stream->getInputConnection() != this)
+                            {
+                                RELAY_LOG(Log::Level::WARN) << idString << "Stream \"" << applicationName << "/" << streamName << "\" already has input, disconnecting";
+                                close(true);
+                                return false;
                             }
+
+                            streaming = true;
+                            stream->start(*this);
                         }
-                        else if (i->second == "_checkbw")
+
+
+                        break;
+                    }
+
+                    case InvokeCommand::ERROR_RESULT:
+                    {
+                        auto i = invokes.find(static_cast<uint32_t>(transactionId.asDouble()));
+
+                        if (i != invokes.end())
                         {
+                            RELAY_LOG(Log::Level::ALL) << idString << i->second << " error";
+
+                            invokes.erase(i);
                         }
-                        else if (i->second == "releaseStream")
+                        else
                         {
+                            RELAY_LOG(Log::Level::ALL) << idString << i->second << "Invalid _error received";
                         }
-                        else if (i->second == "createStream")
+
+                        break;
+                    }
+
+                    case InvokeCommand::RESULT:
+                    {
+                        auto i = invokes.find(static_cast<uint32_t>(transactionId.asDouble()));
+
+                        if (i != invokes.end())
                         {
-                            amf::Node argument2;
+                            RELAY_LOG(Log::Level::ALL) << idString << i->second << " result";
 
-                            if ((ret = argument2.decode(amf::Version::AMF0, packet.data, offset)) > 0)
+                            switch (getInvokeCommand(i->second))
                             {
-                                offset += ret;
+                                case InvokeCommand::CONNECT:
+                                {
+                                    connected = true;
 
-                                Log log(Log::Level::ALL);
-                                log << idString << "Argument 2: ";
-                                argument2.dump(log);
-                            }
+                                    if (!streamName.empty())
+                                    {
+                                        if (direction == Direction::OUTPUT)
+                                        {
+                                            RELAY_LOG(Log::Level::ALL) << idString << "Publishing stream " << streamName;
 
-                            streamId = static_cast<uint32_t>(argument2.asDouble());
+                                            sendReleaseStream();
+                                            sendFCPublish();
+                                        }
+                                        else if (direction == Direction::INPUT)
+                                        {
+                                            RELAY_LOG(Log::Level::ALL) << idString << "Subscribing to stream " << streamName;
 
-                            if (direction == Direction::INPUT)
-                            {
-                                sendGetStreamLength();
-                                sendPlay();
-                                sendUserControl(rtmp::UserControlType::CLIENT_BUFFER_TIME, 0, streamId, bufferSize);
-                            }
-                            else if (direction == Direction::OUTPUT)
-                            {
-                                sendPublish();
+                                            sendFCSubscribe();
+                                        }
+
+                                        sendCreateStream();
+                                    }
+
+                                    break;
+                                }
+
+                                case InvokeCommand::CHECK_BW:
+                                {
+                                    break;
+                                }
+
+                                case InvokeCommand::RELEASE_STREAM:
+                                {
+                                    break;
+                                }
+
+                                case InvokeCommand::CREATE_STREAM:
+                                {
+                                    amf::Node argument2(allocator);
+
+                                    if ((ret = argument2.decode(amf::Version::AMF0, reader)) > 0 && Log::isEnabled(Log::Level::ALL))
+                                    {
+                                        Log log(Log::Level::ALL);
+                                        log << idString << "Argument 2: ";
+                                        argument2.dump(log);
+                                    }
+
+                                    streamId = static_cast<uint32_t>(argument2.asDouble());
+
+                                    if (direction == Direction::INPUT)
+                                    {
+                                        sendGetStreamLength();
+                                        sendPlay();
+                                        sendUserControl(rtmp::UserControlType::CLIENT_BUFFER_TIME, 0, streamId, bufferSize);
+                                    }
+                                    else if (direction == Direction::OUTPUT)
+                                    {
+                                        sendPublish();
+                                    }
+
+                                    RELAY_LOG(Log::Level::ALL) << idString << "Created stream " << streamId;
+
+                                    break;
+                                }
+
+                                case InvokeCommand::DELETE_STREAM:
+                                {
+                                    break;
+                                }
+
+                                default:
+                                {
+                                    break;
+                                }
                             }
 
-                            Log(Log::Level::ALL) << idString << "Created stream " << streamId;
+                            invokes.erase(i);
                         }
-                        else if (i->second == "deleteStream")
+                        else
                         {
+                            RELAY_LOG(Log::Level::ALL) << idString << "Invalid _result received, transaction ID: " << static_cast<uint32_t>(transactionId.asDouble());
                         }
 
-                        invokes.erase(i);
+                        break;
                     }
-                    else
+
+                    default:
                     {
-                        Log(Log::Level::ALL) << idString << "Invalid _result received, transaction ID: " << static_cast<uint32_t>(transactionId.asDouble());
+                        RELAY_LOG(Log::Level::ALL) << idString << "Unhandled INVOKE: " << command.asString();
+                        break;
                     }
                 }
                 break;
@@ -1683,19 +2210,19 @@ namespace relay
             case rtmp::MessageType::AMF0_SHARED_OBJECT:
             case rtmp::MessageType::AMF3_SHARED_OBJECT:
             {
-                Log(Log::Level::ALL) << idString << "Received shared object";
+                RELAY_LOG(Log::Level::ALL) << idString << "Received shared object";
                 break;
             }
 
             case rtmp::MessageType::AGGREGATE:
             {
-                Log(Log::Level::ALL) << idString << "Received aggregated messages";
+                RELAY_LOG(Log::Level::ALL) << idString << "Received aggregated messages";
                 break;
             }
 
             default:
             {
-                Log(Log::Level::ERR) << idString << "Unhandled message: " << static_cast<uint32_t>(packet.messageType);
+                RELAY_LOG(Log::Level::ERR) << idString << "Unhandled message: " << static_cast<uint32_t>(packet.messageType);
                 break;
             }
         }
@@ -1769,6 +2296,60 @@ namespace relay
         }
     }
 
+    bool Connection::sendData(const std::vector<uint8_t>& buffer, const std::chrono::steady_clock::time_point* receiveTime)
+    {
+        // the connection is closed on the next update, not while the stream is iterating its outputs
+        if (sendQueueOverflow) return false;
+
+        if (socket.getOutDataSize() + buffer.size() > relay.getMemoryLimits().maxSendQueueSize)
+        {
+            RELAY_LOG(Log::Level::WARN) << idString << "Send queue exceeds " << relay.getMemoryLimits().maxSendQueueSize << " bytes, disconnecting";
+            ++relay.getCounters().sendQueueOverflows;
+            sendQueueOverflow = true;
+            return false;
+        }
+
+        outBytes += buffer.size();
+        relay.getCounters().sentBytes += buffer.size();
+
+        return receiveTime ? socket.send(buffer, *receiveTime) : socket.send(buffer);
+    }
+
+    bool Connection::sendPacket(rtmp::Packet& packet, const std::chrono::steady_clock::time_point* receiveTime)
+    {
+        // at most 18 bytes of header per chunk
+        uint32_t chunkCount = static_cast<uint32_t>((packet.data.size() + outChunkSize - 1) / outChunkSize);
+        std::vector<uint8_t> buffer = bufferPool.acquire(packet.data.size() + chunkCount * 18);
+
+        packet.encode(buffer, outChunkSize, sentPackets);
+        bool result = sendData(buffer, receiveTime);
+        ++outMessages;
+
+        bufferPool.release(buffer);
+        bufferPool.release(packet.data);
+
+        return result;
+    }
+
+    bool Connection::sendBytesRead()
+    {
+        rtmp::Packet packet;
+        packet.channel = rtmp::Channel::NETWORK;
+        packet.timestamp = 0;
+        packet.messageType = rtmp::MessageType::BYTES_READ;
+
+        // sequence number wraps around at 4 GB
+        uint32_t bytesRead = static_cast<uint32_t>(inBytes);
+        ByteWriter writer(packet.data);
+        writer.writeUInt32BE(bytesRead);
+
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending BYTES_READ, parameter: " << bytesRead;
+
+        inBytesAcknowledged = inBytes;
+
+        return sendPacket(packet);
+    }
+
     bool Connection::sendServerBandwidth()
     {
         rtmp::Packet packet;
@@ -1776,14 +2357,12 @@ namespace relay
         packet.timestamp = 0;
         packet.messageType = rtmp::MessageType::SERVER_BANDWIDTH;
 
-        encodeIntBE(packet.data, 4, serverBandwidth);
+        ByteWriter writer(packet.data);
+        writer.writeUInt32BE(serverBandwidth);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending SERVER_BANDWIDTH";
 
-        Log(Log::Level::ALL) << idString << "Sending SERVER_BANDWIDTH";
-
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendClientBandwidth()
@@ -1793,15 +2372,13 @@ namespace relay
         packet.timestamp = 0;
         packet.messageType = rtmp::MessageType::CLIENT_BANDWIDTH;
 
-        encodeIntBE(packet.data, 4, serverBandwidth);
-        encodeIntBE(packet.data, 1, 2); // dynamic
-
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        ByteWriter writer(packet.data);
+        writer.writeUInt32BE(serverBandwidth);
+        writer.writeUInt8(2); // dynamic
 
-        Log(Log::Level::ALL) << idString << "Sending CLIENT_BANDWIDTH";
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending CLIENT_BANDWIDTH";
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendUserControl(rtmp::UserControlType userControlType, uint64_t timestamp, uint32_t parameter1, uint32_t parameter2)
@@ -1811,30 +2388,31 @@ namespace relay
         packet.timestamp = timestamp;
         packet.messageType = rtmp::MessageType::USER_CONTROL;
 
-        encodeIntBE(packet.data, 2, static_cast<uint16_t>(userControlType));
-        encodeIntBE(packet.data, 4, parameter1); // parameter 1
-        if (parameter2 != 0) encodeIntBE(packet.data, 4, parameter2); // parameter 2
+        ByteWriter writer(packet.data);
+        writer.writeUInt16BE(static_cast<uint16_t>(userControlType));
+        writer.writeUInt32BE(parameter1); // parameter 1
+        if (parameter2 != 0) writer.writeUInt32BE(parameter2); // parameter 2
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        if (Log::isEnabled(Log::Level::ALL))
+        {
+            Log log(Log::Level::ALL);
+            log << idString << "Sending USER_CONTROL of type: ";
 
-        Log log(Log::Level::ALL);
-        log << idString << "Sending USER_CONTROL of type: ";
+            switch (userControlType)
+            {
+                case rtmp::UserControlType::CLEAR_STREAM: log << "CLEAR_STREAM"; break;
+                case rtmp::UserControlType::CLEAR_BUFFER: log << "CLEAR_BUFFER"; break;
+                case rtmp::UserControlType::CLIENT_BUFFER_TIME: log << "CLIENT_BUFFER_TIME"; break;
+                case rtmp::UserControlType::RESET_STREAM: log << "RESET_STREAM"; break;
+                case rtmp::UserControlType::PING: log << "PING"; break;
+                case rtmp::UserControlType::PONG: log << "PONG"; break;
+            }
 
-        switch (userControlType)
-        {
-            case rtmp::UserControlType::CLEAR_STREAM: log << "CLEAR_STREAM"; break;
-            case rtmp::UserControlType::CLEAR_BUFFER: log << "CLEAR_BUFFER"; break;
-            case rtmp::UserControlType::CLIENT_BUFFER_TIME: log << "CLIENT_BUFFER_TIME"; break;
-            case rtmp::UserControlType::RESET_STREAM: log << "RESET_STREAM"; break;
-            case rtmp::UserControlType::PING: log << "PING"; break;
-            case rtmp::UserControlType::PONG: log << "PONG"; break;
+            log << ", parameter 1: " << parameter1;
+            if (parameter2 != 0) log << ", parameter 2: " << parameter2;
         }
 
-        log << ", parameter 1: " << parameter1;
-        if (parameter2 != 0) log << ", parameter 2: " << parameter2;
-
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendSetChunkSize()
@@ -1844,14 +2422,12 @@ namespace relay
         packet.timestamp = 0;
         packet.messageType = rtmp::MessageType::SET_CHUNK_SIZE;
 
-        encodeIntBE(packet.data, 4, outChunkSize);
-
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        ByteWriter writer(packet.data);
+        writer.writeUInt32BE(outChunkSize);
 
-        Log(Log::Level::ALL) << idString << "Sending SET_CHUNK_SIZE";
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending SET_CHUNK_SIZE";
         
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendOnBWDone()
@@ -1882,12 +2458,9 @@ namespace relay
         amf::Node argument2 = 0.0;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
-
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
         invokes[invokeId] = commandName.asString();
 
@@ -1919,12 +2492,9 @@ namespace relay
         amf::Node argument1(amf::Node::Type::Null);
         argument1.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
         invokes[invokeId] = commandName.asString();
 
@@ -1947,21 +2517,11 @@ namespace relay
             packet.data.push_back(0); // using AMF0
         }
 
-        amf::Node commandName = std::string("_result");
-        commandName.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node transactionIdNode = transactionId;
-        transactionIdNode.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node argument1(amf::Node::Type::Null);
-        argument1.encode(amf::Version::AMF0, packet.data);
+        CHECK_BW_RESULT.write(packet.data, transactionId);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE _result";
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
-        
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendCreateStream()
@@ -1989,12 +2549,9 @@ namespace relay
         amf::Node argument1(amf::Node::Type::Null);
         argument1.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
         invokes[invokeId] = commandName.asString();
 
@@ -2014,17 +2571,10 @@ namespace relay
         else if (amfVersion == amf::Version::AMF3)
         {
             packet.messageType = rtmp::MessageType::AMF3_INVOKE;
-            packet.data.push_back(0); // using AMF0
-        }
-
-        amf::Node commandName = std::string("_result");
-        commandName.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node transactionIdNode = transactionId;
-        transactionIdNode.encode(amf::Version::AMF0, packet.data);
+            packet.data.push_back(0); // using AMF0
+        }
 
-        amf::Node argument1(amf::Node::Type::Null);
-        argument1.encode(amf::Version::AMF0, packet.data);
+        CREATE_STREAM_RESULT.write(packet.data, transactionId);
 
         ++streamId;
         if (streamId == 0 || streamId == 2) // streams 0 and 2 are reserved
@@ -2032,15 +2582,13 @@ namespace relay
             ++streamId;
         }
 
-        amf::Node argument2 = static_cast<double>(streamId);
-        argument2.encode(amf::Version::AMF0, packet.data);
-
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        ByteWriter writer(packet.data);
+        writer.writeUInt8(static_cast<uint8_t>(amf::AMF0Marker::Number));
+        writer.writeDouble(static_cast<double>(streamId));
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE _result";
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendReleaseStream()
@@ -2071,12 +2619,9 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
         invokes[invokeId] = commandName.asString();
 
@@ -2099,21 +2644,11 @@ namespace relay
             packet.data.push_back(0); // using AMF0
         }
 
-        amf::Node commandName = std::string("_result");
-        commandName.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node transactionIdNode = transactionId;
-        transactionIdNode.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node argument1(amf::Node::Type::Null);
-        argument1.encode(amf::Version::AMF0, packet.data);
-
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELEASE_STREAM_RESULT.write(packet.data, transactionId);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE _result";
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendDeleteStream()
@@ -2144,12 +2679,9 @@ namespace relay
         amf::Node argument2 = static_cast<double>(streamId);
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
         
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
         
         invokes[invokeId] = commandName.asString();
 
@@ -2189,12 +2721,9 @@ namespace relay
 
         argument1.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
-
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
         invokes[invokeId] = commandName.asString();
         timeSinceLastData = 0;
@@ -2218,32 +2747,13 @@ namespace relay
             packet.data.push_back(0); // using AMF0
         }
 
-        amf::Node commandName = std::string("_result");
-        commandName.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node transactionIdNode = transactionId;
-        transactionIdNode.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node argument1;
-        argument1["fmsVer"] = std::string("FMS/3,5,7,7009");
-        argument1["capabilities"] = 31.0;
-        argument1.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node argument2;
-        argument2["level"] = std::string("status");
-        argument2["code"] = std::string("NetConnection.Connect.Success");
-        argument2["description"] = std::string("Connection succeeded.");
-        argument2["objectEncoding"] = (amfVersion == amf::Version::AMF3) ? 3.0 : 0.0;
-
-        argument2.encode(amf::Version::AMF0, packet.data);
-
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        const InvokeTemplate& result = (amfVersion == amf::Version::AMF3) ? CONNECT_RESULT_AMF3 : CONNECT_RESULT_AMF0;
+        result.write(packet.data, transactionId);
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE _result";
 
         timeSinceLastData = 0;
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendFCPublish()
@@ -2274,12 +2784,9 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
         invokes[invokeId] = commandName.asString();
 
@@ -2305,12 +2812,9 @@ namespace relay
         amf::Node commandName = std::string("onFCPublish");
         commandName.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
-
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendFCUnpublish()
@@ -2341,12 +2845,9 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
         invokes[invokeId] = commandName.asString();
 
@@ -2374,12 +2875,9 @@ namespace relay
         amf::Node commandName = std::string("onFCUnpublish");
         commandName.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendFCSubscribe()
@@ -2410,12 +2908,9 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
         invokes[invokeId] = commandName.asString();
 
@@ -2451,12 +2946,9 @@ namespace relay
         argument2["level"] = std::string("status");
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
-
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendFCUnsubscribe()
@@ -2487,12 +2979,9 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
         invokes[invokeId] = commandName.asString();
 
@@ -2518,12 +3007,9 @@ namespace relay
         amf::Node commandName = std::string("onFCUnsubscribe");
         commandName.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendPublish()
@@ -2558,16 +3044,13 @@ namespace relay
         amf::Node argument3 = std::string("live");
         argument3.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString() << ", transaction ID: " << invokeId;
 
-        if (!socket.send(buffer)) return false;
+        if (!sendPacket(packet)) return false;
 
         invokes[invokeId] = commandName.asString();
 
-        Log(Log::Level::INFO) << idString << "Published stream \"" << streamName << "\" (ID: " << streamId << ") to " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort();
+        RELAY_LOG(Log::Level::INFO) << idString << "Published stream \"" << streamName << "\" (ID: " << streamId << ") to " << ipToString(socket.getRemoteIPAddress()) << ":" << socket.getRemotePort();
 
         timeSinceLastData = 0;
         return true;
@@ -2589,29 +3072,14 @@ namespace relay
             packet.data.push_back(0); // using AMF0
         }
 
-        amf::Node commandName = std::string("onStatus");
-        commandName.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node transactionIdNode = transactionId;
-        transactionIdNode.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node argument1(amf::Node::Type::Null);
-        argument1.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node argument2;
-        argument2["clientid"] = std::string("Lavf57.1.0");
-        argument2["code"] = std::string("NetStream.Publish.Start");
-        argument2["description"] = streamName + " is now published";
-        argument2["details"] = streamName;
-        argument2["level"] = std::string("status");
-        argument2.encode((amfVersion == amf::Version::AMF3) ? amf::Version::AMF3 : amf::Version::AMF0, packet.data);
+        PUBLISH_STATUS.write(packet.data, transactionId);
+        writeStringProperty(packet.data, "description", streamName + " is now published");
+        writeStringProperty(packet.data, "details", streamName);
+        writeObjectEnd(packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE onStatus";
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
-        
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendUnublishStatus(double transactionId)
@@ -2630,29 +3098,14 @@ namespace relay
             packet.data.push_back(0); // using AMF0
         }
 
-        amf::Node commandName = std::string("onStatus");
-        commandName.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node transactionIdNode = transactionId;
-        transactionIdNode.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node argument1(amf::Node::Type::Null);
-        argument1.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node argument2;
-        argument2["clientid"] = std::string("Lavf57.1.0");
-        argument2["code"] = std::string("NetStream.Unpublish.Success");
-        argument2["description"] = streamName + " stopped publishing";
-        argument2["details"] = streamName;
-        argument2["level"] = std::string("status");
-        argument2.encode(amf::Version::AMF0, packet.data);
+        UNPUBLISH_STATUS.write(packet.data, transactionId);
+        writeStringProperty(packet.data, "description", streamName + " stopped publishing");
+        writeStringProperty(packet.data, "details", streamName);
+        writeObjectEnd(packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE onStatus";
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
-        
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendAudioHeader(const std::vector<uint8_t>& headerData)
@@ -2672,144 +3125,143 @@ namespace relay
         // TODO: send video info
     }
 
-    bool Connection::sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData)
+    bool Connection::sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData, const std::chrono::steady_clock::time_point& receiveTime)
     {
         if (!streaming) return false;
 
         timeSinceLastData = 0;
-        return sendAudioData(timestamp, frameData);
+        return sendAudioData(timestamp, frameData, &receiveTime);
     }
 
-    bool Connection::sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData, VideoFrameType frameType)
+    bool Connection::sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData, VideoFrameType frameType, const std::chrono::steady_clock::time_point& receiveTime)
     {
         if (!streaming) return false;
 
         if (!endpoint) return false;
 
-        if (endpoint->videoStream &&
-            (videoFrameSent || frameType == VideoFrameType::KEY))
-        {
-            videoFrameSent = true;
-            timeSinceLastData = 0;
-            return sendVideoData(timestamp, frameData);
-        }
-
-        return true;
-    }
+        bool congestedNow = isCongested();
 
-    bool Connection::sendMetaData(const amf::Node& newMetaData)
-    {
-        if (state != State::HANDSHAKE_DONE) return false;
+        if (congestedNow != congested)
+        {
+            congested = congestedNow;
 
-        if (!endpoint) return false;
+            if (congested)
+                RELAY_LOG(Log::Level::WARN) << idString << "Peer is not acknowledging data, dropping video until next key frame";
+            else
+                RELAY_LOG(Log::Level::INFO) << idString << "Peer caught up with acknowledgements";
+        }
 
-        if (newMetaData.getType() == amf::Node::Type::Dictionary ||
-            newMetaData.getType() == amf::Node::Type::Object)
+        // skip to the next key frame if the peer can not keep up
+        if (congested && frameType != VideoFrameType::KEY)
         {
-            metaData = amf::Node::Type::Dictionary;
+            videoFrameSent = false;
+            ++droppedMessages;
+            return true;
+        }
 
-            for (const std::pair<std::string, amf::Node>& value : newMetaData.asMap())
+        if (endpoint->videoStream)
+        {
+            if (videoFrameSent || frameType == VideoFrameType::KEY)
             {
-                // not in the blacklist
-                if (endpoint->metaDataBlacklist.find(value.first) != endpoint->metaDataBlacklist.end()) continue;
-
-                // don't send audio meta data if audio stream is disabled
-                if (!endpoint->audioStream && (value.first == "audiocodecid" ||
-                                               value.first == "audiodatarate")) continue;
-
-                // don't send video meta data if video stream is disabled
-                if (!endpoint->videoStream && (value.first == "fps" ||
-                                               value.first == "framerate" ||
-                                               value.first == "gopsize" ||
-                                               value.first == "level" ||
-                                               value.first == "profile" ||
-                                               value.first == "videocodecid" ||
-                                               value.first == "videodatarate")) continue;
-
-                metaData[value.first] = value.second;
+                videoFrameSent = true;
+                timeSinceLastData = 0;
+                return sendVideoData(timestamp, frameData, &receiveTime);
             }
 
-            rtmp::Packet packet;
-            packet.channel = rtmp::Channel::AUDIO;
-            packet.messageStreamId = streamId;
-            packet.timestamp = 0;
-
-            if (amfVersion == amf::Version::AMF0)
-            {
-                packet.messageType = rtmp::MessageType::AMF0_DATA;
-            }
-            else if (amfVersion == amf::Version::AMF3)
-            {
-                packet.messageType = rtmp::MessageType::AMF3_DATA;
-                packet.data.push_back(0); // using AMF0
-            }
+            // waiting for a key frame
+            ++droppedMessages;
+        }
 
-            amf::Node commandName = std::string("@setDataFrame");
-            commandName.encode(amf::Version::AMF0, packet.data);
+        return true;
+    }
 
-            amf::Node argument1 = std::string("onMetaData");
-            argument1.encode(amf::Version::AMF0, packet.data);
+    bool Connection::sendMetaData(const amf::Node& filteredMetaData, const std::vector<uint8_t>& body)
+    {
+        if (state != State::HANDSHAKE_DONE) return false;
 
-            amf::Node argument2 = metaData;
-            argument2.encode(amf::Version::AMF0, packet.data);
+        if (!endpoint) return false;
 
-            std::vector<uint8_t> buffer;
-            packet.encode(buffer, outChunkSize, sentPackets);
+        metaData = filteredMetaData;
 
-            {
-                Log log(Log::Level::ALL);
-                log << idString << "Sending meta data " << commandName.asString() << ": ";
-                argument2.dump(log);
-            }
+        rtmp::Packet packet;
+        packet.channel = rtmp::Channel::AUDIO;
+        packet.messageStreamId = streamId;
+        packet.timestamp = 0;
+        packet.messageType = (amfVersion == amf::Version::AMF3) ? rtmp::MessageType::AMF3_DATA : rtmp::MessageType::AMF0_DATA;
+        packet.data = bufferPool.acquire(body.size());
+        packet.data.assign(body.begin(), body.end());
 
-            timeSinceLastData = 0;
-            return socket.send(buffer);
+        if (Log::isEnabled(Log::Level::ALL))
+        {
+            Log log(Log::Level::ALL);
+            log << idString << "Sending meta data @setDataFrame: ";
+            metaData.dump(log);
         }
 
-        return true;
+        timeSinceLastData = 0;
+        return sendPacket(packet);
     }
 
-    bool Connection::sendTextData(uint64_t timestamp, const amf::Node& textData)
+    bool Connection::sendTextData(uint64_t timestamp, const std::vector<uint8_t>& textData)
     {
         if (!endpoint || !streaming) return false;
 
         if (endpoint->dataStream)
         {
-            rtmp::Packet packet;
-            packet.channel = rtmp::Channel::AUDIO;
-            packet.messageStreamId = streamId;
-            packet.timestamp = timestamp;
+            return sendDataMessage(timestamp, textData);
+        }
 
-            if (amfVersion == amf::Version::AMF0)
-            {
-                packet.messageType = rtmp::MessageType::AMF0_DATA;
-            }
-            else if (amfVersion == amf::Version::AMF3)
-            {
-                packet.messageType = rtmp::MessageType::AMF3_DATA;
-                packet.data.push_back(0); // using AMF0
-            }
+        return true;
+    }
 
-            amf::Node commandName = std::string("onTextData");
-            commandName.encode(amf::Version::AMF0, packet.data);
+    bool Connection::sendLatencyProbe(uint64_t timestamp, const std::vector<uint8_t>& probeData)
+    {
+        // probes are controlled by latencyProbes, they are sent even if other data messages are not
+        if (!endpoint || !streaming || !endpoint->latencyProbes) return false;
+
+        return sendDataMessage(timestamp, probeData);
+    }
+
+    bool Connection::sendDataMessage(uint64_t timestamp, const std::vector<uint8_t>& textData)
+    {
+        rtmp::Packet packet;
+        packet.channel = rtmp::Channel::AUDIO;
+        packet.messageStreamId = streamId;
+        packet.timestamp = timestamp;
 
-            amf::Node argument1 = textData;
-            argument1.encode(amf::Version::AMF0, packet.data);
+        if (amfVersion == amf::Version::AMF0)
+        {
+            packet.messageType = rtmp::MessageType::AMF0_DATA;
+            packet.data = bufferPool.acquire(textData.size());
+            packet.data.assign(textData.begin(), textData.end());
+        }
+        else if (amfVersion == amf::Version::AMF3)
+        {
+            packet.messageType = rtmp::MessageType::AMF3_DATA;
+            packet.data = bufferPool.acquire(textData.size() + 1);
+            packet.data.push_back(0); // using AMF0
+            packet.data.insert(packet.data.end(), textData.begin(), textData.end());
+        }
 
-            std::vector<uint8_t> buffer;
-            packet.encode(buffer, outChunkSize, sentPackets);
+        if (Log::isEnabled(Log::Level::ALL))
+        {
+            ByteReader reader(textData);
+            amf::View command;
+            amf::View argument1;
+            amf::Node node;
 
+            if (amf::View::read(reader, command) &&
+                amf::View::read(reader, argument1) &&
+                argument1.toNode(node))
             {
                 Log log(Log::Level::ALL);
                 log << idString << "Sending text data: ";
-                argument1.dump(log);
+                node.dump(log);
             }
-
-            timeSinceLastData = 0;
-            return socket.send(buffer);
         }
 
-        return true;
+        timeSinceLastData = 0;
+        return sendPacket(packet);
     }
 
     bool Connection::sendGetStreamLength()
@@ -2840,12 +3292,9 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
         
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendGetStreamLengthResult(double transactionId)
@@ -2864,24 +3313,11 @@ namespace relay
             packet.data.push_back(0); // using AMF0
         }
 
-        amf::Node commandName = std::string("_result");
-        commandName.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node transactionIdNode = transactionId;
-        transactionIdNode.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node argument1(amf::Node::Type::Null);
-        argument1.encode(amf::Version::AMF0, packet.data);
+        GET_STREAM_LENGTH_RESULT.write(packet.data, transactionId);
 
-        amf::Node argument2 = 0.0;
-        argument2.encode(amf::Version::AMF0, packet.data);
-
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE _result";
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
-        
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendPlay()
@@ -2913,13 +3349,10 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
         timeSinceLastData = 0;
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendPlayStatus(double transactionId)
@@ -2938,29 +3371,78 @@ namespace relay
             packet.data.push_back(0); // using AMF0
         }
 
-        amf::Node commandName = std::string("onStatus");
-        commandName.encode(amf::Version::AMF0, packet.data);
+        PLAY_STATUS.write(packet.data, transactionId);
+        writeStringProperty(packet.data, "description", streamName + " is now playing");
+        writeStringProperty(packet.data, "details", streamName);
+        writeObjectEnd(packet.data);
 
-        amf::Node transactionIdNode = transactionId;
-        transactionIdNode.encode(amf::Version::AMF0, packet.data);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE onStatus";
 
-        amf::Node argument1(amf::Node::Type::Null);
-        argument1.encode(amf::Version::AMF0, packet.data);
+        return sendPacket(packet);
+    }
 
-        amf::Node argument2;
-        argument2["clientid"] = std::string("Lavf57.1.0");
-        argument2["code"] = std::string("NetStream.Play.Start");
-        argument2["description"] = streamName + " is now playing";
-        argument2["details"] = streamName;
-        argument2["level"] = std::string("status");
-        argument2.encode(amf::Version::AMF0, packet.data);
+    bool Connection::sendRejectedStatus(double transactionId, Admission admission)
+    {
+        rtmp::Packet packet;
+        packet.channel = rtmp::Channel::SYSTEM;
+        packet.timestamp = 0;
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        if (amfVersion == amf::Version::AMF0)
+        {
+            packet.messageType = rtmp::MessageType::AMF0_INVOKE;
+        }
+        else if (amfVersion == amf::Version::AMF3)
+        {
+            packet.messageType = rtmp::MessageType::AMF3_INVOKE;
+            packet.data.push_back(0); // using AMF0
+        }
+
+        REJECTED_STATUS.write(packet.data, transactionId);
+        writeStringProperty(packet.data, "description", std::string("Capacity exceeded (") + getAdmissionString(admission) + ")");
+
+        const std::string& redirect = relay.getAdmissionLimits().redirect;
+
+        // the redirect convention of the other media servers, clients reconnect to the address
+        if (!redirect.empty())
+        {
+            amf::Node ex;
+            ex["code"] = 302.0;
+            ex["redirect"] = redirect;
+            writeProperty(packet.data, "ex", ex);
+        }
+
+        writeObjectEnd(packet.data);
+
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE onStatus";
+
+        return sendPacket(packet);
+    }
+
+    bool Connection::sendFailedStatus(double transactionId, const std::string& description)
+    {
+        rtmp::Packet packet;
+        packet.channel = rtmp::Channel::SYSTEM;
+        packet.timestamp = 0;
+
+        if (amfVersion == amf::Version::AMF0)
+        {
+            packet.messageType = rtmp::MessageType::AMF0_INVOKE;
+        }
+        else if (amfVersion == amf::Version::AMF3)
+        {
+            packet.messageType = rtmp::MessageType::AMF3_INVOKE;
+            packet.data.push_back(0); // using AMF0
+        }
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        const InvokeTemplate& status = (direction == Direction::INPUT) ? PUBLISH_FAILED_STATUS : PLAY_FAILED_STATUS;
+        status.write(packet.data, transactionId);
+        writeStringProperty(packet.data, "description", description);
+        writeStringProperty(packet.data, "details", streamName);
+        writeObjectEnd(packet.data);
 
-        return socket.send(buffer);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE onStatus";
+
+        return sendPacket(packet);
     }
 
     bool Connection::sendStop()
@@ -2991,12 +3473,9 @@ namespace relay
         amf::Node argument2 = streamName;
         argument2.encode(amf::Version::AMF0, packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
-
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
 
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
     bool Connection::sendStopStatus(double transactionId)
@@ -3015,32 +3494,17 @@ namespace relay
             packet.data.push_back(0); // using AMF0
         }
 
-        amf::Node commandName = std::string("onStatus");
-        commandName.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node transactionIdNode = transactionId;
-        transactionIdNode.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node argument1(amf::Node::Type::Null);
-        argument1.encode(amf::Version::AMF0, packet.data);
-
-        amf::Node argument2;
-        argument2["clientid"] = std::string("Lavf57.1.0");
-        argument2["code"] = std::string("NetStream.Play.Stop");
-        argument2["description"] = streamName + " is now stopped";
-        argument2["details"] = streamName;
-        argument2["level"] = std::string("status");
-        argument2.encode(amf::Version::AMF0, packet.data);
+        STOP_STATUS.write(packet.data, transactionId);
+        writeStringProperty(packet.data, "description", streamName + " is now stopped");
+        writeStringProperty(packet.data, "details", streamName);
+        writeObjectEnd(packet.data);
 
-        std::vector<uint8_t> buffer;
-        packet.encode(buffer, outChunkSize, sentPackets);
+        RELAY_LOG(Log::Level::ALL) << idString << "Sending INVOKE onStatus";
 
-        Log(Log::Level::ALL) << idString << "Sending INVOKE " << commandName.asString();
-        
-        return socket.send(buffer);
+        return sendPacket(packet);
     }
 
-    bool Connection::sendAudioData(uint64_t timestamp, const std::vector<uint8_t>& audioData)
+    bool Connection::sendAudioData(uint64_t timestamp, const std::vector<uint8_t>& audioData, const std::chrono::steady_clock::time_point* receiveTime)
     {
         if (!endpoint || !streaming) return false;
 
@@ -3052,20 +3516,18 @@ namespace relay
             packet.timestamp = timestamp;
             packet.messageType = rtmp::MessageType::AUDIO_PACKET;
 
-            packet.data = audioData;
+            packet.data = bufferPool.acquire(audioData.size());
+            packet.data.assign(audioData.begin(), audioData.end());
 
-            std::vector<uint8_t> buffer;
-            packet.encode(buffer, outChunkSize, sentPackets);
+            RELAY_LOG(Log::Level::ALL) << idString << "Sending audio packet";
 
-            Log(Log::Level::ALL) << idString << "Sending audio packet";
-
-            return socket.send(buffer);
+            return sendPacket(packet, receiveTime);
         }
 
         return true;
     }
 
-    bool Connection::sendVideoData(uint64_t timestamp, const std::vector<uint8_t>& videoData)
+    bool Connection::sendVideoData(uint64_t timestamp, const std::vector<uint8_t>& videoData, const std::chrono::steady_clock::time_point* receiveTime)
     {
         if (!endpoint || !streaming) return false;
 
@@ -3077,19 +3539,30 @@ namespace relay
             packet.timestamp = timestamp;
             packet.messageType = rtmp::MessageType::VIDEO_PACKET;
 
-            packet.data = videoData;
-
-            std::vector<uint8_t> buffer;
-            packet.encode(buffer, outChunkSize, sentPackets);
+            packet.data = bufferPool.acquire(videoData.size());
+            packet.data.assign(videoData.begin(), videoData.end());
 
-            Log(Log::Level::ALL) << idString << "Sending video packet";
+            RELAY_LOG(Log::Level::ALL) << idString << "Sending video packet";
             
-            return socket.send(buffer);
+            return sendPacket(packet, receiveTime);
         }
 
         return true;
     }
 
+    bool Connection::isCongested() const
+    {
+        // drop video before the send queue reaches the limit and the peer is disconnected
+        if (socket.getOutDataSize() > relay.getMemoryLimits().maxSendQueueSize / 2) return true;
+
+        // peers that never acknowledge don't provide a congestion signal
+        if (!acknowledgementReceived) return false;
+
+        uint32_t unacknowledgedBytes = static_cast<uint32_t>(outBytes) - outBytesAcknowledged;
+
+        return unacknowledgedBytes > 2 * static_cast<uint64_t>(serverBandwidth);
+    }
+
     bool Connection::isDependable()
     {
         return (type == Type::HOST) || (direction == Direction::INPUT && (endpoint ? endpoint->isNameKnown() : false));
@@ -4,8 +4,11 @@
 
 #pragma once
 
+#include <chrono>
 #include <map>
 #include <set>
+#include "BufferPool.hpp"
+#include "LatencyHistogram.hpp"
 #include "Socket.hpp"
 #include "RTMP.hpp"
 #include "Amf.hpp"
@@ -18,7 +21,9 @@ namespace relay
     class Relay;
     class Server;
     class Stream;
+    enum class Admission;
     struct Endpoint;
+    struct ConnectionStatus;
 
     class Connection
     {
@@ -65,7 +70,10 @@ namespace relay
         uint64_t getId() const { return id; }
         std::string getIdString() const { return idString; }
         Type getType() const { return type; }
+        State getState() const { return state; }
         Direction getDirection() const { return direction; }
+        const Endpoint* getEndpoint() const { return endpoint; }
+        amf::Version getAMFVersion() const { return amfVersion; }
         const std::string& getApplicationName() const { return applicationName; }
         const std::string& getStreamName() const { return streamName; }
 
@@ -74,7 +82,17 @@ namespace relay
 
         void update(float delta);
 
-        void getStats(std::string& str, ReportType reportType) const;
+        void getStatus(ConnectionStatus& status) const;
+
+        // host connections that completed the handshake can be handed off to a new process
+        bool canHandOff() const;
+        // appends the RTMP session state, including the data not yet sent to the peer
+        void saveSession(std::vector<uint8_t>& buffer) const;
+        // continues a session saved by another process, the socket must already be adopted
+        bool restoreSession(const std::vector<uint8_t>& buffer);
+        socket_t getSocketFd() const { return socket.getSocketFd(); }
+
+        uint64_t getDroppedMessages() const { return droppedMessages; }
 
         void connect();
 
@@ -84,24 +102,36 @@ namespace relay
 
         bool sendAudioHeader(const std::vector<uint8_t>& headerData);
         bool sendVideoHeader(const std::vector<uint8_t>& headerData);
-        bool sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData);
-        bool sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData, VideoFrameType frameType);
-        bool sendMetaData(const amf::Node& newMetaData);
-        bool sendTextData(uint64_t timestamp, const amf::Node& textData);
+        // receiveTime is when the frame was read from the input socket, used for the latency histograms
+        bool sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData, const std::chrono::steady_clock::time_point& receiveTime);
+        bool sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& frameData, VideoFrameType frameType, const std::chrono::steady_clock::time_point& receiveTime);
+        // body is the encoded @setDataFrame message, shared by outputs with the same meta data filter
+        bool sendMetaData(const amf::Node& filteredMetaData, const std::vector<uint8_t>& body);
+        // textData is the AMF0 encoded message body (command name and arguments)
+        bool sendTextData(uint64_t timestamp, const std::vector<uint8_t>& textData);
+        bool sendLatencyProbe(uint64_t timestamp, const std::vector<uint8_t>& probeData);
 
         bool isDependable();
+        bool isCongested() const;
 
     private:
         void resolveStreamName();
         void updateIdString();
+        void setState(State newState);
 
         void handleConnect(Socket&);
         void handleConnectError(Socket&);
         void handleRead(Socket&, const std::vector<uint8_t>& newData);
         void handleClose(Socket&);
+        void handleFlush(Socket&, uint64_t latency);
 
         bool handlePacket(const rtmp::Packet& packet);
 
+        bool sendData(const std::vector<uint8_t>& buffer, const std::chrono::steady_clock::time_point* receiveTime = nullptr);
+        // encodes the packet into a pooled buffer and returns the packet data to the pool
+        bool sendPacket(rtmp::Packet& packet, const std::chrono::steady_clock::time_point* receiveTime = nullptr);
+
+        bool sendBytesRead();
         bool sendServerBandwidth();
         bool sendClientBandwidth();
         bool sendUserControl(rtmp::UserControlType userControlType, uint64_t timestamp = 0, uint32_t parameter1 = 0, uint32_t parameter2 = 0);
@@ -138,13 +168,18 @@ namespace relay
         bool sendGetStreamLengthResult(double transactionId);
         bool sendPlay();
         bool sendPlayStatus(double transactionId);
+        // NetConnection.Connect.Rejected with the reason and the configured redirect
+        bool sendRejectedStatus(double transactionId, Admission admission);
+        bool sendFailedStatus(double transactionId, const std::string& description);
         bool sendStop();
         bool sendStopStatus(double transactionId);
 
-        bool sendAudioData(uint64_t timestamp, const std::vector<uint8_t>& audioData);
-        bool sendVideoData(uint64_t timestamp, const std::vector<uint8_t>& videoData);
+        bool sendDataMessage(uint64_t timestamp, const std::vector<uint8_t>& textData);
+        bool sendAudioData(uint64_t timestamp, const std::vector<uint8_t>& audioData, const std::chrono::steady_clock::time_point* receiveTime = nullptr);
+        bool sendVideoData(uint64_t timestamp, const std::vector<uint8_t>& videoData, const std::chrono::steady_clock::time_point* receiveTime = nullptr);
 
         Relay& relay;
+        BufferPool& bufferPool;
         const uint64_t id;
 
         Type type;
@@ -162,10 +197,27 @@ namespace relay
         uint32_t addressIndex = 0;
 
         std::vector<uint8_t> data;
+        Arena invokeArena; // backs the AMF nodes of the invoke being handled
+        size_t arenaSize = 0; // of invokeArena, as added to the relay's memory totals
 
         uint32_t inChunkSize = 128;
         uint32_t outChunkSize = 128;
-        uint32_t serverBandwidth = 2500000;
+        uint32_t serverBandwidth = 2500000; // acknowledgement window announced to the peer
+        uint32_t peerBandwidth = 0; // acknowledgement window announced by the peer
+
+        uint64_t inBytes = 0;
+        uint64_t inBytesAcknowledged = 0;
+        uint64_t outBytes = 0;
+        uint32_t outBytesAcknowledged = 0;
+        uint64_t inMessages = 0;
+        uint64_t outMessages = 0;
+        uint64_t droppedMessages = 0; // video frames skipped because the peer could not keep up
+        LatencyHistogram latencyHistogram; // from receiving a frame on the input to handing it to the kernel on this output
+        bool acknowledgementReceived = false;
+        bool congested = false;
+        bool sendQueueOverflow = false; // the send queue reached maxSendQueueSize, closed on the next update
+        bool closing = false; // refused, closed once the reply has been sent
+        float timeSinceClosing = 0.0f;
 
         std::map<uint32_t, rtmp::Header> receivedPackets;
         std::map<uint32_t, rtmp::Header> sentPackets;
@@ -184,6 +236,7 @@ namespace relay
 
         bool videoFrameSent = false;
         float timeSinceMeasure = 0.0f;
+        float timeSinceProbe = 0.0f;
         uint64_t currentAudioBytes = 0;
         uint64_t currentVideoBytes = 0;
         uint64_t audioRate = 0;
@@ -11,3 +11,6 @@ static const uint8_t RTMP_RELAY_VERSION[2] = {0, 8};
 static const uint8_t RTMP_VERSION = 3;
 static const uint8_t RTMP_SERVER_VERSION[4] = {2, 0, 0, 0};
 static const uint8_t RTMP_CLIENT_VERSION[4] = {2, 0, 0, 0}; // {0x0C, 0x0O, 0x0D, 0x0E};
+
+// AMF data message carrying a latency probe between relays
+static const char* const LATENCY_PROBE_COMMAND = "onRelayLatencyProbe";
@@ -22,6 +22,11 @@ namespace relay
         {
             std::string url;
             std::pair<uint32_t, uint16_t> ipAddresses;
+
+            bool operator==(const Address& other) const
+            {
+                return url == other.url && ipAddresses == other.ipAddresses;
+            }
         };
         std::vector<Address> addresses;
         float connectionTimeout = 5.0f;
@@ -34,6 +39,8 @@ namespace relay
         bool videoStream = true;
         bool audioStream = true;
         bool dataStream = true;
+        float latencyProbeInterval = 0.0f; // input endpoints inject latency probes into their streams, 0 disables them
+        bool latencyProbes = false; // output endpoints forward latency probes instead of stripping them
         std::string applicationName;
         std::string streamName;
         std::set<std::string> metaDataBlacklist;
@@ -43,5 +50,29 @@ namespace relay
             return !applicationName.empty() && !streamName.empty() &&
                 isValidName(applicationName) && isValidName(streamName);
         }
+
+        // used by the config reload to find the endpoints that changed
+        bool operator==(const Endpoint& other) const
+        {
+            return connectionType == other.connectionType &&
+                direction == other.direction &&
+                addresses == other.addresses &&
+                connectionTimeout == other.connectionTimeout &&
+                reconnectInterval == other.reconnectInterval &&
+                reconnectCount == other.reconnectCount &&
+                pingInterval == other.pingInterval &&
+                bufferSize == other.bufferSize &&
+                amfVersion == other.amfVersion &&
+                videoStream == other.videoStream &&
+                audioStream == other.audioStream &&
+                dataStream == other.dataStream &&
+                latencyProbeInterval == other.latencyProbeInterval &&
+                latencyProbes == other.latencyProbes &&
+                applicationName == other.applicationName &&
+                streamName == other.streamName &&
+                metaDataBlacklist == other.metaDataBlacklist;
+        }
+
+        bool operator!=(const Endpoint& other) const { return !(*this == other); }
     };
 }
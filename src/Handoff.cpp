@@ -0,0 +1,276 @@
+//
+//  rtmp_relay
+//
+
+#ifndef _WIN32
+#  include <sys/socket.h>
+#  include <sys/time.h>
+#  include <unistd.h>
+#endif
+#include <cstring>
+#include "Handoff.hpp"
+#include "Log.hpp"
+
+namespace relay
+{
+    namespace handoff
+    {
+        static const uint32_t MAX_RECORD_SIZE = 64 * 1024 * 1024;
+        static const size_t HEADER_SIZE = 5; // type and payload length
+        static const uint8_t ACK = 1;
+
+#if defined(__APPLE__)
+        static const int SEND_FLAGS = 0; // SIGPIPE is disabled with SO_NOSIGPIPE in setTimeout
+#elif !defined(_WIN32)
+        static const int SEND_FLAGS = MSG_NOSIGNAL;
+#endif
+
+#ifndef _WIN32
+        static bool sendAll(int fd, const uint8_t* data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t sent = ::send(fd, data, size, SEND_FLAGS);
+
+                if (sent < 0)
+                {
+                    if (errno == EINTR) continue;
+
+                    RELAY_LOG(Log::Level::ERR) << "Failed to send handoff data, error: " << errno;
+                    return false;
+                }
+
+                data += sent;
+                size -= static_cast<size_t>(sent);
+            }
+
+            return true;
+        }
+
+        static void discardFd(socket_t& fd)
+        {
+            if (fd != INVALID_SOCKET) ::close(fd);
+            fd = INVALID_SOCKET;
+        }
+
+        static bool receiveAll(int fd, uint8_t* data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t received = ::recv(fd, data, size, 0);
+
+                if (received < 0)
+                {
+                    if (errno == EINTR) continue;
+
+                    RELAY_LOG(Log::Level::ERR) << "Failed to receive handoff data, error: " << errno;
+                    return false;
+                }
+                else if (received == 0)
+                {
+                    RELAY_LOG(Log::Level::ERR) << "Handoff peer closed the connection";
+                    return false;
+                }
+
+                data += received;
+                size -= static_cast<size_t>(received);
+            }
+
+            return true;
+        }
+#endif
+
+        bool setTimeout(int fd, float timeout)
+        {
+#ifndef _WIN32
+            timeval tv;
+            tv.tv_sec = static_cast<time_t>(timeout);
+            tv.tv_usec = static_cast<suseconds_t>((timeout - static_cast<float>(tv.tv_sec)) * 1000000.0f);
+
+            if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0 ||
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) != 0)
+            {
+                RELAY_LOG(Log::Level::ERR) << "Failed to set handoff timeout, error: " << errno;
+                return false;
+            }
+
+#ifdef __APPLE__
+            int set = 1;
+            if (setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &set, sizeof(int)) != 0)
+            {
+                RELAY_LOG(Log::Level::ERR) << "Failed to set handoff socket option, error: " << errno;
+                return false;
+            }
+#endif
+
+            return true;
+#else
+            (void)fd;
+            (void)timeout;
+            return false;
+#endif
+        }
+
+        bool sendRecord(int fd, RecordType type, const std::vector<uint8_t>& payload, socket_t passedFd)
+        {
+#ifndef _WIN32
+            uint8_t header[HEADER_SIZE];
+            header[0] = static_cast<uint8_t>(type);
+            storeBE32(header + 1, static_cast<uint32_t>(payload.size()));
+
+            iovec iov;
+            iov.iov_base = header;
+            iov.iov_len = sizeof(header);
+
+            msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_iov = &iov;
+            message.msg_iovlen = 1;
+
+            // the descriptor travels with the first byte of the header
+            union
+            {
+                cmsghdr align;
+                char buffer[CMSG_SPACE(sizeof(int))];
+            } control;
+
+            if (passedFd != INVALID_SOCKET)
+            {
+                memset(&control, 0, sizeof(control));
+                message.msg_control = control.buffer;
+                message.msg_controllen = sizeof(control.buffer);
+
+                cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+                cmsg->cmsg_level = SOL_SOCKET;
+                cmsg->cmsg_type = SCM_RIGHTS;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+                memcpy(CMSG_DATA(cmsg), &passedFd, sizeof(int));
+            }
+
+            ssize_t sent;
+            while ((sent = sendmsg(fd, &message, SEND_FLAGS)) < 0 && errno == EINTR);
+
+            if (sent <= 0)
+            {
+                RELAY_LOG(Log::Level::ERR) << "Failed to send handoff record, error: " << errno;
+                return false;
+            }
+
+            return sendAll(fd, header + sent, sizeof(header) - static_cast<size_t>(sent)) &&
+                sendAll(fd, payload.data(), payload.size());
+#else
+            (void)fd;
+            (void)type;
+            (void)payload;
+            (void)passedFd;
+            RELAY_LOG(Log::Level::ERR) << "Handoff is not supported on Windows";
+            return false;
+#endif
+        }
+
+        bool receiveRecord(int fd, RecordType& type, std::vector<uint8_t>& payload, socket_t& passedFd)
+        {
+            passedFd = INVALID_SOCKET;
+
+#ifndef _WIN32
+            uint8_t header[HEADER_SIZE];
+
+            iovec iov;
+            iov.iov_base = header;
+            iov.iov_len = sizeof(header);
+
+            union
+            {
+                cmsghdr align;
+                char buffer[CMSG_SPACE(sizeof(int))];
+            } control;
+            memset(&control, 0, sizeof(control));
+
+            msghdr message;
+            memset(&message, 0, sizeof(message));
+            message.msg_iov = &iov;
+            message.msg_iovlen = 1;
+            message.msg_control = control.buffer;
+            message.msg_controllen = sizeof(control.buffer);
+
+            ssize_t received;
+            while ((received = recvmsg(fd, &message, 0)) < 0 && errno == EINTR);
+
+            if (received <= 0)
+            {
+                RELAY_LOG(Log::Level::ERR) << "Failed to receive handoff record, error: " << (received < 0 ? errno : 0);
+                return false;
+            }
+
+            for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg))
+            {
+                if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+                    cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))
+                {
+                    memcpy(&passedFd, CMSG_DATA(cmsg), sizeof(int));
+                }
+            }
+
+            if (message.msg_flags & MSG_CTRUNC)
+            {
+                RELAY_LOG(Log::Level::ERR) << "Handoff record descriptor truncated";
+                discardFd(passedFd);
+                return false;
+            }
+
+            if (!receiveAll(fd, header + received, sizeof(header) - static_cast<size_t>(received)))
+            {
+                discardFd(passedFd);
+                return false;
+            }
+
+            type = static_cast<RecordType>(header[0]);
+            uint32_t size = loadBE32(header + 1);
+
+            if (size > MAX_RECORD_SIZE)
+            {
+                RELAY_LOG(Log::Level::ERR) << "Handoff record too large (" << size << " bytes)";
+                discardFd(passedFd);
+                return false;
+            }
+
+            payload.resize(size);
+
+            if (!receiveAll(fd, payload.data(), payload.size()))
+            {
+                discardFd(passedFd);
+                return false;
+            }
+
+            return true;
+#else
+            (void)fd;
+            (void)type;
+            (void)payload;
+            RELAY_LOG(Log::Level::ERR) << "Handoff is not supported on Windows";
+            return false;
+#endif
+        }
+
+        bool sendAck(int fd)
+        {
+#ifndef _WIN32
+            return sendAll(fd, &ACK, sizeof(ACK));
+#else
+            (void)fd;
+            return false;
+#endif
+        }
+
+        bool receiveAck(int fd)
+        {
+#ifndef _WIN32
+            uint8_t value = 0;
+            return receiveAll(fd, &value, sizeof(value)) && value == ACK;
+#else
+            (void)fd;
+            return false;
+#endif
+        }
+    }
+}
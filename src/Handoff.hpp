@@ -0,0 +1,68 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "ByteStream.hpp"
+#include "Socket.hpp"
+
+namespace relay
+{
+    // passing the sockets to a newly started process during a binary upgrade, not supported on Windows
+    namespace handoff
+    {
+        const uint32_t VERSION = 1;
+        const float TIMEOUT = 10.0f; // seconds the processes wait for each other
+
+        enum class RecordType: uint8_t
+        {
+            BEGIN = 0, // the protocol version
+            LISTENER = 1, // listen address and the listening socket
+            CONNECTION = 2, // connection session state and the connected socket
+            END = 3
+        };
+
+        // sets the send and receive timeouts (and disables SIGPIPE on Apple platforms)
+        bool setTimeout(int fd, float timeout);
+
+        // the descriptor, if not INVALID_SOCKET, is sent along with the record as SCM_RIGHTS ancillary data
+        bool sendRecord(int fd, RecordType type, const std::vector<uint8_t>& payload, socket_t passedFd = INVALID_SOCKET);
+        // passedFd is INVALID_SOCKET if the record has no descriptor
+        bool receiveRecord(int fd, RecordType& type, std::vector<uint8_t>& payload, socket_t& passedFd);
+
+        // sent by the new process once it has taken over all the sockets
+        bool sendAck(int fd);
+        bool receiveAck(int fd);
+
+        inline void writeString(ByteWriter& writer, const std::string& str)
+        {
+            writer.writeUInt32BE(static_cast<uint32_t>(str.length()));
+            writer.writeBytes(str.data(), str.length());
+        }
+
+        inline bool readString(ByteReader& reader, std::string& result)
+        {
+            uint32_t length;
+            return reader.readUInt32BE(length) && reader.readString(length, result);
+        }
+
+        inline void writeBuffer(ByteWriter& writer, const std::vector<uint8_t>& buffer)
+        {
+            writer.writeUInt32BE(static_cast<uint32_t>(buffer.size()));
+            writer.writeBytes(buffer.data(), buffer.size());
+        }
+
+        inline bool readBuffer(ByteReader& reader, std::vector<uint8_t>& result)
+        {
+            uint32_t length;
+            const uint8_t* data;
+            if (!reader.readUInt32BE(length) || !reader.readBytes(length, data)) return false;
+            result.assign(data, data + length);
+            return true;
+        }
+    }
+}
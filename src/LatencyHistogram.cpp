@@ -0,0 +1,78 @@
+//
+//  rtmp_relay
+//
+
+#include <algorithm>
+#include "LatencyHistogram.hpp"
+
+namespace relay
+{
+    // values below SUB_BUCKET_COUNT have a bucket each, every following power of two is split into
+    // SUB_BUCKET_COUNT / 2 buckets
+    static uint32_t getIndex(uint64_t value)
+    {
+        if (value < LatencyHistogram::SUB_BUCKET_COUNT) return static_cast<uint32_t>(value);
+
+        uint32_t shift = 0;
+        while ((value >> shift) >= LatencyHistogram::SUB_BUCKET_COUNT) ++shift;
+
+        const uint64_t halfCount = LatencyHistogram::SUB_BUCKET_COUNT / 2;
+
+        return static_cast<uint32_t>(LatencyHistogram::SUB_BUCKET_COUNT + (shift - 1) * halfCount + ((value >> shift) - halfCount));
+    }
+
+    // highest value that falls into the bucket
+    static uint64_t getValue(uint32_t index)
+    {
+        if (index < LatencyHistogram::SUB_BUCKET_COUNT) return index;
+
+        const uint64_t halfCount = LatencyHistogram::SUB_BUCKET_COUNT / 2;
+        uint64_t shift = (index - LatencyHistogram::SUB_BUCKET_COUNT) / halfCount + 1;
+        uint64_t subBucket = (index - LatencyHistogram::SUB_BUCKET_COUNT) % halfCount + halfCount;
+
+        return ((subBucket + 1) << shift) - 1;
+    }
+
+    void LatencyHistogram::record(uint64_t value)
+    {
+        const uint64_t maxValue = (static_cast<uint64_t>(1) << MAX_VALUE_BITS) - 1;
+        if (value > maxValue) value = maxValue;
+
+        ++counts[getIndex(value)];
+        ++count;
+        sum += value;
+        if (value > maximum) maximum = value;
+    }
+
+    void LatencyHistogram::getSummary(LatencySummary& summary) const
+    {
+        summary.count = count;
+        summary.sum = sum;
+        summary.max = maximum;
+        summary.p50 = summary.p99 = summary.p999 = 0;
+
+        if (count == 0) return;
+
+        // rank of each percentile, rounded up
+        const uint64_t ranks[] = {
+            (count * 500 + 999) / 1000,
+            (count * 990 + 999) / 1000,
+            (count * 999 + 999) / 1000
+        };
+        uint64_t* results[] = {&summary.p50, &summary.p99, &summary.p999};
+
+        uint32_t next = 0;
+        uint64_t total = 0;
+
+        for (uint32_t index = 0; index < BUCKET_COUNT && next < 3; ++index)
+        {
+            total += counts[index];
+
+            while (next < 3 && total >= ranks[next])
+            {
+                *results[next] = std::min(getValue(index), maximum);
+                ++next;
+            }
+        }
+    }
+}
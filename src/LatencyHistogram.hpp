@@ -0,0 +1,42 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstdint>
+
+namespace relay
+{
+    struct LatencySummary
+    {
+        uint64_t count = 0;
+        uint64_t sum = 0; // microseconds
+        uint64_t p50 = 0;
+        uint64_t p99 = 0;
+        uint64_t p999 = 0;
+        uint64_t max = 0;
+    };
+
+    // HDR style histogram of latencies in microseconds with a precision of about 3%,
+    // only touched by the event loop, the status thread gets a LatencySummary copy
+    class LatencyHistogram
+    {
+    public:
+        static const uint32_t SUB_BUCKET_BITS = 5;
+        static const uint64_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+        static const uint32_t MAX_VALUE_BITS = 32; // about 71 minutes
+        static const uint32_t BUCKET_COUNT = SUB_BUCKET_COUNT + (MAX_VALUE_BITS - SUB_BUCKET_BITS) * (SUB_BUCKET_COUNT / 2);
+
+        void record(uint64_t value);
+        void getSummary(LatencySummary& summary) const;
+
+        uint64_t getCount() const { return count; }
+
+    private:
+        uint64_t counts[BUCKET_COUNT] = {};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+        uint64_t maximum = 0;
+    };
+}
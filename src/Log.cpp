@@ -2,9 +2,16 @@
 //  rtmp_relay
 //
 
+#include <atomic>
 #include <chrono>
-#include <iostream>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 #ifdef _WIN32
 #  include <windows.h>
 #  include <strsafe.h>
@@ -16,53 +23,357 @@
 namespace relay
 {
 #ifndef DEBUG
-    Log::Level Log::threshold = Log::Level::INFO;
+    std::atomic<Log::Level> Log::threshold(Log::Level::INFO);
 #else
-    Log::Level Log::threshold = Log::Level::ALL;
+    std::atomic<Log::Level> Log::threshold(Log::Level::ALL);
 #endif
 
 #if defined(LOG_SYSLOG)
-    bool Log::syslogEnabled = true;
+    std::atomic<bool> Log::syslogEnabled(true);
 #else
-    bool Log::syslogEnabled = false;
+    std::atomic<bool> Log::syslogEnabled(false);
 #endif
 
-    void Log::flush()
+    struct LogEntry
     {
-        if (!s.empty())
+        Log::Level level;
+        std::chrono::system_clock::time_point time; // captured when the statement finished
+        std::string message;
+    };
+
+    // bounded multi-producer single-consumer ring
+    class LogQueue
+    {
+    public:
+        static const size_t CAPACITY = 8192; // must be a power of two
+
+        LogQueue():
+            cells(new Cell[CAPACITY])
+        {
+            for (size_t i = 0; i < CAPACITY; ++i)
+            {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        bool push(LogEntry& entry)
+        {
+            Cell* cell;
+            size_t position = enqueuePosition.load(std::memory_order_relaxed);
+
+            for (;;)
+            {
+                cell = &cells[position & (CAPACITY - 1)];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+                if (difference == 0)
+                {
+                    if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    return false; // full
+                }
+                else
+                {
+                    position = enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->entry = std::move(entry);
+            cell->sequence.store(position + 1, std::memory_order_release);
+
+            return true;
+        }
+
+        // must only be called from the consumer thread
+        bool pop(LogEntry& entry)
+        {
+            Cell& cell = cells[dequeuePosition & (CAPACITY - 1)];
+
+            if (cell.sequence.load(std::memory_order_acquire) != dequeuePosition + 1)
+            {
+                return false; // empty
+            }
+
+            entry = std::move(cell.entry);
+            cell.sequence.store(dequeuePosition + CAPACITY, std::memory_order_release);
+            ++dequeuePosition;
+
+            return true;
+        }
+
+    private:
+        struct Cell
+        {
+            std::atomic<size_t> sequence;
+            LogEntry entry;
+        };
+
+        std::unique_ptr<Cell[]> cells;
+        std::atomic<size_t> enqueuePosition{0};
+        size_t dequeuePosition = 0;
+    };
+
+    class LogWriter
+    {
+    public:
+        static const size_t BATCH_SIZE = 256;
+
+        void start()
+        {
+            std::lock_guard<std::mutex> lock(threadMutex);
+
+            if (running) return;
+
+            if (!exitHandlerRegistered)
+            {
+                // flush the queue on exit, the writer itself is never destroyed
+                std::atexit(Log::stopThread);
+                exitHandlerRegistered = true;
+            }
+
+            running = true;
+            thread = std::thread(&LogWriter::main, this);
+        }
+
+        void stop()
+        {
+            std::lock_guard<std::mutex> lock(threadMutex);
+
+            if (!running) return;
+
+            running = false;
+            wake();
+            thread.join();
+
+            // producers that saw running before it was cleared may still be pushing,
+            // later producers see it cleared and write their lines directly
+            while (producers.load() > 0) std::this_thread::yield();
+
+            // lines pushed while the thread was exiting
+            LogEntry entry;
+            std::lock_guard<std::mutex> sinkLock(sinkMutex);
+            while (queue.pop(entry)) writeBatch(&entry, 1);
+        }
+
+        bool setFile(const std::string& path)
         {
-            auto n = std::chrono::system_clock::now();
-            auto t = std::chrono::system_clock::to_time_t(n);
-            tm* time = localtime(&t);
-            char buffer[32];
-            strftime(buffer, sizeof(buffer), "%Y.%m.%d %H:%M:%S", time);
-
-            if (level == Level::ERR ||
-                level == Level::WARN)
-                std::cerr << buffer << ": " << s << std::endl;
+            FILE* newFile = nullptr;
+
+            if (!path.empty())
+            {
+                newFile = fopen(path.c_str(), "a");
+                if (!newFile) return false;
+            }
+
+            std::lock_guard<std::mutex> lock(sinkMutex);
+
+            if (file) fclose(file);
+            file = newFile;
+
+            return true;
+        }
+
+        void write(LogEntry& entry)
+        {
+            // announced before checking running, so that stop waits for the push before its final drain
+            producers.fetch_add(1);
+
+            if (running.load())
+            {
+                if (queue.push(entry))
+                {
+                    if (sleeping.load(std::memory_order_acquire)) wake();
+                }
+                else
+                {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                producers.fetch_sub(1);
+            }
             else
-                std::cout << buffer << ": " << s << std::endl;
+            {
+                producers.fetch_sub(1);
 
-#ifdef _WIN32
-            wchar_t szBuffer[MAX_PATH];
-            MultiByteToWideChar(CP_UTF8, 0, s.c_str(), -1, szBuffer, MAX_PATH);
-            StringCchCatW(szBuffer, sizeof(szBuffer), L"\n");
-            OutputDebugStringW(szBuffer);
-#elif defined(LOG_SYSLOG)
-            if (syslogEnabled)
+                std::lock_guard<std::mutex> lock(sinkMutex);
+                writeBatch(&entry, 1);
+            }
+        }
+
+        uint64_t getDroppedCount() const
+        {
+            return dropped.load(std::memory_order_relaxed);
+        }
+
+    private:
+        void wake()
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            sleeping.store(false, std::memory_order_release);
+            wakeCondition.notify_one();
+        }
+
+        void main()
+        {
+            std::vector<LogEntry> batch(BATCH_SIZE);
+            uint64_t reportedDropped = 0;
+
+            for (;;)
             {
-                int priority = 0;
-                switch (level)
+                bool stopping = !running;
+
+                size_t count = 0;
+                while (count < BATCH_SIZE && queue.pop(batch[count])) ++count;
+
+                uint64_t currentDropped = dropped.load(std::memory_order_relaxed);
+
+                if (currentDropped != reportedDropped && count < BATCH_SIZE)
                 {
-                    case Level::ERR: priority = LOG_ERR; break;
-                    case Level::WARN: priority = LOG_WARNING; break;
-                    case Level::INFO: priority = LOG_INFO; break;
-                    case Level::ALL: priority = LOG_DEBUG; break;
-                    default: break;
+                    batch[count].level = Log::Level::WARN;
+                    batch[count].time = std::chrono::system_clock::now();
+                    batch[count].message = "Log queue full, dropped " + std::to_string(currentDropped - reportedDropped) + " lines";
+                    ++count;
+
+                    reportedDropped = currentDropped;
                 }
-                syslog(priority, "%s", s.c_str());
+
+                if (count > 0)
+                {
+                    std::lock_guard<std::mutex> lock(sinkMutex);
+                    writeBatch(batch.data(), count);
+                }
+
+                if (count == BATCH_SIZE) continue;
+                if (stopping) break;
+
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                sleeping.store(true, std::memory_order_release);
+                // the timeout covers a producer that pushed just before we went to sleep
+                wakeCondition.wait_for(lock, std::chrono::milliseconds(50), [this] {
+                    return !sleeping.load(std::memory_order_acquire);
+                });
+                sleeping.store(false, std::memory_order_release);
             }
+        }
+
+        void writeBatch(LogEntry* entries, size_t count)
+        {
+            std::string out;
+            std::string err;
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                LogEntry& entry = entries[i];
+
+                auto t = std::chrono::system_clock::to_time_t(entry.time);
+                tm* time = localtime(&t);
+                char buffer[32];
+                strftime(buffer, sizeof(buffer), "%Y.%m.%d %H:%M:%S", time);
+
+                std::string& target = (!file && (entry.level == Log::Level::ERR || entry.level == Log::Level::WARN)) ? err : out;
+                target += buffer;
+                target += ": ";
+                target += entry.message;
+                target += '\n';
+
+#ifdef _WIN32
+                wchar_t szBuffer[MAX_PATH];
+                MultiByteToWideChar(CP_UTF8, 0, entry.message.c_str(), -1, szBuffer, MAX_PATH);
+                StringCchCatW(szBuffer, sizeof(szBuffer), L"\n");
+                OutputDebugStringW(szBuffer);
+#elif defined(LOG_SYSLOG)
+                if (Log::syslogEnabled.load(std::memory_order_relaxed))
+                {
+                    int priority = 0;
+                    switch (entry.level)
+                    {
+                        case Log::Level::ERR: priority = LOG_ERR; break;
+                        case Log::Level::WARN: priority = LOG_WARNING; break;
+                        case Log::Level::INFO: priority = LOG_INFO; break;
+                        case Log::Level::ALL: priority = LOG_DEBUG; break;
+                        default: break;
+                    }
+                    syslog(priority, "%s", entry.message.c_str());
+                }
 #endif
+                entry.message.clear();
+            }
+
+            if (!err.empty())
+            {
+                fwrite(err.data(), 1, err.size(), stderr);
+                fflush(stderr);
+            }
+
+            if (!out.empty())
+            {
+                FILE* target = file ? file : stdout;
+                fwrite(out.data(), 1, out.size(), target);
+                fflush(target);
+            }
+        }
+
+        LogQueue queue;
+        std::atomic<uint64_t> dropped{0};
+
+        std::mutex threadMutex;
+        std::thread thread;
+        std::atomic<bool> running{false};
+        std::atomic<uint32_t> producers{0}; // threads between checking running and finishing their push
+        bool exitHandlerRegistered = false;
+
+        std::mutex wakeMutex;
+        std::condition_variable wakeCondition;
+        std::atomic<bool> sleeping{false};
+
+        std::mutex sinkMutex;
+        FILE* file = nullptr;
+    };
+
+    // intentionally leaked so that logging keeps working during static destruction
+    static LogWriter& getWriter()
+    {
+        static LogWriter* writer = new LogWriter();
+        return *writer;
+    }
+
+    void Log::startThread()
+    {
+        getWriter().start();
+    }
+
+    void Log::stopThread()
+    {
+        getWriter().stop();
+    }
+
+    bool Log::setFile(const std::string& path)
+    {
+        return getWriter().setFile(path);
+    }
+
+    uint64_t Log::getDroppedCount()
+    {
+        return getWriter().getDroppedCount();
+    }
+
+    void Log::flush()
+    {
+        if (!s.empty())
+        {
+            LogEntry entry;
+            entry.level = level;
+            entry.time = std::chrono::system_clock::now();
+            entry.message = std::move(s);
+
+            getWriter().write(entry);
+
             s.clear();
         }
     }
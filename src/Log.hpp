@@ -4,8 +4,18 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
 
+// highest level compiled into the binary (0 - OFF, 1 - ERR, 2 - WARN, 3 - INFO, 4 - ALL)
+#ifndef LOG_MAX_LEVEL
+#  define LOG_MAX_LEVEL 4
+#endif
+
+// arguments are only evaluated if the level is enabled, e.g. RELAY_LOG(Log::Level::ALL) << expensive();
+#define RELAY_LOG(level) !relay::Log::isEnabled(level) ? (void)0 : relay::Log::Voidify() & relay::Log(level)
+
 namespace relay
 {
     class Log
@@ -20,8 +30,29 @@ namespace relay
             ALL
         };
 
-        static Level threshold;
-        static bool syslogEnabled;
+        // written when the config is (re)loaded, read by the log writer and status threads
+        static std::atomic<Level> threshold;
+        static std::atomic<bool> syslogEnabled;
+
+        // writes log lines on a background thread, safe to call more than once
+        static void startThread();
+        // drains the queue and stops the background thread
+        static void stopThread();
+        // lines are written to this file instead of stdout/stderr, empty path restores the console
+        static bool setFile(const std::string& path);
+        // number of lines dropped because the queue was full
+        static uint64_t getDroppedCount();
+
+        static inline bool isEnabled(Level level)
+        {
+            return static_cast<int>(level) <= LOG_MAX_LEVEL && level <= threshold.load(std::memory_order_relaxed);
+        }
+
+        // turns the stream expression into void so it can be used in RELAY_LOG's conditional
+        struct Voidify
+        {
+            void operator&(const Log&) {}
+        };
 
         Log()
         {
@@ -68,7 +99,7 @@ namespace relay
 
         template<typename T> Log& operator<<(T val)
         {
-            if (level <= threshold)
+            if (level <= threshold.load(std::memory_order_relaxed))
             {
                 s += std::to_string(val);
             }
@@ -78,7 +109,7 @@ namespace relay
 
         Log& operator<<(const std::string& val)
         {
-            if (level <= threshold)
+            if (level <= threshold.load(std::memory_order_relaxed))
             {
                 s += val;
             }
@@ -88,7 +119,7 @@ namespace relay
 
         Log& operator<<(const char* val)
         {
-            if (level <= threshold)
+            if (level <= threshold.load(std::memory_order_relaxed))
             {
                 s += val;
             }
@@ -98,7 +129,7 @@ namespace relay
 
         Log& operator<<(char* val)
         {
-            if (level <= threshold)
+            if (level <= threshold.load(std::memory_order_relaxed))
             {
                 s += val;
             }
@@ -0,0 +1,94 @@
+//
+//  rtmp_relay
+//
+
+#include <cmath>
+#include "MediaAnalytics.hpp"
+
+namespace relay
+{
+    static const double BITRATE_TIME_CONSTANT = 2.0; // seconds
+    static const double FRAME_INTERVAL_WEIGHT = 1.0 / 16.0;
+    static const uint64_t MAX_TIMESTAMP_GAP = 1000; // milliseconds, larger jumps are counted as discontinuities
+
+    static double decay(double bitrate, const std::chrono::steady_clock::time_point& from, const std::chrono::steady_clock::time_point& to)
+    {
+        double seconds = std::chrono::duration<double>(to - from).count();
+        return (seconds > 0.0) ? bitrate * std::exp(-seconds / BITRATE_TIME_CONSTANT) : bitrate;
+    }
+
+    int64_t MediaAnalytics::addFrame(Track& track, uint64_t timestamp, size_t size, const std::chrono::steady_clock::time_point& time)
+    {
+        int64_t delta = -1;
+
+        if (track.started)
+        {
+            // exponentially weighted, a constant bitrate converges to its value
+            track.bitrate = decay(track.bitrate, track.time, time) + size * 8.0 / BITRATE_TIME_CONSTANT;
+
+            if (timestamp < track.timestamp || timestamp - track.timestamp > MAX_TIMESTAMP_GAP)
+            {
+                ++discontinuities;
+            }
+            else
+            {
+                delta = static_cast<int64_t>(timestamp - track.timestamp);
+            }
+        }
+        else
+        {
+            track.started = true;
+            track.bitrate = size * 8.0 / BITRATE_TIME_CONSTANT;
+        }
+
+        track.timestamp = timestamp;
+        track.time = time;
+
+        return delta;
+    }
+
+    void MediaAnalytics::addAudioFrame(uint64_t timestamp, size_t size, const std::chrono::steady_clock::time_point& time)
+    {
+        addFrame(audio, timestamp, size, time);
+    }
+
+    void MediaAnalytics::addVideoFrame(uint64_t timestamp, size_t size, VideoFrameType frameType, const std::chrono::steady_clock::time_point& time)
+    {
+        int64_t delta = addFrame(video, timestamp, size, time);
+
+        // frames with the same timestamp don't move the average
+        if (delta > 0)
+        {
+            frameInterval = (frameInterval > 0.0) ?
+                frameInterval + (static_cast<double>(delta) - frameInterval) * FRAME_INTERVAL_WEIGHT :
+                static_cast<double>(delta);
+        }
+
+        if (frameType == VideoFrameType::KEY || frameType == VideoFrameType::GENERATED_KEY)
+        {
+            if (keyFrameReceived)
+            {
+                gopLength = framesSinceKeyFrame;
+                keyFrameInterval = (timestamp > keyFrameTimestamp) ? timestamp - keyFrameTimestamp : 0;
+            }
+
+            keyFrameReceived = true;
+            keyFrameTimestamp = timestamp;
+            framesSinceKeyFrame = 0;
+        }
+
+        ++framesSinceKeyFrame;
+    }
+
+    void MediaAnalytics::getSummary(MediaSummary& summary, const std::chrono::steady_clock::time_point& time) const
+    {
+        summary.frameRate = (frameInterval > 0.0) ? 1000.0 / frameInterval : 0.0;
+        summary.gopLength = gopLength;
+        summary.keyFrameInterval = keyFrameInterval;
+        summary.audioBitrate = audio.started ? decay(audio.bitrate, audio.time, time) : 0.0;
+        summary.videoBitrate = video.started ? decay(video.bitrate, video.time, time) : 0.0;
+        summary.drift = (audio.started && video.started) ?
+            static_cast<int64_t>(video.timestamp) - static_cast<int64_t>(audio.timestamp) : 0;
+        summary.discontinuities = discontinuities;
+    }
+}
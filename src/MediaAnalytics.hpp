@@ -0,0 +1,57 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include "Utils.hpp"
+
+namespace relay
+{
+    struct MediaSummary
+    {
+        double frameRate = 0.0; // from the video timestamps
+        uint32_t gopLength = 0; // video frames in the last complete group of pictures
+        uint64_t keyFrameInterval = 0; // milliseconds between the last two key frames
+        double audioBitrate = 0.0; // bits per second
+        double videoBitrate = 0.0;
+        int64_t drift = 0; // milliseconds the video timestamps are ahead of the audio timestamps
+        uint64_t discontinuities = 0; // timestamps that went backwards or jumped forward
+    };
+
+    // media statistics of a stream updated with every frame in constant time and space,
+    // only touched by the event loop, the status thread gets a MediaSummary copy
+    class MediaAnalytics
+    {
+    public:
+        void addAudioFrame(uint64_t timestamp, size_t size, const std::chrono::steady_clock::time_point& time);
+        void addVideoFrame(uint64_t timestamp, size_t size, VideoFrameType frameType, const std::chrono::steady_clock::time_point& time);
+        // bitrates are decayed to the given time, so they drop when the frames stop
+        void getSummary(MediaSummary& summary, const std::chrono::steady_clock::time_point& time) const;
+
+    private:
+        struct Track
+        {
+            bool started = false;
+            uint64_t timestamp = 0;
+            double bitrate = 0.0;
+            std::chrono::steady_clock::time_point time;
+        };
+
+        // returns the timestamp delta or -1 for the first frame and discontinuities
+        int64_t addFrame(Track& track, uint64_t timestamp, size_t size, const std::chrono::steady_clock::time_point& time);
+
+        Track audio;
+        Track video;
+
+        double frameInterval = 0.0; // moving average in milliseconds
+        bool keyFrameReceived = false;
+        uint64_t keyFrameTimestamp = 0;
+        uint32_t framesSinceKeyFrame = 0;
+        uint32_t gopLength = 0;
+        uint64_t keyFrameInterval = 0;
+        uint64_t discontinuities = 0;
+    };
+}
@@ -0,0 +1,128 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace relay
+{
+    // monotonic counters updated where the traffic passes, read by the /metrics endpoint
+    struct TrafficCounters
+    {
+        uint64_t inBytes = 0;
+        uint64_t outBytes = 0;
+        uint64_t inMessages = 0;
+        uint64_t outMessages = 0;
+        uint64_t droppedMessages = 0;
+    };
+
+    struct RelayCounters
+    {
+        uint64_t acceptedConnections = 0;
+        uint64_t clientConnections = 0; // connections opened to other hosts
+        uint64_t completedHandshakes = 0;
+        uint64_t configReloads = 0;
+        uint64_t failedConfigReloads = 0;
+        uint64_t reloadTime = 0; // microseconds the last config reload took
+        uint64_t failedUpgrades = 0; // binary upgrades after which this process kept running
+        uint64_t restoredConnections = 0; // connections taken over from the previous process
+        uint64_t oversizedMessages = 0; // peers disconnected for announcing a message larger than maxMessageSize
+        uint64_t sendQueueOverflows = 0; // peers disconnected for falling more than maxSendQueueSize behind
+        uint64_t memoryRejections = 0; // publishers and players refused because the memory budget was exceeded
+        uint64_t sentBytes = 0; // to all peers, including the RTMP control messages
+        uint64_t loopRejections = 0; // players refused because of the event loop utilization
+        uint64_t egressRejections = 0; // players refused because of the egress rate
+        uint64_t streamOutputRejections = 0; // players refused because the stream had too many outputs
+    };
+
+    // bytes held by each subsystem, summed on the event loop when needed
+    struct MemoryUsage
+    {
+        uint64_t inputBuffers = 0; // received data waiting for the rest of its message
+        uint64_t sendQueues = 0; // data waiting for the sockets
+        uint64_t streamCaches = 0; // headers and meta data sent to new outputs
+        uint64_t bufferPool = 0; // buffers kept for reuse
+        uint64_t arenas = 0; // blocks kept by the connections' invoke arenas
+
+        uint64_t getTotal() const { return inputBuffers + sendQueues + streamCaches + bufferPool + arenas; }
+    };
+
+    // time spent in each phase of Relay::run, in microseconds
+    struct LoopCounters
+    {
+        uint64_t iterations = 0;
+        uint64_t networkTime = 0;
+        uint64_t statusTime = 0;
+        uint64_t connectionTime = 0;
+        uint64_t serverTime = 0;
+        uint64_t sleepTime = 0;
+        uint64_t readySockets = 0; // summed over all iterations
+        uint64_t maxReadySockets = 0;
+        uint64_t slowCallbacks = 0;
+    };
+
+    // Prometheus text exposition format helpers
+    inline void writeMetricHeader(std::string& str, const std::string& name, const char* type, const char* help)
+    {
+        str += "# HELP ";
+        str += name;
+        str += " ";
+        str += help;
+        str += "\n# TYPE ";
+        str += name;
+        str += " ";
+        str += type;
+        str += "\n";
+    }
+
+    inline void writeMetric(std::string& str, const std::string& name, const std::string& labels, uint64_t value)
+    {
+        str += name;
+        if (!labels.empty())
+        {
+            str += "{";
+            str += labels;
+            str += "}";
+        }
+        str += " ";
+        str += std::to_string(value);
+        str += "\n";
+    }
+
+    inline void writeRealMetric(std::string& str, const std::string& name, const std::string& labels, double value)
+    {
+        str += name;
+        if (!labels.empty())
+        {
+            str += "{";
+            str += labels;
+            str += "}";
+        }
+        str += " ";
+        str += std::to_string(value);
+        str += "\n";
+    }
+
+    inline void appendMetricLabel(std::string& labels, const char* name, const std::string& value)
+    {
+        if (!labels.empty()) labels += ",";
+        labels += name;
+        labels += "=\"";
+
+        for (char c : value)
+        {
+            switch (c)
+            {
+                case '\\': labels += "\\\\"; break;
+                case '"': labels += "\\\""; break;
+                case '\n': labels += "\\n"; break;
+                default: labels += c; break;
+            }
+        }
+
+        labels += "\"";
+    }
+}
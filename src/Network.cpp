@@ -55,9 +55,11 @@ namespace relay
         auto currentTime = std::chrono::steady_clock::now();
         auto diff = std::chrono::duration_cast<std::chrono::microseconds>(currentTime - previousTime);
 
-        float delta = diff.count() / 1000000000.0f;
+        float delta = diff.count() / 1000000.0f;
         previousTime = currentTime;
 
+        readyCount = 0;
+
         std::vector<pollfd> pollFds;
         pollFds.reserve(sockets.size());
 
@@ -82,7 +84,7 @@ namespace relay
 #endif
             {
                 int error = getLastError();
-                Log(Log::Level::ERR) << "Poll failed, error: " << error;
+                RELAY_LOG(Log::Level::ERR) << "Poll failed, error: " << error;
                 return false;
             }
 
@@ -108,6 +110,8 @@ namespace relay
                 {
                     Socket* socket = *i;
 
+                    if (pollFd.revents & (POLLIN | POLLERR | POLLHUP)) ++readyCount;
+
                     if (pollFd.revents & POLLIN)
                     {
                         socket->read();
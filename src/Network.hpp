@@ -11,6 +11,7 @@
 #include <string>
 #include <set>
 #include <chrono>
+#include "BufferPool.hpp"
 #include "Socket.hpp"
 
 namespace relay
@@ -28,6 +29,14 @@ namespace relay
         Network& operator=(Network&&) = delete;
 
         bool update();
+        // sockets that had data or an error to read in the last update
+        size_t getReadyCount() const { return readyCount; }
+
+        BufferPool& getBufferPool() { return bufferPool; }
+        const BufferPool& getBufferPool() const { return bufferPool; }
+
+        // out data of all the sockets, kept up to date by the sockets
+        size_t getSendQueueSize() const { return sendQueueSize; }
 
     protected:
         void addSocket(Socket& socket);
@@ -38,5 +47,9 @@ namespace relay
         std::set<Socket*> socketDeleteSet;
 
         std::chrono::steady_clock::time_point previousTime;
+        size_t readyCount = 0;
+
+        BufferPool bufferPool;
+        size_t sendQueueSize = 0;
     };
 }
@@ -5,9 +5,11 @@
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include "Constants.hpp"
 #include "Log.hpp"
 #include "RTMP.hpp"
-#include "Utils.hpp"
+#include "Sha256.hpp"
 
 namespace relay
 {
@@ -35,113 +37,117 @@ namespace relay
             };
         }
 
-        static uint32_t decodeHeader(const std::vector<uint8_t>& data, uint32_t offset, Header& header, std::map<uint32_t, rtmp::Header>& previousPackets)
+        static void logHeader(const Header& header)
         {
-            uint32_t originalOffset = offset;
+            Log log(Log::Level::ALL);
+            log << "Header type: ";
 
-            if (data.size() - offset < 1)
+            switch (header.type)
             {
-                return 0;
-            }
-
-            uint8_t headerData = *(data.data() + offset);
-            offset += 1;
+                case Header::Type::TWELVE_BYTE: log << "TWELVE_BYTE"; break;
+                case Header::Type::EIGHT_BYTE: log << "EIGHT_BYTE"; break;
+                case Header::Type::FOUR_BYTE: log << "FOUR_BYTE"; break;
+                case Header::Type::ONE_BYTE: log << "ONE_BYTE"; break;
+                default: log << "invalid header type"; break;
+            };
 
-            header.channel = static_cast<uint32_t>(headerData & 0x3F);
-            header.type = static_cast<Header::Type>(headerData >> 6);
+            log << "(" << static_cast<uint32_t>(header.type) << "), channel: " << static_cast<uint32_t>(header.channel);
 
-            if (header.channel < 2)
+            if (header.type != Header::Type::ONE_BYTE)
             {
-                uint32_t newChannel;
-                uint32_t ret = decodeIntBE(data, offset, header.channel + 1, newChannel);
+                log << ", ts: " << header.ts;
 
-                if (!ret)
+                if (header.ts == 0xffffff)
                 {
-                    return false;
+                    log << " (extended)";
                 }
 
-                offset += ret;
+                if (header.type != Header::Type::FOUR_BYTE)
+                {
+                    log << ", data length: " << header.length;
+                    log << ", message type: " << messageTypeToString(header.messageType) << "(" << static_cast<uint32_t>(header.messageType) << ")";
 
-                header.channel = 64 + newChannel;
+                    if (header.type != Header::Type::EIGHT_BYTE)
+                    {
+                        log << ", message stream ID: " << header.messageStreamId;
+                    }
+                }
             }
 
-            Log log(Log::Level::ALL);
-            log << "Header type: ";
+            log << ", final timestamp: " << header.timestamp;
+        }
 
-            switch (header.type)
+        static bool decodeHeader(ByteReader& reader, Header& header, std::map<uint32_t, rtmp::Header>& previousPackets)
+        {
+            uint8_t headerData;
+
+            if (!reader.readUInt8(headerData))
             {
-                case Header::Type::TWELVE_BYTE: log << "TWELVE_BYTE"; break;
-                case Header::Type::EIGHT_BYTE: log << "EIGHT_BYTE"; break;
-                case Header::Type::FOUR_BYTE: log << "FOUR_BYTE"; break;
-                case Header::Type::ONE_BYTE: log << "ONE_BYTE"; break;
-                default: log << "invalid header type"; break;
-            };
+                return false;
+            }
 
-            log << "(" << static_cast<uint32_t>(header.type) << "), channel: " << static_cast<uint32_t>(header.channel);
+            header.channel = static_cast<uint32_t>(headerData & 0x3F);
+            header.type = static_cast<Header::Type>(headerData >> 6);
 
-            header.length  = previousPackets[header.channel].length;
-            header.messageType  = previousPackets[header.channel].messageType;
-            header.messageStreamId = previousPackets[header.channel].messageStreamId;
-            header.ts = previousPackets[header.channel].ts;
+            if (header.channel == 0)
+            {
+                uint8_t newChannel;
 
-            if (header.type != Header::Type::ONE_BYTE)
+                if (!reader.readUInt8(newChannel))
+                {
+                    return false;
+                }
+
+                header.channel = 64 + newChannel;
+            }
+            else if (header.channel == 1)
             {
-                uint32_t ret = decodeIntBE(data, offset, 3, header.ts);
+                uint16_t newChannel;
 
-                if (!ret)
+                if (!reader.readUInt16BE(newChannel))
                 {
-                    return 0;
+                    return false;
                 }
 
-                offset += ret;
+                header.channel = 64 + newChannel;
+            }
 
-                log << ", ts: " << header.ts;
+            const Header& previousHeader = previousPackets[header.channel];
 
-                if (header.ts == 0xffffff)
+            header.length = previousHeader.length;
+            header.messageType = previousHeader.messageType;
+            header.messageStreamId = previousHeader.messageStreamId;
+            header.ts = previousHeader.ts;
+
+            if (header.type != Header::Type::ONE_BYTE)
+            {
+                if (!reader.readUInt24BE(header.ts))
                 {
-                    log << " (extended)";
+                    return false;
                 }
 
                 if (header.type != Header::Type::FOUR_BYTE)
                 {
-                    ret = decodeIntBE(data, offset, 3, header.length);
-
-                    if (!ret)
+                    if (!reader.readUInt24BE(header.length))
                     {
-                        return 0;
+                        return false;
                     }
 
-                    offset += ret;
-
-                    log << ", data length: " << header.length;
+                    uint8_t messageType;
 
-                    if (data.size() - offset < 1)
+                    if (!reader.readUInt8(messageType))
                     {
-                        return 0;
+                        return false;
                     }
 
-                    header.messageType = static_cast<MessageType>(*(data.data() + offset));
-                    offset += 1;
-
-                    log << ", message type: " << messageTypeToString(header.messageType) << "(" << static_cast<uint32_t>(header.messageType) << ")";
+                    header.messageType = static_cast<MessageType>(messageType);
 
                     if (header.type != Header::Type::EIGHT_BYTE)
                     {
-                        if (data.size() - offset < 4)
+                        if (!reader.readUInt32LE(header.messageStreamId))
                         {
-                            return 0;
+                            return false;
                         }
-
-                        ret = decodeIntLE(data, offset, 4, header.messageStreamId);
-
-                        if (!ret)
-                        {
-                            return 0;
-                        }
-
-                        offset += ret;
-
-                        log << ", message stream ID: " << header.messageStreamId;
                     }
                 }
             }
@@ -149,16 +155,14 @@ namespace relay
             // extended timestamp
             if (header.ts == 0xffffff)
             {
-                uint32_t ret = decodeIntBE(data, offset, 4, header.timestamp);
+                uint32_t extendedTimestamp;
 
-                if (!ret)
+                if (!reader.readUInt32BE(extendedTimestamp))
                 {
-                    return 0;
+                    return false;
                 }
 
-                offset += ret;
-
-                log << ", extended timestamp: " << header.timestamp;
+                header.timestamp = extendedTimestamp;
             }
             else
             {
@@ -168,38 +172,76 @@ namespace relay
             // relative timestamp
             if (header.type != rtmp::Header::Type::TWELVE_BYTE)
             {
-                header.timestamp += previousPackets[header.channel].timestamp;
+                header.timestamp += previousHeader.timestamp;
             }
 
-            log << ", final timestamp: " << header.timestamp;
+            if (Log::isEnabled(Log::Level::ALL))
+            {
+                logHeader(header);
+            }
 
-            return offset - originalOffset;
+            return true;
         }
 
-        uint32_t Packet::decode(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets)
+        uint32_t Packet::decode(const std::vector<uint8_t>& buffer, uint32_t offset, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets, BufferPool* bufferPool)
         {
-            uint32_t originalOffset = offset;
+            ByteReader reader(buffer, offset);
+
+            return decode(reader, chunkSize, previousPackets, bufferPool);
+        }
+
+        uint32_t Packet::decode(ByteReader& reader, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets, BufferPool* bufferPool)
+        {
+            if (chunkSize == 0)
+            {
+                return 0;
+            }
+
+            size_t originalOffset = reader.getOffset();
 
             uint32_t remainingBytes = 0;
 
             data.clear();
+            length = 0;
 
             auto currentPreviousPackets = previousPackets;
 
             bool firstPacket = true;
 
+            // basic header (with the type bits set to ONE_BYTE) that continuation chunks on the same chunk stream start with
+            uint8_t continuationHeader[3];
+            uint32_t continuationHeaderSize = 0;
+            uint32_t extendedTimestampSize = 0;
+
             do
             {
+                // continuation chunks are nearly always type 3 headers on the chunk stream of the message,
+                // compare their header bytes and copy the payload without decoding the header
+                if (!firstPacket)
+                {
+                    uint32_t packetSize = std::min(remainingBytes, chunkSize);
+
+                    if (reader.getRemaining() >= continuationHeaderSize + extendedTimestampSize + packetSize &&
+                        memcmp(reader.getCurrent(), continuationHeader, continuationHeaderSize) == 0)
+                    {
+                        const uint8_t* chunk = reader.getCurrent() + continuationHeaderSize + extendedTimestampSize;
+                        data.insert(data.end(), chunk, chunk + packetSize);
+                        reader.skip(continuationHeaderSize + extendedTimestampSize + packetSize);
+
+                        remainingBytes -= packetSize;
+                        continue;
+                    }
+                }
+
+                size_t headerOffset = reader.getOffset();
                 Header header;
-                uint32_t ret = decodeHeader(buffer, offset, header, currentPreviousPackets);
 
-                if (!ret)
+                if (!decodeHeader(reader, header, currentPreviousPackets))
                 {
+                    reader.setOffset(originalOffset);
                     return 0;
                 }
 
-                offset += ret;
-
                 if (header.type == Header::Type::FOUR_BYTE ||
                     header.type == Header::Type::EIGHT_BYTE ||
                     header.type == Header::Type::TWELVE_BYTE)
@@ -216,49 +258,78 @@ namespace relay
                     timestamp = header.timestamp;
 
                     remainingBytes = header.length;
+                    length = header.length;
 
                     currentPreviousPackets[header.channel].ts = header.ts;
                     currentPreviousPackets[header.channel].timestamp = header.timestamp;
 
+                    const uint8_t* basicHeader = reader.getData() + headerOffset;
+                    continuationHeaderSize = ((basicHeader[0] & 0x3F) == 0) ? 2 : ((basicHeader[0] & 0x3F) == 1) ? 3 : 1;
+                    std::copy(basicHeader, basicHeader + continuationHeaderSize, continuationHeader);
+                    continuationHeader[0] |= static_cast<uint8_t>(Header::Type::ONE_BYTE) << 6;
+                    extendedTimestampSize = (header.ts == 0xffffff) ? 4 : 0;
+
+                    // every following chunk has at least a one byte header, don't parse the chunks if the message is not complete yet
+                    uint32_t chunkCount = (remainingBytes + chunkSize - 1) / chunkSize;
+
+                    if (chunkCount > 1 && reader.getRemaining() < static_cast<size_t>(remainingBytes) + chunkCount - 1)
+                    {
+                        reader.setOffset(originalOffset);
+                        return 0;
+                    }
+
+                    // the length comes from the peer, storage is only taken once the whole message has arrived
+                    if (bufferPool && data.capacity() < remainingBytes)
+                    {
+                        bufferPool->release(data);
+                        data = bufferPool->acquire(remainingBytes);
+                    }
+                    else
+                    {
+                        data.reserve(remainingBytes);
+                    }
+
                     firstPacket = false;
                 }
 
                 uint32_t packetSize = std::min(remainingBytes, chunkSize);
 
-                if (packetSize + offset > buffer.size())
+                const uint8_t* chunk;
+
+                if (!reader.readBytes(packetSize, chunk))
                 {
-                    Log(Log::Level::ALL) << "Not enough data to read";
+                    RELAY_LOG(Log::Level::ALL) << "Not enough data to read";
 
+                    reader.setOffset(originalOffset);
                     return 0;
                 }
 
-                data.insert(data.end(), buffer.begin() + offset, buffer.begin() + offset + packetSize);
+                data.insert(data.end(), chunk, chunk + packetSize);
 
                 remainingBytes -= packetSize;
-                offset += packetSize;
             }
             while (remainingBytes);
 
             // store previous packet if successfully read packet
             previousPackets = currentPreviousPackets;
 
-            return offset - originalOffset;
+            return static_cast<uint32_t>(reader.getOffset() - originalOffset);
         }
 
-        static uint32_t encodeHeader(std::vector<uint8_t>& data, Header& header, std::map<uint32_t, rtmp::Header>& previousPackets)
+        static bool encodeHeader(ByteWriter& writer, Header& header, std::map<uint32_t, rtmp::Header>& previousPackets)
         {
-            uint32_t originalSize = static_cast<uint32_t>(data.size());
+            const Header& previousHeader = previousPackets[header.channel];
 
-            bool useDelta = previousPackets[header.channel].channel != Channel::NONE &&
-                previousPackets[header.channel].messageStreamId == header.messageStreamId &&
-                header.timestamp >= previousPackets[header.channel].timestamp;
+            bool useDelta = previousHeader.channel != Channel::NONE &&
+                previousHeader.messageStreamId == header.messageStreamId &&
+                header.timestamp >= previousHeader.timestamp;
 
             uint64_t timestamp = header.timestamp;
 
             // relative timestamp
             if (useDelta)
             {
-                timestamp -= previousPackets[header.channel].timestamp;
+                timestamp -= previousHeader.timestamp;
             }
 
             if (timestamp >= 0xffffff)
@@ -272,10 +343,10 @@ namespace relay
 
             if (useDelta)
             {
-                if (header.messageType == previousPackets[header.channel].messageType &&
-                    header.length == previousPackets[header.channel].length)
+                if (header.messageType == previousHeader.messageType &&
+                    header.length == previousHeader.length)
                 {
-                    if (header.timestamp == previousPackets[header.channel].timestamp)
+                    if (header.timestamp == previousHeader.timestamp)
                     {
                         header.type = rtmp::Header::Type::ONE_BYTE;
                     }
@@ -299,103 +370,82 @@ namespace relay
             if (header.channel < 64)
             {
                 headerData |= static_cast<uint8_t>(header.channel);
-                data.push_back(headerData);
+                writer.writeUInt8(headerData);
             }
             else if (static_cast<uint32_t>(header.channel) < 64 + 256)
             {
                 headerData |= 0;
-                data.push_back(headerData);
-                encodeIntBE(data, 1, header.channel - 64);
+                writer.writeUInt8(headerData);
+                writer.writeUInt8(static_cast<uint8_t>(header.channel - 64));
             }
-            else
+            else if (static_cast<uint32_t>(header.channel) < 64 + 65536)
             {
                 headerData |= 1;
-                data.push_back(headerData);
-                encodeIntBE(data, 2, header.channel - 64);
+                writer.writeUInt8(headerData);
+                writer.writeUInt16BE(static_cast<uint16_t>(header.channel - 64));
             }
-
-            Log log(Log::Level::ALL);
-            log << "Header type: ";
-
-            switch (header.type)
+            else
             {
-                case Header::Type::TWELVE_BYTE: log << "TWELVE_BYTE"; break;
-                case Header::Type::EIGHT_BYTE: log << "EIGHT_BYTE"; break;
-                case Header::Type::FOUR_BYTE: log << "FOUR_BYTE"; break;
-                case Header::Type::ONE_BYTE: log << "ONE_BYTE"; break;
-                default: log << "invalid header type"; break;
-            };
-
-            log << "(" << static_cast<uint32_t>(header.type) << "), channel: " << static_cast<uint32_t>(header.channel);
+                return false;
+            }
 
             if (header.type != Header::Type::ONE_BYTE)
             {
-                uint32_t ret = encodeIntBE(data, 3, header.ts);
-
-                if (!ret)
-                {
-                    return 0;
-                }
-
-                log << ", ts: " << header.ts;
-
-                if (header.ts == 0xffffff)
-                {
-                    log << " (extended)";
-                }
+                writer.writeUInt24BE(header.ts);
 
                 if (header.type != Header::Type::FOUR_BYTE)
                 {
-                    ret = encodeIntBE(data, 3, header.length);
-
-                    if (!ret)
+                    if (header.length > 0xffffff)
                     {
-                        return 0;
+                        return false;
                     }
 
-                    data.insert(data.end(), static_cast<uint8_t>(header.messageType));
-
-                    log << ", data length: " << header.length;
-                    log << ", message type: " << messageTypeToString(header.messageType) << "(" << static_cast<uint32_t>(header.messageType) << ")";
+                    writer.writeUInt24BE(header.length);
+                    writer.writeUInt8(static_cast<uint8_t>(header.messageType));
 
                     if (header.type != Header::Type::EIGHT_BYTE)
                     {
-                        ret = encodeIntLE(data, 4, header.messageStreamId);
-
-                        if (!ret)
-                        {
-                            return 0;
-                        }
-
-                        log << ", message stream ID: " << header.messageStreamId;
+                        writer.writeUInt32LE(header.messageStreamId);
                     }
                 }
             }
 
-            if (header.ts == 0xffffff || (header.type == Header::Type::ONE_BYTE && previousPackets[header.channel].ts == 0xffffff))
+            if (header.ts == 0xffffff || (header.type == Header::Type::ONE_BYTE && previousHeader.ts == 0xffffff))
             {
-                uint32_t ret = encodeIntBE(data, 4, timestamp);
-
-                if (!ret)
-                {
-                    return 0;
-                }
-
-                log << ", extended timestamp: " << header.timestamp;
+                writer.writeUInt32BE(static_cast<uint32_t>(timestamp));
             }
 
-            log << ", final timestamp: " << header.timestamp;
+            if (Log::isEnabled(Log::Level::ALL))
+            {
+                logHeader(header);
+            }
 
-            return static_cast<uint32_t>(data.size()) - originalSize;
+            return true;
         }
 
         uint32_t Packet::encode(std::vector<uint8_t>& buffer, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets) const
         {
-            uint32_t originalSize = static_cast<uint32_t>(buffer.size());
+            ByteWriter writer(buffer);
+
+            return encode(writer, chunkSize, previousPackets);
+        }
+
+        uint32_t Packet::encode(ByteWriter& writer, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets) const
+        {
+            if (chunkSize == 0)
+            {
+                return 0;
+            }
+
+            size_t originalSize = writer.getSize();
 
             uint32_t remainingBytes = static_cast<uint32_t>(data.size());
             uint32_t start = 0;
 
+            // at most 18 bytes of header (3 basic + 11 message + 4 extended timestamp) per chunk
+            uint32_t chunkCount = (remainingBytes + chunkSize - 1) / chunkSize;
+            writer.reserve(data.size() + chunkCount * 18);
+
             Header header;
             header.channel = channel;
             header.messageType = messageType;
@@ -405,7 +455,7 @@ namespace relay
 
             while (remainingBytes > 0)
             {
-                if (!encodeHeader(buffer, header, previousPackets))
+                if (!encodeHeader(writer, header, previousPackets))
                 {
                     return 0;
                 }
@@ -419,13 +469,126 @@ namespace relay
 
                 uint32_t size = std::min(remainingBytes, chunkSize);
 
-                buffer.insert(buffer.end(), data.begin() + start, data.begin() + start + size);
+                writer.writeBytes(data.data() + start, size);
 
                 start += size;
                 remainingBytes -= size;
             }
 
-            return static_cast<uint32_t>(buffer.size()) - originalSize;
+            return static_cast<uint32_t>(writer.getSize() - originalSize);
+        }
+
+        static const uint8_t GENUINE_FP_KEY[] = {
+            'G', 'e', 'n', 'u', 'i', 'n', 'e', ' ', 'A', 'd', 'o', 'b', 'e', ' ',
+            'F', 'l', 'a', 's', 'h', ' ', 'P', 'l', 'a', 'y', 'e', 'r', ' ', '0', '0', '1', // 30 bytes
+            0xF0, 0xEE, 0xC2, 0x4A, 0x80, 0x68, 0xBE, 0xE8, 0x2E, 0x00, 0xD0, 0xD1,
+            0x02, 0x9E, 0x7E, 0x57, 0x6E, 0xEC, 0x5D, 0x2D, 0x29, 0x80, 0x6F, 0xAB,
+            0x93, 0xB8, 0xE6, 0x36, 0xCF, 0xEB, 0x31, 0xAE
+        };
+
+        static const uint8_t GENUINE_FMS_KEY[] = {
+            'G', 'e', 'n', 'u', 'i', 'n', 'e', ' ', 'A', 'd', 'o', 'b', 'e', ' ',
+            'F', 'l', 'a', 's', 'h', ' ', 'M', 'e', 'd', 'i', 'a', ' ',
+            'S', 'e', 'r', 'v', 'e', 'r', ' ', '0', '0', '1', // 36 bytes
+            0xF0, 0xEE, 0xC2, 0x4A, 0x80, 0x68, 0xBE, 0xE8, 0x2E, 0x00, 0xD0, 0xD1,
+            0x02, 0x9E, 0x7E, 0x57, 0x6E, 0xEC, 0x5D, 0x2D, 0x29, 0x80, 0x6F, 0xAB,
+            0x93, 0xB8, 0xE6, 0x36, 0xCF, 0xEB, 0x31, 0xAE
+        };
+
+        static const uint32_t HANDSHAKE_SIZE = sizeof(Challenge);
+        static const uint32_t DIGEST_SIZE = Sha256::DIGEST_SIZE;
+
+        // the digest block starts either at byte 8 or at byte 772 of the challenge
+        static uint32_t getDigestOffset(const uint8_t* challenge, uint32_t base)
+        {
+            uint32_t offset = static_cast<uint32_t>(challenge[base]) +
+                challenge[base + 1] +
+                challenge[base + 2] +
+                challenge[base + 3];
+
+            return offset % 728 + base + 4;
+        }
+
+        static void calculateDigest(const uint8_t* challenge, uint32_t digestOffset, const uint8_t* key, size_t keySize, uint8_t* digest)
+        {
+            HmacSha256 hmac(key, keySize);
+            hmac.update(challenge, digestOffset);
+            hmac.update(challenge + digestOffset + DIGEST_SIZE, HANDSHAKE_SIZE - digestOffset - DIGEST_SIZE);
+            hmac.finish(digest);
+        }
+
+        uint32_t findClientDigest(const uint8_t* challenge)
+        {
+            // version 0 means simple handshake
+            if (challenge[4] == 0 && challenge[5] == 0 && challenge[6] == 0 && challenge[7] == 0) return 0;
+
+            const uint32_t bases[] = {772, 8};
+
+            for (uint32_t base : bases)
+            {
+                uint32_t digestOffset = getDigestOffset(challenge, base);
+
+                uint8_t digest[DIGEST_SIZE];
+                calculateDigest(challenge, digestOffset, GENUINE_FP_KEY, 30, digest);
+
+                if (std::equal(digest, digest + DIGEST_SIZE, challenge + digestOffset)) return digestOffset;
+            }
+
+            return 0;
+        }
+
+        void signServerChallenge(uint8_t* challenge, uint32_t clientDigestOffset)
+        {
+            uint32_t digestOffset = getDigestOffset(challenge, (clientDigestOffset >= 776) ? 772 : 8);
+
+            calculateDigest(challenge, digestOffset, GENUINE_FMS_KEY, 36, challenge + digestOffset);
+        }
+
+        void signServerAck(uint8_t* ack, const uint8_t* clientDigest)
+        {
+            uint8_t key[DIGEST_SIZE];
+
+            HmacSha256 keyHmac(GENUINE_FMS_KEY, sizeof(GENUINE_FMS_KEY));
+            keyHmac.update(clientDigest, DIGEST_SIZE);
+            keyHmac.finish(key);
+
+            HmacSha256 hmac(key, sizeof(key));
+            hmac.update(ack, HANDSHAKE_SIZE - DIGEST_SIZE);
+            hmac.finish(ack + HANDSHAKE_SIZE - DIGEST_SIZE);
+        }
+
+        bool writeHandshakeReply(const uint8_t* challenge, uint8_t* reply, const std::function<void(uint8_t*, size_t)>& generateRandomBytes)
+        {
+            // S0
+            reply[0] = RTMP_VERSION;
+
+            // S1
+            Challenge* replyChallenge = reinterpret_cast<Challenge*>(reply + sizeof(uint8_t));
+            replyChallenge->time = 0;
+            std::copy(RTMP_SERVER_VERSION, RTMP_SERVER_VERSION + sizeof(RTMP_SERVER_VERSION), replyChallenge->version);
+            generateRandomBytes(replyChallenge->randomBytes, sizeof(replyChallenge->randomBytes));
+
+            // S2
+            uint8_t* ack = reply + sizeof(uint8_t) + sizeof(Challenge);
+
+            uint32_t digestOffset = findClientDigest(challenge);
+
+            if (digestOffset > 0)
+            {
+                signServerChallenge(reinterpret_cast<uint8_t*>(replyChallenge), digestOffset);
+
+                generateRandomBytes(ack, sizeof(Ack));
+                signServerAck(ack, challenge + digestOffset);
+
+                return true;
+            }
+            else
+            {
+                // echo C1
+                std::copy(challenge, challenge + sizeof(Ack), ack);
+
+                return false;
+            }
         }
     }
 }
@@ -5,8 +5,11 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <vector>
 #include <map>
+#include "BufferPool.hpp"
+#include "ByteStream.hpp"
 
 namespace relay
 {
@@ -82,11 +85,16 @@ namespace relay
             MessageType messageType = MessageType::NONE;
             uint32_t messageStreamId = 0;
             uint64_t timestamp = 0;
+            uint32_t length = 0; // message length from the first chunk header, set even if the message is not complete yet
 
             std::vector<uint8_t> data;
 
-            uint32_t decode(const std::vector<uint8_t>& data, uint32_t offset, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets);
+            // takes the storage for data from the buffer pool if one is given
+            uint32_t decode(const std::vector<uint8_t>& data, uint32_t offset, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets, BufferPool* bufferPool = nullptr);
+            // leaves the reader untouched if the whole packet is not available yet
+            uint32_t decode(ByteReader& reader, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets, BufferPool* bufferPool = nullptr);
             uint32_t encode(std::vector<uint8_t>& data, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets) const;
+            uint32_t encode(ByteWriter& writer, uint32_t chunkSize, std::map<uint32_t, rtmp::Header>& previousPackets) const;
         };
 
         struct Challenge
@@ -102,5 +110,17 @@ namespace relay
             uint8_t version[4];
             uint8_t randomBytes[1528];
         };
+
+        // digest ("complex") handshake used by Flash Player 9 and newer clients
+        // returns the offset of the client digest in C1 or 0 if C1 is not signed
+        uint32_t findClientDigest(const uint8_t* challenge);
+        // signs S1 using the same digest scheme as the client
+        void signServerChallenge(uint8_t* challenge, uint32_t clientDigestOffset);
+        // signs S2 with a key derived from the client digest
+        void signServerAck(uint8_t* ack, const uint8_t* clientDigest);
+
+        // writes S0, S1 and S2 replying to C1 into reply (1 + 2 * 1536 bytes), uses the digest handshake if C1 is signed
+        // generateRandomBytes fills the random parts of S1 and S2, returns true if the digest handshake was used
+        bool writeHandshakeReply(const uint8_t* challenge, uint8_t* reply, const std::function<void(uint8_t*, size_t)>& generateRandomBytes);
     }
 }
@@ -3,129 +3,63 @@
 //
 
 #include <ctime>
+#include <cstring>
 #include <memory>
 #include <algorithm>
 #include <functional>
 #include <iostream>
 #include <chrono>
 #include <regex>
+#include <set>
 #include <thread>
 #include <sstream>
 #include <iostream>
 #include <iomanip>
+#ifndef _WIN32
+#  include <sys/socket.h>
+#  include <sys/wait.h>
+#  include <unistd.h>
+#endif
 #include "yaml-cpp/yaml.h"
+#include "Handoff.hpp"
 #include "Log.hpp"
 #include "Relay.hpp"
 #include "Status.hpp"
 #include "Connection.hpp"
+#include "StatusSnapshot.hpp"
+#include "Utils.hpp"
 
 namespace relay
 {
     uint64_t Relay::currentId = 0;
 
-    Relay::Relay(Network& aNetwork):
-        generator(static_cast<unsigned int>(std::chrono::high_resolution_clock::now().time_since_epoch().count())),
-        network(aNetwork)
+    static const uint64_t SLOW_CALLBACK_THRESHOLD = 10000; // microseconds
+    static const uint64_t CAPACITY_INTERVAL = 1000000; // microseconds
+    static const char* const DEFAULT_RELAY_ID = "rtmp_relay";
+
+    static uint64_t getMicroseconds(const std::chrono::steady_clock::duration& duration)
     {
-        previousTime = std::chrono::steady_clock::now();
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
     }
 
-    Relay::~Relay()
+    const char* getAdmissionString(Admission admission)
     {
-        for (auto& a : servers)
+        switch (admission)
         {
-            a->stop();
+            case Admission::ACCEPTED: return "accepted";
+            case Admission::LOOP_UTILIZATION: return "loop utilization";
+            case Admission::EGRESS_RATE: return "egress rate";
+            case Admission::STREAM_OUTPUTS: return "stream outputs";
         }
 
-        for (auto& c : connections)
-        {
-            c->close(true);
-        }
+        return "unknown";
     }
 
-    bool Relay::init(const std::string& config)
+    // fills in the endpoints of each server and the addresses to listen on, without changing the relay
+    static bool parseServers(const YAML::Node& serversArray,
+                             std::vector<std::vector<Endpoint>>& serverEndpoints,
+                             std::set<std::string>& listenAddresses)
     {
-        servers.clear();
-        connections.clear();
-        status.reset();
-
-        YAML::Node document;
-
-        try
-        {
-            document = YAML::LoadFile(config);
-        }
-        catch (YAML::BadFile)
-        {
-            Log(Log::Level::ERR) << "Failed to open " << config;
-            return false;
-        }
-        catch (YAML::ParserException& e)
-        {
-            Log(Log::Level::ERR) << "Failed to parse " << config << ", " << e.msg << " on line " << e.mark.line << " column " << e.mark.column;
-            return false;
-        }
-
-        if (document["log"])
-        {
-            const YAML::Node& logObject = document["log"];
-
-            if (logObject["level"])
-            {
-                Log::threshold = static_cast<Log::Level>(logObject["level"].as<uint32_t>());
-            }
-
-#ifndef _WIN32
-            if (logObject["syslogEnabled"])
-            {
-                Log::syslogEnabled = logObject["syslogEnabled"].as<bool>();
-            }
-
-            if (logObject["syslogIdent"])
-            {
-                syslogIdent = logObject["syslogIdent"].as<std::string>();
-            }
-
-            if (logObject["syslogFacility"])
-            {
-                std::string facility = logObject["syslogFacility"].as<std::string>();
-
-                if (facility == "LOG_USER") syslogFacility = LOG_USER;
-                else if (facility == "LOG_LOCAL0") syslogFacility = LOG_LOCAL0;
-                else if (facility == "LOG_LOCAL1") syslogFacility = LOG_LOCAL1;
-                else if (facility == "LOG_LOCAL2") syslogFacility = LOG_LOCAL2;
-                else if (facility == "LOG_LOCAL3") syslogFacility = LOG_LOCAL3;
-                else if (facility == "LOG_LOCAL4") syslogFacility = LOG_LOCAL4;
-                else if (facility == "LOG_LOCAL5") syslogFacility = LOG_LOCAL5;
-                else if (facility == "LOG_LOCAL6") syslogFacility = LOG_LOCAL6;
-                else if (facility == "LOG_LOCAL7") syslogFacility = LOG_LOCAL7;
-            }
-#endif
-        }
-
-        openLog();
-
-        if (document["timeout"])
-        {
-            float ts = document["timeout"].as<float>();
-            timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<int>(ts * 1000));
-            hasTimeout = true;
-        }
-
-        if (document["statusPage"])
-        {
-            const YAML::Node& statusPageObject = document["statusPage"];
-
-            if (statusPageObject["address"])
-            {
-                status.reset(new Status(network, *this, statusPageObject["address"].as<std::string>()));
-            }
-        }
-
-        std::set<std::string> listenAddresses;
-
-        const YAML::Node& serversArray = document["servers"];
-
         for (size_t serverIndex = 0; serverIndex < serversArray.size(); ++serverIndex)
         {
             std::vector<Endpoint> endpoints;
@@ -144,7 +78,7 @@ namespace relay
 
                     if (!endpointObject["type"] || !endpointObject["direction"] || !endpointObject["address"])
                     {
-                        Log(Log::Level::ERR) << "Endpoint configuration is missing field";
+                        RELAY_LOG(Log::Level::ERR) << "Endpoint configuration is missing field";
                         return false;
                     }
 
@@ -191,6 +125,11 @@ namespace relay
                         endpointAddress.url = address;
                         endpointAddress.ipAddresses = std::make_pair(addr.first, addr.second);
                         endpoint.addresses.push_back(endpointAddress);
+
+                        if (endpoint.connectionType == Connection::Type::HOST)
+                        {
+                            listenAddresses.insert(address);
+                        }
                     }
 
                     if (endpointObject["connectionTimeout"]) endpoint.connectionTimeout = endpointObject["connectionTimeout"].as<float>();
@@ -215,6 +154,8 @@ namespace relay
                     if (endpointObject["video"]) endpoint.videoStream = endpointObject["video"].as<bool>();
                     if (endpointObject["audio"]) endpoint.audioStream = endpointObject["audio"].as<bool>();
                     if (endpointObject["data"]) endpoint.dataStream = endpointObject["data"].as<bool>();
+                    if (endpointObject["latencyProbeInterval"]) endpoint.latencyProbeInterval = endpointObject["latencyProbeInterval"].as<float>();
+                    if (endpointObject["latencyProbes"]) endpoint.latencyProbes = endpointObject["latencyProbes"].as<bool>();
                     if (endpointObject["amfVersion"])
                     {
                         switch (endpointObject["amfVersion"].as<uint32_t>())
@@ -222,7 +163,7 @@ namespace relay
                             case 0: endpoint.amfVersion = amf::Version::AMF0; break;
                             case 3: endpoint.amfVersion = amf::Version::AMF3; break;
                             default:
-                                Log(Log::Level::ERR) << "Invalid AMF version";
+                                RELAY_LOG(Log::Level::ERR) << "Invalid AMF version";
                                 break;
                         }
 
@@ -244,26 +185,574 @@ namespace relay
 
                 if (!hasName)
                 {
-                    Log(Log::Level::ERR) << "Server configuration is invalid";
+                    RELAY_LOG(Log::Level::ERR) << "Server configuration is invalid";
                     return false;
                 }
             }
 
-            // start the server
-            std::unique_ptr<Server> server(new Server(*this, network));
-            server->start(endpoints);
-            servers.push_back(std::move(server));
+            serverEndpoints.push_back(endpoints);
+        }
+
+        return true;
+    }
+
+    Relay::Relay(Network& aNetwork):
+        generator(static_cast<unsigned int>(std::chrono::high_resolution_clock::now().time_since_epoch().count())),
+        network(aNetwork)
+    {
+        previousTime = std::chrono::steady_clock::now();
+    }
+
+    Relay::~Relay()
+    {
+        for (auto& a : servers)
+        {
+            a->stop();
+        }
+
+        for (auto& c : connections)
+        {
+            c->close(true);
+        }
+    }
+
+    void Relay::generateRandomBytes(uint8_t* data, size_t size)
+    {
+        ::generateRandomBytes(generator, data, size);
+    }
+
+    bool Relay::init(const std::string& config)
+    {
+        YAML::Node document;
+
+        try
+        {
+            document = YAML::LoadFile(config);
+        }
+        catch (YAML::BadFile)
+        {
+            RELAY_LOG(Log::Level::ERR) << "Failed to open " << config;
+            return false;
+        }
+        catch (YAML::ParserException& e)
+        {
+            RELAY_LOG(Log::Level::ERR) << "Failed to parse " << config << ", " << e.msg << " on line " << e.mark.line << " column " << e.mark.column;
+            return false;
+        }
+
+        // parsed before anything is changed, so that an invalid config leaves the running one intact
+        std::vector<std::vector<Endpoint>> serverEndpoints;
+        std::set<std::string> listenAddresses;
+
+        if (!parseServers(document["servers"], serverEndpoints, listenAddresses))
+        {
+            return false;
+        }
+
+        configFile = config;
+
+        if (document["log"])
+        {
+            const YAML::Node& logObject = document["log"];
+
+            if (logObject["level"])
+            {
+                Log::threshold.store(static_cast<Log::Level>(logObject["level"].as<uint32_t>()), std::memory_order_relaxed);
+            }
+
+            if (logObject["file"])
+            {
+                logFile = logObject["file"].as<std::string>();
+            }
+
+#ifndef _WIN32
+            if (logObject["syslogEnabled"])
+            {
+                Log::syslogEnabled.store(logObject["syslogEnabled"].as<bool>(), std::memory_order_relaxed);
+            }
+
+            if (logObject["syslogIdent"])
+            {
+                syslogIdent = logObject["syslogIdent"].as<std::string>();
+            }
+
+            if (logObject["syslogFacility"])
+            {
+                std::string facility = logObject["syslogFacility"].as<std::string>();
+
+                if (facility == "LOG_USER") syslogFacility = LOG_USER;
+                else if (facility == "LOG_LOCAL0") syslogFacility = LOG_LOCAL0;
+                else if (facility == "LOG_LOCAL1") syslogFacility = LOG_LOCAL1;
+                else if (facility == "LOG_LOCAL2") syslogFacility = LOG_LOCAL2;
+                else if (facility == "LOG_LOCAL3") syslogFacility = LOG_LOCAL3;
+                else if (facility == "LOG_LOCAL4") syslogFacility = LOG_LOCAL4;
+                else if (facility == "LOG_LOCAL5") syslogFacility = LOG_LOCAL5;
+                else if (facility == "LOG_LOCAL6") syslogFacility = LOG_LOCAL6;
+                else if (facility == "LOG_LOCAL7") syslogFacility = LOG_LOCAL7;
+            }
+#endif
+        }
+
+        openLog();
+
+        relayId = document["relayId"] ? document["relayId"].as<std::string>() : DEFAULT_RELAY_ID;
+
+        MemoryLimits newMemoryLimits;
+
+        if (document["memory"])
+        {
+            const YAML::Node& memoryObject = document["memory"];
+
+            if (memoryObject["maxMessageSize"]) newMemoryLimits.maxMessageSize = memoryObject["maxMessageSize"].as<uint32_t>();
+            if (memoryObject["maxSendQueueSize"]) newMemoryLimits.maxSendQueueSize = memoryObject["maxSendQueueSize"].as<uint64_t>();
+            if (memoryObject["budget"]) newMemoryLimits.budget = memoryObject["budget"].as<uint64_t>();
+        }
+
+        memoryLimits = newMemoryLimits;
+
+        AdmissionLimits newAdmissionLimits;
+
+        if (document["admission"])
+        {
+            const YAML::Node& admissionObject = document["admission"];
+
+            if (admissionObject["maxLoopUtilization"]) newAdmissionLimits.maxLoopUtilization = admissionObject["maxLoopUtilization"].as<double>();
+            if (admissionObject["maxEgressRate"]) newAdmissionLimits.maxEgressRate = admissionObject["maxEgressRate"].as<uint64_t>();
+            if (admissionObject["maxStreamOutputs"]) newAdmissionLimits.maxStreamOutputs = admissionObject["maxStreamOutputs"].as<uint32_t>();
+            if (admissionObject["redirect"]) newAdmissionLimits.redirect = admissionObject["redirect"].as<std::string>();
+        }
+
+        admissionLimits = newAdmissionLimits;
+
+        if (document["timeout"])
+        {
+            float ts = document["timeout"].as<float>();
+            timeout = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<int>(ts * 1000));
+            hasTimeout = true;
+        }
+
+        std::string newStatusAddress;
+
+        if (document["statusPage"])
+        {
+            const YAML::Node& statusPageObject = document["statusPage"];
+
+            if (statusPageObject["address"])
+            {
+                newStatusAddress = statusPageObject["address"].as<std::string>();
+            }
+        }
+
+        // the status page keeps its clients unless it moves
+        if (newStatusAddress != statusAddress)
+        {
+            status.reset();
+            statusAddress = newStatusAddress;
+            if (!statusAddress.empty()) status.reset(new Status(*this, statusAddress));
+        }
+
+        updateServers(serverEndpoints);
+        updateAcceptors(listenAddresses);
+
+        return true;
+    }
+
+    void Relay::updateServers(const std::vector<std::vector<Endpoint>>& serverEndpoints)
+    {
+        std::vector<std::unique_ptr<Server>> oldServers;
+        oldServers.swap(servers);
+
+        std::vector<std::unique_ptr<Server>> newServers(serverEndpoints.size());
+
+        // unchanged servers are kept as they are
+        for (size_t serverIndex = 0; serverIndex < serverEndpoints.size(); ++serverIndex)
+        {
+            for (auto& server : oldServers)
+            {
+                if (server && server->hasEndpoints(serverEndpoints[serverIndex]))
+                {
+                    newServers[serverIndex] = std::move(server);
+                    break;
+                }
+            }
+        }
+
+        // the rest of the old servers are paired with the changed ones in order and only their changed endpoints restart
+        auto oldServer = oldServers.begin();
+
+        for (size_t serverIndex = 0; serverIndex < serverEndpoints.size(); ++serverIndex)
+        {
+            if (newServers[serverIndex]) continue;
+
+            while (oldServer != oldServers.end() && !*oldServer) ++oldServer;
+
+            if (oldServer != oldServers.end())
+            {
+                RELAY_LOG(Log::Level::INFO) << "Reloading server " << (*oldServer)->getId();
+                (*oldServer)->reload(serverEndpoints[serverIndex]);
+                newServers[serverIndex] = std::move(*oldServer);
+            }
+            else
+            {
+                // start the server
+                std::unique_ptr<Server> server(new Server(*this, network));
+                server->start(serverEndpoints[serverIndex]);
+                newServers[serverIndex] = std::move(server);
+            }
+        }
+
+        for (auto& server : oldServers)
+        {
+            if (!server) continue;
+
+            RELAY_LOG(Log::Level::INFO) << "Stopping server " << server->getId();
+
+            for (const Endpoint& endpoint : server->getEndpoints())
+            {
+                closeConnections(endpoint);
+            }
+
+            server->stop();
+            closeConnections();
+        }
+
+        servers.swap(newServers);
+    }
+
+    void Relay::updateAcceptors(const std::set<std::string>& listenAddresses)
+    {
+        // accepted connections stay open even if their address is removed
+        for (auto i = acceptors.begin(); i != acceptors.end();)
+        {
+            if (listenAddresses.find(i->first) == listenAddresses.end())
+            {
+                RELAY_LOG(Log::Level::INFO) << "Stopped listening on " << i->first;
+                i = acceptors.erase(i);
+            }
+            else
+            {
+                ++i;
+            }
         }
 
         for (const std::string& address : listenAddresses)
         {
+            if (acceptors.find(address) != acceptors.end()) continue;
+
             Socket acceptor(network);
             acceptor.setAcceptCallback(std::bind(&Relay::handleAccept, this, std::placeholders::_1, std::placeholders::_2));
-            acceptor.startAccept(address);
-            acceptors.push_back(std::move(acceptor));
+
+            // a socket handed off by the previous process keeps the connections waiting to be accepted
+            auto handoffListener = handoffListeners.find(address);
+
+            if (handoffListener != handoffListeners.end())
+            {
+                acceptor.adopt(handoffListener->second);
+                handoffListeners.erase(handoffListener);
+            }
+            else
+            {
+                acceptor.startAccept(address);
+            }
+
+            acceptors.insert(std::make_pair(address, std::move(acceptor)));
+        }
+    }
+
+    void Relay::closeConnections(const Endpoint& endpoint)
+    {
+        for (const auto& connection : connections)
+        {
+            if (connection->getEndpoint() == &endpoint) connection->close(true);
+        }
+
+        closeConnections();
+    }
+
+    void Relay::closeConnections()
+    {
+        for (auto i = connections.begin(); i != connections.end();)
+        {
+            i = ((*i)->isClosed() ? connections.erase(i) : i + 1);
+        }
+    }
+
+    void Relay::reloadConfig()
+    {
+        RELAY_LOG(Log::Level::INFO) << "Reloading config " << configFile;
+
+        auto startTime = std::chrono::steady_clock::now();
+
+        if (init(configFile))
+        {
+            ++counters.configReloads;
+            counters.reloadTime = getMicroseconds(std::chrono::steady_clock::now() - startTime);
+            RELAY_LOG(Log::Level::INFO) << "Config reloaded in " << counters.reloadTime << " us";
+        }
+        else
+        {
+            ++counters.failedConfigReloads;
+            RELAY_LOG(Log::Level::ERR) << "Failed to reload config, keeping the previous one";
+        }
+    }
+
+    bool Relay::handOff()
+    {
+#ifndef _WIN32
+        if (arguments.empty())
+        {
+            RELAY_LOG(Log::Level::ERR) << "Can not upgrade, command line arguments not set";
+            return false;
+        }
+
+        RELAY_LOG(Log::Level::INFO) << "Starting " << arguments.front() << " to hand off the sockets";
+
+        int fds[2];
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        {
+            RELAY_LOG(Log::Level::ERR) << "Failed to create handoff socket pair, error: " << errno;
+            return false;
+        }
+
+        // prepared before forking, the child only calls async-signal-safe functions before exec
+        std::vector<std::string> childArguments;
+
+        for (size_t i = 0; i < arguments.size(); ++i)
+        {
+            // the descriptor of the previous upgrade
+            if (arguments[i] == "--handoff") ++i;
+            else childArguments.push_back(arguments[i]);
+        }
+
+        childArguments.push_back("--handoff");
+        childArguments.push_back(std::to_string(fds[1]));
+
+        std::vector<char*> argv;
+        for (std::string& argument : childArguments) argv.push_back(&argument[0]);
+        argv.push_back(nullptr);
+
+        // only one process can listen on the status page address
+        status.reset();
+
+        pid_t pid = fork();
+
+        if (pid == 0)
+        {
+            for (int i = getdtablesize(); i > STDERR_FILENO; --i)
+            {
+                if (i != fds[1]) ::close(i);
+            }
+
+            execvp(argv[0], argv.data());
+            _exit(EXIT_FAILURE);
         }
 
+        ::close(fds[1]);
+
+        std::vector<Connection*> handedOffConnections;
+        bool result = false;
+
+        if (pid < 0)
+        {
+            RELAY_LOG(Log::Level::ERR) << "Failed to fork process, error: " << errno;
+        }
+        else
+        {
+            std::vector<uint8_t> payload;
+            ByteWriter writer(payload);
+            writer.writeUInt32BE(handoff::VERSION);
+
+            result = handoff::setTimeout(fds[0], handoff::TIMEOUT) &&
+                handoff::sendRecord(fds[0], handoff::RecordType::BEGIN, payload);
+
+            for (const auto& acceptor : acceptors)
+            {
+                if (!result) break;
+                if (acceptor.second.getSocketFd() == INVALID_SOCKET) continue;
+
+                payload.clear();
+                handoff::writeString(writer, acceptor.first);
+                result = handoff::sendRecord(fds[0], handoff::RecordType::LISTENER, payload, acceptor.second.getSocketFd());
+            }
+
+            // outputs first, so that restoring the input of their stream does not send them the headers again
+            for (bool inputs : {false, true})
+            {
+                for (const auto& connection : connections)
+                {
+                    if (!result) break;
+                    if (!connection->canHandOff() ||
+                        (connection->getDirection() == Connection::Direction::INPUT) != inputs) continue;
+
+                    payload.clear();
+                    connection->saveSession(payload);
+                    result = handoff::sendRecord(fds[0], handoff::RecordType::CONNECTION, payload, connection->getSocketFd());
+                    handedOffConnections.push_back(connection.get());
+                }
+            }
+
+            payload.clear();
+            result = result &&
+                handoff::sendRecord(fds[0], handoff::RecordType::END, payload) &&
+                handoff::receiveAck(fds[0]);
+        }
+
+        ::close(fds[0]);
+
+        if (!result)
+        {
+            ++counters.failedUpgrades;
+            RELAY_LOG(Log::Level::ERR) << "Failed to hand off the sockets, keeping this process running";
+
+            if (pid > 0) waitpid(pid, nullptr, WNOHANG);
+            if (!statusAddress.empty()) status.reset(new Status(*this, statusAddress));
+
+            return false;
+        }
+
+        // the new process owns the sockets now, closing the descriptors here doesn't affect the peers
+        acceptors.clear();
+
+        for (Connection* connection : handedOffConnections)
+        {
+            connection->close(true);
+        }
+
+        RELAY_LOG(Log::Level::INFO) << "Handed off " << handedOffConnections.size() << " connections to process " << pid;
+
         return true;
+#else
+        RELAY_LOG(Log::Level::ERR) << "Upgrade is not supported on Windows";
+        return false;
+#endif
+    }
+
+    bool Relay::receiveHandoff(int fd)
+    {
+#ifndef _WIN32
+        handoffFd = fd;
+
+        handoff::RecordType type;
+        std::vector<uint8_t> payload;
+        socket_t passedFd;
+        uint32_t version;
+
+        if (!handoff::setTimeout(handoffFd, handoff::TIMEOUT) ||
+            !handoff::receiveRecord(handoffFd, type, payload, passedFd))
+        {
+            return false;
+        }
+
+        ByteReader reader(payload);
+
+        if (type != handoff::RecordType::BEGIN ||
+            !reader.readUInt32BE(version) ||
+            version != handoff::VERSION)
+        {
+            RELAY_LOG(Log::Level::ERR) << "Unsupported handoff version";
+            return false;
+        }
+
+        for (;;)
+        {
+            if (!handoff::receiveRecord(handoffFd, type, payload, passedFd))
+            {
+                return false;
+            }
+
+            switch (type)
+            {
+                case handoff::RecordType::LISTENER:
+                {
+                    ByteReader listenerReader(payload);
+                    std::string address;
+
+                    if (passedFd == INVALID_SOCKET || !handoff::readString(listenerReader, address))
+                    {
+                        RELAY_LOG(Log::Level::ERR) << "Invalid handoff listener";
+                        return false;
+                    }
+
+                    handoffListeners[address] = passedFd;
+                    break;
+                }
+
+                case handoff::RecordType::CONNECTION:
+                {
+                    if (passedFd == INVALID_SOCKET)
+                    {
+                        RELAY_LOG(Log::Level::ERR) << "Invalid handoff connection";
+                        return false;
+                    }
+
+                    handoffConnections.push_back(std::make_pair(payload, passedFd));
+                    break;
+                }
+
+                case handoff::RecordType::END:
+                {
+                    RELAY_LOG(Log::Level::INFO) << "Received " << handoffListeners.size() << " listeners and " << handoffConnections.size() << " connections from the previous process";
+                    return true;
+                }
+
+                default:
+                {
+                    RELAY_LOG(Log::Level::ERR) << "Invalid handoff record " << static_cast<uint32_t>(type);
+                    return false;
+                }
+            }
+        }
+#else
+        (void)fd;
+        RELAY_LOG(Log::Level::ERR) << "Upgrade is not supported on Windows";
+        return false;
+#endif
+    }
+
+    bool Relay::finishHandoff()
+    {
+#ifndef _WIN32
+        // listen addresses that are not in the config anymore
+        for (const auto& listener : handoffListeners)
+        {
+            RELAY_LOG(Log::Level::INFO) << "Stopped listening on " << listener.first;
+            ::close(listener.second);
+        }
+
+        handoffListeners.clear();
+
+        for (const auto& handoffConnection : handoffConnections)
+        {
+            Socket socket(network);
+            if (!socket.adopt(handoffConnection.second)) continue;
+
+            std::unique_ptr<Connection> connection(new Connection(*this, socket));
+
+            if (connection->restoreSession(handoffConnection.first))
+            {
+                ++counters.restoredConnections;
+            }
+            else
+            {
+                connection->close(true);
+            }
+
+            connections.push_back(std::move(connection));
+        }
+
+        handoffConnections.clear();
+
+        // the previous process stops using the sockets once it receives the acknowledgement
+        bool result = handoff::sendAck(handoffFd);
+        ::close(handoffFd);
+        handoffFd = -1;
+
+        return result;
+#else
+        RELAY_LOG(Log::Level::ERR) << "Upgrade is not supported on Windows";
+        return false;
+#endif
     }
 
     std::vector<std::pair<Server*, const Endpoint*>> Relay::getEndpoints(const std::pair<uint32_t, uint16_t>& address,
@@ -283,7 +772,7 @@ namespace relay
                         (endpoint.applicationName.empty() || std::regex_match(applicationName, std::regex(endpoint.applicationName))) &&
                         (endpoint.streamName.empty() || std::regex_match(streamName, std::regex(endpoint.streamName))))
                     {
-                        Log(Log::Level::ALL) << "Application \"" << applicationName << "\", stream \"" << streamName << "\" matched endpoint application \"" << endpoint.applicationName << "\", stream \"" << endpoint.streamName << "\"";
+                        RELAY_LOG(Log::Level::ALL) << "Application \"" << applicationName << "\", stream \"" << streamName << "\" matched endpoint application \"" << endpoint.applicationName << "\", stream \"" << endpoint.streamName << "\"";
 
                         if (endpoint.direction == direction)
                         {
@@ -296,14 +785,14 @@ namespace relay
                                      endpointAddress.ipAddresses.first == address.first) &&
                                     endpointAddress.ipAddresses.second == address.second)
                                 {
-                                    Log(Log::Level::ALL) << "Address " << ipToString(address.first) << ":" << address.second << " matched address " << ipToString(endpointAddress.ipAddresses.first) << ":" << endpointAddress.ipAddresses.second;
+                                    RELAY_LOG(Log::Level::ALL) << "Address " << ipToString(address.first) << ":" << address.second << " matched address " << ipToString(endpointAddress.ipAddresses.first) << ":" << endpointAddress.ipAddresses.second;
 
                                     found = true;
                                     break;
                                 }
                                 else
                                 {
-                                    Log(Log::Level::ALL) << "Address " << ipToString(address.first) << ":" << address.second << " did not match address " << ipToString(endpointAddress.ipAddresses.first) << ":" << endpointAddress.ipAddresses.second;
+                                    RELAY_LOG(Log::Level::ALL) << "Address " << ipToString(address.first) << ":" << address.second << " did not match address " << ipToString(endpointAddress.ipAddresses.first) << ":" << endpointAddress.ipAddresses.second;
                                 }
                             }
 
@@ -315,12 +804,12 @@ namespace relay
                     }
                     else
                     {
-                        Log(Log::Level::ALL) << "Application: \"" << applicationName << "\", stream: \"" << streamName << "\" did not match endpoint application: \"" << endpoint.applicationName << "\", stream: \"" << endpoint.streamName << "\"";
+                        RELAY_LOG(Log::Level::ALL) << "Application: \"" << applicationName << "\", stream: \"" << streamName << "\" did not match endpoint application: \"" << endpoint.applicationName << "\", stream: \"" << endpoint.streamName << "\"";
                     }
                 }
                 catch (std::regex_error e)
                 {
-                    Log(Log::Level::ERR) << "Configuration error: Invalid regex for output connection";
+                    RELAY_LOG(Log::Level::ERR) << "Configuration error: Invalid regex for output connection";
                     exit(1);
                 }
             }
@@ -340,8 +829,15 @@ namespace relay
     {
         const std::chrono::microseconds sleepTime(5000);
 
+        capacityTime = std::chrono::steady_clock::now();
+        capacitySleepTime = loopCounters.sleepTime;
+        capacitySentBytes = counters.sentBytes;
+
         while (active)
         {
+            if (reloadRequested.exchange(false)) reloadConfig();
+            if (upgradeRequested.exchange(false) && handOff()) break;
+
             auto currentTime = std::chrono::steady_clock::now();
             if (hasTimeout && currentTime > timeout)
             {
@@ -353,8 +849,15 @@ namespace relay
 
             network.update();
 
+            auto networkTime = std::chrono::steady_clock::now();
+            size_t readyCount = network.getReadyCount();
+            loopCounters.readySockets += readyCount;
+            if (readyCount > loopCounters.maxReadySockets) loopCounters.maxReadySockets = readyCount;
+
             if (status) status->update(delta);
 
+            auto statusTime = std::chrono::steady_clock::now();
+
             for (auto i = connections.begin(); i != connections.end();)
             {
                 const std::unique_ptr<Connection>& connection = *i;
@@ -369,201 +872,193 @@ namespace relay
                     ++i;
                 }
 
+                auto connectionStartTime = std::chrono::steady_clock::now();
                 connection->update(delta);
+                checkCallbackTime(connectionStartTime, connection->getIdString(), "update");
             }
 
+            auto connectionTime = std::chrono::steady_clock::now();
+
             for (const auto& server : servers)
             {
                 server->update(delta);
             }
 
+            auto serverTime = std::chrono::steady_clock::now();
+
             std::this_thread::sleep_for(sleepTime);
+
+            auto sleepEndTime = std::chrono::steady_clock::now();
+
+            ++loopCounters.iterations;
+            loopCounters.networkTime += getMicroseconds(networkTime - currentTime);
+            loopCounters.statusTime += getMicroseconds(statusTime - networkTime);
+            loopCounters.connectionTime += getMicroseconds(connectionTime - statusTime);
+            loopCounters.serverTime += getMicroseconds(serverTime - connectionTime);
+            loopCounters.sleepTime += getMicroseconds(sleepEndTime - serverTime);
+            iterationHistogram.record(getMicroseconds(serverTime - currentTime));
+
+            updateCapacity(sleepEndTime);
         }
     }
 
-    void Relay::getStats(std::string& str, ReportType reportType) const
+    void Relay::updateCapacity(const std::chrono::steady_clock::time_point& currentTime)
     {
-        std::map<Connection*, Stream*> cons;
-        std::map<Stream*, Connection*> streams;
+        uint64_t elapsed = getMicroseconds(currentTime - capacityTime);
+        if (elapsed < CAPACITY_INTERVAL) return;
 
-        for (auto& c : connections)
+        // the loop sleeps in every iteration, the rest of the time it is busy
+        uint64_t sleep = loopCounters.sleepTime - capacitySleepTime;
+        loopUtilization = (elapsed > sleep) ? static_cast<double>(elapsed - sleep) / static_cast<double>(elapsed) : 0.0;
+        egressRate = (counters.sentBytes - capacitySentBytes) * 1000000 / elapsed;
+
+        capacityTime = currentTime;
+        capacitySleepTime = loopCounters.sleepTime;
+        capacitySentBytes = counters.sentBytes;
+    }
+
+    Admission Relay::admitPlayer(const Stream* stream)
+    {
+        if (admissionLimits.maxLoopUtilization > 0.0 && loopUtilization >= admissionLimits.maxLoopUtilization)
         {
-            cons[c.get()] = c->getStream();
+            ++counters.loopRejections;
+            return Admission::LOOP_UTILIZATION;
         }
 
-        for (auto& s : servers)
+        if (admissionLimits.maxEgressRate > 0 && egressRate >= admissionLimits.maxEgressRate)
         {
-            s->getConnections(cons);
+            ++counters.egressRejections;
+            return Admission::EGRESS_RATE;
         }
 
-        switch (reportType)
+        if (admissionLimits.maxStreamOutputs > 0 && stream &&
+            stream->getOutputConnectionCount() >= admissionLimits.maxStreamOutputs)
         {
-            case ReportType::TEXT:
-            {
-                std::stringstream ss;
+            ++counters.streamOutputRejections;
+            return Admission::STREAM_OUTPUTS;
+        }
 
-                ss
-                << std::setw(8) << " "
-                << std::setw(5) << "ID" << " "
-                << std::setw(20) << "Application" << " "
-                << std::setw(20) << "Stream name" << " "
+        return Admission::ACCEPTED;
+    }
 
-                << std::setw(15) << "Status" << " "
-                << std::setw(22) << "Address" << " "
-                << std::setw(7) << "Type" << " "
-                << std::setw(20) << "State" << " "
-                << std::setw(10) << "Direction" << " "
+    MemoryUsage Relay::getMemoryUsage() const
+    {
+        MemoryUsage usage = memoryTotals;
+        usage.sendQueues = network.getSendQueueSize();
+        usage.bufferPool = network.getBufferPool().getCachedSize();
 
-                << std::setw(6) << "Server" << " " << " Metadata\n";
+        return usage;
+    }
 
-                auto header = ss.str();
+    bool Relay::isOverMemoryBudget() const
+    {
+        return memoryLimits.budget > 0 && getMemoryUsage().getTotal() > memoryLimits.budget;
+    }
 
+    std::shared_ptr<StatusSnapshot> Relay::createSnapshot() const
+    {
+        std::shared_ptr<StatusSnapshot> snapshot = std::make_shared<StatusSnapshot>();
+        std::set<uint64_t> streamConnectionIds;
 
-                str = "Pending connections:\n";
-                for (const auto& c : cons)
-                {
-                    if (c.second == nullptr)
-                    {
-                        c.first->getStats(str, reportType);
-                    }
-                }
+        for (const auto& server : servers)
+        {
+            ServerStatus serverStatus;
+            serverStatus.id = server->getId();
+            serverStatus.counters = server->getCounters();
+            snapshot->servers.push_back(serverStatus);
 
-                str += "\nStreams:\n";
-                for (auto it = cons.begin(); it != cons.end(); ++it)
-                {
-                    if (it->second != nullptr)
-                    {
-                        Stream* stream = it->second;
-                        stream->getStats(str, reportType);
-                        str += header;
+            for (const auto& stream : server->getStreams())
+            {
+                snapshot->streams.push_back(StreamStatus());
+                stream->getStatus(snapshot->streams.back());
 
-                        if (stream->getInputConnection())
-                        {
-                            stream->getInputConnection()->getStats(str, reportType);
-                            cons[stream->getInputConnection()] = nullptr;
-                        }
-                        for (auto cit = it; cit != cons.end(); ++cit)
-                        {
-                            if (cons[cit->first] == stream && cit->first != stream->getInputConnection())
-                            {
-                                cons[cit->first] = nullptr;
-                                cit->first->getStats(str, reportType);
-                            }
-                        }
-                    }
+                for (const ConnectionStatus& connection : snapshot->streams.back().connections)
+                {
+                    streamConnectionIds.insert(connection.id);
                 }
-
-                break;
             }
-            case ReportType::HTML:
+        }
+
+        // connections that are not part of any stream yet
+        auto addPending = [&snapshot, &streamConnectionIds](const Connection& connection) {
+            if (streamConnectionIds.find(connection.getId()) == streamConnectionIds.end())
             {
-                auto header = "<table border=\"1\" cellspacing=\"0\" cellpadding=\"5\"><tr><th>ID</th><th>Name</th><th>Application</th><th>Status</th><th>Address</th><th>Connection</th><th>State</th><th>Direction</th><th>Server ID</th><th>Meta data</th></tr>";
+                snapshot->pendingConnections.push_back(ConnectionStatus());
+                connection.getStatus(snapshot->pendingConnections.back());
+            }
+        };
 
-                str = "<html><title>Status</title><body>";
+        for (const auto& connection : connections)
+        {
+            addPending(*connection);
+        }
 
-                str = "<b>Pending connections</b>";
-                str += header;
-                for (const auto& c : cons)
-                {
-                    if (c.second == nullptr)
-                    {
-                        c.first->getStats(str, reportType);
-                    }
-                }
-                str += "</table>";
+        for (const auto& server : servers)
+        {
+            for (const auto& connection : server->getClientConnections())
+            {
+                addPending(*connection);
+            }
+        }
 
-                str = "<b>Streams</b><br>";
-                for (auto it = cons.begin(); it != cons.end(); ++it)
-                {
-                    if (it->second)
-                    {
-                        Stream* stream = it->second;
-                        stream->getStats(str, reportType);
+        snapshot->relayCounters = counters;
+        snapshot->loopCounters = loopCounters;
+        iterationHistogram.getSummary(snapshot->iterationTime);
 
-                        str += header;
-                        if (stream->getInputConnection())
-                        {
-                            stream->getInputConnection()->getStats(str, reportType);
-                            cons[stream->getInputConnection()] = nullptr;
-                        }
-                        for (auto cit = it; cit != cons.end(); ++cit)
-                        {
-                            if (cons[cit->first] == stream && cit->first != stream->getInputConnection())
-                            {
-                                cons[cit->first] = nullptr;
-                                cit->first->getStats(str, reportType);
-                            }
-                        }
-                        str += "</table>";
-                    }
-                }
+        const BufferPool& bufferPool = network.getBufferPool();
+        snapshot->bufferPool.hitCount = bufferPool.getHitCount();
+        snapshot->bufferPool.missCount = bufferPool.getMissCount();
+        snapshot->bufferPool.releaseCount = bufferPool.getReleaseCount();
+        snapshot->bufferPool.discardCount = bufferPool.getDiscardCount();
+        snapshot->bufferPool.cachedSize = bufferPool.getCachedSize();
 
-                str += "</body></html>";
+        snapshot->memory = getMemoryUsage();
+        snapshot->memoryBudget = memoryLimits.budget;
 
-                break;
-            }
-            case ReportType::JSON:
-            {
-                bool first = true;
-                str = "{\"pending_connections\":[";
-                for (const auto& c : cons)
-                {
-                    if (c.second == nullptr)
-                    {
-                        if (!first) str += ",";
-                        first = false;
-                        c.first->getStats(str, reportType);
-                    }
-                }
-                str += "], \"streams\":[";
-                bool firstStream = true;
-                for (auto it = cons.begin(); it != cons.end(); ++it)
-                {
-                    if (it->second != nullptr)
-                    {
-                        Stream* stream = it->second;
-                        if (!firstStream) str += ",";
-                        firstStream = false;
-                        stream->getStats(str, reportType);
+        snapshot->capacity.loopUtilization = loopUtilization;
+        snapshot->capacity.egressRate = egressRate;
+        snapshot->capacity.maxLoopUtilization = admissionLimits.maxLoopUtilization;
+        snapshot->capacity.maxEgressRate = admissionLimits.maxEgressRate;
+        snapshot->capacity.maxStreamOutputs = admissionLimits.maxStreamOutputs;
 
-                        first = true;
-                        if (stream->getInputConnection())
-                        {
-                            first = false;
-                            stream->getInputConnection()->getStats(str, reportType);
-                            cons[stream->getInputConnection()] = nullptr;
-                        }
-                        for (auto cit = it; cit != cons.end(); ++cit)
-                        {
-                            if (cons[cit->first] == stream && cit->first != stream->getInputConnection())
-                            {
-                                if (!first) str += ",";
-                                first = false;
-                                
-                                cons[cit->first] = nullptr;
-                                cit->first->getStats(str, reportType);
-                            }
-                        }
+        return snapshot;
+    }
 
-                        str += "]}";
-                    }
-                }
-                str += "]}";
-                
-                break;
-            }
+    void Relay::checkCallbackTime(const std::chrono::steady_clock::time_point& startTime, const std::string& idString, const char* name)
+    {
+        uint64_t duration = getMicroseconds(std::chrono::steady_clock::now() - startTime);
+
+        if (duration > SLOW_CALLBACK_THRESHOLD)
+        {
+            ++loopCounters.slowCallbacks;
+            RELAY_LOG(Log::Level::WARN) << idString << "Slow " << name << " callback, took " << duration / 1000 << " ms";
         }
     }
 
+    void Relay::getStats(std::string& str, ReportType reportType) const
+    {
+        createSnapshot()->getStats(str, reportType);
+    }
+
     void Relay::openLog()
     {
 #ifndef _WIN32
         openlog(syslogIdent.empty() ? nullptr : syslogIdent.c_str(), 0, syslogFacility);
 #endif
+
+        if (!Log::setFile(logFile))
+        {
+            RELAY_LOG(Log::Level::ERR) << "Failed to open log file " << logFile;
+        }
+
+        // started after daemonizing, threads do not survive fork
+        Log::startThread();
     }
 
     void Relay::closeLog()
     {
+        Log::stopThread();
+
 #ifndef _WIN32
         closelog();
 #endif
@@ -572,6 +1067,7 @@ namespace relay
     void Relay::handleAccept(Socket&, Socket& clientSocket)
     {
         std::unique_ptr<Connection> connection(new Connection(*this, clientSocket));
+        ++counters.acceptedConnections;
 
         connections.push_back(std::move(connection));
     }
@@ -4,8 +4,12 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <map>
 #include <random>
+#include <set>
+#include <string>
 #include <vector>
 #include <utility>
 #include <chrono>
@@ -14,6 +18,8 @@
 #include "Status.hpp"
 #include "Server.hpp"
 #include "Endpoint.hpp"
+#include "LatencyHistogram.hpp"
+#include "Metrics.hpp"
 
 #ifndef _WIN32
 #  include <sys/syslog.h>
@@ -22,6 +28,33 @@
 namespace relay
 {
     class Status;
+    class StatusSnapshot;
+
+    struct MemoryLimits
+    {
+        uint32_t maxMessageSize = 8 * 1024 * 1024; // RTMP messages can announce up to 16 MB
+        uint64_t maxSendQueueSize = 32 * 1024 * 1024; // per connection, video is dropped until the next key frame above half of it
+        uint64_t budget = 0; // new publishers and players are refused above it, 0 for no limit
+    };
+
+    // new players are refused once any of the limits is reached, 0 for no limit
+    struct AdmissionLimits
+    {
+        double maxLoopUtilization = 0.0; // busy fraction of the event loop time
+        uint64_t maxEgressRate = 0; // bytes per second sent to all peers
+        uint32_t maxStreamOutputs = 0; // output connections per stream
+        std::string redirect; // sent to the refused players, empty for none
+    };
+
+    enum class Admission
+    {
+        ACCEPTED,
+        LOOP_UTILIZATION,
+        EGRESS_RATE,
+        STREAM_OUTPUTS
+    };
+
+    const char* getAdmissionString(Admission admission);
 
     class Relay
     {
@@ -37,14 +70,51 @@ namespace relay
         Relay& operator=(Relay&&) = delete;
 
         std::mt19937& getGenerator() { return generator; }
+        void generateRandomBytes(uint8_t* data, size_t size);
         Network& getNetwork() { return network; }
+        // identifies this relay in latency probes
+        const std::string& getRelayId() const { return relayId; }
 
         bool init(const std::string& config);
         void close();
 
         void run();
+        // async-signal-safe, makes run() return after the current iteration
+        void stop() { active = false; }
+        // async-signal-safe, makes run() reload the config file before the next iteration
+        void reload() { reloadRequested = true; }
+        // async-signal-safe, makes run() start a new process with the arguments and hand off the sockets to it
+        void upgrade() { upgradeRequested = true; }
+        void setArguments(const std::vector<std::string>& newArguments) { arguments = newArguments; }
+
+        // called before init in the new process, receives the sockets from the previous one
+        bool receiveHandoff(int fd);
+        // called after init, restores the connections and lets the previous process exit
+        bool finishHandoff();
 
         void getStats(std::string& str, ReportType reportType) const;
+        // must be called on the event loop thread
+        std::shared_ptr<StatusSnapshot> createSnapshot() const;
+
+        RelayCounters& getCounters() { return counters; }
+
+        const MemoryLimits& getMemoryLimits() const { return memoryLimits; }
+        // running totals of the input buffers, stream caches and arenas, their owners add and subtract their size changes
+        MemoryUsage& getMemoryTotals() { return memoryTotals; }
+        MemoryUsage getMemoryUsage() const;
+        bool isOverMemoryBudget() const;
+
+        const AdmissionLimits& getAdmissionLimits() const { return admissionLimits; }
+        // checks the capacity before a player is added to the stream (nullptr if it doesn't exist yet), counts the refusals
+        Admission admitPlayer(const Stream* stream);
+
+        // closes the host connections of the endpoint, called when the endpoint is removed
+        void closeConnections(const Endpoint& endpoint);
+
+        // counts and logs event loop callbacks that ran longer than SLOW_CALLBACK_THRESHOLD
+        void checkCallbackTime(const std::chrono::steady_clock::time_point& startTime, const std::string& idString, const char* name);
+        // nullptr if the status page is not enabled
+        Status* getStatus() { return status.get(); }
 
         void openLog();
         void closeLog();
@@ -57,20 +127,54 @@ namespace relay
     private:
         void handleAccept(Socket& acceptor, Socket& clientSocket);
 
+        void reloadConfig();
+        // returns true if the new process took over the sockets
+        bool handOff();
+        void updateServers(const std::vector<std::vector<Endpoint>>& serverEndpoints);
+        void updateAcceptors(const std::set<std::string>& listenAddresses);
+        // deletes the closed host connections
+        void closeConnections();
+        // measures the loop utilization and the egress rate once per CAPACITY_INTERVAL
+        void updateCapacity(const std::chrono::steady_clock::time_point& currentTime);
+
         static uint64_t currentId;
         std::mt19937 generator;
-        bool active = true;
+        std::atomic<bool> active{true};
+        std::atomic<bool> reloadRequested{false};
+        std::atomic<bool> upgradeRequested{false};
+        std::string configFile;
+        std::vector<std::string> arguments; // of the command line, used to start the new process
+
+        int handoffFd = -1;
+        std::map<std::string, socket_t> handoffListeners; // keyed by the listen address
+        std::vector<std::pair<std::vector<uint8_t>, socket_t>> handoffConnections; // session state and socket
 
         Network& network;
         std::unique_ptr<Status> status;
+        std::string statusAddress;
         std::chrono::steady_clock::time_point previousTime;
         std::chrono::steady_clock::time_point timeout;
         bool hasTimeout = false;
 
+        MemoryUsage memoryTotals; // declared before the servers and connections, which update it until they are deleted
         std::vector<std::unique_ptr<Server>> servers;
         std::vector<std::unique_ptr<Connection>> connections;
 
-        std::vector<Socket> acceptors;
+        RelayCounters counters;
+        LoopCounters loopCounters;
+        MemoryLimits memoryLimits;
+        AdmissionLimits admissionLimits;
+        double loopUtilization = 0.0; // of the last CAPACITY_INTERVAL
+        uint64_t egressRate = 0; // bytes per second of the last CAPACITY_INTERVAL
+        std::chrono::steady_clock::time_point capacityTime; // start of the current CAPACITY_INTERVAL
+        uint64_t capacitySleepTime = 0; // loopCounters.sleepTime at capacityTime
+        uint64_t capacitySentBytes = 0; // counters.sentBytes at capacityTime
+        LatencyHistogram iterationHistogram; // duration of Relay::run iterations without the sleep
+
+        std::map<std::string, Socket> acceptors; // keyed by the listen address
+
+        std::string logFile;
+        std::string relayId;
 
 #ifndef _WIN32
         std::string syslogIdent;
@@ -2,6 +2,7 @@
 //  rtmp_relay
 //
 
+#include <algorithm>
 #include "Server.hpp"
 #include "Relay.hpp"
 
@@ -96,32 +97,98 @@ namespace relay
 
     void Server::start(const std::vector<Endpoint>& aEndpoints)
     {
-        endpoints = aEndpoints;
+        endpoints.assign(aEndpoints.begin(), aEndpoints.end());
 
         for (const Endpoint& endpoint : endpoints)
         {
-            if (endpoint.connectionType == Connection::Type::CLIENT &&
-                endpoint.direction == Connection::Direction::INPUT &&
-                endpoint.isNameKnown())
+            startEndpoint(endpoint);
+        }
+    }
+
+    void Server::reload(const std::vector<Endpoint>& newEndpoints)
+    {
+        for (auto i = endpoints.begin(); i != endpoints.end();)
+        {
+            if (std::find(newEndpoints.begin(), newEndpoints.end(), *i) == newEndpoints.end())
+            {
+                stopEndpoint(*i);
+                i = endpoints.erase(i);
+            }
+            else
             {
-                Socket socket(network);
+                ++i;
+            }
+        }
+
+        for (const Endpoint& endpoint : newEndpoints)
+        {
+            if (std::find(endpoints.begin(), endpoints.end(), endpoint) == endpoints.end())
+            {
+                endpoints.push_back(endpoint);
+                startEndpoint(endpoints.back());
+            }
+        }
+    }
+
+    bool Server::hasEndpoints(const std::vector<Endpoint>& otherEndpoints) const
+    {
+        return endpoints.size() == otherEndpoints.size() &&
+            std::equal(endpoints.begin(), endpoints.end(), otherEndpoints.begin());
+    }
 
-                Stream* stream = createStream(endpoint.applicationName,
-                                              endpoint.streamName);
+    void Server::startEndpoint(const Endpoint& endpoint)
+    {
+        if (endpoint.connectionType != Connection::Type::CLIENT) return;
+
+        if (endpoint.direction == Connection::Direction::INPUT &&
+            endpoint.isNameKnown())
+        {
+            Stream* stream = createStream(endpoint.applicationName,
+                                          endpoint.streamName);
 
-                std::unique_ptr<Connection> connection(new Connection(relay,
-                                                                      *stream,
-                                                                      endpoint));
+            std::unique_ptr<Connection> connection(new Connection(relay,
+                                                                  *stream,
+                                                                  endpoint));
 
-                connection->setStream(stream);
+            connection->setStream(stream);
 
-                connection->connect();
+            connection->connect();
 
-                connections.push_back(std::move(connection));
+            connections.push_back(std::move(connection));
+        }
+        else if (endpoint.direction == Connection::Direction::OUTPUT)
+        {
+            // streams that are already running get the new output right away
+            for (const auto& stream : streams)
+            {
+                stream->addEndpoint(endpoint);
             }
         }
     }
 
+    void Server::stopEndpoint(const Endpoint& endpoint)
+    {
+        RELAY_LOG(Log::Level::INFO) << "Stopping endpoint " << (endpoint.addresses.empty() ? std::string() : endpoint.addresses.front().url);
+
+        for (const auto& stream : streams)
+        {
+            stream->removeEndpoint(endpoint);
+        }
+
+        relay.closeConnections(endpoint);
+
+        // the closed connections and streams still point to the endpoint, so they can't wait for update
+        for (auto i = connections.begin(); i != connections.end();)
+        {
+            i = ((*i)->isClosed() ? connections.erase(i) : i + 1);
+        }
+
+        for (auto si = streams.begin(); si != streams.end();)
+        {
+            si = ((*si)->isClosed() ? streams.erase(si) : si + 1);
+        }
+    }
+
     void Server::update(float delta)
     {
         for (auto i = connections.begin(); i != connections.end();)
@@ -152,56 +219,4 @@ namespace relay
             connection->update(delta);
         }
     }
-
-    void Server::getConnections(std::map<Connection*, Stream*>& cons)
-    {
-        for (auto& c : connections)
-        {
-            cons[c.get()] = c->getStream();
-        }
-
-        for (auto& s : streams)
-        {
-            s->getConnections(cons);
-        }
-    }
-
-    void Server::getStats(std::string& str, ReportType reportType) const
-    {
-        switch (reportType)
-        {
-            case ReportType::TEXT:
-            {
-                for (const auto& c : connections)
-                {
-                    c->getStats(str, reportType);
-                }
-
-                for (const auto& s : streams)
-                {
-                    s->getStats(str, reportType);
-                }
-                break;
-            }
-            case ReportType::HTML:
-            {
-                for (const auto& c : connections)
-                {
-                    c->getStats(str, reportType);
-                }
-                break;
-            }
-            case ReportType::JSON:
-            {
-                bool first = true;
-                for (const auto& c : connections)
-                {
-                    if (!first) str += ",";
-                    first = false;
-                    c->getStats(str, reportType);
-                }
-                break;
-            }
-        }
-    }
 }
@@ -4,10 +4,12 @@
 
 #pragma once
 
+#include <list>
 #include <vector>
 #include "Connection.hpp"
 #include "Endpoint.hpp"
 #include "Stream.hpp"
+#include "Metrics.hpp"
 
 namespace relay
 {
@@ -22,6 +24,7 @@ namespace relay
         Server& operator=(Server&&) = delete;
 
         uint64_t getId() const { return id; }
+        Relay& getRelay() { return relay; }
 
         Connection* createConnection(Stream& stream,
                                      const Endpoint& endpoint);
@@ -33,13 +36,19 @@ namespace relay
         void deleteStream(Stream* stream);
 
         void start(const std::vector<Endpoint>& aEndpoints);
+        // stops the endpoints that are not in the new list and starts the added ones, the rest keep running
+        void reload(const std::vector<Endpoint>& newEndpoints);
+        bool hasEndpoints(const std::vector<Endpoint>& otherEndpoints) const;
 
         void update(float delta);
-        void getStats(std::string& str, ReportType reportType) const;
 
-        const std::vector<Endpoint>& getEndpoints() const { return endpoints; }
+        const std::list<Endpoint>& getEndpoints() const { return endpoints; }
         void cleanup() { needsCleanup = true; }
-        void getConnections(std::map<Connection*, Stream*>& cons);
+        const std::vector<std::unique_ptr<Stream>>& getStreams() const { return streams; }
+        const std::vector<std::unique_ptr<Connection>>& getClientConnections() const { return connections; }
+
+        TrafficCounters& getCounters() { return counters; }
+        const TrafficCounters& getCounters() const { return counters; }
 
         void stop();
 
@@ -48,13 +57,17 @@ namespace relay
         const uint64_t id;
 
         Network& network;
-        std::vector<Endpoint> endpoints;
+        std::list<Endpoint> endpoints; // connections point to the endpoints, so they must not move
 
         std::vector<std::unique_ptr<Stream>> streams;
         std::vector<std::unique_ptr<Connection>> connections;
 
         bool needsCleanup = false;
 
+        TrafficCounters counters; // totals of the streams, including deleted ones
+
         void deleteConnection(Connection* connection);
+        void startEndpoint(const Endpoint& endpoint);
+        void stopEndpoint(const Endpoint& endpoint);
     };
 }
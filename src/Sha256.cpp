@@ -0,0 +1,193 @@
+//
+//  rtmp_relay
+//
+
+#include <cstring>
+#include "Sha256.hpp"
+
+namespace relay
+{
+    static const uint32_t ROUND_CONSTANTS[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+    static inline uint32_t rotateRight(uint32_t value, uint32_t bits)
+    {
+        return (value >> bits) | (value << (32 - bits));
+    }
+
+    Sha256::Sha256()
+    {
+        state[0] = 0x6a09e667;
+        state[1] = 0xbb67ae85;
+        state[2] = 0x3c6ef372;
+        state[3] = 0xa54ff53a;
+        state[4] = 0x510e527f;
+        state[5] = 0x9b05688c;
+        state[6] = 0x1f83d9ab;
+        state[7] = 0x5be0cd19;
+    }
+
+    void Sha256::transform(const uint8_t* block)
+    {
+        uint32_t w[64];
+
+        for (uint32_t i = 0; i < 16; ++i)
+        {
+            w[i] = (static_cast<uint32_t>(block[i * 4]) << 24) |
+                (static_cast<uint32_t>(block[i * 4 + 1]) << 16) |
+                (static_cast<uint32_t>(block[i * 4 + 2]) << 8) |
+                static_cast<uint32_t>(block[i * 4 + 3]);
+        }
+
+        for (uint32_t i = 16; i < 64; ++i)
+        {
+            uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+        uint32_t f = state[5];
+        uint32_t g = state[6];
+        uint32_t h = state[7];
+
+        for (uint32_t i = 0; i < 64; ++i)
+        {
+            uint32_t s1 = rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25);
+            uint32_t ch = (e & f) ^ (~e & g);
+            uint32_t temp1 = h + s1 + ch + ROUND_CONSTANTS[i] + w[i];
+            uint32_t s0 = rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22);
+            uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+            uint32_t temp2 = s0 + maj;
+
+            h = g;
+            g = f;
+            f = e;
+            e = d + temp1;
+            d = c;
+            c = b;
+            b = a;
+            a = temp1 + temp2;
+        }
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+
+    void Sha256::update(const uint8_t* data, size_t size)
+    {
+        totalSize += size;
+
+        if (bufferSize > 0)
+        {
+            size_t count = BLOCK_SIZE - bufferSize;
+            if (count > size) count = size;
+
+            memcpy(buffer + bufferSize, data, count);
+            bufferSize += count;
+            data += count;
+            size -= count;
+
+            if (bufferSize < BLOCK_SIZE) return;
+
+            transform(buffer);
+            bufferSize = 0;
+        }
+
+        while (size >= BLOCK_SIZE)
+        {
+            transform(data);
+            data += BLOCK_SIZE;
+            size -= BLOCK_SIZE;
+        }
+
+        if (size > 0)
+        {
+            memcpy(buffer, data, size);
+            bufferSize = size;
+        }
+    }
+
+    void Sha256::finish(uint8_t* digest)
+    {
+        uint64_t bitCount = totalSize * 8;
+
+        uint8_t padding[BLOCK_SIZE * 2];
+        memset(padding, 0, sizeof(padding));
+        padding[0] = 0x80;
+
+        size_t paddingSize = (bufferSize < BLOCK_SIZE - 8) ? (BLOCK_SIZE - 8 - bufferSize) : (BLOCK_SIZE * 2 - 8 - bufferSize);
+
+        for (uint32_t i = 0; i < 8; ++i)
+        {
+            padding[paddingSize + i] = static_cast<uint8_t>(bitCount >> (56 - i * 8));
+        }
+
+        update(padding, paddingSize + 8);
+
+        for (uint32_t i = 0; i < 8; ++i)
+        {
+            digest[i * 4] = static_cast<uint8_t>(state[i] >> 24);
+            digest[i * 4 + 1] = static_cast<uint8_t>(state[i] >> 16);
+            digest[i * 4 + 2] = static_cast<uint8_t>(state[i] >> 8);
+            digest[i * 4 + 3] = static_cast<uint8_t>(state[i]);
+        }
+    }
+
+    HmacSha256::HmacSha256(const uint8_t* key, size_t keySize)
+    {
+        uint8_t keyBlock[Sha256::BLOCK_SIZE];
+        memset(keyBlock, 0, sizeof(keyBlock));
+
+        if (keySize > Sha256::BLOCK_SIZE)
+        {
+            Sha256 keyHash;
+            keyHash.update(key, keySize);
+            keyHash.finish(keyBlock);
+        }
+        else
+        {
+            memcpy(keyBlock, key, keySize);
+        }
+
+        uint8_t pad[Sha256::BLOCK_SIZE];
+
+        for (size_t i = 0; i < Sha256::BLOCK_SIZE; ++i) pad[i] = keyBlock[i] ^ 0x36;
+        inner.update(pad, sizeof(pad));
+
+        for (size_t i = 0; i < Sha256::BLOCK_SIZE; ++i) pad[i] = keyBlock[i] ^ 0x5c;
+        outer.update(pad, sizeof(pad));
+    }
+
+    void HmacSha256::update(const uint8_t* data, size_t size)
+    {
+        inner.update(data, size);
+    }
+
+    void HmacSha256::finish(uint8_t* digest)
+    {
+        uint8_t innerDigest[Sha256::DIGEST_SIZE];
+        inner.finish(innerDigest);
+
+        outer.update(innerDigest, sizeof(innerDigest));
+        outer.finish(digest);
+    }
+}
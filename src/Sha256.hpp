@@ -0,0 +1,44 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace relay
+{
+    class Sha256
+    {
+    public:
+        static const size_t DIGEST_SIZE = 32;
+        static const size_t BLOCK_SIZE = 64;
+
+        Sha256();
+
+        void update(const uint8_t* data, size_t size);
+        void finish(uint8_t* digest);
+
+    private:
+        void transform(const uint8_t* block);
+
+        uint32_t state[8];
+        uint8_t buffer[BLOCK_SIZE];
+        size_t bufferSize = 0;
+        uint64_t totalSize = 0;
+    };
+
+    class HmacSha256
+    {
+    public:
+        HmacSha256(const uint8_t* key, size_t keySize);
+
+        void update(const uint8_t* data, size_t size);
+        void finish(uint8_t* digest);
+
+    private:
+        Sha256 inner;
+        Sha256 outer;
+    };
+}
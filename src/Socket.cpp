@@ -14,6 +14,12 @@
 #  include <netdb.h>
 #  include <unistd.h>
 #endif
+#ifdef __linux__
+#  include <sys/ioctl.h>
+#  include <linux/sockios.h>
+#  include <linux/tcp.h>
+#endif
+#include <cstddef>
 #include <cstring>
 #include <fcntl.h>
 #include "Socket.hpp"
@@ -22,8 +28,9 @@
 
 namespace relay
 {
-    static const int WAITING_QUEUE_SIZE = 5;
-    static uint8_t TEMP_BUFFER[65536];
+    static const int WAITING_QUEUE_SIZE = SOMAXCONN;
+    static thread_local uint8_t TEMP_BUFFER[65536]; // the status thread reads with its own Network
+    static const float STATS_SAMPLE_INTERVAL = 1.0f;
 
 #ifdef _WIN32
     static inline bool initWSA()
@@ -33,13 +40,13 @@ namespace relay
         int error = WSAStartup(sockVersion, &wsaData);
         if (error != 0)
         {
-            Log(Log::Level::ERR) << "WSAStartup failed, error: " << error;
+            RELAY_LOG(Log::Level::ERR) << "WSAStartup failed, error: " << error;
             return false;
         }
 
         if (wsaData.wVersion != sockVersion)
         {
-            Log(Log::Level::ERR) << "Incorrect Winsock version";
+            RELAY_LOG(Log::Level::ERR) << "Incorrect Winsock version";
             WSACleanup();
             return false;
         }
@@ -82,7 +89,7 @@ namespace relay
         if (ret != 0)
         {
             int error = getLastError();
-            Log(Log::Level::ERR) << "Failed to get address info of " << address << ", error: " << error;
+            RELAY_LOG(Log::Level::ERR) << "Failed to get address info of " << address << ", error: " << error;
             return false;
         }
 
@@ -118,6 +125,8 @@ namespace relay
 
         writeData();
         closeSocketFd();
+
+        network.sendQueueSize -= outData.size();
     }
 
     Socket::Socket(Socket&& other):
@@ -137,7 +146,10 @@ namespace relay
         acceptCallback(std::move(other.acceptCallback)),
         connectCallback(std::move(other.connectCallback)),
         connectErrorCallback(std::move(other.connectErrorCallback)),
-        outData(std::move(other.outData))
+        flushCallback(std::move(other.flushCallback)),
+        outData(std::move(other.outData)),
+        sentSize(other.sentSize),
+        sendMarks(std::move(other.sendMarks))
     {
         network.addSocket(*this);
 
@@ -173,7 +185,11 @@ namespace relay
         acceptCallback = std::move(other.acceptCallback);
         connectCallback = std::move(other.connectCallback);
         connectErrorCallback = std::move(other.connectErrorCallback);
+        flushCallback = std::move(other.flushCallback);
+        network.sendQueueSize -= outData.size();
         outData = std::move(other.outData);
+        sentSize = other.sentSize;
+        sendMarks = std::move(other.sendMarks);
 
         remoteAddressString = ipToString(remoteIPAddress) + ":" + std::to_string(remotePort);
 
@@ -215,8 +231,13 @@ namespace relay
         ready = false;
         accepting = false;
         connecting = false;
+        network.sendQueueSize -= outData.size();
         outData.clear();
         inData.clear();
+        sentSize = 0;
+        sendMarks.clear();
+        stats = SocketStats();
+        timeSinceSample = 0.0f;
 
         return result;
     }
@@ -233,7 +254,7 @@ namespace relay
 
                 close();
 
-                Log(Log::Level::WARN) << "Failed to connect to " << remoteAddressString << ", connection timed out";
+                RELAY_LOG(Log::Level::WARN) << "Failed to connect to " << remoteAddressString << ", connection timed out";
 
                 if (connectErrorCallback)
                 {
@@ -241,13 +262,55 @@ namespace relay
                 }
             }
         }
+        else if (ready && !accepting)
+        {
+            timeSinceSample += delta;
+
+            if (timeSinceSample >= STATS_SAMPLE_INTERVAL)
+            {
+                timeSinceSample = 0.0f;
+                sampleStats();
+            }
+        }
+    }
+
+    void Socket::sampleStats()
+    {
+#ifdef __linux__
+        tcp_info info;
+        socklen_t length = sizeof(info);
+        memset(&info, 0, sizeof(info));
+
+        if (getsockopt(socketFd, IPPROTO_TCP, TCP_INFO, &info, &length) != 0)
+        {
+            stats.valid = false;
+            return;
+        }
+
+        stats.valid = true;
+        stats.rtt = info.tcpi_rtt;
+        stats.rttVariance = info.tcpi_rttvar;
+        stats.congestionWindow = info.tcpi_snd_cwnd;
+        stats.retransmits = info.tcpi_total_retrans;
+
+        // older kernels return a shorter structure
+        if (length >= offsetof(tcp_info, tcpi_delivery_rate) + sizeof(info.tcpi_delivery_rate))
+        {
+            stats.deliveryRate = info.tcpi_delivery_rate;
+        }
+
+        int queueSize = 0;
+        stats.kernelOutQueue = (ioctl(socketFd, SIOCOUTQ, &queueSize) == 0) ? static_cast<uint32_t>(queueSize) : 0;
+        queueSize = 0;
+        stats.kernelInQueue = (ioctl(socketFd, SIOCINQ, &queueSize) == 0) ? static_cast<uint32_t>(queueSize) : 0;
+#endif
     }
 
     bool Socket::startRead()
     {
         if (socketFd == INVALID_SOCKET)
         {
-            Log(Log::Level::ERR) << "Can not start reading, invalid socket";
+            RELAY_LOG(Log::Level::ERR) << "Can not start reading, invalid socket";
             return false;
         }
 
@@ -291,7 +354,7 @@ namespace relay
         if (setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&value), sizeof(value)) < 0)
         {
             int error = getLastError();
-            Log(Log::Level::ERR) << "setsockopt(SO_REUSEADDR) failed, error: " << error;
+            RELAY_LOG(Log::Level::ERR) << "setsockopt(SO_REUSEADDR) failed, error: " << error;
             return false;
         }
 
@@ -304,18 +367,18 @@ namespace relay
         if (bind(socketFd, reinterpret_cast<sockaddr*>(&serverAddress), sizeof(serverAddress)) < 0)
         {
             int error = getLastError();
-            Log(Log::Level::ERR) << "Failed to bind server socket to port " << localPort << ", error: " << error;
+            RELAY_LOG(Log::Level::ERR) << "Failed to bind server socket to port " << localPort << ", error: " << error;
             return false;
         }
 
         if (listen(socketFd, WAITING_QUEUE_SIZE) < 0)
         {
             int error = getLastError();
-            Log(Log::Level::ERR) << "Failed to listen on " << ipToString(localIPAddress) << ":" << localPort << ", error: " << error;
+            RELAY_LOG(Log::Level::ERR) << "Failed to listen on " << ipToString(localIPAddress) << ":" << localPort << ", error: " << error;
             return false;
         }
 
-        Log(Log::Level::INFO) << "Server listening on " << ipToString(localIPAddress) << ":" << localPort;
+        RELAY_LOG(Log::Level::INFO) << "Server listening on " << ipToString(localIPAddress) << ":" << localPort;
         
         accepting = true;
         ready = true;
@@ -357,7 +420,7 @@ namespace relay
 
         remoteAddressString = ipToString(remoteIPAddress) + ":" + std::to_string(remotePort);
 
-        Log(Log::Level::INFO) << "Connecting to " << remoteAddressString;
+        RELAY_LOG(Log::Level::INFO) << "Connecting to " << remoteAddressString;
 
         sockaddr_in addr;
         memset(&addr, 0, sizeof(addr));
@@ -379,7 +442,7 @@ namespace relay
                 }
                 else
                 {
-                    Log(Log::Level::WARN) << "Failed to connect to " << remoteAddressString << ", error: " << error;
+                    RELAY_LOG(Log::Level::WARN) << "Failed to connect to " << remoteAddressString << ", error: " << error;
                     if (connectErrorCallback)
                     {
                         connectErrorCallback(*this);
@@ -391,7 +454,7 @@ namespace relay
         {
             // connected
             ready = true;
-            Log(Log::Level::INFO) << "Socket connected to " << remoteAddressString;
+            RELAY_LOG(Log::Level::INFO) << "Socket connected to " << remoteAddressString;
             if (connectCallback)
             {
                 connectCallback(*this);
@@ -404,7 +467,7 @@ namespace relay
         if (getsockname(socketFd, reinterpret_cast<sockaddr*>(&localAddr), &localAddrSize) != 0)
         {
             int error = getLastError();
-            Log(Log::Level::WARN) << "Failed to get address of the socket connecting to " << remoteAddressString << ", error: " << error;
+            RELAY_LOG(Log::Level::WARN) << "Failed to get address of the socket connecting to " << remoteAddressString << ", error: " << error;
             closeSocketFd();
             connecting = false;
             if (connectErrorCallback)
@@ -420,6 +483,76 @@ namespace relay
         return true;
     }
 
+    bool Socket::adopt(socket_t newSocketFd)
+    {
+        if (socketFd != INVALID_SOCKET)
+        {
+            close();
+        }
+
+        socketFd = newSocketFd;
+
+        sockaddr_in localAddr;
+        socklen_t localAddrSize = sizeof(localAddr);
+
+        if (getsockname(socketFd, reinterpret_cast<sockaddr*>(&localAddr), &localAddrSize) != 0)
+        {
+            int error = getLastError();
+            RELAY_LOG(Log::Level::ERR) << "Failed to get address of the adopted socket, error: " << error;
+            closeSocketFd();
+            return false;
+        }
+
+        localIPAddress = localAddr.sin_addr.s_addr;
+        localPort = ntohs(localAddr.sin_port);
+
+        int value = 0;
+        socklen_t valueSize = sizeof(value);
+
+        if (getsockopt(socketFd, SOL_SOCKET, SO_ACCEPTCONN, reinterpret_cast<char*>(&value), &valueSize) != 0)
+        {
+            int error = getLastError();
+            RELAY_LOG(Log::Level::ERR) << "getsockopt(SO_ACCEPTCONN) failed, error: " << error;
+            closeSocketFd();
+            return false;
+        }
+
+        accepting = (value != 0);
+
+        if (!accepting)
+        {
+            sockaddr_in remoteAddr;
+            socklen_t remoteAddrSize = sizeof(remoteAddr);
+
+            if (getpeername(socketFd, reinterpret_cast<sockaddr*>(&remoteAddr), &remoteAddrSize) != 0)
+            {
+                int error = getLastError();
+                RELAY_LOG(Log::Level::ERR) << "Failed to get peer address of the adopted socket, error: " << error;
+                closeSocketFd();
+                return false;
+            }
+
+            remoteIPAddress = remoteAddr.sin_addr.s_addr;
+            remotePort = ntohs(remoteAddr.sin_port);
+        }
+
+        // O_NONBLOCK is shared with the process that opened the socket, so it is already set
+        remoteAddressString = ipToString(remoteIPAddress) + ":" + std::to_string(remotePort);
+        connecting = false;
+        ready = true;
+
+        if (accepting)
+        {
+            RELAY_LOG(Log::Level::INFO) << "Server listening on " << ipToString(localIPAddress) << ":" << localPort << " (adopted)";
+        }
+        else
+        {
+            RELAY_LOG(Log::Level::INFO) << "Adopted connection from " << remoteAddressString << " to " << ipToString(localIPAddress) << ":" << localPort;
+        }
+
+        return true;
+    }
+
     void Socket::setConnectTimeout(float timeout)
     {
         connectTimeout = timeout;
@@ -450,6 +583,11 @@ namespace relay
         connectErrorCallback = newConnectErrorCallback;
     }
 
+    void Socket::setFlushCallback(const std::function<void(Socket&, uint64_t)>& newFlushCallback)
+    {
+        flushCallback = newFlushCallback;
+    }
+
     bool Socket::createSocketFd()
     {
         socketFd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -466,7 +604,7 @@ namespace relay
         if (socketFd == INVALID_SOCKET)
         {
             int error = getLastError();
-            Log(Log::Level::ERR) << "Failed to create socket, error: " << error;
+            RELAY_LOG(Log::Level::ERR) << "Failed to create socket, error: " << error;
             return false;
         }
 
@@ -489,7 +627,7 @@ namespace relay
         if (setsockopt(socketFd, SOL_SOCKET, SO_NOSIGPIPE, &set, sizeof(int)) != 0)
         {
             int error = getLastError();
-            Log(Log::Level::ERR) << "Failed to set socket option, error: " << error;
+            RELAY_LOG(Log::Level::ERR) << "Failed to set socket option, error: " << error;
             return false;
         }
 #endif
@@ -511,19 +649,19 @@ namespace relay
             if (result < 0)
             {
                 int error = getLastError();
-                Log(Log::Level::ERR) << "Failed to close socket " << ipToString(localIPAddress) << ":" << localPort << ", error: " << error;
+                RELAY_LOG(Log::Level::ERR) << "Failed to close socket " << ipToString(localIPAddress) << ":" << localPort << ", error: " << error;
                 return false;
             }
             else
             {
-                Log(Log::Level::INFO) << "Socket " << ipToString(localIPAddress) << ":" << localPort << " closed";
+                RELAY_LOG(Log::Level::INFO) << "Socket " << ipToString(localIPAddress) << ":" << localPort << " closed";
             }
         }
 
         return true;
     }
 
-    bool Socket::send(std::vector<uint8_t> buffer)
+    bool Socket::send(const std::vector<uint8_t>& buffer)
     {
         if (socketFd == INVALID_SOCKET)
         {
@@ -531,6 +669,16 @@ namespace relay
         }
 
         outData.insert(outData.end(), buffer.begin(), buffer.end());
+        network.sendQueueSize += buffer.size();
+
+        return true;
+    }
+
+    bool Socket::send(const std::vector<uint8_t>& buffer, const std::chrono::steady_clock::time_point& timestamp)
+    {
+        if (!send(buffer)) return false;
+
+        sendMarks.push_back(std::make_pair(sentSize + outData.size(), timestamp));
 
         return true;
     }
@@ -558,17 +706,17 @@ namespace relay
 #endif
                     error == EWOULDBLOCK)
                 {
-                    Log(Log::Level::ERR) << "No sockets to accept";
+                    RELAY_LOG(Log::Level::ERR) << "No sockets to accept";
                 }
                 else
                 {
-                    Log(Log::Level::ERR) << "Failed to accept client, error: " << error;
+                    RELAY_LOG(Log::Level::ERR) << "Failed to accept client, error: " << error;
                     return false;
                 }
             }
             else
             {
-                Log(Log::Level::INFO) << "Client connected from " << ipToString(address.sin_addr.s_addr) << ":" << ntohs(address.sin_port) << " to " << ipToString(localIPAddress) << ":" << localPort;
+                RELAY_LOG(Log::Level::INFO) << "Client connected from " << ipToString(address.sin_addr.s_addr) << ":" << ntohs(address.sin_port) << " to " << ipToString(localIPAddress) << ":" << localPort;
 
                 Socket socket(network, clientFd, true,
                               localIPAddress, localPort,
@@ -595,7 +743,7 @@ namespace relay
         {
             connecting = false;
             ready = true;
-            Log(Log::Level::INFO) << "Socket connected to " << remoteAddressString;
+            RELAY_LOG(Log::Level::INFO) << "Socket connected to " << remoteAddressString;
             if (connectCallback)
             {
                 connectCallback(*this);
@@ -631,24 +779,24 @@ namespace relay
 #endif
                 error == EWOULDBLOCK)
             {
-                Log(Log::Level::WARN) << "Nothing to read from " << remoteAddressString;
+                RELAY_LOG(Log::Level::WARN) << "Nothing to read from " << remoteAddressString;
                 return true;
             }
             else if (error == ECONNRESET)
             {
-                Log(Log::Level::INFO) << "Connection to " << remoteAddressString << " reset by peer";
+                RELAY_LOG(Log::Level::INFO) << "Connection to " << remoteAddressString << " reset by peer";
                 disconnected();
                 return false;
             }
             else if (error == ECONNREFUSED)
             {
-                Log(Log::Level::INFO) << "Connection to " << remoteAddressString << " refused";
+                RELAY_LOG(Log::Level::INFO) << "Connection to " << remoteAddressString << " refused";
                 disconnected();
                 return false;
             }
             else
             {
-                Log(Log::Level::ERR) << "Failed to read from " << remoteAddressString << ", error: " << error;
+                RELAY_LOG(Log::Level::ERR) << "Failed to read from " << remoteAddressString << ", error: " << error;
                 disconnected();
                 return false;
             }
@@ -660,8 +808,9 @@ namespace relay
             return true;
         }
 
-        Log(Log::Level::ALL) << "Socket received " << size << " bytes from " << remoteAddressString;
+        RELAY_LOG(Log::Level::ALL) << "Socket received " << size << " bytes from " << remoteAddressString;
 
+        readTime = std::chrono::steady_clock::now();
         inData.assign(TEMP_BUFFER, TEMP_BUFFER + size);
 
         if (readCallback)
@@ -701,40 +850,58 @@ namespace relay
 #endif
                     error == EWOULDBLOCK)
                 {
-                    Log(Log::Level::WARN) << "Can not write to " << remoteAddressString << " now";
+                    RELAY_LOG(Log::Level::WARN) << "Can not write to " << remoteAddressString << " now";
                     return true;
                 }
                 else if (error == EPIPE)
                 {
-                    Log(Log::Level::ERR) << "Failed to send data to " << remoteAddressString << ", socket has been shut down";
+                    RELAY_LOG(Log::Level::ERR) << "Failed to send data to " << remoteAddressString << ", socket has been shut down";
                     disconnected();
                     return false;
                 }
                 else if (error == ECONNRESET)
                 {
-                    Log(Log::Level::INFO) << "Connection to " << remoteAddressString << " reset by peer";
+                    RELAY_LOG(Log::Level::INFO) << "Connection to " << remoteAddressString << " reset by peer";
                     disconnected();
                     return false;
                 }
                 else
                 {
-                    Log(Log::Level::ERR) << "Failed to write to socket " << remoteAddressString << ", error: " << error;
+                    RELAY_LOG(Log::Level::ERR) << "Failed to write to socket " << remoteAddressString << ", error: " << error;
                     disconnected();
                     return false;
                 }
             }
             else if (size != dataSize)
             {
-                Log(Log::Level::ALL) << "Socket did not send all data to " << remoteAddressString << ", sent " << size << " out of " << outData.size() << " bytes";
+                RELAY_LOG(Log::Level::ALL) << "Socket did not send all data to " << remoteAddressString << ", sent " << size << " out of " << outData.size() << " bytes";
             }
             else
             {
-                Log(Log::Level::ALL) << "Socket sent " << size << " bytes to " << remoteAddressString;
+                RELAY_LOG(Log::Level::ALL) << "Socket sent " << size << " bytes to " << remoteAddressString;
             }
 
             if (size > 0)
             {
                 outData.erase(outData.begin(), outData.begin() + size);
+                network.sendQueueSize -= static_cast<size_t>(size);
+                sentSize += static_cast<uint64_t>(size);
+
+                if (!sendMarks.empty() && sendMarks.front().first <= sentSize)
+                {
+                    auto currentTime = std::chrono::steady_clock::now();
+
+                    while (!sendMarks.empty() && sendMarks.front().first <= sentSize)
+                    {
+                        uint64_t latency = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(currentTime - sendMarks.front().second).count());
+                        sendMarks.pop_front();
+
+                        if (flushCallback)
+                        {
+                            flushCallback(*this, latency);
+                        }
+                    }
+                }
             }
         }
         
@@ -750,7 +917,7 @@ namespace relay
             connecting = false;
             ready = false;
 
-            Log(Log::Level::WARN) << "Failed to connect to " << remoteAddressString;
+            RELAY_LOG(Log::Level::WARN) << "Failed to connect to " << remoteAddressString;
 
             if (socketFd != INVALID_SOCKET)
             {
@@ -769,7 +936,7 @@ namespace relay
         {
             if (ready)
             {
-                Log(Log::Level::INFO) << "Socket disconnected from " << remoteAddressString << " disconnected";
+                RELAY_LOG(Log::Level::INFO) << "Socket disconnected from " << remoteAddressString << " disconnected";
 
                 ready = false;
 
@@ -791,6 +958,7 @@ namespace relay
                 remoteIPAddress = 0;
                 remotePort = 0;
                 ready = false;
+                network.sendQueueSize -= outData.size();
                 outData.clear();
             }
         }
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <chrono>
+#include <deque>
 #include <vector>
 #include <functional>
 #include <cstdint>
@@ -46,6 +48,19 @@ namespace relay
 #endif
     }
 
+    // kernel view of a connected TCP socket, sampled periodically, only available on Linux
+    struct SocketStats
+    {
+        bool valid = false;
+        uint32_t rtt = 0; // microseconds
+        uint32_t rttVariance = 0; // microseconds
+        uint32_t congestionWindow = 0; // segments
+        uint32_t retransmits = 0; // total retransmitted segments
+        uint64_t deliveryRate = 0; // bytes per second, 0 if not supported by the kernel
+        uint32_t kernelOutQueue = 0; // bytes not yet acknowledged by the peer
+        uint32_t kernelInQueue = 0; // bytes not yet read
+    };
+
     class Network;
 
     class Socket
@@ -74,6 +89,10 @@ namespace relay
         bool connect(const std::string& address);
         bool connect(uint32_t address, uint16_t newPort);
 
+        // takes over a listening or connected socket opened by another process
+        bool adopt(socket_t newSocketFd);
+        socket_t getSocketFd() const { return socketFd; }
+
         bool isConnecting() const { return connecting; }
         void setConnectTimeout(float timeout);
 
@@ -82,8 +101,14 @@ namespace relay
         void setAcceptCallback(const std::function<void(Socket&, Socket&)>& newAcceptCallback);
         void setConnectCallback(const std::function<void(Socket&)>& newConnectCallback);
         void setConnectErrorCallback(const std::function<void(Socket&)>& newConnectErrorCallback);
+        void setFlushCallback(const std::function<void(Socket&, uint64_t)>& newFlushCallback);
 
-        bool send(std::vector<uint8_t> buffer);
+        bool send(const std::vector<uint8_t>& buffer);
+        // the flush callback is called with the microseconds since timestamp once the last byte of buffer is handed to the kernel
+        bool send(const std::vector<uint8_t>& buffer, const std::chrono::steady_clock::time_point& timestamp);
+
+        // time of the last successful receive, valid while the read callback runs
+        const std::chrono::steady_clock::time_point& getReadTime() const { return readTime; }
 
         uint32_t getLocalIPAddress() const { return localIPAddress; }
         uint16_t getLocalPort() const { return localPort; }
@@ -94,6 +119,10 @@ namespace relay
         bool isReady() const { return ready; }
 
         bool hasOutData() const { return !outData.empty(); }
+        size_t getOutDataSize() const { return outData.size(); }
+        const std::vector<uint8_t>& getOutData() const { return outData; }
+
+        const SocketStats& getStats() const { return stats; }
 
     protected:
         Socket(Network& aNetwork, socket_t aSocketFd, bool aReady,
@@ -107,6 +136,7 @@ namespace relay
         bool writeData();
 
         bool disconnected();
+        void sampleStats();
 
         bool createSocketFd();
         bool closeSocketFd();
@@ -133,10 +163,17 @@ namespace relay
         std::function<void(Socket&, Socket&)> acceptCallback;
         std::function<void(Socket&)> connectCallback;
         std::function<void(Socket&)> connectErrorCallback;
+        std::function<void(Socket&, uint64_t)> flushCallback;
 
         std::vector<uint8_t> inData;
         std::vector<uint8_t> outData;
+        uint64_t sentSize = 0; // bytes handed to the kernel since the socket was opened
+        std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>> sendMarks; // end offsets of timestamped buffers
+        std::chrono::steady_clock::time_point readTime;
 
         std::string remoteAddressString;
+
+        SocketStats stats;
+        float timeSinceSample = 0.0f;
     };
 }
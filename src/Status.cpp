@@ -2,39 +2,196 @@
 //  rtmp_relay
 //
 
+#include <chrono>
 #include "Status.hpp"
 #include "Relay.hpp"
+#include "Connection.hpp"
+#include "Stream.hpp"
+#include "Server.hpp"
 #include "StatusSender.hpp"
+#include "StatusSnapshot.hpp"
+#include "Utils.hpp"
+#include "Log.hpp"
 
 namespace relay
 {
-    Status::Status(Network& aNetwork, Relay& aRelay, const std::string& address):
-        network(aNetwork), socket(aNetwork), relay(aRelay)
+    // requests within this time are served from the same snapshot
+    static const std::chrono::milliseconds SNAPSHOT_INTERVAL(1000);
+    static const size_t MAX_STATUS_CONNECTIONS = 64;
+
+    Status::Status(Relay& aRelay, const std::string& address):
+        relay(aRelay), socket(network),
+        snapshot(std::make_shared<StatusSnapshot>())
     {
         //socket.setConnectTimeout(connectionTimeout);
         socket.setAcceptCallback(std::bind(&Status::handleAccept, this, std::placeholders::_1, std::placeholders::_2));
 
         socket.startAccept(address);
+
+        thread = std::thread(&Status::run, this);
+    }
+
+    Status::~Status()
+    {
+        running = false;
+        if (thread.joinable()) thread.join();
     }
 
     void Status::update(float)
     {
-        for (auto i = statusSenders.begin(); i != statusSenders.end();)
+        if (snapshotRequested.exchange(false))
+        {
+            std::shared_ptr<StatusSnapshot> newSnapshot = relay.createSnapshot();
+            newSnapshot->generation = ++generation;
+            newSnapshot->time = std::chrono::steady_clock::now();
+            std::atomic_store(&snapshot, std::shared_ptr<const StatusSnapshot>(newSnapshot));
+        }
+
+        if (!events.empty())
+        {
+            std::shared_ptr<const std::string> newEvents = std::make_shared<const std::string>(std::move(events));
+            events.clear();
+
+            std::lock_guard<std::mutex> lock(eventMutex);
+            pendingEvents.push_back(newEvents);
+        }
+    }
+
+    std::shared_ptr<const StatusSnapshot> Status::getSnapshot() const
+    {
+        return std::atomic_load(&snapshot);
+    }
+
+    bool Status::isCurrent(const StatusSnapshot& currentSnapshot)
+    {
+        return currentSnapshot.generation > 0 &&
+            std::chrono::steady_clock::now() - currentSnapshot.time < SNAPSHOT_INTERVAL;
+    }
+
+    void Status::publishStreamEvent(Stream& stream, const Connection& connection, bool started)
+    {
+        if (!hasSubscribers()) return;
+
+        std::string data = "{\"id\":" + std::to_string(stream.getId()) + "," +
+            "\"serverId\":" + std::to_string(stream.getServer().getId()) + "," +
+            "\"name\":\"" + escapeString(stream.getStreamName()) + "\"," +
+            "\"application\":\"" + escapeString(stream.getApplicationName()) + "\"," +
+            "\"connectionId\":" + std::to_string(connection.getId()) + "," +
+            "\"direction\":\"" + getDirectionString(connection.getDirection()) + "\"}";
+
+        encodeEvent(events, started ? "streamStart" : "streamStop", data);
+    }
+
+    void Status::publishConnectionEvent(const Connection& connection, bool closed)
+    {
+        if (!hasSubscribers()) return;
+
+        std::string data = "{\"id\":" + std::to_string(connection.getId()) + "," +
+            "\"name\":\"" + escapeString(connection.getStreamName()) + "\"," +
+            "\"application\":\"" + escapeString(connection.getApplicationName()) + "\"," +
+            "\"connection\":\"" + getTypeString(connection.getType()) + "\"," +
+            "\"state\":\"" + getStateString(connection.getState()) + "\"," +
+            "\"direction\":\"" + getDirectionString(connection.getDirection()) + "\"}";
+
+        encodeEvent(events, closed ? "connectionClose" : "connectionState", data);
+    }
+
+    void Status::publishRateEvent(const Connection& connection, uint64_t audioRate, uint64_t videoRate)
+    {
+        if (!hasSubscribers()) return;
+
+        std::string data = "{\"id\":" + std::to_string(connection.getId()) + "," +
+            "\"audioRate\":" + std::to_string(audioRate) + "," +
+            "\"videoRate\":" + std::to_string(videoRate) + "}";
+
+        encodeEvent(events, "rate", data);
+    }
+
+    void Status::encodeEvent(std::string& str, const char* name, const std::string& data)
+    {
+        str += "event: ";
+        str += name;
+        str += "\n";
+
+        // every line of the data needs its own field
+        std::string::size_type start = 0;
+
+        for (;;)
         {
-            if ((*i)->isConnected())
+            std::string::size_type end = data.find('\n', start);
+
+            str += "data: ";
+            str.append(data, start, (end == std::string::npos) ? std::string::npos : end - start);
+            str += "\n";
+
+            if (end == std::string::npos) break;
+            start = end + 1;
+        }
+
+        str += "\n";
+    }
+
+    void Status::run()
+    {
+        const std::chrono::microseconds sleepTime(5000);
+        auto previousTime = std::chrono::steady_clock::now();
+
+        while (running)
+        {
+            auto currentTime = std::chrono::steady_clock::now();
+            float delta = std::chrono::duration_cast<std::chrono::milliseconds>(currentTime - previousTime).count() / 1000.0f;
+            previousTime = currentTime;
+
+            network.update();
+
+            std::vector<std::shared_ptr<const std::string>> newEvents;
+
             {
-                ++i;
+                std::lock_guard<std::mutex> lock(eventMutex);
+                newEvents.swap(pendingEvents);
             }
-            else
+
+            for (auto i = statusSenders.begin(); i != statusSenders.end();)
             {
-                i = statusSenders.erase(i);
+                // the same encoded events are shared by all subscribers
+                for (const std::shared_ptr<const std::string>& event : newEvents)
+                {
+                    (*i)->sendEvents(*event);
+                }
+
+                (*i)->update(delta);
+
+                if ((*i)->isConnected())
+                {
+                    ++i;
+                }
+                else
+                {
+                    i = statusSenders.erase(i);
+                }
             }
+
+            std::this_thread::sleep_for(sleepTime);
         }
     }
 
     void Status::handleAccept(Socket&, Socket& clientSocket)
     {
-        std::unique_ptr<StatusSender> statusSender(new StatusSender(network, clientSocket, relay));
+        if (statusSenders.size() >= MAX_STATUS_CONNECTIONS)
+        {
+            RELAY_LOG(Log::Level::WARN) << "Too many status connections, rejecting client";
+
+            std::string response = "HTTP/1.1 503 Service Unavailable\r\n"
+                "Content-Length: 0\r\n"
+                "Connection: close\r\n"
+                "\r\n";
+
+            // sent when the socket is destroyed
+            clientSocket.send(std::vector<uint8_t>(response.begin(), response.end()));
+            return;
+        }
+
+        std::unique_ptr<StatusSender> statusSender(new StatusSender(network, clientSocket, *this));
         
         statusSenders.push_back(std::move(statusSender));
     }
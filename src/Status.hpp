@@ -4,12 +4,19 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include "Network.hpp"
 #include "StatusSender.hpp"
 
 namespace relay
 {
     class Relay;
+    class StatusSnapshot;
+    class Connection;
+    class Stream;
 
     enum class ReportType
     {
@@ -18,25 +25,61 @@ namespace relay
         JSON
     };
 
+    // serves the status page from its own thread and network, using snapshots published by the event loop
     class Status
     {
     public:
-        Status(Network& aNetwork, Relay& aRelay, const std::string& address);
+        Status(Relay& aRelay, const std::string& address);
+        ~Status();
 
         Status(const Status&) = delete;
         Status& operator=(const Status&) = delete;
         Status(Status&& other) = delete;
         Status& operator=(Status&& other) = delete;
 
+        // called on the event loop thread, publishes a new snapshot if the status thread asked for one
         void update(float delta);
 
+        std::shared_ptr<const StatusSnapshot> getSnapshot() const;
+
+        // called on the status thread when a request finds the snapshot too old, the relay is only walked on demand
+        void requestSnapshot() { snapshotRequested = true; }
+        static bool isCurrent(const StatusSnapshot& currentSnapshot);
+
+        // events for the /stats/events subscribers, published on the event loop thread and handed over in update()
+        bool hasSubscribers() const { return subscriberCount > 0; }
+        void publishStreamEvent(Stream& stream, const Connection& connection, bool started);
+        void publishConnectionEvent(const Connection& connection, bool closed);
+        void publishRateEvent(const Connection& connection, uint64_t audioRate, uint64_t videoRate);
+
+        // called on the status thread
+        void addSubscriber() { ++subscriberCount; }
+        void removeSubscriber() { --subscriberCount; }
+
+        // server-sent event encoding
+        static void encodeEvent(std::string& str, const char* name, const std::string& data);
+
     private:
+        void run();
         void handleAccept(Socket& acceptor, Socket& clientSocket);
 
-        Network& network;
-        Socket socket;
         Relay& relay;
+        Network network;
+        Socket socket;
 
         std::vector<std::unique_ptr<StatusSender>> statusSenders;
+
+        // only accessed through std::atomic_load and std::atomic_store
+        std::shared_ptr<const StatusSnapshot> snapshot;
+        std::atomic<bool> snapshotRequested{false};
+        uint64_t generation = 0;
+
+        std::string events; // encoded on the event loop thread since the last update
+        std::mutex eventMutex;
+        std::vector<std::shared_ptr<const std::string>> pendingEvents; // guarded by eventMutex
+        std::atomic<uint32_t> subscriberCount{0};
+
+        std::atomic<bool> running{true};
+        std::thread thread;
     };
 }
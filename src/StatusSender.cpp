@@ -3,48 +3,131 @@
 //
 
 #include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <sstream>
 #include "StatusSender.hpp"
-#include "Relay.hpp"
+#include "Status.hpp"
+#include "StatusSnapshot.hpp"
 #include "Utils.hpp"
 #include "Log.hpp"
 
 namespace relay
 {
+    static const size_t MAX_REQUEST_SIZE = 16384;
+    static const size_t CHUNK_SIZE = 16384;
+    static const size_t MAX_QUEUED_SIZE = 65536; // body is queued only while less than this is waiting in the socket
+    static const float KEEP_ALIVE_TIMEOUT = 15.0f;
+    static const float HEARTBEAT_INTERVAL = 10.0f;
+    static const size_t MAX_SUBSCRIBER_QUEUED_SIZE = 1024 * 1024; // subscribers that fall further behind are dropped
+
+    static std::string toLower(std::string str)
+    {
+        std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return str;
+    }
+
     StatusSender::StatusSender(Network& aNetwork,
                                Socket& aSocket,
-                               Relay& aRelay):
+                               Status& aStatus):
         network(aNetwork),
         socket(std::move(aSocket)),
-        relay(aRelay)
+        status(aStatus)
     {
         socket.setReadCallback(std::bind(&StatusSender::handleRead, this, std::placeholders::_1, std::placeholders::_2));
         socket.setCloseCallback(std::bind(&StatusSender::handleClose, this, std::placeholders::_1));
     }
 
+    StatusSender::~StatusSender()
+    {
+        if (subscribed) status.removeSubscriber();
+    }
+
+    void StatusSender::update(float delta)
+    {
+        timeSinceActivity += delta;
+
+        if (subscribed && timeSinceActivity >= HEARTBEAT_INTERVAL)
+        {
+            const std::string heartbeat = ":\n\n";
+            socket.send(std::vector<uint8_t>(heartbeat.begin(), heartbeat.end()));
+            timeSinceActivity = 0.0f;
+        }
+
+        sendBody();
+
+        if (bodyOffset >= body.size())
+        {
+            if (closing)
+            {
+                if (!socket.hasOutData())
+                {
+                    socket.close();
+                }
+            }
+            else
+            {
+                processRequests();
+            }
+        }
+
+        if (socket.isReady() && timeSinceActivity > KEEP_ALIVE_TIMEOUT)
+        {
+            RELAY_LOG(Log::Level::INFO) << "Status connection timed out";
+            socket.close(true);
+        }
+    }
+
     void StatusSender::handleRead(Socket&, const std::vector<uint8_t>& newData)
     {
-        const std::vector<uint8_t> clrf = {'\r', '\n'};
+        timeSinceActivity = 0.0f;
 
         data.insert(data.end(), newData.begin(), newData.end());
 
-        for (;;)
+        processRequests();
+    }
+
+    void StatusSender::handleClose(Socket&)
+    {
+    }
+
+    void StatusSender::processRequests()
+    {
+        const std::vector<uint8_t> clrf = {'\r', '\n'};
+
+        while (!closing && !subscribed && bodyOffset >= body.size())
         {
+            if (requestReceived)
+            {
+                // retried on every update until the event loop has published a current snapshot
+                if (!handleRequest()) break;
+
+                requestReceived = false;
+                startLine.clear();
+                headers.clear();
+                continue;
+            }
+
             auto i = std::search(data.begin(), data.end(), clrf.begin(), clrf.end());
 
             if (i == data.end())
             {
+                if (data.size() > MAX_REQUEST_SIZE)
+                {
+                    RELAY_LOG(Log::Level::ERR) << "Status request too large";
+                    socket.close(true);
+                }
                 break;
             }
 
             std::string line(data.begin(), i);
+            data.erase(data.begin(), i + 2);
 
             if (line.empty()) // end of header
             {
                 if (!startLine.empty()) // received header
                 {
-                    sendReport();
-                    socket.close();
-                    break;
+                    requestReceived = true;
                 }
             }
             else
@@ -58,93 +141,238 @@ namespace relay
                     headers.push_back(line);
                 }
             }
-
-            data.erase(data.begin(), i + 2);
         }
     }
 
-    void StatusSender::handleClose(Socket&)
+    static bool isStatusPath(const std::string& path)
     {
+        return path == "/stats" || path == "/stats.html" || path == "/stats.txt" ||
+            path == "/stats.json" || path == "/metrics" || path == "/stats/events";
     }
 
-    void StatusSender::sendReport()
+    bool StatusSender::handleRequest()
     {
         std::vector<std::string> fields;
         tokenize(startLine, fields);
 
-        if (fields.size() >= 2 && fields[0] == "GET")
+        if (fields.size() >= 2 && fields[0] == "GET" && isStatusPath(fields[1]) &&
+            !Status::isCurrent(*status.getSnapshot()))
         {
-            if (fields[1] == "/stats" || fields[1] == "/stats.html")
-            {
-                std::string info;
-                relay.getStats(info, ReportType::HTML);
+            status.requestSnapshot();
+            return false;
+        }
 
-                std::string response = "HTTP/1.1 200 OK\r\n"
-                    "Cache-Control: no-cache, no-store, must-revalidate\r\n"
-                    "Pragma: no-cache\r\n"
-                    "Expires: 0\r\n"
-                    "Content-Type: text/html\r\n"
-                    "Content-Length: " + std::to_string(info.length()) + "\r\n"
-                    "\r\n" + info;
+        std::string connection;
+        getHeader("Connection", connection);
+        connection = toLower(connection);
 
+        bool http11 = fields.size() >= 3 && fields[2] == "HTTP/1.1";
+        keepAlive = http11 ? connection != "close" : connection == "keep-alive";
+        if (!keepAlive) closing = true; // close once the response has been sent
 
-                std::vector<uint8_t> buffer(response.begin(), response.end());
+        if (fields.size() >= 2 && fields[0] == "GET")
+        {
+            std::shared_ptr<const StatusSnapshot> snapshot = status.getSnapshot();
+            std::string contentType;
+            body.clear();
 
-                socket.send(buffer);
+            if (fields[1] == "/stats" || fields[1] == "/stats.html")
+            {
+                contentType = "text/html";
+                snapshot->getStats(body, ReportType::HTML);
             }
             else if (fields[1] == "/stats.txt")
             {
-                std::string info;
-                relay.getStats(info, ReportType::TEXT);
-
-                std::string response = "HTTP/1.1 200 OK\r\n"
-                    "Cache-Control: no-cache, no-store, must-revalidate\r\n"
-                    "Pragma: no-cache\r\n"
-                    "Expires: 0\r\n"
-                    "Content-Type: text/plain\r\n"
-                    "Content-Length: " + std::to_string(info.length()) + "\r\n"
-                    "\r\n" + info;
-
-                std::vector<uint8_t> buffer(response.begin(), response.end());
-
-                socket.send(buffer);
+                contentType = "text/plain";
+                snapshot->getStats(body, ReportType::TEXT);
             }
             else if (fields[1] == "/stats.json")
             {
-                std::string info;
-                relay.getStats(info, ReportType::JSON);
-
-                std::string response = "HTTP/1.1 200 OK\r\n"
-                    "Cache-Control: no-cache, no-store, must-revalidate\r\n"
-                    "Pragma: no-cache\r\n"
-                    "Expires: 0\r\n"
-                    "Content-Type: application/json\r\n"
-                    "Content-Length: " + std::to_string(info.length()) + "\r\n"
-                    "\r\n" + info;
+                contentType = "application/json";
+                snapshot->getStats(body, ReportType::JSON);
+            }
+            else if (fields[1] == "/metrics")
+            {
+                contentType = "text/plain; version=0.0.4";
+                snapshot->getMetrics(body);
+            }
+            else if (fields[1] == "/stats/events")
+            {
+                subscribe();
+                return true;
+            }
+            else
+            {
+                sendError();
+                return true;
+            }
 
-                std::vector<uint8_t> buffer(response.begin(), response.end());
+            // the ETag only changes with the rendered content, not with every snapshot
+            std::string etag = "\"" + std::to_string(body.size()) + "-" + std::to_string(hashString(body)) + "\"";
+            std::string ifNoneMatch;
 
-                socket.send(buffer);
+            if (getHeader("If-None-Match", ifNoneMatch) &&
+                (ifNoneMatch == "*" || ifNoneMatch.find(etag) != std::string::npos))
+            {
+                body.clear();
+                sendNotModified(etag);
             }
             else
             {
-                sendError();
+                chunked = http11 && body.size() > CHUNK_SIZE;
+                sendResponse(contentType, etag);
             }
         }
         else
         {
             sendError();
         }
+
+        return true;
+    }
+
+    void StatusSender::sendResponse(const std::string& contentType, const std::string& etag)
+    {
+        std::string response = "HTTP/1.1 200 OK\r\n"
+            "Cache-Control: no-cache, no-store, must-revalidate\r\n"
+            "Pragma: no-cache\r\n"
+            "Expires: 0\r\n"
+            "ETag: " + etag + "\r\n"
+            "Content-Type: " + contentType + "\r\n";
+
+        if (chunked)
+        {
+            response += "Transfer-Encoding: chunked\r\n";
+        }
+        else
+        {
+            response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+        }
+
+        response += keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+        response += "\r\n";
+
+        std::vector<uint8_t> buffer(response.begin(), response.end());
+
+        socket.send(buffer);
+
+        bodyOffset = 0;
+        sendBody();
+    }
+
+    void StatusSender::sendNotModified(const std::string& etag)
+    {
+        std::string response = "HTTP/1.1 304 Not Modified\r\n"
+            "ETag: " + etag + "\r\n" +
+            (keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n") +
+            "\r\n";
+
+        std::vector<uint8_t> buffer(response.begin(), response.end());
+
+        socket.send(buffer);
+    }
+
+    void StatusSender::subscribe()
+    {
+        std::string response = "HTTP/1.1 200 OK\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Content-Type: text/event-stream\r\n"
+            "\r\n";
+
+        // the full state first, followed by changes only
+        std::string info;
+        status.getSnapshot()->getStats(info, ReportType::JSON);
+        Status::encodeEvent(response, "snapshot", info);
+
+        socket.send(std::vector<uint8_t>(response.begin(), response.end()));
+
+        // the stream lasts until the client disconnects
+        closing = false;
+        subscribed = true;
+        status.addSubscriber();
+    }
+
+    void StatusSender::sendEvents(const std::string& events)
+    {
+        if (!subscribed || !socket.isReady()) return;
+
+        if (socket.getOutDataSize() > MAX_SUBSCRIBER_QUEUED_SIZE)
+        {
+            RELAY_LOG(Log::Level::WARN) << "Status event subscriber too slow, disconnecting";
+            socket.close(true);
+            return;
+        }
+
+        socket.send(std::vector<uint8_t>(events.begin(), events.end()));
+        timeSinceActivity = 0.0f;
     }
 
     void StatusSender::sendError()
     {
         std::string response = "HTTP/1.1 404 Not Found\r\n"
             "Last-modified: Fri, 09 Aug 1996 14:21:40 GMT\r\n"
+            "Content-Length: 0\r\n" +
+            std::string(keepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n") +
             "\r\n";
 
         std::vector<uint8_t> buffer(response.begin(), response.end());
 
         socket.send(buffer);
     }
+
+    void StatusSender::sendBody()
+    {
+        while (bodyOffset < body.size() && socket.getOutDataSize() < MAX_QUEUED_SIZE)
+        {
+            size_t size = std::min(CHUNK_SIZE, body.size() - bodyOffset);
+
+            std::vector<uint8_t> buffer;
+
+            if (chunked)
+            {
+                std::stringstream ss;
+                ss << std::hex << size << "\r\n";
+                std::string chunkHeader = ss.str();
+                buffer.insert(buffer.end(), chunkHeader.begin(), chunkHeader.end());
+            }
+
+            buffer.insert(buffer.end(), body.begin() + static_cast<std::string::difference_type>(bodyOffset),
+                          body.begin() + static_cast<std::string::difference_type>(bodyOffset + size));
+            bodyOffset += size;
+
+            if (chunked)
+            {
+                const char* chunkEnd = (bodyOffset == body.size()) ? "\r\n0\r\n\r\n" : "\r\n";
+                buffer.insert(buffer.end(), chunkEnd, chunkEnd + strlen(chunkEnd));
+            }
+
+            socket.send(buffer);
+            timeSinceActivity = 0.0f;
+        }
+
+        if (bodyOffset >= body.size())
+        {
+            body.clear();
+            bodyOffset = 0;
+        }
+    }
+
+    bool StatusSender::getHeader(const std::string& name, std::string& value) const
+    {
+        std::string lowerName = toLower(name);
+
+        for (const std::string& header : headers)
+        {
+            size_t i = header.find(':');
+
+            if (i != std::string::npos && toLower(header.substr(0, i)) == lowerName)
+            {
+                size_t start = header.find_first_not_of(" \t", i + 1);
+                value = (start == std::string::npos) ? std::string() : header.substr(start);
+                return true;
+            }
+        }
+
+        return false;
+    }
 }
@@ -8,36 +8,61 @@
 
 namespace relay
 {
-    class Relay;
+    class Status;
 
     class StatusSender
     {
     public:
         StatusSender(Network& aNetwork,
                      Socket& aSocket,
-                     Relay& aRelay);
+                     Status& aStatus);
+
+        ~StatusSender();
 
         StatusSender(const StatusSender&) = delete;
         StatusSender(StatusSender&&) = delete;
         StatusSender& operator=(const StatusSender&) = delete;
         StatusSender& operator=(StatusSender&&) = delete;
 
+        void update(float delta);
+        // forwards encoded server-sent events if the client has subscribed to them
+        void sendEvents(const std::string& events);
+
         bool isConnected() const { return socket.isReady(); }
-        
+
     private:
         void handleRead(Socket& clientSocket, const std::vector<uint8_t>& newData);
         void handleClose(Socket& clientSocket);
 
-        void sendReport();
+        // handles buffered requests one at a time, the next one only after the previous response has been queued
+        void processRequests();
+        // returns false if the request has to wait for a current snapshot
+        bool handleRequest();
+        void sendResponse(const std::string& contentType, const std::string& etag);
+        void sendNotModified(const std::string& etag);
+        void subscribe();
         void sendError();
+        // queues the rest of the response body while the socket keeps up
+        void sendBody();
+
+        bool getHeader(const std::string& name, std::string& value) const;
 
         Network& network;
         Socket socket;
-        Relay& relay;
+        Status& status;
 
         std::vector<uint8_t> data;
 
         std::string startLine;
         std::vector<std::string> headers;
+
+        std::string body;
+        size_t bodyOffset = 0;
+        bool chunked = false;
+        bool keepAlive = true;
+        bool closing = false;
+        bool subscribed = false;
+        bool requestReceived = false; // startLine and headers hold a whole request that has not been handled yet
+        float timeSinceActivity = 0.0f;
     };
 }
@@ -0,0 +1,795 @@
+//
+//  rtmp_relay
+//
+
+#include <sstream>
+#include <iomanip>
+#include "StatusSnapshot.hpp"
+#include "Utils.hpp"
+
+namespace relay
+{
+    const char* getTypeString(Connection::Type type)
+    {
+        switch (type)
+        {
+            case Connection::Type::HOST: return "HOST";
+            case Connection::Type::CLIENT: return "CLIENT";
+        }
+
+        return "";
+    }
+
+    const char* getStateString(Connection::State state)
+    {
+        switch (state)
+        {
+            case Connection::State::UNINITIALIZED: return "UNINITIALIZED";
+            case Connection::State::VERSION_RECEIVED: return "VERSION_RECEIVED";
+            case Connection::State::VERSION_SENT: return "VERSION_SENT";
+            case Connection::State::ACK_SENT: return "ACK_SENT";
+            case Connection::State::HANDSHAKE_DONE: return "HANDSHAKE_DONE";
+        }
+
+        return "";
+    }
+
+    const char* getDirectionString(Connection::Direction direction)
+    {
+        switch (direction)
+        {
+            case Connection::Direction::NONE: return "NONE";
+            case Connection::Direction::INPUT: return "INPUT";
+            case Connection::Direction::OUTPUT: return "OUTPUT";
+        }
+
+        return "";
+    }
+
+    static std::string getLatencyText(const LatencySummary& latency)
+    {
+        return "latency p50/p99/p999/max: " + std::to_string(latency.p50) + "/" +
+            std::to_string(latency.p99) + "/" +
+            std::to_string(latency.p999) + "/" +
+            std::to_string(latency.max) + " us";
+    }
+
+    static std::string getLatencyJson(const LatencySummary& latency)
+    {
+        return "{\"count\":" + std::to_string(latency.count) +
+            ",\"p50\":" + std::to_string(latency.p50) +
+            ",\"p99\":" + std::to_string(latency.p99) +
+            ",\"p999\":" + std::to_string(latency.p999) +
+            ",\"max\":" + std::to_string(latency.max) + "}";
+    }
+
+    static std::string getProbeText(const StreamStatus& stream)
+    {
+        return "probe from " + stream.probeRelay + " " + getLatencyText(stream.probeLatency) +
+            ", from origin " + stream.probeOrigin + " " + std::to_string(stream.probeOriginLatency) +
+            " us over " + std::to_string(stream.probeHops) + " hops";
+    }
+
+    static std::string getProbeJson(const StreamStatus& stream)
+    {
+        return "{\"relay\":\"" + stream.probeRelay + "\"" +
+            ",\"latency\":" + getLatencyJson(stream.probeLatency) +
+            ",\"origin\":\"" + stream.probeOrigin + "\"" +
+            ",\"originLatency\":" + std::to_string(stream.probeOriginLatency) +
+            ",\"hops\":" + std::to_string(stream.probeHops) + "}";
+    }
+
+    static std::string getMediaText(const MediaSummary& media)
+    {
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(2) << "fps " << media.frameRate <<
+            ", GOP " << media.gopLength << " frames/" << media.keyFrameInterval << " ms" <<
+            ", bitrate audio/video: " << static_cast<uint64_t>(media.audioBitrate / 1000.0) << "/" <<
+            static_cast<uint64_t>(media.videoBitrate / 1000.0) << " kbit/s" <<
+            ", A/V drift: " << media.drift << " ms" <<
+            ", discontinuities: " << media.discontinuities;
+        return ss.str();
+    }
+
+    static std::string getMediaJson(const MediaSummary& media)
+    {
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(2) << "{\"frameRate\":" << media.frameRate <<
+            ",\"gopLength\":" << media.gopLength <<
+            ",\"keyFrameInterval\":" << media.keyFrameInterval <<
+            ",\"audioBitrate\":" << static_cast<uint64_t>(media.audioBitrate) <<
+            ",\"videoBitrate\":" << static_cast<uint64_t>(media.videoBitrate) <<
+            ",\"drift\":" << media.drift <<
+            ",\"discontinuities\":" << media.discontinuities << "}";
+        return ss.str();
+    }
+
+    static bool hasMetaData(const ConnectionStatus& connection)
+    {
+        return connection.metaData.getType() == amf::Node::Type::Dictionary ||
+            connection.metaData.getType() == amf::Node::Type::Object;
+    }
+
+    static void getConnectionStats(const ConnectionStatus& connection, std::string& str, ReportType reportType)
+    {
+        switch (reportType)
+        {
+            case ReportType::TEXT:
+            {
+                std::stringstream ss;
+
+                ss
+                << std::setw(8) << " "
+                << std::setw(5) << connection.id << " "
+                << std::setw(20) << connection.applicationName << " "
+                << std::setw(20) << connection.streamName << " "
+                << std::setw(15) << (connection.connected ? "connected" : "not connected") << " "
+                << std::setw(22) << connection.address << " "
+                << std::setw(7) << getTypeString(connection.type) << " "
+                << std::setw(20) << getStateString(connection.state) << " "
+                << std::setw(10) << getDirectionString(connection.direction) << " "
+                << std::setw(6) << (connection.hasServer ? std::to_string(connection.serverId) : "") << " ";
+
+                if (hasMetaData(connection))
+                {
+                    bool first = true;
+
+                    for (const auto& value : connection.metaData.asMap())
+                    {
+                        if (!first) ss << ", ";
+                        first = false;
+                        ss << value.first + " = " + value.second.toString();
+                    }
+                }
+
+                str += ss.str();
+                str += "\n";
+                break;
+            }
+            case ReportType::HTML:
+            {
+                str += "<tr><td>" + std::to_string(connection.id) + "</td><td>" + connection.streamName + "</td>" +
+                    "<td>" + connection.applicationName + "</td>" +
+                    "<td>" + (connection.connected ? "Connected" : "Not connected") + "</td><td>" + connection.address + "</td>" +
+                    "<td>" + getTypeString(connection.type) + "</td>" +
+                    "<td>" + getStateString(connection.state) + "</td>" +
+                    "<td>" + getDirectionString(connection.direction) + "</td>" +
+                    "<td>" + (connection.hasServer ? std::to_string(connection.serverId) : "") + "</td><td>";
+
+                if (hasMetaData(connection))
+                {
+                    bool first = true;
+
+                    for (const auto& value : connection.metaData.asMap())
+                    {
+                        if (!first) str += "<br/>";
+                        first = false;
+                        str += value.first + " = " + value.second.toString();
+                    }
+                }
+
+                str += "</td></tr>";
+                break;
+            }
+            case ReportType::JSON:
+            {
+                str += "{\"id\":" + std::to_string(connection.id) + "," +
+                    "\"name\":\"" + connection.streamName + "\","
+                    "\"application\":\"" + connection.applicationName + "\"," +
+                    "\"status\":" + (connection.connected ? "\"connected\"" : "\"not connected\"") + "," +
+                    "\"address\":\"" + connection.address + "\"," +
+                    "\"connection\":\"" + getTypeString(connection.type) + "\"," +
+                    "\"state\":\"" + getStateString(connection.state) + "\"," +
+                    "\"direction\":\"" + getDirectionString(connection.direction) + "\"";
+
+                if (connection.hasServer) str += ",\"serverId\":" + std::to_string(connection.serverId);
+
+                str += ",\"sendQueue\":" + std::to_string(connection.sendQueueSize);
+                str += ",\"inputBuffer\":" + std::to_string(connection.inputBufferSize);
+                str += ",\"arena\":" + std::to_string(connection.arenaSize);
+
+                if (connection.latency.count) str += ",\"latency\":" + getLatencyJson(connection.latency);
+
+                if (connection.socketStats.valid)
+                {
+                    const SocketStats& socketStats = connection.socketStats;
+
+                    str += ",\"tcp\":{\"rtt\":" + std::to_string(socketStats.rtt) + "," +
+                        "\"rttVariance\":" + std::to_string(socketStats.rttVariance) + "," +
+                        "\"congestionWindow\":" + std::to_string(socketStats.congestionWindow) + "," +
+                        "\"retransmits\":" + std::to_string(socketStats.retransmits) + "," +
+                        "\"deliveryRate\":" + std::to_string(socketStats.deliveryRate) + "," +
+                        "\"kernelOutQueue\":" + std::to_string(socketStats.kernelOutQueue) + "," +
+                        "\"kernelInQueue\":" + std::to_string(socketStats.kernelInQueue) + "}";
+                }
+
+                if (hasMetaData(connection))
+                {
+                    str += ",\"metaData\":{";
+                    bool first = true;
+
+                    for (const auto& value : connection.metaData.asMap())
+                    {
+                        if (!first) str += ", ";
+                        first = false;
+                        if (value.second.getType() == amf::Node::Type::Boolean)
+                        {
+                            str += "\"" + escapeString(value.first) + "\":" + (value.second.asBool() ? "true" : "false");
+                        }
+                        else if (value.second.isNumber())
+                        {
+                            str += "\"" + escapeString(value.first) + "\":" + value.second.toString();
+                        }
+                        else
+                        {
+                            str += "\"" + escapeString(value.first) + "\":\"" + escapeString(value.second.toString()) + "\"";
+                        }
+                    }
+
+                    str += "}";
+                }
+
+                str += "}";
+                break;
+            }
+        }
+    }
+
+    void StatusSnapshot::getStats(std::string& str, ReportType reportType) const
+    {
+        switch (reportType)
+        {
+            case ReportType::TEXT:
+            {
+                std::stringstream ss;
+
+                ss
+                << std::setw(8) << " "
+                << std::setw(5) << "ID" << " "
+                << std::setw(20) << "Application" << " "
+                << std::setw(20) << "Stream name" << " "
+
+                << std::setw(15) << "Status" << " "
+                << std::setw(22) << "Address" << " "
+                << std::setw(7) << "Type" << " "
+                << std::setw(20) << "State" << " "
+                << std::setw(10) << "Direction" << " "
+
+                << std::setw(6) << "Server" << " " << " Metadata\n";
+
+                auto header = ss.str();
+
+                str = "Pending connections:\n";
+                for (const ConnectionStatus& connection : pendingConnections)
+                {
+                    getConnectionStats(connection, str, reportType);
+                }
+
+                str += "\nStreams:\n";
+                for (const StreamStatus& stream : streams)
+                {
+                    str += "    Stream[" + std::to_string(stream.id) + "]: " + stream.applicationName + "/" + stream.streamName;
+                    if (stream.counters.inMessages) str += ", " + getMediaText(stream.media);
+                    if (stream.latency.count) str += ", " + getLatencyText(stream.latency);
+                    if (stream.probeLatency.count) str += ", " + getProbeText(stream);
+                    str += "\n";
+                    str += header;
+
+                    for (const ConnectionStatus& connection : stream.connections)
+                    {
+                        getConnectionStats(connection, str, reportType);
+                    }
+                }
+
+                str += "\nEvent loop: iterations: " + std::to_string(loopCounters.iterations) +
+                    ", iteration " + getLatencyText(iterationTime) +
+                    ", ready sockets: " + std::to_string(loopCounters.readySockets) + " total, " + std::to_string(loopCounters.maxReadySockets) + " max" +
+                    ", slow callbacks: " + std::to_string(loopCounters.slowCallbacks) + "\n";
+                str += "Event loop time (ms): network: " + std::to_string(loopCounters.networkTime / 1000) +
+                    ", status: " + std::to_string(loopCounters.statusTime / 1000) +
+                    ", connections: " + std::to_string(loopCounters.connectionTime / 1000) +
+                    ", servers: " + std::to_string(loopCounters.serverTime / 1000) +
+                    ", sleep: " + std::to_string(loopCounters.sleepTime / 1000) + "\n";
+
+                str += "\nBuffer pool: hits: " + std::to_string(bufferPool.hitCount) +
+                    ", misses: " + std::to_string(bufferPool.missCount) +
+                    ", releases: " + std::to_string(bufferPool.releaseCount) +
+                    ", discards: " + std::to_string(bufferPool.discardCount) +
+                    ", cached bytes: " + std::to_string(bufferPool.cachedSize) + "\n";
+
+                str += "Memory (bytes): input buffers: " + std::to_string(memory.inputBuffers) +
+                    ", send queues: " + std::to_string(memory.sendQueues) +
+                    ", stream caches: " + std::to_string(memory.streamCaches) +
+                    ", buffer pool: " + std::to_string(memory.bufferPool) +
+                    ", arenas: " + std::to_string(memory.arenas) +
+                    ", total: " + std::to_string(memory.getTotal()) +
+                    ", budget: " + (memoryBudget ? std::to_string(memoryBudget) : "none") + "\n";
+
+                str += "Capacity: loop utilization: " + std::to_string(capacity.loopUtilization) +
+                    " (limit: " + (capacity.maxLoopUtilization > 0.0 ? std::to_string(capacity.maxLoopUtilization) : "none") + ")" +
+                    ", egress bytes/s: " + std::to_string(capacity.egressRate) +
+                    " (limit: " + (capacity.maxEgressRate ? std::to_string(capacity.maxEgressRate) : "none") + ")" +
+                    ", outputs per stream limit: " + (capacity.maxStreamOutputs ? std::to_string(capacity.maxStreamOutputs) : "none") + "\n";
+
+                break;
+            }
+            case ReportType::HTML:
+            {
+                auto header = "<table border=\"1\" cellspacing=\"0\" cellpadding=\"5\"><tr><th>ID</th><th>Name</th><th>Application</th><th>Status</th><th>Address</th><th>Connection</th><th>State</th><th>Direction</th><th>Server ID</th><th>Meta data</th></tr>";
+
+                str = "<html><title>Status</title><body>";
+
+                str += "<b>Pending connections</b>";
+                str += header;
+                for (const ConnectionStatus& connection : pendingConnections)
+                {
+                    getConnectionStats(connection, str, reportType);
+                }
+                str += "</table>";
+
+                str += "<b>Streams</b><br>";
+                for (const StreamStatus& stream : streams)
+                {
+                    str += "<b>Stream[" + std::to_string(stream.id) + "]: " + stream.applicationName + "/" + stream.streamName + "</b>";
+                    if (stream.counters.inMessages) str += " " + getMediaText(stream.media);
+                    if (stream.latency.count) str += " " + getLatencyText(stream.latency);
+                    if (stream.probeLatency.count) str += " " + getProbeText(stream);
+                    str += header;
+
+                    for (const ConnectionStatus& connection : stream.connections)
+                    {
+                        getConnectionStats(connection, str, reportType);
+                    }
+
+                    str += "</table>";
+                }
+
+                str += "<b>Event loop</b><br><table border=\"1\" cellspacing=\"0\" cellpadding=\"5\"><tr><th>Iterations</th><th>Iteration time</th><th>Ready sockets</th><th>Max ready sockets</th><th>Slow callbacks</th><th>Network ms</th><th>Status ms</th><th>Connections ms</th><th>Servers ms</th><th>Sleep ms</th></tr>";
+                str += "<tr><td>" + std::to_string(loopCounters.iterations) + "</td>" +
+                    "<td>" + getLatencyText(iterationTime) + "</td>" +
+                    "<td>" + std::to_string(loopCounters.readySockets) + "</td>" +
+                    "<td>" + std::to_string(loopCounters.maxReadySockets) + "</td>" +
+                    "<td>" + std::to_string(loopCounters.slowCallbacks) + "</td>" +
+                    "<td>" + std::to_string(loopCounters.networkTime / 1000) + "</td>" +
+                    "<td>" + std::to_string(loopCounters.statusTime / 1000) + "</td>" +
+                    "<td>" + std::to_string(loopCounters.connectionTime / 1000) + "</td>" +
+                    "<td>" + std::to_string(loopCounters.serverTime / 1000) + "</td>" +
+                    "<td>" + std::to_string(loopCounters.sleepTime / 1000) + "</td></tr></table>";
+
+                str += "<b>Buffer pool</b><br><table border=\"1\" cellspacing=\"0\" cellpadding=\"5\"><tr><th>Hits</th><th>Misses</th><th>Releases</th><th>Discards</th><th>Cached bytes</th></tr>";
+                str += "<tr><td>" + std::to_string(bufferPool.hitCount) + "</td>" +
+                    "<td>" + std::to_string(bufferPool.missCount) + "</td>" +
+                    "<td>" + std::to_string(bufferPool.releaseCount) + "</td>" +
+                    "<td>" + std::to_string(bufferPool.discardCount) + "</td>" +
+                    "<td>" + std::to_string(bufferPool.cachedSize) + "</td></tr></table>";
+
+                str += "<b>Memory (bytes)</b><br><table border=\"1\" cellspacing=\"0\" cellpadding=\"5\"><tr><th>Input buffers</th><th>Send queues</th><th>Stream caches</th><th>Buffer pool</th><th>Arenas</th><th>Total</th><th>Budget</th></tr>";
+                str += "<tr><td>" + std::to_string(memory.inputBuffers) + "</td>" +
+                    "<td>" + std::to_string(memory.sendQueues) + "</td>" +
+                    "<td>" + std::to_string(memory.streamCaches) + "</td>" +
+                    "<td>" + std::to_string(memory.bufferPool) + "</td>" +
+                    "<td>" + std::to_string(memory.arenas) + "</td>" +
+                    "<td>" + std::to_string(memory.getTotal()) + "</td>" +
+                    "<td>" + (memoryBudget ? std::to_string(memoryBudget) : "none") + "</td></tr></table>";
+
+                str += "<b>Capacity</b><br><table border=\"1\" cellspacing=\"0\" cellpadding=\"5\"><tr><th>Loop utilization</th><th>Limit</th><th>Egress bytes/s</th><th>Limit</th><th>Outputs per stream limit</th></tr>";
+                str += "<tr><td>" + std::to_string(capacity.loopUtilization) + "</td>" +
+                    "<td>" + (capacity.maxLoopUtilization > 0.0 ? std::to_string(capacity.maxLoopUtilization) : "none") + "</td>" +
+                    "<td>" + std::to_string(capacity.egressRate) + "</td>" +
+                    "<td>" + (capacity.maxEgressRate ? std::to_string(capacity.maxEgressRate) : "none") + "</td>" +
+                    "<td>" + (capacity.maxStreamOutputs ? std::to_string(capacity.maxStreamOutputs) : "none") + "</td></tr></table>";
+
+                str += "</body></html>";
+
+                break;
+            }
+            case ReportType::JSON:
+            {
+                bool first = true;
+                str = "{\"pending_connections\":[";
+                for (const ConnectionStatus& connection : pendingConnections)
+                {
+                    if (!first) str += ",";
+                    first = false;
+                    getConnectionStats(connection, str, reportType);
+                }
+                str += "], \"streams\":[";
+                bool firstStream = true;
+                for (const StreamStatus& stream : streams)
+                {
+                    if (!firstStream) str += ",";
+                    firstStream = false;
+                    str += "{\"id\": " + std::to_string(stream.id) + ", \"applicationName\":\"" + stream.applicationName + "\", \"streamName\":\"" + stream.streamName + "\", ";
+                    str += "\"media\":" + getMediaJson(stream.media) + ", ";
+                    str += "\"memory\":{\"cache\":" + std::to_string(stream.cacheSize) + ",\"total\":" + std::to_string(stream.memoryUsage) + "}, ";
+                    if (stream.latency.count) str += "\"latency\":" + getLatencyJson(stream.latency) + ", ";
+                    if (stream.probeLatency.count) str += "\"probe\":" + getProbeJson(stream) + ", ";
+                    str += "\"connections\": [";
+
+                    first = true;
+                    for (const ConnectionStatus& connection : stream.connections)
+                    {
+                        if (!first) str += ",";
+                        first = false;
+                        getConnectionStats(connection, str, reportType);
+                    }
+
+                    str += "]}";
+                }
+
+                str += "], \"loop\":{\"iterations\":" + std::to_string(loopCounters.iterations) +
+                    ",\"iteration\":" + getLatencyJson(iterationTime) +
+                    ",\"ready_sockets\":" + std::to_string(loopCounters.readySockets) +
+                    ",\"max_ready_sockets\":" + std::to_string(loopCounters.maxReadySockets) +
+                    ",\"slow_callbacks\":" + std::to_string(loopCounters.slowCallbacks) +
+                    ",\"phases\":{\"network\":" + std::to_string(loopCounters.networkTime) +
+                    ",\"status\":" + std::to_string(loopCounters.statusTime) +
+                    ",\"connections\":" + std::to_string(loopCounters.connectionTime) +
+                    ",\"servers\":" + std::to_string(loopCounters.serverTime) +
+                    ",\"sleep\":" + std::to_string(loopCounters.sleepTime) + "}}";
+
+                str += ", \"buffer_pool\":{\"hits\":" + std::to_string(bufferPool.hitCount) +
+                    ",\"misses\":" + std::to_string(bufferPool.missCount) +
+                    ",\"releases\":" + std::to_string(bufferPool.releaseCount) +
+                    ",\"discards\":" + std::to_string(bufferPool.discardCount) +
+                    ",\"cached_bytes\":" + std::to_string(bufferPool.cachedSize) + "}";
+
+                str += ", \"memory\":{\"input_buffers\":" + std::to_string(memory.inputBuffers) +
+                    ",\"send_queues\":" + std::to_string(memory.sendQueues) +
+                    ",\"stream_caches\":" + std::to_string(memory.streamCaches) +
+                    ",\"buffer_pool\":" + std::to_string(memory.bufferPool) +
+                    ",\"arenas\":" + std::to_string(memory.arenas) +
+                    ",\"total\":" + std::to_string(memory.getTotal()) +
+                    ",\"budget\":" + std::to_string(memoryBudget) + "}";
+
+                str += ", \"capacity\":{\"loop_utilization\":" + std::to_string(capacity.loopUtilization) +
+                    ",\"egress_rate\":" + std::to_string(capacity.egressRate) +
+                    ",\"max_loop_utilization\":" + std::to_string(capacity.maxLoopUtilization) +
+                    ",\"max_egress_rate\":" + std::to_string(capacity.maxEgressRate) +
+                    ",\"max_stream_outputs\":" + std::to_string(capacity.maxStreamOutputs) +
+                    ",\"rejections\":{\"loop_utilization\":" + std::to_string(relayCounters.loopRejections) +
+                    ",\"egress_rate\":" + std::to_string(relayCounters.egressRejections) +
+                    ",\"stream_outputs\":" + std::to_string(relayCounters.streamOutputRejections) + "}}}";
+
+                break;
+            }
+        }
+    }
+
+    template<class T>
+    static void writeTrafficMetrics(std::string& str, const std::string& prefix, const char* scope,
+                                    const std::vector<std::pair<std::string, const T*>>& entries)
+    {
+        struct Family
+        {
+            const char* name;
+            const char* help;
+            uint64_t TrafficCounters::* counter;
+        };
+
+        static const Family FAMILIES[] = {
+            {"_received_bytes_total", "Bytes received", &TrafficCounters::inBytes},
+            {"_sent_bytes_total", "Bytes sent", &TrafficCounters::outBytes},
+            {"_received_messages_total", "Messages received", &TrafficCounters::inMessages},
+            {"_sent_messages_total", "Messages sent", &TrafficCounters::outMessages},
+            {"_dropped_messages_total", "Video frames dropped because an output could not keep up", &TrafficCounters::droppedMessages}
+        };
+
+        for (const Family& family : FAMILIES)
+        {
+            std::string name = prefix + family.name;
+            writeMetricHeader(str, name, "counter", (std::string(family.help) + " per " + scope).c_str());
+
+            for (const auto& entry : entries)
+            {
+                writeMetric(str, name, entry.first, entry.second->counters.*family.counter);
+            }
+        }
+    }
+
+    template<class T>
+    static void writeLatencyMetrics(std::string& str, const std::string& name, const char* help,
+                                    const std::vector<std::pair<std::string, const T*>>& entries,
+                                    LatencySummary T::*summary = &T::latency)
+    {
+        writeMetricHeader(str, name, "summary", help);
+
+        for (const auto& entry : entries)
+        {
+            const LatencySummary& latency = entry.second->*summary;
+            if (!latency.count) continue;
+
+            const std::pair<const char*, uint64_t> quantiles[] = {
+                {"0.5", latency.p50},
+                {"0.99", latency.p99},
+                {"0.999", latency.p999}
+            };
+
+            for (const auto& quantile : quantiles)
+            {
+                std::string labels = entry.first;
+                appendMetricLabel(labels, "quantile", quantile.first);
+                writeMetric(str, name, labels, quantile.second);
+            }
+
+            writeMetric(str, name + "_sum", entry.first, latency.sum);
+            writeMetric(str, name + "_count", entry.first, latency.count);
+        }
+    }
+
+    static void writeSocketMetrics(std::string& str, const std::vector<std::pair<std::string, const ConnectionStatus*>>& entries)
+    {
+        struct Family
+        {
+            const char* name;
+            const char* type;
+            const char* help;
+            uint64_t (*value)(const SocketStats&);
+        };
+
+        static const Family FAMILIES[] = {
+            {"rtmp_relay_connection_tcp_rtt_microseconds", "gauge", "Smoothed TCP round trip time per connection",
+                [](const SocketStats& stats) -> uint64_t { return stats.rtt; }},
+            {"rtmp_relay_connection_tcp_rtt_variance_microseconds", "gauge", "TCP round trip time variance per connection",
+                [](const SocketStats& stats) -> uint64_t { return stats.rttVariance; }},
+            {"rtmp_relay_connection_tcp_congestion_window_segments", "gauge", "TCP congestion window per connection",
+                [](const SocketStats& stats) -> uint64_t { return stats.congestionWindow; }},
+            {"rtmp_relay_connection_tcp_retransmits_total", "counter", "Retransmitted TCP segments per connection",
+                [](const SocketStats& stats) -> uint64_t { return stats.retransmits; }},
+            {"rtmp_relay_connection_tcp_delivery_rate_bytes", "gauge", "TCP delivery rate estimate in bytes per second per connection",
+                [](const SocketStats& stats) -> uint64_t { return stats.deliveryRate; }},
+            {"rtmp_relay_connection_kernel_send_queue_bytes", "gauge", "Bytes in the kernel send queue not yet acknowledged per connection",
+                [](const SocketStats& stats) -> uint64_t { return stats.kernelOutQueue; }},
+            {"rtmp_relay_connection_kernel_receive_queue_bytes", "gauge", "Bytes in the kernel receive queue not yet read per connection",
+                [](const SocketStats& stats) -> uint64_t { return stats.kernelInQueue; }}
+        };
+
+        for (const Family& family : FAMILIES)
+        {
+            writeMetricHeader(str, family.name, family.type, family.help);
+
+            for (const auto& entry : entries)
+            {
+                // connections that have not been sampled yet are left out
+                if (entry.second->socketStats.valid)
+                {
+                    writeMetric(str, family.name, entry.first, family.value(entry.second->socketStats));
+                }
+            }
+        }
+    }
+
+    static void writeMediaMetrics(std::string& str, const std::vector<std::pair<std::string, const StreamStatus*>>& entries)
+    {
+        writeMetricHeader(str, "rtmp_relay_stream_frame_rate", "gauge", "Video frames per second from the timestamps per stream");
+        for (const auto& entry : entries)
+        {
+            writeRealMetric(str, "rtmp_relay_stream_frame_rate", entry.first, entry.second->media.frameRate);
+        }
+
+        writeMetricHeader(str, "rtmp_relay_stream_gop_frames", "gauge", "Video frames in the last group of pictures per stream");
+        for (const auto& entry : entries)
+        {
+            writeMetric(str, "rtmp_relay_stream_gop_frames", entry.first, entry.second->media.gopLength);
+        }
+
+        writeMetricHeader(str, "rtmp_relay_stream_keyframe_interval_milliseconds", "gauge", "Time between the last two key frames per stream");
+        for (const auto& entry : entries)
+        {
+            writeMetric(str, "rtmp_relay_stream_keyframe_interval_milliseconds", entry.first, entry.second->media.keyFrameInterval);
+        }
+
+        writeMetricHeader(str, "rtmp_relay_stream_bitrate_bits_per_second", "gauge", "Exponentially weighted moving average of the bitrate per stream");
+        for (const auto& entry : entries)
+        {
+            std::string labels = entry.first;
+            appendMetricLabel(labels, "track", "audio");
+            writeRealMetric(str, "rtmp_relay_stream_bitrate_bits_per_second", labels, entry.second->media.audioBitrate);
+
+            labels = entry.first;
+            appendMetricLabel(labels, "track", "video");
+            writeRealMetric(str, "rtmp_relay_stream_bitrate_bits_per_second", labels, entry.second->media.videoBitrate);
+        }
+
+        writeMetricHeader(str, "rtmp_relay_stream_av_drift_milliseconds", "gauge", "Difference between the last video and audio timestamps per stream");
+        for (const auto& entry : entries)
+        {
+            writeRealMetric(str, "rtmp_relay_stream_av_drift_milliseconds", entry.first, static_cast<double>(entry.second->media.drift));
+        }
+
+        writeMetricHeader(str, "rtmp_relay_stream_timestamp_discontinuities_total", "counter", "Timestamps that went backwards or jumped forward per stream");
+        for (const auto& entry : entries)
+        {
+            writeMetric(str, "rtmp_relay_stream_timestamp_discontinuities_total", entry.first, entry.second->media.discontinuities);
+        }
+    }
+
+    static std::string getConnectionLabels(const ConnectionStatus& connection)
+    {
+        std::string labels;
+        appendMetricLabel(labels, "id", std::to_string(connection.id));
+        if (connection.hasServer) appendMetricLabel(labels, "server", std::to_string(connection.serverId));
+        appendMetricLabel(labels, "type", (connection.type == Connection::Type::HOST) ? "host" : "client");
+        appendMetricLabel(labels, "direction", (connection.direction == Connection::Direction::INPUT) ? "input" :
+                          (connection.direction == Connection::Direction::OUTPUT) ? "output" : "none");
+        appendMetricLabel(labels, "application", connection.applicationName);
+        appendMetricLabel(labels, "stream", connection.streamName);
+
+        return labels;
+    }
+
+    void StatusSnapshot::getMetrics(std::string& str) const
+    {
+        std::vector<std::pair<std::string, const ServerStatus*>> serverEntries;
+        std::vector<std::pair<std::string, const StreamStatus*>> streamEntries;
+        std::vector<std::pair<std::string, const ConnectionStatus*>> connectionEntries;
+
+        serverEntries.reserve(servers.size());
+        streamEntries.reserve(streams.size());
+        connectionEntries.reserve(pendingConnections.size());
+
+        for (const ServerStatus& server : servers)
+        {
+            std::string labels;
+            appendMetricLabel(labels, "server", std::to_string(server.id));
+            serverEntries.push_back(std::make_pair(labels, &server));
+        }
+
+        for (const ConnectionStatus& connection : pendingConnections)
+        {
+            connectionEntries.push_back(std::make_pair(getConnectionLabels(connection), &connection));
+        }
+
+        for (const StreamStatus& stream : streams)
+        {
+            std::string labels;
+            appendMetricLabel(labels, "server", std::to_string(stream.serverId));
+            appendMetricLabel(labels, "id", std::to_string(stream.id));
+            appendMetricLabel(labels, "application", stream.applicationName);
+            appendMetricLabel(labels, "stream", stream.streamName);
+            streamEntries.push_back(std::make_pair(labels, &stream));
+
+            for (const ConnectionStatus& connection : stream.connections)
+            {
+                connectionEntries.push_back(std::make_pair(getConnectionLabels(connection), &connection));
+            }
+        }
+
+        str.reserve(str.size() + 1024 + (connectionEntries.size() + streamEntries.size()) * 1024);
+
+        writeMetricHeader(str, "rtmp_relay_accepted_connections_total", "counter", "Connections accepted from peers");
+        writeMetric(str, "rtmp_relay_accepted_connections_total", "", relayCounters.acceptedConnections);
+        writeMetricHeader(str, "rtmp_relay_client_connections_total", "counter", "Connections opened to other hosts");
+        writeMetric(str, "rtmp_relay_client_connections_total", "", relayCounters.clientConnections);
+        writeMetricHeader(str, "rtmp_relay_handshakes_total", "counter", "Completed RTMP handshakes");
+        writeMetric(str, "rtmp_relay_handshakes_total", "", relayCounters.completedHandshakes);
+        writeMetricHeader(str, "rtmp_relay_config_reloads_total", "counter", "Config reloads");
+        writeMetric(str, "rtmp_relay_config_reloads_total", "", relayCounters.configReloads);
+        writeMetricHeader(str, "rtmp_relay_config_reload_failures_total", "counter", "Config reloads that failed and kept the previous config");
+        writeMetric(str, "rtmp_relay_config_reload_failures_total", "", relayCounters.failedConfigReloads);
+        writeMetricHeader(str, "rtmp_relay_config_reload_microseconds", "gauge", "Duration of the last config reload");
+        writeMetric(str, "rtmp_relay_config_reload_microseconds", "", relayCounters.reloadTime);
+        writeMetricHeader(str, "rtmp_relay_upgrade_failures_total", "counter", "Binary upgrades that failed and kept this process running");
+        writeMetric(str, "rtmp_relay_upgrade_failures_total", "", relayCounters.failedUpgrades);
+        writeMetricHeader(str, "rtmp_relay_restored_connections_total", "counter", "Connections taken over from the previous process");
+        writeMetric(str, "rtmp_relay_restored_connections_total", "", relayCounters.restoredConnections);
+        writeMetricHeader(str, "rtmp_relay_connections", "gauge", "Open connections");
+        writeMetric(str, "rtmp_relay_connections", "", connectionEntries.size());
+
+        writeMetricHeader(str, "rtmp_relay_buffer_pool_hits_total", "counter", "Buffers reused from the pool");
+        writeMetric(str, "rtmp_relay_buffer_pool_hits_total", "", bufferPool.hitCount);
+        writeMetricHeader(str, "rtmp_relay_buffer_pool_misses_total", "counter", "Buffers allocated because the pool had none");
+        writeMetric(str, "rtmp_relay_buffer_pool_misses_total", "", bufferPool.missCount);
+        writeMetricHeader(str, "rtmp_relay_buffer_pool_cached_bytes", "gauge", "Bytes held by the buffer pool");
+        writeMetric(str, "rtmp_relay_buffer_pool_cached_bytes", "", bufferPool.cachedSize);
+
+        writeMetricHeader(str, "rtmp_relay_memory_bytes", "gauge", "Bytes held by each subsystem");
+        writeMetric(str, "rtmp_relay_memory_bytes", "subsystem=\"input_buffers\"", memory.inputBuffers);
+        writeMetric(str, "rtmp_relay_memory_bytes", "subsystem=\"send_queues\"", memory.sendQueues);
+        writeMetric(str, "rtmp_relay_memory_bytes", "subsystem=\"stream_caches\"", memory.streamCaches);
+        writeMetric(str, "rtmp_relay_memory_bytes", "subsystem=\"buffer_pool\"", memory.bufferPool);
+        writeMetric(str, "rtmp_relay_memory_bytes", "subsystem=\"arenas\"", memory.arenas);
+        writeMetricHeader(str, "rtmp_relay_memory_budget_bytes", "gauge", "Memory budget above which new publishers and players are refused, 0 if unlimited");
+        writeMetric(str, "rtmp_relay_memory_budget_bytes", "", memoryBudget);
+        writeMetricHeader(str, "rtmp_relay_memory_rejections_total", "counter", "Publishers and players refused because the memory budget was exceeded");
+        writeMetric(str, "rtmp_relay_memory_rejections_total", "", relayCounters.memoryRejections);
+        writeMetricHeader(str, "rtmp_relay_oversized_messages_total", "counter", "Connections closed for announcing a message larger than the limit");
+        writeMetric(str, "rtmp_relay_oversized_messages_total", "", relayCounters.oversizedMessages);
+        writeMetricHeader(str, "rtmp_relay_send_queue_overflows_total", "counter", "Connections closed because their send queue exceeded the limit");
+        writeMetric(str, "rtmp_relay_send_queue_overflows_total", "", relayCounters.sendQueueOverflows);
+
+        writeMetricHeader(str, "rtmp_relay_sent_bytes_total", "counter", "Bytes sent to all peers");
+        writeMetric(str, "rtmp_relay_sent_bytes_total", "", relayCounters.sentBytes);
+        writeMetricHeader(str, "rtmp_relay_egress_bytes_per_second", "gauge", "Bytes sent to all peers in the last second");
+        writeMetric(str, "rtmp_relay_egress_bytes_per_second", "", capacity.egressRate);
+        writeMetricHeader(str, "rtmp_relay_loop_utilization", "gauge", "Fraction of the last second the event loop was busy");
+        writeRealMetric(str, "rtmp_relay_loop_utilization", "", capacity.loopUtilization);
+        writeMetricHeader(str, "rtmp_relay_admission_max_loop_utilization", "gauge", "Loop utilization above which new players are refused, 0 if unlimited");
+        writeRealMetric(str, "rtmp_relay_admission_max_loop_utilization", "", capacity.maxLoopUtilization);
+        writeMetricHeader(str, "rtmp_relay_admission_max_egress_bytes_per_second", "gauge", "Egress rate above which new players are refused, 0 if unlimited");
+        writeMetric(str, "rtmp_relay_admission_max_egress_bytes_per_second", "", capacity.maxEgressRate);
+        writeMetricHeader(str, "rtmp_relay_admission_max_stream_outputs", "gauge", "Outputs per stream above which new players are refused, 0 if unlimited");
+        writeMetric(str, "rtmp_relay_admission_max_stream_outputs", "", capacity.maxStreamOutputs);
+        writeMetricHeader(str, "rtmp_relay_admission_rejections_total", "counter", "Players refused because a capacity limit was reached");
+        writeMetric(str, "rtmp_relay_admission_rejections_total", "reason=\"loop_utilization\"", relayCounters.loopRejections);
+        writeMetric(str, "rtmp_relay_admission_rejections_total", "reason=\"egress_rate\"", relayCounters.egressRejections);
+        writeMetric(str, "rtmp_relay_admission_rejections_total", "reason=\"stream_outputs\"", relayCounters.streamOutputRejections);
+
+        writeMetricHeader(str, "rtmp_relay_loop_iterations_total", "counter", "Event loop iterations");
+        writeMetric(str, "rtmp_relay_loop_iterations_total", "", loopCounters.iterations);
+        writeMetricHeader(str, "rtmp_relay_loop_phase_microseconds_total", "counter", "Time spent in each phase of the event loop");
+        writeMetric(str, "rtmp_relay_loop_phase_microseconds_total", "phase=\"network\"", loopCounters.networkTime);
+        writeMetric(str, "rtmp_relay_loop_phase_microseconds_total", "phase=\"status\"", loopCounters.statusTime);
+        writeMetric(str, "rtmp_relay_loop_phase_microseconds_total", "phase=\"connections\"", loopCounters.connectionTime);
+        writeMetric(str, "rtmp_relay_loop_phase_microseconds_total", "phase=\"servers\"", loopCounters.serverTime);
+        writeMetric(str, "rtmp_relay_loop_phase_microseconds_total", "phase=\"sleep\"", loopCounters.sleepTime);
+        writeMetricHeader(str, "rtmp_relay_loop_ready_sockets_total", "counter", "Sockets ready to read, summed over event loop iterations");
+        writeMetric(str, "rtmp_relay_loop_ready_sockets_total", "", loopCounters.readySockets);
+        writeMetricHeader(str, "rtmp_relay_loop_max_ready_sockets", "gauge", "Most sockets ready to read in one event loop iteration");
+        writeMetric(str, "rtmp_relay_loop_max_ready_sockets", "", loopCounters.maxReadySockets);
+        writeMetricHeader(str, "rtmp_relay_loop_slow_callbacks_total", "counter", "Connection callbacks that blocked the event loop for more than 10 ms");
+        writeMetric(str, "rtmp_relay_loop_slow_callbacks_total", "", loopCounters.slowCallbacks);
+
+        const std::string iterationName = "rtmp_relay_loop_iteration_microseconds";
+        writeMetricHeader(str, iterationName, "summary", "Duration of event loop iterations without the sleep");
+        writeMetric(str, iterationName, "quantile=\"0.5\"", iterationTime.p50);
+        writeMetric(str, iterationName, "quantile=\"0.99\"", iterationTime.p99);
+        writeMetric(str, iterationName, "quantile=\"0.999\"", iterationTime.p999);
+        writeMetric(str, iterationName + "_sum", "", iterationTime.sum);
+        writeMetric(str, iterationName + "_count", "", iterationTime.count);
+
+        writeTrafficMetrics(str, "rtmp_relay_server", "server", serverEntries);
+
+        writeMetricHeader(str, "rtmp_relay_stream_outputs", "gauge", "Output connections per stream");
+        for (const auto& entry : streamEntries)
+        {
+            writeMetric(str, "rtmp_relay_stream_outputs", entry.first, entry.second->outputConnectionCount);
+        }
+
+        writeMetricHeader(str, "rtmp_relay_stream_memory_bytes", "gauge", "Bytes held by the cache and the connections per stream");
+        for (const auto& entry : streamEntries)
+        {
+            writeMetric(str, "rtmp_relay_stream_memory_bytes", entry.first, entry.second->memoryUsage);
+        }
+
+        writeTrafficMetrics(str, "rtmp_relay_stream", "stream", streamEntries);
+        writeMediaMetrics(str, streamEntries);
+        writeLatencyMetrics(str, "rtmp_relay_stream_latency_microseconds", "Time from receiving a frame to handing it to the kernel for each output per stream", streamEntries);
+        writeLatencyMetrics(str, "rtmp_relay_stream_probe_latency_microseconds", "One-way latency of probes from the previous relay per stream", streamEntries, &StreamStatus::probeLatency);
+
+        writeMetricHeader(str, "rtmp_relay_stream_probe_origin_latency_microseconds", "gauge", "One-way latency of the last probe from the origin relay per stream");
+        for (const auto& entry : streamEntries)
+        {
+            if (!entry.second->probeLatency.count) continue;
+
+            std::string labels = entry.first;
+            appendMetricLabel(labels, "origin", entry.second->probeOrigin);
+            writeMetric(str, "rtmp_relay_stream_probe_origin_latency_microseconds", labels, entry.second->probeOriginLatency);
+        }
+
+        writeMetricHeader(str, "rtmp_relay_stream_probe_hops", "gauge", "Relays the last probe passed through per stream");
+        for (const auto& entry : streamEntries)
+        {
+            if (!entry.second->probeLatency.count) continue;
+
+            writeMetric(str, "rtmp_relay_stream_probe_hops", entry.first, entry.second->probeHops);
+        }
+
+        writeMetricHeader(str, "rtmp_relay_connection_send_queue_bytes", "gauge", "Bytes waiting in the socket send queue per connection");
+        for (const auto& entry : connectionEntries)
+        {
+            writeMetric(str, "rtmp_relay_connection_send_queue_bytes", entry.first, entry.second->sendQueueSize);
+        }
+
+        writeMetricHeader(str, "rtmp_relay_connection_input_buffer_bytes", "gauge", "Bytes received but not yet decoded per connection");
+        for (const auto& entry : connectionEntries)
+        {
+            writeMetric(str, "rtmp_relay_connection_input_buffer_bytes", entry.first, entry.second->inputBufferSize);
+        }
+
+        writeSocketMetrics(str, connectionEntries);
+        writeLatencyMetrics(str, "rtmp_relay_connection_latency_microseconds", "Time from receiving a frame to handing it to the kernel per output connection", connectionEntries);
+
+        writeTrafficMetrics(str, "rtmp_relay_connection", "connection", connectionEntries);
+    }
+}
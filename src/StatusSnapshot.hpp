@@ -0,0 +1,115 @@
+//
+//  rtmp_relay
+//
+
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include "Amf.hpp"
+#include "Connection.hpp"
+#include "LatencyHistogram.hpp"
+#include "MediaAnalytics.hpp"
+#include "Metrics.hpp"
+#include "Status.hpp"
+
+namespace relay
+{
+    const char* getTypeString(Connection::Type type);
+    const char* getStateString(Connection::State state);
+    const char* getDirectionString(Connection::Direction direction);
+
+    struct ConnectionStatus
+    {
+        uint64_t id = 0;
+        std::string applicationName;
+        std::string streamName;
+        bool connected = false;
+        std::string address;
+        Connection::Type type = Connection::Type::HOST;
+        Connection::State state = Connection::State::UNINITIALIZED;
+        Connection::Direction direction = Connection::Direction::NONE;
+        bool hasServer = false;
+        uint64_t serverId = 0;
+        amf::Node metaData;
+
+        TrafficCounters counters;
+        uint64_t sendQueueSize = 0;
+        uint64_t inputBufferSize = 0;
+        uint64_t arenaSize = 0;
+        SocketStats socketStats;
+        LatencySummary latency;
+    };
+
+    struct StreamStatus
+    {
+        uint64_t id = 0;
+        uint64_t serverId = 0;
+        std::string applicationName;
+        std::string streamName;
+        uint64_t outputConnectionCount = 0;
+        TrafficCounters counters;
+        LatencySummary latency;
+        MediaSummary media;
+        uint64_t cacheSize = 0; // headers and meta data
+        uint64_t memoryUsage = 0; // cache and the buffers of the stream's connections
+
+        // latency probes received from other relays
+        LatencySummary probeLatency;
+        std::string probeOrigin;
+        std::string probeRelay;
+        uint64_t probeOriginLatency = 0;
+        uint32_t probeHops = 0;
+
+        std::vector<ConnectionStatus> connections; // input connection first
+    };
+
+    struct ServerStatus
+    {
+        uint64_t id = 0;
+        TrafficCounters counters;
+    };
+
+    struct BufferPoolStatus
+    {
+        uint64_t hitCount = 0;
+        uint64_t missCount = 0;
+        uint64_t releaseCount = 0;
+        uint64_t discardCount = 0;
+        uint64_t cachedSize = 0;
+    };
+
+    struct CapacityStatus
+    {
+        double loopUtilization = 0.0; // busy fraction of the event loop in the last second
+        uint64_t egressRate = 0; // bytes per second
+        double maxLoopUtilization = 0.0;
+        uint64_t maxEgressRate = 0;
+        uint32_t maxStreamOutputs = 0;
+    };
+
+    // copy of the relay state taken on the event loop, never modified after it is published
+    class StatusSnapshot
+    {
+    public:
+        void getStats(std::string& str, ReportType reportType) const;
+        // Prometheus text format
+        void getMetrics(std::string& str) const;
+
+        std::vector<ConnectionStatus> pendingConnections;
+        std::vector<StreamStatus> streams;
+        std::vector<ServerStatus> servers;
+
+        RelayCounters relayCounters;
+        LoopCounters loopCounters;
+        LatencySummary iterationTime;
+        BufferPoolStatus bufferPool;
+        MemoryUsage memory;
+        uint64_t memoryBudget = 0;
+        CapacityStatus capacity;
+
+        uint64_t generation = 0; // increased with every published snapshot, 0 until the first one
+        std::chrono::steady_clock::time_point time; // when the snapshot was taken
+    };
+}
@@ -3,13 +3,98 @@
 //
 
 #include <algorithm>
+#include <chrono>
 #include "Stream.hpp"
 #include "Connection.hpp"
 #include "Relay.hpp"
 #include "Server.hpp"
+#include "Endpoint.hpp"
+#include "StatusSnapshot.hpp"
+#include "Constants.hpp"
 
 namespace relay
 {
+    // endpoints with the same key receive the same meta data
+    static std::string getMetaDataFilterKey(const Endpoint& endpoint, amf::Version amfVersion)
+    {
+        std::string key;
+        key += (amfVersion == amf::Version::AMF3) ? '3' : '0';
+        key += endpoint.audioStream ? 'a' : '-';
+        key += endpoint.videoStream ? 'v' : '-';
+
+        for (const std::string& name : endpoint.metaDataBlacklist)
+        {
+            key += std::to_string(name.length()) + ":" + name;
+        }
+
+        return key;
+    }
+
+    static amf::Node filterMetaData(const amf::Node& metaData, const Endpoint& endpoint)
+    {
+        amf::Node result = amf::Node::Type::Dictionary;
+
+        for (const auto& value : metaData.asMap())
+        {
+            // not in the blacklist
+            if (endpoint.metaDataBlacklist.find(value.first) != endpoint.metaDataBlacklist.end()) continue;
+
+            // don't send audio meta data if audio stream is disabled
+            if (!endpoint.audioStream && (value.first == "audiocodecid" ||
+                                          value.first == "audiodatarate")) continue;
+
+            // don't send video meta data if video stream is disabled
+            if (!endpoint.videoStream && (value.first == "fps" ||
+                                          value.first == "framerate" ||
+                                          value.first == "gopsize" ||
+                                          value.first == "level" ||
+                                          value.first == "profile" ||
+                                          value.first == "videocodecid" ||
+                                          value.first == "videodatarate")) continue;
+
+            result[value.first] = value.second;
+        }
+
+        return result;
+    }
+
+    // milliseconds since the epoch, relays in a chain are expected to have synchronized clocks
+    static double getWallClockTime()
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    static uint64_t getProbeLatency(double currentTime, double time)
+    {
+        // clock skew between relays can make the latency negative
+        return (currentTime > time) ? static_cast<uint64_t>((currentTime - time) * 1000.0) : 0;
+    }
+
+    static void encodeMetaData(const amf::Node& metaData, amf::Version amfVersion, std::vector<uint8_t>& body)
+    {
+        if (amfVersion == amf::Version::AMF3)
+        {
+            body.push_back(0); // using AMF0
+        }
+
+        amf::Node commandName = std::string("@setDataFrame");
+        commandName.encode(amf::Version::AMF0, body);
+
+        amf::Node argument1 = std::string("onMetaData");
+        argument1.encode(amf::Version::AMF0, body);
+
+        if (amfVersion == amf::Version::AMF3)
+        {
+            // AMF3 sends repeated keys and values as references
+            body.push_back(static_cast<uint8_t>(amf::AMF0Marker::SwitchToAMF3));
+            metaData.encode(amf::Version::AMF3, body);
+        }
+        else
+        {
+            metaData.encode(amf::Version::AMF0, body);
+        }
+    }
+
     Stream::Stream(Server& aServer,
                    const std::string& aApplicationName,
                    const std::string& aStreamName):
@@ -20,33 +105,72 @@ namespace relay
     {
         idString = "[ST:" + std::to_string(id) + " " + applicationName + "/" + streamName + "] ";
 
-        Log(Log::Level::INFO) << idString << "Create";
+        RELAY_LOG(Log::Level::INFO) << idString << "Create";
     }
 
     Stream::~Stream()
     {
-        Log(Log::Level::INFO) << idString << "Delete";
+        server.getRelay().getMemoryTotals().streamCaches -= cacheSize;
+
+        RELAY_LOG(Log::Level::INFO) << idString << "Delete";
     }
 
-    void Stream::getStats(std::string& str, ReportType reportType) const
+    void Stream::getStatus(StreamStatus& status) const
     {
-        switch (reportType)
+        status.id = id;
+        status.serverId = server.getId();
+        status.applicationName = applicationName;
+        status.streamName = streamName;
+        status.outputConnectionCount = outputConnections.size();
+        status.counters = counters;
+        status.cacheSize = getCacheSize();
+        latencyHistogram.getSummary(status.latency);
+        mediaAnalytics.getSummary(status.media, std::chrono::steady_clock::now());
+        probeLatencyHistogram.getSummary(status.probeLatency);
+        status.probeOrigin = probeOrigin;
+        status.probeRelay = probeRelay;
+        status.probeOriginLatency = probeOriginLatency;
+        status.probeHops = probeHops;
+
+        std::vector<const Connection*> streamConnections;
+        if (inputConnection) streamConnections.push_back(inputConnection);
+
+        for (const std::vector<Connection*>* list : {&outputConnections, &connections})
         {
-            case ReportType::TEXT:
-            {
-                str += "    Stream[" + std::to_string(id) + "]: " + applicationName + "/" + streamName + "\n";
-                break;
-            }
-            case ReportType::HTML:
-            {
-                str += "<b>Stream[" + std::to_string(id) + "]: " + applicationName + "/" + streamName + "</b>";
-                break;
-            }
-            case ReportType::JSON:
+            for (const Connection* connection : *list)
             {
-                str += "{\"id\": " + std::to_string(id) + ", \"applicationName\":\"" + applicationName + "\", \"streamName\":\"" + streamName + "\", \"connections\": [";
+                if (std::find(streamConnections.begin(), streamConnections.end(), connection) == streamConnections.end())
+                {
+                    streamConnections.push_back(connection);
+                }
             }
         }
+
+        status.connections.resize(streamConnections.size());
+
+        status.memoryUsage = status.cacheSize;
+
+        for (size_t i = 0; i < streamConnections.size(); ++i)
+        {
+            streamConnections[i]->getStatus(status.connections[i]);
+            status.memoryUsage += status.connections[i].inputBufferSize + status.connections[i].sendQueueSize +
+                status.connections[i].arenaSize;
+        }
+    }
+
+    void Stream::updateCacheSize()
+    {
+        size_t size = audioHeader.size() + videoHeader.size();
+
+        for (const auto& i : filteredMetaData)
+        {
+            size += i.second.body.size();
+        }
+
+        MemoryUsage& memoryTotals = server.getRelay().getMemoryTotals();
+        memoryTotals.streamCaches += size;
+        memoryTotals.streamCaches -= cacheSize;
+        cacheSize = size;
     }
 
     bool Stream::hasDependableConnections()
@@ -79,13 +203,16 @@ namespace relay
     {
         if (closed) return;
 
-        Log() << idString << "Stream start " << connection.getIdString();
+        RELAY_LOG(Log::Level::INFO) << idString << "Stream start " << connection.getIdString();
+        if (Status* status = server.getRelay().getStatus()) status->publishStreamEvent(*this, connection, true);
+
         if (connection.getDirection() == Connection::Direction::INPUT)
         {
             if (!inputConnection)
             {
                 inputConnection = &connection;
             }
+            if (!streaming) mediaAnalytics = MediaAnalytics();
             streaming = true;
 
             for (const Endpoint& endpoint : server.getEndpoints())
@@ -132,12 +259,58 @@ namespace relay
 
                 if (!videoHeader.empty()) connection.sendVideoHeader(videoHeader);
                 if (!audioHeader.empty()) connection.sendAudioHeader(audioHeader);
-                if (metaData.getType() != amf::Node::Type::Unknown) connection.sendMetaData(metaData);
+                if (metaData.getType() != amf::Node::Type::Unknown) sendFilteredMetaData(connection);
             }
         }
         else
         {
-            Log(Log::Level::ERR) << "Stream start direction not set";
+            RELAY_LOG(Log::Level::ERR) << "Stream start direction not set";
+        }
+    }
+
+    void Stream::addEndpoint(const Endpoint& endpoint)
+    {
+        if (closed || !streaming) return;
+
+        if (endpoint.connectionType == Connection::Type::CLIENT &&
+            endpoint.direction == Connection::Direction::OUTPUT)
+        {
+            Connection* newConnection = server.createConnection(*this, endpoint);
+            newConnection->connect();
+
+            connections.push_back(newConnection);
+        }
+    }
+
+    void Stream::removeEndpoint(const Endpoint& endpoint)
+    {
+        if (closed) return;
+
+        // the stream can't continue without its input
+        if (inputConnection && inputConnection->getEndpoint() == &endpoint)
+        {
+            close();
+            return;
+        }
+
+        for (auto it = connections.begin(); it != connections.end();)
+        {
+            auto con = *it;
+            if (con->getEndpoint() == &endpoint)
+            {
+                it = connections.erase(it);
+
+                auto ci = std::find(outputConnections.begin(), outputConnections.end(), con);
+                if (ci != outputConnections.end()) outputConnections.erase(ci);
+
+                if (con->getDirection() == Connection::Direction::INPUT) inputConnectionCreated = false;
+
+                con->close(true);
+            }
+            else
+            {
+                it++;
+            }
         }
     }
 
@@ -145,7 +318,9 @@ namespace relay
     {
         if (closed) return;
 
-        Log() << idString << "Stream stop " << connection.getIdString();
+        RELAY_LOG(Log::Level::INFO) << idString << "Stream stop " << connection.getIdString();
+        if (Status* status = server.getRelay().getStatus()) status->publishStreamEvent(*this, connection, false);
+
         if (&connection == inputConnection)
         {
             streaming = false;
@@ -192,15 +367,30 @@ namespace relay
         }
     }
 
+    void Stream::restoreHeaders(const std::vector<uint8_t>& newAudioHeader,
+                                const std::vector<uint8_t>& newVideoHeader,
+                                const amf::Node& newMetaData)
+    {
+        audioHeader = newAudioHeader;
+        videoHeader = newVideoHeader;
+        metaData = newMetaData;
+        filteredMetaData.clear();
+        updateCacheSize();
+    }
+
     void Stream::sendAudioHeader(const std::vector<uint8_t>& headerData)
     {
         audioHeader = headerData;
+        updateCacheSize();
+
+        countInput(headerData.size());
 
         for (Connection* outputConnection : outputConnections)
         {
             if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
             {
                 outputConnection->sendAudioHeader(headerData);
+                countOutput(headerData.size());
             }
         }
     }
@@ -208,34 +398,57 @@ namespace relay
     void Stream::sendVideoHeader(const std::vector<uint8_t>& headerData)
     {
         videoHeader = headerData;
+        updateCacheSize();
+
+        countInput(headerData.size());
 
         for (Connection* outputConnection : outputConnections)
         {
             if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
             {
                 outputConnection->sendVideoHeader(headerData);
+                countOutput(headerData.size());
             }
         }
     }
 
-    void Stream::sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& audioData)
+    void Stream::sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& audioData, const std::chrono::steady_clock::time_point& receiveTime)
     {
+        countInput(audioData.size());
+        lastTimestamp = timestamp;
+        mediaAnalytics.addAudioFrame(timestamp, audioData.size(), receiveTime);
+
         for (Connection* outputConnection : outputConnections)
         {
             if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
             {
-                outputConnection->sendAudioFrame(timestamp, audioData);
+                outputConnection->sendAudioFrame(timestamp, audioData, receiveTime);
+                countOutput(audioData.size());
             }
         }
     }
 
-    void Stream::sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& videoData, VideoFrameType frameType)
+    void Stream::sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& videoData, VideoFrameType frameType, const std::chrono::steady_clock::time_point& receiveTime)
     {
+        countInput(videoData.size());
+        lastTimestamp = timestamp;
+        mediaAnalytics.addVideoFrame(timestamp, videoData.size(), frameType, receiveTime);
+
         for (Connection* outputConnection : outputConnections)
         {
             if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
             {
-                outputConnection->sendVideoFrame(timestamp, videoData, frameType);
+                uint64_t droppedMessages = outputConnection->getDroppedMessages();
+                outputConnection->sendVideoFrame(timestamp, videoData, frameType, receiveTime);
+
+                if (outputConnection->getDroppedMessages() != droppedMessages)
+                {
+                    countDrop();
+                }
+                else
+                {
+                    countOutput(videoData.size());
+                }
             }
         }
     }
@@ -243,38 +456,143 @@ namespace relay
     void Stream::sendMetaData(const amf::Node& newMetaData)
     {
         metaData = newMetaData;
+        filteredMetaData.clear();
+        updateCacheSize();
+        countInput(0);
 
         for (Connection* outputConnection : outputConnections)
         {
             if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
             {
-                outputConnection->sendMetaData(metaData);
+                sendFilteredMetaData(*outputConnection);
             }
         }
     }
 
-    void Stream::sendTextData(uint64_t timestamp, const amf::Node& textData)
+    void Stream::sendFilteredMetaData(Connection& connection)
+    {
+        if (metaData.getType() != amf::Node::Type::Dictionary &&
+            metaData.getType() != amf::Node::Type::Object) return;
+
+        const Endpoint* endpoint = connection.getEndpoint();
+        if (!endpoint) return;
+
+        std::string key = getMetaDataFilterKey(*endpoint, connection.getAMFVersion());
+        auto i = filteredMetaData.find(key);
+
+        if (i == filteredMetaData.end())
+        {
+            FilteredMetaData entry;
+            entry.metaData = filterMetaData(metaData, *endpoint);
+            encodeMetaData(entry.metaData, connection.getAMFVersion(), entry.body);
+
+            i = filteredMetaData.insert(std::make_pair(key, std::move(entry))).first;
+            updateCacheSize();
+        }
+
+        connection.sendMetaData(i->second.metaData, i->second.body);
+        countOutput(i->second.body.size());
+    }
+
+    void Stream::countInput(size_t size)
     {
+        ++counters.inMessages;
+        counters.inBytes += size;
+
+        TrafficCounters& serverCounters = server.getCounters();
+        ++serverCounters.inMessages;
+        serverCounters.inBytes += size;
+    }
+
+    void Stream::countOutput(size_t size)
+    {
+        ++counters.outMessages;
+        counters.outBytes += size;
+
+        TrafficCounters& serverCounters = server.getCounters();
+        ++serverCounters.outMessages;
+        serverCounters.outBytes += size;
+    }
+
+    void Stream::countDrop()
+    {
+        ++counters.droppedMessages;
+        ++server.getCounters().droppedMessages;
+    }
+
+    void Stream::sendTextData(uint64_t timestamp, const std::vector<uint8_t>& textData)
+    {
+        countInput(textData.size());
+
         for (Connection* outputConnection : outputConnections)
         {
             if (outputConnection->getDirection() == Connection::Direction::OUTPUT)
             {
                 outputConnection->sendTextData(timestamp, textData);
+                countOutput(textData.size());
             }
         }
     }
 
-    void Stream::getConnections(std::map<Connection*, Stream*>& cons)
+    void Stream::sendLatencyProbe()
     {
-        if (inputConnection) cons[inputConnection] = this;
+        forwardLatencyProbe(server.getRelay().getRelayId(), getWallClockTime(), 0);
+    }
 
-        for (const auto& c : outputConnections)
+    void Stream::receiveLatencyProbe(const amf::Node& probe)
+    {
+        if (!probe["origin"].isString() || !probe["originTime"].isNumber() ||
+            !probe["relay"].isString() || !probe["time"].isNumber() ||
+            !probe["hops"].isNumber())
         {
-            cons[c] = this;
+            RELAY_LOG(Log::Level::WARN) << idString << "Invalid latency probe";
+            return;
         }
-        for (const auto& c : connections)
+
+        double currentTime = getWallClockTime();
+        uint64_t latency = getProbeLatency(currentTime, probe["time"].asDouble());
+
+        probeLatencyHistogram.record(latency);
+        probeOrigin = probe["origin"].asString();
+        probeRelay = probe["relay"].asString();
+        probeOriginLatency = getProbeLatency(currentTime, probe["originTime"].asDouble());
+        probeHops = probe["hops"].asUInt32() + 1;
+
+        RELAY_LOG(Log::Level::ALL) << idString << "Latency probe from " << probeRelay << ": " << latency << " us, from origin " << probeOrigin << ": " << probeOriginLatency << " us";
+
+        forwardLatencyProbe(probeOrigin, probe["originTime"].asDouble(), probeHops);
+    }
+
+    void Stream::forwardLatencyProbe(const std::string& origin, double originTime, uint32_t hops)
+    {
+        std::vector<uint8_t> body;
+
+        for (Connection* outputConnection : outputConnections)
         {
-            cons[c] = this;
+            const Endpoint* endpoint = outputConnection->getEndpoint();
+
+            // stripped for outputs that are not relays
+            if (outputConnection->getDirection() != Connection::Direction::OUTPUT ||
+                !endpoint || !endpoint->latencyProbes) continue;
+
+            if (body.empty())
+            {
+                amf::Node commandName = std::string(LATENCY_PROBE_COMMAND);
+                commandName.encode(amf::Version::AMF0, body);
+
+                std::map<std::string, amf::Node> values;
+                values["origin"] = origin;
+                values["originTime"] = originTime;
+                values["relay"] = server.getRelay().getRelayId();
+                values["time"] = getWallClockTime();
+                values["hops"] = static_cast<double>(hops);
+
+                amf::Node argument1 = values;
+                argument1.encode(amf::Version::AMF0, body);
+            }
+
+            outputConnection->sendLatencyProbe(lastTimestamp, body);
+            countOutput(body.size());
         }
     }
 }
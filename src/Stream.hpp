@@ -4,10 +4,15 @@
 
 #pragma once
 
+#include <chrono>
+#include <map>
 #include <string>
 #include <vector>
 #include "Amf.hpp"
 #include "Socket.hpp"
+#include "LatencyHistogram.hpp"
+#include "MediaAnalytics.hpp"
+#include "Metrics.hpp"
 #include "Status.hpp"
 #include "Utils.hpp"
 
@@ -16,6 +21,8 @@ namespace relay
     class Relay;
     class Server;
     class Connection;
+    struct Endpoint;
+    struct StreamStatus;
 
     class Stream
     {
@@ -36,27 +43,65 @@ namespace relay
         const std::string& getApplicationName() const { return applicationName; }
         const std::string& getStreamName() const { return streamName; }
 
-        void getStats(std::string& str, ReportType reportType) const;
+        void getStatus(StreamStatus& status) const;
 
         void start(Connection& connection);
         void stop(Connection& connection);
 
+        // called by the server when the config is reloaded
+        void addEndpoint(const Endpoint& endpoint);
+        void removeEndpoint(const Endpoint& endpoint);
+
         Connection* getInputConnection() const { return inputConnection; }
 
+        const std::vector<uint8_t>& getAudioHeader() const { return audioHeader; }
+        const std::vector<uint8_t>& getVideoHeader() const { return videoHeader; }
+        const amf::Node& getMetaData() const { return metaData; }
+        // bytes of the headers and meta data kept for new outputs
+        size_t getCacheSize() const { return cacheSize; }
+        // sets the headers of a stream handed off by another process, the outputs already have them
+        void restoreHeaders(const std::vector<uint8_t>& newAudioHeader,
+                            const std::vector<uint8_t>& newVideoHeader,
+                            const amf::Node& newMetaData);
+
         void sendAudioHeader(const std::vector<uint8_t>& headerData);
         void sendVideoHeader(const std::vector<uint8_t>& headerData);
-        void sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& audioData);
-        void sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& videoData, VideoFrameType frameType);
+        void sendAudioFrame(uint64_t timestamp, const std::vector<uint8_t>& audioData, const std::chrono::steady_clock::time_point& receiveTime);
+        void sendVideoFrame(uint64_t timestamp, const std::vector<uint8_t>& videoData, VideoFrameType frameType, const std::chrono::steady_clock::time_point& receiveTime);
         void sendMetaData(const amf::Node& newMetaData);
-        void sendTextData(uint64_t timestamp, const amf::Node& textData);
+        void sendTextData(uint64_t timestamp, const std::vector<uint8_t>& textData);
+
+        // starts a latency probe from this relay
+        void sendLatencyProbe();
+        // records the latency of a probe received from the previous relay and passes it on
+        void receiveLatencyProbe(const amf::Node& probe);
 
         bool hasDependableConnections();
         void close();
         bool isClosed() { return closed; }
         uint64_t getId() { return id; }
-        void getConnections(std::map<Connection*, Stream*>& cons);
+        size_t getOutputConnectionCount() const { return outputConnections.size(); }
+
+        const TrafficCounters& getCounters() const { return counters; }
+
+        // called by the outputs once a frame has been handed to the kernel
+        void recordLatency(uint64_t latency) { latencyHistogram.record(latency); }
 
     private:
+        struct FilteredMetaData
+        {
+            amf::Node metaData;
+            std::vector<uint8_t> body;
+        };
+
+        void sendFilteredMetaData(Connection& connection);
+        // recalculates cacheSize after the cache changed and updates the relay's memory totals
+        void updateCacheSize();
+        void forwardLatencyProbe(const std::string& origin, double originTime, uint32_t hops);
+        void countInput(size_t size);
+        void countOutput(size_t size);
+        void countDrop();
+
         const uint64_t id;
         bool closed = false;
         std::string idString;
@@ -74,7 +119,21 @@ namespace relay
         std::vector<uint8_t> audioHeader;
         std::vector<uint8_t> videoHeader;
         amf::Node metaData;
+        // filtered and encoded meta data, keyed by the endpoint's filter and the AMF version
+        std::map<std::string, FilteredMetaData> filteredMetaData;
+        size_t cacheSize = 0;
 
         std::vector<Connection*> connections;
+
+        TrafficCounters counters;
+        LatencyHistogram latencyHistogram;
+        MediaAnalytics mediaAnalytics;
+
+        uint64_t lastTimestamp = 0; // of the last media frame, used for the injected probes
+        LatencyHistogram probeLatencyHistogram; // one-way latency from the previous relay
+        std::string probeOrigin;
+        std::string probeRelay;
+        uint64_t probeOriginLatency = 0; // microseconds from the origin relay at the last probe
+        uint32_t probeHops = 0;
     };
 }
@@ -2,6 +2,7 @@
 //  rtmp_relay
 //
 
+#include <cstring>
 #include "Utils.hpp"
 
 static size_t replaceAll(std::string& str, const std::string& from, const std::string& to)
@@ -35,6 +36,24 @@ size_t replaceTokens(std::string& str, const std::map<std::string, std::string>&
     return count;
 }
 
+void generateRandomBytes(std::mt19937& generator, uint8_t* data, size_t size)
+{
+    // use all 32 bits of each generated value instead of drawing every byte separately
+    while (size >= sizeof(uint32_t))
+    {
+        uint32_t value = generator();
+        memcpy(data, &value, sizeof(value));
+        data += sizeof(value);
+        size -= sizeof(value);
+    }
+
+    if (size > 0)
+    {
+        uint32_t value = generator();
+        memcpy(data, &value, size);
+    }
+}
+
 std::string getAudioCodec(AudioCodec codecId)
 {
     switch (codecId)
@@ -5,6 +5,8 @@
 #include <cstdlib>
 #include <iostream>
 #include <csignal>
+#include <string>
+#include <vector>
 
 #include <sys/stat.h>
 #ifndef _WIN32
@@ -29,28 +31,26 @@ static void signalHandler(int signo)
     switch(signo)
     {
         case SIGHUP:
-            // rehash the server
-            if (!rel.init(config))
-            {
-                Log(Log::Level::ERR) << "Failed to reload config";
-                exit(EXIT_FAILURE);
-            }
+            // rehash the server, the main loop does the reload
+            rel.reload();
             break;
         case SIGTERM:
-            // shutdown the server
-            rel.close();
-            rel.closeLog();
-            exit(EXIT_SUCCESS);
+            // shutdown the server, the main loop does the cleanup
+            rel.stop();
+            break;
+        case SIGUSR2:
+            // start the new binary and hand off the sockets to it, the main loop does the upgrade
+            rel.upgrade();
             break;
         case SIGUSR1:
         {
             std::string str;
             rel.getStats(str, ReportType::TEXT);
-            Log(Log::Level::INFO) << str;
+            RELAY_LOG(Log::Level::INFO) << str;
             break;
         }
         case SIGPIPE:
-            Log(Log::Level::ERR) << "Received SIGPIPE";
+            RELAY_LOG(Log::Level::ERR) << "Received SIGPIPE";
             break;
     }
 }
@@ -61,7 +61,7 @@ static bool daemonize(const char* lock_file)
 
     if (pid < 0)
     {
-        Log(Log::Level::ERR) << "Failed to fork process";
+        RELAY_LOG(Log::Level::ERR) << "Failed to fork process";
         return false;
     }
     if (pid > 0) exit(EXIT_SUCCESS); // parent process
@@ -72,7 +72,7 @@ static bool daemonize(const char* lock_file)
 
     if (sid < 0)
     {
-        Log(Log::Level::ERR) << "Failed to create a session";
+        RELAY_LOG(Log::Level::ERR) << "Failed to create a session";
         return false;
     }
 
@@ -94,13 +94,13 @@ static bool daemonize(const char* lock_file)
 
     if (lfp == -1)
     {
-        Log(Log::Level::ERR) << "Failed to open lock file";
+        RELAY_LOG(Log::Level::ERR) << "Failed to open lock file";
         return false;
     }
 
     if (lockf(lfp, F_TLOCK, 0) == -1)
     {
-        Log(Log::Level::ERR) << "Failed to lock the file";
+        RELAY_LOG(Log::Level::ERR) << "Failed to lock the file";
         return false;
     }
 
@@ -109,25 +109,43 @@ static bool daemonize(const char* lock_file)
     // record pid to lockfile
     if (write(lfp, str.c_str(), str.length()) == -1)
     {
-        Log(Log::Level::ERR) << "Failed to write pid to lock file";
+        RELAY_LOG(Log::Level::ERR) << "Failed to write pid to lock file";
         return false;
     }
 
     // ignore child terminate signal
     if (std::signal(SIGCHLD, SIG_IGN) == SIG_ERR)
     {
-        Log(Log::Level::ERR) << "Failed to ignore SIGCHLD";
+        RELAY_LOG(Log::Level::ERR) << "Failed to ignore SIGCHLD";
         return false;
     }
 
-    // hangup signal
-    if (std::signal(SIGHUP, signalHandler) == SIG_ERR)
+    RELAY_LOG(Log::Level::INFO) << "Daemon started, pid: " << getpid();
+
+    return true;
+}
+
+// the new process of an upgrade is already detached, but the pid file still has the previous pid
+static bool writePid(const char* lockFile)
+{
+    int lfp = open(lockFile, O_WRONLY|O_CREAT|O_TRUNC, 0600);
+
+    if (lfp == -1)
     {
-        Log(Log::Level::ERR) << "Failed to capure SIGHUP";
+        RELAY_LOG(Log::Level::ERR) << "Failed to open lock file";
         return false;
     }
 
-    Log(Log::Level::INFO) << "Daemon started, pid: " << getpid();
+    std::string str = std::to_string(getpid());
+
+    if (write(lfp, str.c_str(), str.length()) == -1)
+    {
+        RELAY_LOG(Log::Level::ERR) << "Failed to write pid to lock file";
+        close(lfp);
+        return false;
+    }
+
+    close(lfp);
 
     return true;
 }
@@ -138,14 +156,14 @@ static int getPid(const char* lockFile)
 
     if (lfp == -1)
     {
-        Log(Log::Level::ERR) << "Failed to open lock file";
+        RELAY_LOG(Log::Level::ERR) << "Failed to open lock file";
         return 0;
     }
 
     char str[20];
     if (read(lfp, str, sizeof(str)) == -1)
     {
-        Log(Log::Level::ERR) << "Failed to read pid from the lock file";
+        RELAY_LOG(Log::Level::ERR) << "Failed to read pid from the lock file";
         return 0;
     }
 
@@ -160,6 +178,8 @@ static int getPid(const char* lockFile)
 int main(int argc, const char* argv[])
 {
     bool daemon = false;
+    int handoffFd = -1;
+    std::vector<std::string> arguments(argv, argv + argc); // to start the new process of an upgrade with
 
     for (int i = 1; i < argc; ++i)
     {
@@ -167,6 +187,10 @@ int main(int argc, const char* argv[])
         {
             if (++i < argc) config = argv[i];
         }
+        else if (std::string(argv[i]) == "--handoff")
+        {
+            if (++i < argc) handoffFd = atoi(argv[i]);
+        }
         else if (std::string(argv[i]) == "--reload-config")
         {
 #ifndef _WIN32
@@ -174,7 +198,7 @@ int main(int argc, const char* argv[])
             {
                 if (kill(pid, SIGHUP) != 0)
                 {
-                    Log(Log::Level::ERR) << "Failed to send SIGHUP to the daemon";
+                    RELAY_LOG(Log::Level::ERR) << "Failed to send SIGHUP to the daemon";
                     return EXIT_FAILURE;
                 }
 
@@ -182,11 +206,34 @@ int main(int argc, const char* argv[])
             }
             else
             {
-                Log(Log::Level::ERR) << "Failed to get the pid of the daemon";
+                RELAY_LOG(Log::Level::ERR) << "Failed to get the pid of the daemon";
                 return EXIT_FAILURE;
             }
 #else
-            Log(Log::Level::ERR) << "Daemon is not supported on Windows";
+            RELAY_LOG(Log::Level::ERR) << "Daemon is not supported on Windows";
+            return EXIT_FAILURE;
+#endif
+        }
+        else if (std::string(argv[i]) == "--upgrade")
+        {
+#ifndef _WIN32
+            if (int pid = getPid("/var/run/rtmp_relay.pid"))
+            {
+                if (kill(pid, SIGUSR2) != 0)
+                {
+                    RELAY_LOG(Log::Level::ERR) << "Failed to send SIGUSR2 to the daemon";
+                    return EXIT_FAILURE;
+                }
+
+                return EXIT_SUCCESS;
+            }
+            else
+            {
+                RELAY_LOG(Log::Level::ERR) << "Failed to get the pid of the daemon";
+                return EXIT_FAILURE;
+            }
+#else
+            RELAY_LOG(Log::Level::ERR) << "Daemon is not supported on Windows";
             return EXIT_FAILURE;
 #endif
         }
@@ -201,89 +248,127 @@ int main(int argc, const char* argv[])
             {
                 if (unlink("/var/run/rtmp_relay.pid") != 0)
                 {
-                    Log(Log::Level::WARN) << "Failed to delete pid file";
+                    RELAY_LOG(Log::Level::WARN) << "Failed to delete pid file";
                 }
 
                 if (kill(pid, SIGTERM) != 0)
                 {
-                    Log(Log::Level::ERR) << "Failed to kill daemon";
+                    RELAY_LOG(Log::Level::ERR) << "Failed to kill daemon";
                     return EXIT_FAILURE;
                 }
 
-                Log(Log::Level::INFO) << "Daemon killed";
+                RELAY_LOG(Log::Level::INFO) << "Daemon killed";
 
                 return EXIT_SUCCESS;
             }
             else
             {
-                Log(Log::Level::ERR) << "Failed to get the pid of the daemon";
+                RELAY_LOG(Log::Level::ERR) << "Failed to get the pid of the daemon";
                 return EXIT_FAILURE;
             }
 #else
-            Log(Log::Level::ERR) << "Daemon is not supported on Windows";
+            RELAY_LOG(Log::Level::ERR) << "Daemon is not supported on Windows";
             return EXIT_FAILURE;
 #endif
         }
         else if (std::string(argv[i]) == "--help")
         {
             const char* exe = argc >= 1 ? argv[0] : "rtmp_relay";
-            Log(Log::Level::INFO) << "Usage: " << exe << " --config <path to config file> [--daemon] [--kill-daemon] [--log <level>]";
+            RELAY_LOG(Log::Level::INFO) << "Usage: " << exe << " --config <path to config file> [--daemon] [--kill-daemon] [--reload-config] [--upgrade] [--log <level>]";
             return EXIT_SUCCESS;
         }
         else if (std::string(argv[i]) == "--version")
         {
-            Log(Log::Level::INFO) << "RTMP relay v" << static_cast<uint32_t>(RTMP_RELAY_VERSION[0]) << "." << static_cast<uint32_t>(RTMP_RELAY_VERSION[1]);
+            RELAY_LOG(Log::Level::INFO) << "RTMP relay v" << static_cast<uint32_t>(RTMP_RELAY_VERSION[0]) << "." << static_cast<uint32_t>(RTMP_RELAY_VERSION[1]);
             return EXIT_SUCCESS;
         }
     }
 
     if (config.empty())
     {
-        Log(Log::Level::ERR) << "No config file";
+        RELAY_LOG(Log::Level::ERR) << "No config file";
         return EXIT_FAILURE;
     }
 
-    if (daemon)
+    // the new process of an upgrade inherits the session of the previous one
+    if (daemon && handoffFd == -1)
     {
 #ifndef _WIN32
         if (!daemonize("/var/run/rtmp_relay.pid")) return EXIT_FAILURE;
 #else
-        Log(Log::Level::ERR) << "Daemon is not supported on Windows";
+        RELAY_LOG(Log::Level::ERR) << "Daemon is not supported on Windows";
         return EXIT_FAILURE;
 #endif
     }
 
 #ifndef _WIN32
+    // hangup signal
+    if (std::signal(SIGHUP, signalHandler) == SIG_ERR)
+    {
+        RELAY_LOG(Log::Level::ERR) << "Failed to capure SIGHUP";
+        return EXIT_FAILURE;
+    }
+
     if (std::signal(SIGUSR1, signalHandler) == SIG_ERR)
     {
-        Log(Log::Level::ERR) << "Failed to capure SIGUSR1";
+        RELAY_LOG(Log::Level::ERR) << "Failed to capure SIGUSR1";
+        return EXIT_FAILURE;
+    }
+
+    if (std::signal(SIGUSR2, signalHandler) == SIG_ERR)
+    {
+        RELAY_LOG(Log::Level::ERR) << "Failed to capure SIGUSR2";
         return EXIT_FAILURE;
     }
 
     if (std::signal(SIGPIPE, signalHandler) == SIG_ERR)
     {
-        Log(Log::Level::ERR) << "Failed to capure SIGPIPE";
+        RELAY_LOG(Log::Level::ERR) << "Failed to capure SIGPIPE";
         return EXIT_FAILURE;
     }
 
     // software termination signal from kill
     if (std::signal(SIGTERM, signalHandler) == SIG_ERR)
     {
-        Log(Log::Level::ERR) << "Failed to capure SIGTERM";
+        RELAY_LOG(Log::Level::ERR) << "Failed to capure SIGTERM";
         return EXIT_FAILURE;
     }
 #endif
 
+    rel.setArguments(arguments);
+
+    if (handoffFd != -1 && !rel.receiveHandoff(handoffFd))
+    {
+        RELAY_LOG(Log::Level::ERR) << "Failed to receive the sockets from the previous process";
+        return EXIT_FAILURE;
+    }
+
     if (!rel.init(config))
     {
-        Log(Log::Level::ERR) << "-----------------  RTMP Relay " << VERSION << " -----------------";
-        Log(Log::Level::ERR) << "Failed to init relay";
+        RELAY_LOG(Log::Level::ERR) << "-----------------  RTMP Relay " << VERSION << " -----------------";
+        RELAY_LOG(Log::Level::ERR) << "Failed to init relay";
         return EXIT_FAILURE;
     }
 
-    Log(Log::Level::ERR) << "-----------------  RTMP Relay " << VERSION << " -----------------";
+    if (handoffFd != -1)
+    {
+        if (!rel.finishHandoff())
+        {
+            RELAY_LOG(Log::Level::ERR) << "Failed to take over the sockets from the previous process";
+            return EXIT_FAILURE;
+        }
+
+#ifndef _WIN32
+        if (daemon) writePid("/var/run/rtmp_relay.pid");
+#endif
+    }
+
+    RELAY_LOG(Log::Level::ERR) << "-----------------  RTMP Relay " << VERSION << " -----------------";
 
     rel.run();
 
+    rel.close();
+    rel.closeLog();
+
     return EXIT_SUCCESS;
 }